@@ -1,236 +1,60 @@
 // Question 2, Task 2: Creating a Blockchain
 
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <openssl/sha.h>
-
-#define MAX_DATA_SIZE 256
-#define HASH_SIZE 64
-
-typedef struct Block
-{
-        int index;
-        time_t timestamp;
-        char data[MAX_DATA_SIZE];
-        char previous_hash[HASH_SIZE + 1];
-        char hash[HASH_SIZE + 1];
-        struct Block *next;
-} Block;
-
-typedef struct Blockchain
-{
-        Block *head;
-        int length;
-} Blockchain;
-
-void calculateHash(Block *block, char *output);
-Block *createBlock(int index, const char *data, const char *previous_hash);
-void displayBlock(Block *block);
-Blockchain *createBlockchain(void);
-int addBlock(Blockchain *chain, const char *data);
-int validateBlockchain(Blockchain *chain);
-void displayBlockchain(Blockchain *chain);
-void freeBlockchain(Blockchain *chain);
+#include <unistd.h>
+#include "chain.h"
 
 /**
- * Calculates SHA-256 hash for a block
- * @param block Block to be hashed
- * @param output Buffer to store the resulting hash
+ * Prints a message from the chain library on a line of its own
+ * @param context Stream to print to
+ * @param message Message without its line break
  */
-void calculateHash(Block *block, char *output)
+static void printMessage(void *context, const char *message)
 {
-        char input[MAX_DATA_SIZE * 2];
-        unsigned char hash[SHA256_DIGEST_LENGTH];
-        SHA256_CTX sha256;
-
-        snprintf(input, sizeof(input), "%d%ld%s%s",
-                 block->index, block->timestamp, block->data, block->previous_hash);
-
-        SHA256_Init(&sha256);
-        SHA256_Update(&sha256, input, strlen(input));
-        SHA256_Final(hash, &sha256);
-
-        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        {
-                sprintf(output + (i * 2), "%02x", hash[i]);
-        }
-        output[HASH_SIZE] = '\0';
+        fprintf((FILE *)context, "%s\n", message);
+        fflush((FILE *)context);
 }
 
-/**
- * Creates a new block
- * @param index Block index
- * @param data Block data
- * @param previous_hash Hash of previous block
- * @return Pointer to new block or NULL if creation fails
- */
-Block *createBlock(int index, const char *data, const char *previous_hash)
+int main(int argc, char *argv[])
 {
-        Block *block = (Block *)malloc(sizeof(Block));
-        if (!block)
-                return NULL;
-
-        block->index = index;
-        block->timestamp = time(NULL);
-        strncpy(block->data, data, MAX_DATA_SIZE - 1);
-        block->data[MAX_DATA_SIZE - 1] = '\0';
-        strncpy(block->previous_hash, previous_hash, HASH_SIZE);
-        block->previous_hash[HASH_SIZE] = '\0';
-        block->next = NULL;
-
-        calculateHash(block, block->hash);
-        return block;
-}
+        const char *batch = NULL;
 
-/**
- * Creates a new blockchain
- * @return Pointer to new blockchain or NULL if creation fails
- */
-Blockchain *createBlockchain(void)
-{
-        Blockchain *chain = (Blockchain *)malloc(sizeof(Blockchain));
-        if (chain)
+        if (argc == 3 && strcmp(argv[1], "--batch") == 0)
         {
-                chain->head = NULL;
-                chain->length = 0;
+                batch = argv[2];
         }
-        return chain;
-}
-
-/**
- * Adds a new block to the blockchain
- * @param chain Pointer to the blockchain
- * @param data Data to be stored in the new block
- * @return 1 if successful, 0 if failed
- */
-int addBlock(Blockchain *chain, const char *data)
-{
-        if (!chain)
-                return 0;
-
-        // Create genesis block if chain is empty
-        if (!chain->head)
+        else if (argc != 1)
         {
-                chain->head = createBlock(0, data, "0");
-                if (!chain->head)
-                        return 0;
-                chain->length = 1;
+                printf("Usage: %s [--batch FILE]    (FILE - reads commands from standard input)\n", argv[0]);
                 return 1;
         }
 
-        // Find last block
-        Block *current = chain->head;
-        while (current->next)
+        // Messages of scripted runs go to stderr, leaving stdout to the command results
+        setChainMessageCallback(printMessage, batch ? stderr : stdout);
+        Blockchain *chain = createBlockchain();
+        if (!chain)
         {
-                current = current->next;
-        }
-
-        Block *newBlock = createBlock(chain->length, data, current->hash);
-        if (!newBlock)
-                return 0;
-
-        current->next = newBlock;
-        chain->length++;
-
-        return 1;
-}
-
-/**
- * Validates the integrity of the blockchain
- * @param chain Pointer to the blockchain
- * @return 1 if valid, 0 if invalid
- */
-int validateBlockchain(Blockchain *chain)
-{
-        if (!chain || !chain->head)
+                printf("Failed to create blockchain!\n");
                 return 1;
+        }
 
-        Block *current = chain->head->next;
-        Block *previous = chain->head;
-        char calculated_hash[HASH_SIZE + 1];
-
-        while (current)
+        // Scripted runs start from a fresh genesis block and print only command results
+        if (batch)
         {
-                calculateHash(previous, calculated_hash);
-                if (strcmp(current->previous_hash, calculated_hash) != 0)
+                FILE *input = strcmp(batch, "-") == 0 ? stdin : fopen(batch, "r");
+                if (!input)
                 {
-                        return 0;
+                        printf("Error: Could not open %s for reading\n", batch);
+                        freeBlockchain(chain);
+                        return 1;
                 }
 
-                calculateHash(current, calculated_hash);
-                if (strcmp(current->hash, calculated_hash) != 0)
-                {
-                        return 0;
-                }
-
-                previous = current;
-                current = current->next;
-        }
-
-        return 1;
-}
-
-/**
- * Displays information of a single block
- * @param block Block to display
- */
-void displayBlock(Block *block)
-{
-        printf("\nBlock #%d\n", block->index);
-        printf("Timestamp: %s", ctime(&block->timestamp));
-        printf("Data: %s\n", block->data);
-        printf("Previous Hash: %s\n", block->previous_hash);
-        printf("Hash: %s\n", block->hash);
-}
-
-/**
- * Displays all blocks in the blockchain
- * @param chain Pointer to the blockchain
- */
-void displayBlockchain(Blockchain *chain)
-{
-        if (!chain || !chain->head)
-        {
-                printf("Blockchain is empty\n");
-                return;
-        }
-
-        Block *current = chain->head;
-        while (current)
-        {
-                displayBlock(current);
-                current = current->next;
-        }
-}
-
-/**
- * Frees all memory allocated for the blockchain
- * @param chain Pointer to the blockchain
- */
-void freeBlockchain(Blockchain *chain)
-{
-        if (!chain)
-                return;
-
-        Block *current = chain->head;
-        while (current)
-        {
-                Block *temp = current;
-                current = current->next;
-                free(temp);
-        }
-        free(chain);
-}
-
-int main()
-{
-        Blockchain *chain = createBlockchain();
-        if (!chain)
-        {
-                printf("Failed to create blockchain!\n");
-                return 1;
+                int ok = addBlock(chain, "Genesis Block") && runBatch(&chain, input, stdout, NULL);
+                if (input != stdin)
+                        fclose(input);
+                freeBlockchain(chain);
+                return ok ? 0 : 1;
         }
 
         printf("Creating the genesis block...\n");
@@ -272,7 +96,7 @@ int main()
                         break;
 
                 case 2:
-                        displayBlockchain(chain);
+                        displayBlockchain(chain, stdout);
                         break;
 
                 case 3:
@@ -0,0 +1,486 @@
+// Client for a chain served with blockchain_persistence --serve, and for its --feed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "chain.h"
+
+#define BENCH_BLOCK_EVERY 100       // Writes between the blocks each load-test connection adds
+
+/* One load-test connection and what it measured */
+typedef struct BenchWorker
+{
+        pthread_t thread;
+        const char *socket_path;
+        int requests;
+        int depth;                  // Requests kept in flight
+        int write_percent;
+        int length;                 // Chain length when the test started, for picking heights
+        unsigned int seed;
+        double *latencies;          // Seconds from queuing each request to reading its answer
+        int errors;                 // Answers with a status other than RPC_OK
+        int started;
+        int failed;                 // The connection broke
+} BenchWorker;
+
+/**
+ * Reads a monotonic clock
+ * @return Seconds since an arbitrary point
+ */
+static double now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Prints an answer as one "ok ..." or "error ..." line, plus one line per transaction
+ * @param response Answer to print
+ */
+static void printResponse(const RpcMessage *response)
+{
+        const BlockHeader *header = &response->header;
+
+        if (response->status != RPC_OK)
+        {
+                printf("error %s\n", response->status == RPC_NOT_FOUND ? "not found"
+                                     : response->status == RPC_REJECTED ? "rejected"
+                                                                        : "bad request");
+                return;
+        }
+
+        switch (response->type)
+        {
+        case RPC_CHAIN_INFO:
+        case RPC_SUBMIT_TRANSACTION:
+        case RPC_ADD_BLOCK:
+        case RPC_GET_BLOCK:
+        case RPC_FIND_BLOCK:
+                printf("ok block %d %lld %d %s %s %s\n", header->index, (long long)header->timestamp,
+                       header->transaction_count, header->previous_hash, header->hash,
+                       response->data ? response->data : "");
+                break;
+
+        case RPC_GET_TRANSACTIONS:
+                printf("ok transactions %d\n", response->transaction_count);
+                for (int i = 0; i < response->transaction_count; i++)
+                {
+                        const Transaction *trans = &response->transactions[i];
+                        printf("%s %s %.2f %lld\n", trans->sender, trans->receiver, trans->amount,
+                               (long long)trans->timestamp);
+                }
+                break;
+
+        case RPC_GET_BALANCE:
+                printf("ok balance %.2f\n", response->balance);
+                break;
+
+        default:
+                printf("ok\n");
+        }
+}
+
+/**
+ * Sends one command given on the command line and prints its answer
+ * @param socket_path Path the server listens on
+ * @param argc Number of words in the command
+ * @param argv The command's words
+ * @return 1 if the server answered RPC_OK, 0 otherwise
+ */
+static int runCommand(const char *socket_path, int argc, char *argv[])
+{
+        RpcMessage request;
+        RpcMessage response;
+        const char *command = argv[0];
+
+        memset(&request, 0, sizeof(RpcMessage));
+        if (strcmp(command, "info") == 0 && argc == 1)
+        {
+                request.type = RPC_CHAIN_INFO;
+        }
+        else if ((strcmp(command, "block") == 0 || strcmp(command, "txs") == 0) && argc == 2)
+        {
+                request.type = command[0] == 'b' ? RPC_GET_BLOCK : RPC_GET_TRANSACTIONS;
+                request.height = atoi(argv[1]);
+        }
+        else if (strcmp(command, "find") == 0 && argc == 2 && strlen(argv[1]) <= HASH_SIZE)
+        {
+                request.type = RPC_FIND_BLOCK;
+                strcpy(request.hash, argv[1]);
+        }
+        else if (strcmp(command, "balance") == 0 && argc == 2)
+        {
+                request.type = RPC_GET_BALANCE;
+                strncpy(request.transaction.sender, argv[1], MAX_SENDER_SIZE - 1);
+        }
+        else if (strcmp(command, "tx") == 0 && argc == 4)
+        {
+                request.type = RPC_SUBMIT_TRANSACTION;
+                strncpy(request.transaction.sender, argv[1], MAX_SENDER_SIZE - 1);
+                strncpy(request.transaction.receiver, argv[2], MAX_RECEIVER_SIZE - 1);
+                request.transaction.amount = atof(argv[3]);
+        }
+        else if (strcmp(command, "add-block") == 0 && argc == 2)
+        {
+                request.type = RPC_ADD_BLOCK;
+                request.data = argv[1];
+                request.data_length = (int)strlen(argv[1]);
+        }
+        else if (strcmp(command, "validate") == 0 && argc == 1)
+        {
+                request.type = RPC_VALIDATE;
+        }
+        else if (strcmp(command, "save") == 0 && argc == 1)
+        {
+                request.type = RPC_SAVE;
+        }
+        else
+        {
+                printf("Error: Unknown command %s\n", command);
+                return 0;
+        }
+
+        RpcConnection *connection = connectRpc(socket_path);
+        if (!connection)
+                return 0;
+
+        int ok = sendRpcRequest(connection, &request) && readRpcResponse(connection, &response);
+        if (ok)
+                printResponse(&response);
+        else
+                printf("Error: Lost the connection to %s\n", socket_path);
+        closeRpc(connection);
+        return ok && response.status == RPC_OK;
+}
+
+/**
+ * Picks the next load-test request: mostly reads, with transactions and the occasional block as writes
+ * @param worker Connection the request is for
+ * @param id Number of the request on the connection
+ * @param request Receives the request
+ */
+static void fillBenchRequest(BenchWorker *worker, int id, RpcMessage *request)
+{
+        int roll = rand_r(&worker->seed) % 100;
+
+        memset(request, 0, sizeof(RpcMessage));
+        request->id = (uint32_t)id;
+        if (roll < worker->write_percent)
+        {
+                if (id % BENCH_BLOCK_EVERY == 0)
+                {
+                        request->type = RPC_ADD_BLOCK;
+                        request->data = "Load test block";
+                        request->data_length = (int)strlen(request->data);
+                        return;
+                }
+                request->type = RPC_SUBMIT_TRANSACTION;
+                snprintf(request->transaction.sender, MAX_SENDER_SIZE, "load-%d", roll);
+                snprintf(request->transaction.receiver, MAX_RECEIVER_SIZE, "load-%d", id % 100);
+                request->transaction.amount = 1;
+                return;
+        }
+
+        switch (roll % 3)
+        {
+        case 0:
+                request->type = RPC_GET_BLOCK;
+                request->height = worker->length > 0 ? rand_r(&worker->seed) % worker->length : 0;
+                break;
+        case 1:
+                request->type = RPC_GET_BALANCE;
+                snprintf(request->transaction.sender, MAX_SENDER_SIZE, "load-%d", id % 100);
+                break;
+        default:
+                request->type = RPC_CHAIN_INFO;
+        }
+}
+
+/**
+ * Runs one load-test connection, keeping up to depth requests in flight
+ * @param arg The connection's BenchWorker
+ * @return NULL
+ */
+static void *runBenchWorker(void *arg)
+{
+        BenchWorker *worker = (BenchWorker *)arg;
+        RpcMessage request;
+        RpcMessage response;
+        int queued = 0;
+        int answered = 0;
+
+        double *sent_at = (double *)malloc(worker->requests * sizeof(double));
+        RpcConnection *connection = sent_at ? connectRpc(worker->socket_path) : NULL;
+        worker->failed = !connection;
+
+        while (!worker->failed && answered < worker->requests)
+        {
+                while (queued < worker->requests && queued - answered < worker->depth)
+                {
+                        fillBenchRequest(worker, queued, &request);
+                        sent_at[queued] = now();
+                        if (!sendRpcRequest(connection, &request))
+                        {
+                                worker->failed = 1;
+                                break;
+                        }
+                        queued++;
+                }
+                if (worker->failed)
+                        break;
+
+                // Answers come back in the order the requests went out
+                if (!readRpcResponse(connection, &response) || response.id != (uint32_t)answered)
+                {
+                        worker->failed = 1;
+                        break;
+                }
+                worker->latencies[answered] = now() - sent_at[answered];
+                worker->errors += response.status != RPC_OK;
+                answered++;
+        }
+
+        worker->requests = answered;
+        closeRpc(connection);
+        free(sent_at);
+        return NULL;
+}
+
+/**
+ * Orders latencies for picking percentiles
+ * @param a First latency
+ * @param b Second latency
+ * @return Negative, zero or positive as a sorts before, with or after b
+ */
+static int compareLatencies(const void *a, const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/**
+ * Load-tests a server with pipelined requests over several connections and reports throughput and latency
+ * @param socket_path Path the server listens on
+ * @param argc Number of options
+ * @param argv Options: -c CONNECTIONS, -n REQUESTS, -d DEPTH, -w WRITE_PERCENT; writes submit
+ *             transactions the server keeps, so the default of 0 leaves its chain as it was
+ * @return 1 if every connection finished, 0 otherwise
+ */
+static int runBench(const char *socket_path, int argc, char *argv[])
+{
+        int connections = 4;
+        int requests = 100000;
+        int depth = 32;
+        int write_percent = 0;
+        RpcMessage request;
+        RpcMessage response;
+
+        // Every option takes a number; anything else is a mistake rather than something to skip
+        for (int i = 0; i < argc; i += 2)
+        {
+                int *option = NULL;
+                if (strcmp(argv[i], "-c") == 0)
+                        option = &connections;
+                else if (strcmp(argv[i], "-n") == 0)
+                        option = &requests;
+                else if (strcmp(argv[i], "-d") == 0)
+                        option = &depth;
+                else if (strcmp(argv[i], "-w") == 0)
+                        option = &write_percent;
+
+                char *end = NULL;
+                long value = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+                if (!option || !end || end == argv[i + 1] || *end != '\0' || value < 0 || value > INT_MAX)
+                {
+                        printf("Error: Invalid load test option %s\n", argv[i]);
+                        return 0;
+                }
+                *option = (int)value;
+        }
+        if (connections < 1 || requests < connections || depth < 1 || write_percent > 100)
+        {
+                printf("Error: Invalid load test options\n");
+                return 0;
+        }
+
+        // Reads pick heights from the chain as it stood when the test began
+        RpcConnection *connection = connectRpc(socket_path);
+        memset(&request, 0, sizeof(RpcMessage));
+        request.type = RPC_CHAIN_INFO;
+        int ok = connection && sendRpcRequest(connection, &request) && readRpcResponse(connection, &response) &&
+                 response.status == RPC_OK;
+        closeRpc(connection);
+        if (!ok)
+                return 0;
+
+        BenchWorker *workers = (BenchWorker *)calloc(connections, sizeof(BenchWorker));
+        double *latencies = (double *)malloc(requests * sizeof(double));
+        if (!workers || !latencies)
+        {
+                free(workers);
+                free(latencies);
+                return 0;
+        }
+
+        double start = now();
+        int assigned = 0;
+        for (int i = 0; i < connections; i++)
+        {
+                BenchWorker *worker = &workers[i];
+                worker->socket_path = socket_path;
+                worker->requests = requests / connections + (i < requests % connections);
+                worker->depth = depth;
+                worker->write_percent = write_percent;
+                worker->length = response.header.index + 1;
+                worker->seed = (unsigned int)i + 1;
+                worker->latencies = latencies + assigned;
+                assigned += worker->requests;
+                worker->started = pthread_create(&worker->thread, NULL, runBenchWorker, worker) == 0;
+                worker->failed = !worker->started;
+        }
+
+        int answered = 0;
+        int errors = 0;
+        for (int i = 0; i < connections; i++)
+        {
+                if (workers[i].started)
+                        pthread_join(workers[i].thread, NULL);
+                ok &= !workers[i].failed;
+                errors += workers[i].errors;
+
+                // Gather each connection's latencies into one run for sorting
+                memmove(latencies + answered, workers[i].latencies, workers[i].requests * sizeof(double));
+                answered += workers[i].requests;
+        }
+        double elapsed = now() - start;
+
+        qsort(latencies, answered, sizeof(double), compareLatencies);
+        printf("%d requests over %d connections, up to %d in flight each, %d%% writes\n", answered, connections,
+               depth, write_percent);
+        printf("Throughput: %.0f requests/s\n", answered / elapsed);
+        if (answered > 0)
+                printf("Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[answered / 2] * 1e6,
+                       latencies[(int)(answered * 0.99)] * 1e6, latencies[answered - 1] * 1e6);
+        printf("Errors: %d\n", errors);
+        if (!ok)
+                printf("Error: Some connections failed\n");
+
+        free(workers);
+        free(latencies);
+        return ok;
+}
+
+/**
+ * Follows a chain's feed, printing each event, then reports how far behind the publisher the events arrived
+ * @param feed_name Name the server created the feed with
+ * @param argc Number of options
+ * @param argv Options: -n EVENTS to stop after, -p wait|drop, -q to print only the report
+ * @return 1 if the feed could be followed, 0 otherwise
+ */
+static int runWatch(const char *feed_name, int argc, char *argv[])
+{
+        long limit = 0;
+        int policy = FEED_WAIT;
+        int quiet = 0;
+
+        for (int i = 0; i < argc; i++)
+        {
+                if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+                        limit = atol(argv[++i]);
+                else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+                        policy = strcmp(argv[++i], "drop") == 0 ? FEED_DROP : FEED_WAIT;
+                else if (strcmp(argv[i], "-q") == 0)
+                        quiet = 1;
+        }
+
+        ChainFeed *feed = openChainFeed(feed_name);
+        FeedSubscriber *subscriber = feed ? subscribeFeed(feed, policy) : NULL;
+        if (!subscriber)
+        {
+                closeChainFeed(feed);
+                return 0;
+        }
+
+        FeedEvent event;
+        double *latencies = NULL;
+        long capacity = 0;
+        long count = 0;
+        uint64_t first = 0;
+        uint64_t last = 0;
+        while ((limit == 0 || count < limit) && readFeedEvent(subscriber, &event, -1) == 1)
+        {
+                struct timespec time;
+                clock_gettime(CLOCK_MONOTONIC, &time);
+                double latency = (time.tv_sec * 1e9 + time.tv_nsec - event.published_ns) / 1e9;
+
+                if (count == capacity)
+                {
+                        long grown_capacity = capacity ? capacity * 2 : 1024;
+                        double *grown = (double *)realloc(latencies, grown_capacity * sizeof(double));
+                        if (!grown)
+                                break;
+                        latencies = grown;
+                        capacity = grown_capacity;
+                }
+                latencies[count++] = latency;
+                if (!first)
+                        first = event.sequence;
+                last = event.sequence;
+
+                if (quiet)
+                        continue;
+                if (event.type == FEED_BLOCK)
+                        printf("block %d %s\n", event.header.index, event.header.hash);
+                else
+                        printf("tx %d %s %s %.2f\n", event.header.index, event.transaction.sender,
+                               event.transaction.receiver, event.transaction.amount);
+        }
+
+        // Sequence numbers run on through events a dropping subscriber lost
+        qsort(latencies, count, sizeof(double), compareLatencies);
+        printf("%ld events, %llu dropped\n", count, count ? (unsigned long long)(last - first + 1 - count) : 0ULL);
+        if (count > 0)
+                printf("Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[count / 2] * 1e6,
+                       latencies[(long)(count * 0.99)] * 1e6, latencies[count - 1] * 1e6);
+
+        free(latencies);
+        unsubscribeFeed(subscriber);
+        closeChainFeed(feed);
+        return 1;
+}
+
+/**
+ * Prints a message from the chain library on a line of its own
+ * @param context Stream to print to
+ * @param message Message without its line break
+ */
+static void printMessage(void *context, const char *message)
+{
+        fprintf((FILE *)context, "%s\n", message);
+        fflush((FILE *)context);
+}
+
+int main(int argc, char *argv[])
+{
+        if (argc < 3)
+        {
+                printf("Usage: %s SOCKET info | block HEIGHT | find HASH | txs HEIGHT | balance ADDRESS\n"
+                       "       %s SOCKET tx SENDER RECEIVER AMOUNT | add-block DATA | validate | save\n"
+                       "       %s SOCKET bench [-c CONNECTIONS] [-n REQUESTS] [-d DEPTH] [-w WRITE_PERCENT, kept by the server]\n"
+                       "       %s FEED watch [-n EVENTS] [-p wait | drop] [-q]\n",
+                       argv[0], argv[0], argv[0], argv[0]);
+                return 1;
+        }
+
+        setChainMessageCallback(printMessage, stdout);
+        if (strcmp(argv[2], "bench") == 0)
+                return runBench(argv[1], argc - 3, argv + 3) ? 0 : 1;
+        if (strcmp(argv[2], "watch") == 0)
+                return runWatch(argv[1], argc - 3, argv + 3) ? 0 : 1;
+        return runCommand(argv[1], argc - 2, argv + 2) ? 0 : 1;
+}
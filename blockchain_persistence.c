@@ -1,68 +1,292 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <openssl/sha.h>
-
-#define MAX_DATA_SIZE 256
-#define HASH_SIZE 64
-#define MAX_TRANSACTIONS 10
-#define MAX_SENDER_SIZE 50
-#define MAX_RECEIVER_SIZE 50
-#define TRANS_STR_SIZE 150
-#define INPUT_BUFFER_SIZE 1024
-#define FILENAME "blockchain.dat"
-
-typedef struct Transaction
-{
-        char sender[MAX_SENDER_SIZE];
-        char receiver[MAX_RECEIVER_SIZE];
-        double amount;
-        time_t timestamp;
-} Transaction;
+#include "chain.h"
 
-typedef struct Block
-{
-        int index;
-        time_t timestamp;
-        char data[MAX_DATA_SIZE];
-        Transaction transactions[MAX_TRANSACTIONS];
-        int transaction_count;
-        char previous_hash[HASH_SIZE + 1];
-        char hash[HASH_SIZE + 1];
-        struct Block *next;
-} Block;
-
-typedef struct Blockchain
-{
-        Block *head;
-        int length;
-} Blockchain;
-
-void calculateHash(Block *block, char *output);
-Block *createBlock(int index, const char *data, const char *previous_hash);
-void displayBlock(Block *block);
-Blockchain *createBlockchain(void);
-int addBlock(Blockchain *chain, const char *data);
-int validateBlockchain(Blockchain *chain);
-void displayBlockchain(Blockchain *chain);
-void freeBlockchain(Blockchain *chain);
-int addTransaction(Block *block, const char *sender, const char *receiver, double amount);
-void displayTransactions(Block *block);
-int saveBlockchain(Blockchain *chain, const char *filename);
-Blockchain *loadBlockchain(const char *filename);
 double getDoubleInput(const char *prompt);
 void getStringInput(const char *prompt, char *buffer, size_t size);
+void printMessage(void *context, const char *message);
+int parseCount(const char *text, long max, long *value);
+
+// Largest megabyte count whose byte size still fits a size_t
+#define MAX_MB ((long)((SIZE_MAX >> 20) < LONG_MAX ? (SIZE_MAX >> 20) : LONG_MAX))
 
-int main()
+int main(int argc, char *argv[])
 {
-        Blockchain *chain = createBlockchain();
+        ChainConfig config;
+        initChainConfig(&config);
+        setChainMessageCallback(printMessage, stdout);
+        int show_height = -1;
+        const char *show_hash = NULL;
+        const char *batch = NULL;
+        const char *serve = NULL;
+        const char *sync_from = NULL;
+        const char *feed_name = NULL;
+        const char *find_address = NULL;
+        const char *find_from = NULL;
+        const char *find_to = NULL;
+
+        // Optional pruning, payload caching, fsync batching, segmenting, file encoding, disk indexes and state snapshots
+        long value = 0;
+        for (int i = 1; i < argc; i++)
+        {
+                if (strcmp(argv[i], "--prune-blocks") == 0 && i + 1 < argc && parseCount(argv[++i], INT_MAX, &value))
+                {
+                        config.prune_keep_blocks = (int)value;
+                }
+                else if (strcmp(argv[i], "--prune-mb") == 0 && i + 1 < argc && parseCount(argv[++i], MAX_MB, &value))
+                {
+                        config.prune_keep_bytes = (size_t)value * 1024 * 1024;
+                }
+                else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc && parseCount(argv[++i], INT_MAX, &value))
+                {
+                        config.log_sync_records = (int)value;
+                }
+                else if (strcmp(argv[i], "--segment-mb") == 0 && i + 1 < argc && parseCount(argv[++i], MAX_MB, &value))
+                {
+                        config.segment_bytes = (size_t)value * 1024 * 1024;
+                }
+                else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc && parseCount(argv[++i], MAX_MB, &value))
+                {
+                        config.cache_bytes = (size_t)value * 1024 * 1024;
+                }
+                else if (strcmp(argv[i], "--compact") == 0)
+                {
+                        config.file_layout = LAYOUT_COMPACT;
+                }
+                else if (strcmp(argv[i], "--compress") == 0)
+                {
+                        config.file_layout = LAYOUT_COMPACT | LAYOUT_COMPRESSED;
+                }
+                else if (strcmp(argv[i], "--index") == 0)
+                {
+                        config.disk_indexes = 1;
+                }
+                else if (strcmp(argv[i], "--snapshot-every") == 0 && i + 1 < argc &&
+                         parseCount(argv[++i], INT_MAX, &value))
+                {
+                        config.state_snapshot_blocks = (int)value;
+                }
+                else if (strcmp(argv[i], "--show-height") == 0 && i + 1 < argc &&
+                         parseCount(argv[++i], INT_MAX, &value))
+                {
+                        show_height = (int)value;
+                }
+                else if (strcmp(argv[i], "--show-hash") == 0 && i + 1 < argc)
+                {
+                        show_hash = argv[++i];
+                }
+                else if (strcmp(argv[i], "--find-address") == 0 && i + 1 < argc)
+                {
+                        find_address = argv[++i];
+                }
+                else if (strcmp(argv[i], "--find-time") == 0 && i + 2 < argc)
+                {
+                        find_from = argv[++i];
+                        find_to = argv[++i];
+                }
+                else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+                {
+                        batch = argv[++i];
+                }
+                else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+                {
+                        serve = argv[++i];
+                }
+                else if (strcmp(argv[i], "--sync-from") == 0 && i + 1 < argc)
+                {
+                        sync_from = argv[++i];
+                }
+                else if (strcmp(argv[i], "--feed") == 0 && i + 1 < argc)
+                {
+                        feed_name = argv[++i];
+                }
+                else
+                {
+                        printf("Usage: %s [--prune-blocks N] [--prune-mb N] [--sync-every N] [--segment-mb N]\n"
+                               "          [--cache-mb N] [--compact | --compress] [--index] [--snapshot-every N]\n"
+                               "          [--batch FILE | --serve SOCKET | --sync-from SOCKET] [--feed NAME]\n"
+                               "       %s --show-height N | --show-hash HASH\n"
+                               "       %s --find-address ADDRESS | --find-time FROM TO\n",
+                               argv[0], argv[0], argv[0]);
+                        return 1;
+                }
+        }
+
+        // Look a single block up through the file's index without loading the chain
+        if (show_height >= 0 || show_hash)
+        {
+                ChainFile *file = openChainFile(FILENAME);
+                if (!file)
+                        return 1;
+
+                Block *block = show_height >= 0 ? readFileBlockAtHeight(file, show_height)
+                                                : readFileBlockByHash(file, show_hash);
+                if (block)
+                        displayBlock(block, stdout);
+                else
+                        printf("Block not found in %s\n", FILENAME);
+                closeChainFile(file);
+                return block ? 0 : 1;
+        }
+
+        // Search the disk indexes a chain saved with --index keeps, again without loading the chain
+        if (find_address || find_from)
+        {
+                ChainIndex *index = openChainIndex(FILENAME);
+                if (!index)
+                        return 1;
+
+                IndexHit hits[64];
+                IndexHit last;
+                int count;
+                long listed = 0;
+                long found = 0;
+                do
+                {
+                        const IndexHit *after = listed > 0 ? &last : NULL;
+                        count = find_address ? findIndexedTransactions(index, find_address, after, hits, 64)
+                                             : findIndexedBlocksByTime(index, (time_t)atoll(find_from),
+                                                                       (time_t)atoll(find_to), after, hits, 64);
+                        for (int i = 0; i < count; i++)
+                        {
+                                // Blocks a reorg took off the active chain stay indexed but no longer count
+                                if (!hits[i].active)
+                                        continue;
+                                found++;
+                                if (find_address)
+                                        printf("Block #%d, transaction %d: %s %.2f at %lld\n", hits[i].height,
+                                               hits[i].position, hits[i].sent ? "sent" : "received", hits[i].amount,
+                                               (long long)hits[i].timestamp);
+                                else
+                                        printf("Block #%d at %lld: %s\n", hits[i].height, (long long)hits[i].timestamp,
+                                               hits[i].hash);
+                        }
+                        if (count > 0)
+                                last = hits[count - 1];
+                        listed += count;
+                } while (count == 64);
+
+                printf("%ld %s found in %s.index\n", found, find_address ? "transactions" : "blocks", FILENAME);
+                closeChainIndex(index);
+                return 0;
+        }
+
+        // Daemon mode serves the saved chain, or a new one if there is none, and saves it on the way out
+        if (serve)
+        {
+                FILE *existing = fopen(FILENAME, "rb");
+                Blockchain *served = existing ? loadBlockchainWithConfig(FILENAME, &config)
+                                              : createBlockchainWithConfig(&config);
+                if (existing)
+                        fclose(existing);
+                if (!served || (!existing && !addBlock(served, "Genesis Block")))
+                {
+                        printf("Failed to load blockchain!\n");
+                        freeBlockchain(served);
+                        return 1;
+                }
+
+                // Blocks and transactions added through the server are published to subscribers of the feed
+                ChainFeed *feed = feed_name ? createChainFeed(feed_name, 0) : NULL;
+                if (feed_name && (!feed || !attachChainFeed(served, feed)))
+                {
+                        closeChainFeed(feed);
+                        freeBlockchain(served);
+                        return 1;
+                }
+
+                int ok = runServer(served, serve, FILENAME);
+                if (ok && saveBlockchain(served, FILENAME))
+                        printf("Blockchain saved successfully!\n");
+                else if (ok)
+                        printf("Failed to save blockchain!\n");
+                freeBlockchain(served);
+                closeChainFeed(feed);
+                return ok ? 0 : 1;
+        }
+
+        // Catch-up mode brings the saved chain, or an empty one, level with a served chain and saves it
+        if (sync_from)
+        {
+                FILE *existing = fopen(FILENAME, "rb");
+                Blockchain *local = existing ? loadBlockchainWithConfig(FILENAME, &config)
+                                             : createBlockchainWithConfig(&config);
+                if (existing)
+                        fclose(existing);
+                if (!local)
+                {
+                        printf("Failed to load blockchain!\n");
+                        return 1;
+                }
+
+                struct timespec start;
+                struct timespec end;
+                SyncStats stats;
+                int length = getChainLength(local);
+                Block *tip = getChainTip(local);
+                char tip_hash[HASH_SIZE + 1];
+                snprintf(tip_hash, sizeof(tip_hash), "%s", tip ? getBlockHash(tip) : "");
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                RpcConnection *connection = connectRpc(sync_from);
+                int status = connection ? syncFromRpc(local, connection, &stats) : SYNC_FAILED;
+                int ok = status != SYNC_FAILED;
+                closeRpc(connection);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                if (ok)
+                {
+                        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+                        if (status == SYNC_DIVERGED)
+                                printf("The chains still diverge after block %d; this one is heavier, so the peer "
+                                       "has to sync from it\n", stats.fork_height);
+                        else if (length > 0 && stats.fork_height < length - 1)
+                                printf("The chains diverge after block %d\n", stats.fork_height);
+                        printf("Downloaded %d headers and %d blocks (%.1f MB) in %.2f s\n", stats.headers,
+                               stats.blocks, stats.bytes / 1e6, seconds);
+                        printf("Chain length: %d (was %d)\n", getChainLength(local), length);
+                        // Switching to the peer's branch at equal length downloads nothing, but still has to be saved
+                        tip = getChainTip(local);
+                        if (stats.blocks > 0 || (tip && strcmp(getBlockHash(tip), tip_hash) != 0))
+                        {
+                                ok = saveBlockchain(local, FILENAME);
+                                printf(ok ? "Blockchain saved successfully!\n" : "Failed to save blockchain!\n");
+                        }
+                }
+                freeBlockchain(local);
+                return ok && status == SYNC_LEVEL ? 0 : 1;
+        }
+
+        Blockchain *chain = createBlockchainWithConfig(&config);
         if (!chain)
         {
                 printf("Failed to create blockchain!\n");
                 return 1;
         }
 
+        // Scripted runs start from a fresh genesis block and print only command results
+        if (batch)
+        {
+                FILE *input = strcmp(batch, "-") == 0 ? stdin : fopen(batch, "r");
+                if (!input)
+                {
+                        printf("Error: Could not open %s for reading\n", batch);
+                        freeBlockchain(chain);
+                        return 1;
+                }
+
+                // Messages go to stderr, leaving stdout to the command results
+                setChainMessageCallback(printMessage, stderr);
+                int ok = addBlock(chain, "Genesis Block") && runBatch(&chain, input, stdout, &config);
+                if (input != stdin)
+                        fclose(input);
+                freeBlockchain(chain);
+                return ok ? 0 : 1;
+        }
+
         // Create genesis block
         printf("Creating the genesis block...\n");
         if (addBlock(chain, "Genesis Block"))
@@ -81,9 +305,26 @@ int main()
         char receiver[MAX_RECEIVER_SIZE];
         double amount;
         int choice;
+        SaveJob *save = NULL;
+        SaveProgress progress;
 
         do
         {
+                // Report the background save once it is done, without holding up the menu
+                if (save && getSaveProgress(save, &progress))
+                {
+                        if (waitForSave(chain))
+                                printf("Blockchain saved successfully!\n");
+                        else
+                                printf("Failed to save blockchain!\n");
+                        save = NULL;
+                }
+                else if (save)
+                {
+                        printf("\nSaving in the background: %d of %d records written\n", progress.records_written,
+                               progress.records_total);
+                }
+
                 printf("\nBlockchain Menu:\n");
                 printf("1. Add new block\n");
                 printf("2. Add transaction to latest block\n");
@@ -92,6 +333,10 @@ int main()
                 printf("5. Save blockchain\n");
                 printf("6. Load blockchain\n");
                 printf("7. Exit\n");
+                printf("8. Show memory pool statistics\n");
+                printf("9. Show account balances\n");
+                printf("10. Import blocks and transactions (JSONL or CSV)\n");
+                printf("11. Export blockchain (JSONL or CSV)\n");
                 printf("Enter choice: ");
 
                 char choice_str[10];
@@ -115,44 +360,53 @@ int main()
                         break;
 
                 case 2:
-                        if (!chain->head)
+                {
+                        Block *latest = getChainTip(chain);
+                        if (!latest)
                         {
                                 printf("Create a block first!\n");
                                 break;
                         }
 
-                        Block *latest = chain->head;
-                        while (latest->next)
-                                latest = latest->next;
-
                         getStringInput("Enter sender: ", sender, MAX_SENDER_SIZE);
                         getStringInput("Enter receiver: ", receiver, MAX_RECEIVER_SIZE);
                         amount = getDoubleInput("Enter amount: ");
 
-                        if (addTransaction(latest, sender, receiver, amount))
+                        if (addTransaction(chain, latest, sender, receiver, amount))
                                 printf("Transaction added successfully!\n");
                         else
                                 printf("Failed to add transaction!\n");
-                        break;
+                }
+                break;
 
                 case 3:
-                        displayBlockchain(chain);
+                        displayBlockchain(chain, stdout);
+                        break;
+
+                case 4:
+                        if (validateBlockchain(chain))
+                                printf("Blockchain is valid!\n");
+                        else
+                                printf("Blockchain is invalid!\n");
                         break;
 
                 case 5:
-                        if (saveBlockchain(chain, FILENAME))
-                        {
-                                printf("Blockchain saved successfully!\n");
-                        }
+                        // A save still in flight finishes first; the new one picks up after it
+                        save = saveBlockchainInBackground(chain, FILENAME);
+                        if (save)
+                                printf("Saving blockchain in the background...\n");
                         else
-                        {
                                 printf("Failed to save blockchain!\n");
-                        }
                         break;
 
                 case 6:
                 {
-                        Blockchain *loaded_chain = loadBlockchain(FILENAME);
+                        // Let a save in flight complete so the file is whole before it is read
+                        waitForSave(chain);
+                        save = NULL;
+                        // The current chain lets go of the file first, or both would append to it
+                        releaseBlockchainFile(chain);
+                        Blockchain *loaded_chain = loadBlockchainWithConfig(FILENAME, &config);
                         if (loaded_chain)
                         {
                                 freeBlockchain(chain);
@@ -170,272 +424,38 @@ int main()
                         printf("Exiting...\n");
                         break;
 
-                default:
-                        printf("Invalid choice! Please enter a number between 1 and 7.\n");
-                }
-        } while (choice != 7);
-
-        freeBlockchain(chain);
-        return 0;
-}
-
-/**
- * Creates a new blockchain
- * @return Pointer to new blockchain or NULL if creation fails
- */
-Blockchain *createBlockchain(void)
-{
-        Blockchain *chain = (Blockchain *)malloc(sizeof(Blockchain));
-        if (chain)
-        {
-                chain->head = NULL;
-                chain->length = 0;
-        }
-        return chain;
-}
-
-/**
- * Calculates SHA-256 hash for a block including transaction data
- * @param block Block to be hashed
- * @param output Buffer to store the resulting hash
- */
-void calculateHash(Block *block, char *output)
-{
-        char input[INPUT_BUFFER_SIZE];
-        char trans_data[INPUT_BUFFER_SIZE / 2] = "";
-        unsigned char hash[SHA256_DIGEST_LENGTH];
-        SHA256_CTX sha256;
-
-        // Create transaction string for hashing
-        for (int i = 0; i < block->transaction_count; i++)
-        {
-                char trans_str[TRANS_STR_SIZE];
-                snprintf(trans_str, TRANS_STR_SIZE, "%s%s%.2f",
-                         block->transactions[i].sender,
-                         block->transactions[i].receiver,
-                         block->transactions[i].amount);
-                if (strlen(trans_data) + strlen(trans_str) < sizeof(trans_data) - 1)
-                {
-                        strcat(trans_data, trans_str);
-                }
-        }
-
-        // Combine all block data including transactions for hashing
-        snprintf(input, sizeof(input), "%d%ld%s%s%s",
-                 block->index, block->timestamp, block->data,
-                 block->previous_hash, trans_data);
-
-        SHA256_Init(&sha256);
-        SHA256_Update(&sha256, input, strlen(input));
-        SHA256_Final(hash, &sha256);
-
-        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-        {
-                sprintf(output + (i * 2), "%02x", hash[i]);
-        }
-        output[HASH_SIZE] = '\0';
-}
-
-/**
- * Creates a new block
- * @param index Block index
- * @param data Block data
- * @param previous_hash Hash of previous block
- * @return Pointer to new block or NULL if creation fails
- */
-Block *createBlock(int index, const char *data, const char *previous_hash)
-{
-        Block *block = (Block *)malloc(sizeof(Block));
-        if (!block)
-                return NULL;
-
-        block->index = index;
-        block->timestamp = time(NULL);
-        block->transaction_count = 0;
-        strncpy(block->data, data, MAX_DATA_SIZE - 1);
-        block->data[MAX_DATA_SIZE - 1] = '\0';
-        strncpy(block->previous_hash, previous_hash, HASH_SIZE);
-        block->previous_hash[HASH_SIZE] = '\0';
-        block->next = NULL;
-
-        calculateHash(block, block->hash);
-        return block;
-}
-
-/**
- * Adds a new block to the blockchain
- * @param chain Pointer to the blockchain
- * @param data Data for the new block
- * @return 1 if successful, 0 if failed
- */
-int addBlock(Blockchain *chain, const char *data)
-{
-        if (!chain)
-                return 0;
-
-        if (!chain->head)
-        {
-                chain->head = createBlock(0, data, "0");
-                if (!chain->head)
-                        return 0;
-                chain->length = 1;
-                return 1;
-        }
-
-        Block *current = chain->head;
-        while (current->next)
-        {
-                current = current->next;
-        }
-
-        Block *newBlock = createBlock(chain->length, data, current->hash);
-        if (!newBlock)
-                return 0;
-
-        current->next = newBlock;
-        chain->length++;
-
-        return 1;
-}
+                case 8:
+                        displayPoolStats(chain, stdout);
+                        displayCacheStats(chain, stdout);
+                        break;
 
-/**
- * Validates the integrity of the blockchain
- * @param chain Pointer to the blockchain
- * @return 1 if valid, 0 if invalid
- */
-int validateBlockchain(Blockchain *chain)
-{
-        if (!chain || !chain->head)
-                return 1;
+                case 9:
+                        displayBalances(chain, stdout);
+                        break;
 
-        Block *current = chain->head->next;
-        Block *previous = chain->head;
-        char calculated_hash[HASH_SIZE + 1];
+                case 10:
+                        getStringInput("Enter file to import (.csv or .jsonl): ", input, MAX_DATA_SIZE);
+                        if (importBlockchain(chain, input))
+                                printf("Import complete!\n");
+                        else
+                                printf("Import stopped early!\n");
+                        break;
 
-        while (current)
-        {
-                calculateHash(previous, calculated_hash);
-                if (strcmp(current->previous_hash, calculated_hash) != 0)
-                {
-                        return 0;
-                }
+                case 11:
+                        getStringInput("Enter file to export to (.csv or .jsonl): ", input, MAX_DATA_SIZE);
+                        if (exportBlockchain(chain, input))
+                                printf("Export complete!\n");
+                        else
+                                printf("Failed to export blockchain!\n");
+                        break;
 
-                calculateHash(current, calculated_hash);
-                if (strcmp(current->hash, calculated_hash) != 0)
-                {
-                        return 0;
+                default:
+                        printf("Invalid choice! Please enter a number between 1 and 11.\n");
                 }
+        } while (choice != 7);
 
-                previous = current;
-                current = current->next;
-        }
-
-        return 1;
-}
-
-/**
- * Adds a new transaction to a block
- * @param block Target block
- * @param sender Transaction sender
- * @param receiver Transaction receiver
- * @param amount Transaction amount
- * @return 1 if successful, 0 if failed
- */
-int addTransaction(Block *block, const char *sender, const char *receiver, double amount)
-{
-        if (!block || block->transaction_count >= MAX_TRANSACTIONS)
-                return 0;
-
-        Transaction *trans = &block->transactions[block->transaction_count];
-        strncpy(trans->sender, sender, MAX_SENDER_SIZE - 1);
-        trans->sender[MAX_SENDER_SIZE - 1] = '\0';
-
-        strncpy(trans->receiver, receiver, MAX_RECEIVER_SIZE - 1);
-        trans->receiver[MAX_RECEIVER_SIZE - 1] = '\0';
-
-        trans->amount = amount;
-        trans->timestamp = time(NULL);
-
-        block->transaction_count++;
-
-        calculateHash(block, block->hash);
-        return 1;
-}
-
-/**
- * Displays transactions in a block
- * @param block Block containing transactions
- */
-void displayTransactions(Block *block)
-{
-        if (block->transaction_count == 0)
-        {
-                printf("No transactions in this block\n");
-                return;
-        }
-
-        printf("\nTransactions:\n");
-        for (int i = 0; i < block->transaction_count; i++)
-        {
-                printf("Transaction #%d:\n", i + 1);
-                printf("  From: %s\n", block->transactions[i].sender);
-                printf("  To: %s\n", block->transactions[i].receiver);
-                printf("  Amount: %.2f\n", block->transactions[i].amount);
-                printf("  Time: %s", ctime(&block->transactions[i].timestamp));
-        }
-}
-
-/**
- * Displays information of a single block including transactions
- * @param block Block to display
- */
-void displayBlock(Block *block)
-{
-        printf("\nBlock #%d\n", block->index);
-        printf("Timestamp: %s", ctime(&block->timestamp));
-        printf("Data: %s\n", block->data);
-        printf("Previous Hash: %s\n", block->previous_hash);
-        printf("Hash: %s\n", block->hash);
-        displayTransactions(block);
-}
-
-/**
- * Displays the entire blockchain
- * @param chain Pointer to the blockchain
- */
-void displayBlockchain(Blockchain *chain)
-{
-        if (!chain || !chain->head)
-        {
-                printf("Blockchain is empty\n");
-                return;
-        }
-
-        Block *current = chain->head;
-        while (current)
-        {
-                displayBlock(current);
-                current = current->next;
-        }
-}
-
-/**
- * Frees all memory allocated for the blockchain
- * @param chain Pointer to the blockchain
- */
-void freeBlockchain(Blockchain *chain)
-{
-        if (!chain)
-                return;
-
-        Block *current = chain->head;
-        while (current)
-        {
-                Block *temp = current;
-                current = current->next;
-                free(temp);
-        }
-        free(chain);
+        freeBlockchain(chain);
+        return 0;
 }
 
 /**
@@ -478,141 +498,29 @@ double getDoubleInput(const char *prompt)
 }
 
 /**
- * Saves the blockchain to a file
- * @param chain Pointer to the blockchain
- * @param filename Name of the file to save to
- * @return 1 if successful, 0 if failed
+ * Prints a message from the chain library on a line of its own
+ * @param context Stream to print to
+ * @param message Message without its line break
  */
-int saveBlockchain(Blockchain *chain, const char *filename)
+void printMessage(void *context, const char *message)
 {
-        if (!chain)
-                return 0;
-
-        FILE *file = fopen(filename, "wb");
-        if (!file)
-        {
-                printf("Error: Could not open file for writing\n");
-                return 0;
-        }
-
-        // Write chain length first
-        fwrite(&chain->length, sizeof(int), 1, file);
-
-        // Write each block
-        Block *current = chain->head;
-        while (current)
-        {
-                // Write block data
-                fwrite(&current->index, sizeof(int), 1, file);
-                fwrite(&current->timestamp, sizeof(time_t), 1, file);
-                fwrite(current->data, sizeof(char), MAX_DATA_SIZE, file);
-                fwrite(&current->transaction_count, sizeof(int), 1, file);
-
-                // Write transactions
-                for (int i = 0; i < current->transaction_count; i++)
-                {
-                        fwrite(&current->transactions[i], sizeof(Transaction), 1, file);
-                }
-
-                // Write hashes
-                fwrite(current->previous_hash, sizeof(char), HASH_SIZE + 1, file);
-                fwrite(current->hash, sizeof(char), HASH_SIZE + 1, file);
-
-                current = current->next;
-        }
-
-        fclose(file);
-        printf("Blockchain saved successfully to %s\n", filename);
-        return 1;
+        fprintf((FILE *)context, "%s\n", message);
+        fflush((FILE *)context);
 }
 
 /**
- * Loads the blockchain from a file
- * @param filename Name of the file to load from
- * @return Pointer to loaded blockchain or NULL if failed
+ * Parses a whole non-negative decimal count from a command line option
+ * @param text Option value
+ * @param max Largest value accepted
+ * @param value Set to the count when it parses
+ * @return 1 if the text is a count no larger than max, 0 otherwise
  */
-Blockchain *loadBlockchain(const char *filename)
+int parseCount(const char *text, long max, long *value)
 {
-        FILE *file = fopen(filename, "rb");
-        if (!file)
-        {
-                printf("Error: Could not open file for reading\n");
-                return NULL;
-        }
-
-        Blockchain *chain = createBlockchain();
-        if (!chain)
-        {
-                fclose(file);
-                return NULL;
-        }
-
-        // Read chain length
-        int length;
-        if (fread(&length, sizeof(int), 1, file) != 1)
-        {
-                printf("Error: Could not read chain length\n");
-                freeBlockchain(chain);
-                fclose(file);
-                return NULL;
-        }
-
-        // Read each block
-        for (int i = 0; i < length; i++)
-        {
-                Block *block = (Block *)malloc(sizeof(Block));
-                if (!block)
-                {
-                        freeBlockchain(chain);
-                        fclose(file);
-                        return NULL;
-                }
-
-                // Read block data
-                fread(&block->index, sizeof(int), 1, file);
-                fread(&block->timestamp, sizeof(time_t), 1, file);
-                fread(block->data, sizeof(char), MAX_DATA_SIZE, file);
-                fread(&block->transaction_count, sizeof(int), 1, file);
-
-                // Read transactions
-                for (int j = 0; j < block->transaction_count; j++)
-                {
-                        fread(&block->transactions[j], sizeof(Transaction), 1, file);
-                }
-
-                // Read hashes
-                fread(block->previous_hash, sizeof(char), HASH_SIZE + 1, file);
-                fread(block->hash, sizeof(char), HASH_SIZE + 1, file);
-
-                block->next = NULL;
-
-                // Add block to chain
-                if (!chain->head)
-                {
-                        chain->head = block;
-                }
-                else
-                {
-                        Block *current = chain->head;
-                        while (current->next)
-                        {
-                                current = current->next;
-                        }
-                        current->next = block;
-                }
-        }
-
-        chain->length = length;
-        fclose(file);
-
-        // Re-validate the loaded blockchain
-        if (!validateBlockchain(chain))
-        {
-                printf("Error: Loaded blockchain is invalid\n");
-                freeBlockchain(chain);
-                return NULL;
-        }
-
-        printf("Blockchain loaded and validated successfully from %s\n", filename);
-        return chain;
+        char *end = NULL;
+        long parsed = strtol(text, &end, 10);
+        if (end == text || *end != '\0' || parsed < 0 || parsed > max)
+                return 0;
+        *value = parsed;
+        return 1;
 }
@@ -3,216 +3,129 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <openssl/sha.h>
-
-#define MAX_DATA_SIZE 256
-#define HASH_SIZE 64
-
-/**
- * Structure representing a block in the blockchain
- */
-typedef struct Block
-{
-	int index;
-	time_t timestamp;
-	char data[MAX_DATA_SIZE];
-	char previous_hash[HASH_SIZE + 1];
-	char hash[HASH_SIZE + 1];
-	struct Block *next;
-} Block;
-
-/**
- * Structure representing the blockchain
- */
-typedef struct
-{
-	Block *head;
-	int length;
-} Blockchain;
-
-/**
- * Calculates SHA-256 hash for a block
- * @param block Pointer to the block to hash
- * @param output Buffer to store the resulting hash string
- */
-void calculateHash(Block *block, char *output)
-{
-	char input[MAX_DATA_SIZE * 2];
-	unsigned char hash[SHA256_DIGEST_LENGTH];
-	SHA256_CTX sha256;
-
-	// Combine block data for hashing
-	snprintf(input, sizeof(input), "%d%ld%s%s",
-		 block->index, block->timestamp, block->data, block->previous_hash);
-
-	// Calculate hash
-	SHA256_Init(&sha256);
-	SHA256_Update(&sha256, input, strlen(input));
-	SHA256_Final(hash, &sha256);
-
-	// Convert to hex string
-	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-	{
-		sprintf(output + (i * 2), "%02x", hash[i]);
-	}
-	output[HASH_SIZE] = '\0';
-}
+#include <unistd.h>
+#include "chain.h"
 
 /**
- * Creates a new block with given parameters
- * @param index Block index
- * @param data Block data
- * @param previous_hash Hash of the previous block
- * @return Pointer to the new block
+ * Runs a simulated network of nodes and prints what it measured
+ * @param argc Number of options
+ * @param argv Options, each followed by its value
+ * @return 1 if the simulation ran, 0 otherwise
  */
-Block *createBlock(int index, const char *data, const char *previous_hash)
+static int runNetwork(int argc, char *argv[])
 {
-	Block *block = (Block *)malloc(sizeof(Block));
-	if (!block)
-		return NULL;
-
-	block->index = index;
-	block->timestamp = time(NULL);
-	strncpy(block->data, data, MAX_DATA_SIZE - 1);
-	block->data[MAX_DATA_SIZE - 1] = '\0';
-	strncpy(block->previous_hash, previous_hash, HASH_SIZE);
-	block->previous_hash[HASH_SIZE] = '\0';
-	block->next = NULL;
-
-	calculateHash(block, block->hash);
-	return block;
-}
+	NetworkConfig config;
+	NetworkReport report;
 
-/**
- * Validates the entire blockchain
- * @param chain Pointer to the blockchain
- * @return 1 if valid, 0 if invalid
- */
-int validateChain(Blockchain *chain)
-{
-	if (!chain->head)
-		return 1; // Empty chain is valid
-
-	Block *current = chain->head->next;
-	Block *previous = chain->head;
-	char calculated_hash[HASH_SIZE + 1];
-
-	while (current)
+	initNetworkConfig(&config);
+	for (int i = 0; i < argc; i += 2)
 	{
-		// Verify previous hash link
-		calculateHash(previous, calculated_hash);
-		if (strcmp(current->previous_hash, calculated_hash) != 0)
+		if (i + 1 == argc)
 		{
+			printf("Error: %s needs a value\n", argv[i]);
 			return 0;
 		}
 
-		// Verify current block's hash
-		calculateHash(current, calculated_hash);
-		if (strcmp(current->hash, calculated_hash) != 0)
+		double value = atof(argv[i + 1]);
+		if (strcmp(argv[i], "--nodes") == 0)
+			config.nodes = (int)value;
+		else if (strcmp(argv[i], "--peers") == 0)
+			config.peers = (int)value;
+		else if (strcmp(argv[i], "--latency") == 0)
+			config.latency_ms = value;
+		else if (strcmp(argv[i], "--jitter") == 0)
+			config.jitter_ms = value;
+		else if (strcmp(argv[i], "--loss") == 0)
+			config.loss = value / 100;
+		else if (strcmp(argv[i], "--bandwidth") == 0)
+			config.bandwidth_kbps = value;
+		else if (strcmp(argv[i], "--interval") == 0)
+			config.block_interval_ms = value;
+		else if (strcmp(argv[i], "--tx-rate") == 0)
+			config.transaction_rate = value;
+		else if (strcmp(argv[i], "--duration") == 0)
+			config.duration_s = value;
+		else if (strcmp(argv[i], "--timeout") == 0)
+			config.timeout_s = value;
+		else if (strcmp(argv[i], "--speed") == 0)
+			config.speed = value;
+		else if (strcmp(argv[i], "--seed") == 0)
+			config.seed = (unsigned int)value;
+		else
 		{
+			printf("Error: Unknown option %s\n", argv[i]);
 			return 0;
 		}
-
-		previous = current;
-		current = current->next;
 	}
 
-	return 1;
-}
-
-/**
- * Adds a new block to the blockchain
- * @param chain Pointer to the blockchain
- * @param data Data to store in the new block
- * @return 1 if successful, 0 if failed
- */
-int addBlock(Blockchain *chain, const char *data)
-{
-	if (!chain)
+	printf("Simulating %d nodes with %d extra peers each for %.0f s at %.0fx speed\n", config.nodes,
+	       config.peers, config.duration_s, config.speed);
+	printf("Links: %.1f ms latency, %.1f ms jitter, %.1f%% loss, %.0f kbit/s\n", config.latency_ms,
+	       config.jitter_ms, config.loss * 100, config.bandwidth_kbps);
+	printf("Load: a block every %.0f ms, %.0f transactions/s\n\n", config.block_interval_ms,
+	       config.transaction_rate);
+	if (!runNetworkSimulation(&config, &report))
 		return 0;
 
-	if (!chain->head)
-	{
-		// Create genesis block
-		chain->head = createBlock(0, data, "0");
-		chain->length = 1;
-		return chain->head != NULL;
-	}
-
-	Block *current = chain->head;
-	while (current->next)
-	{
-		current = current->next;
-	}
-
-	Block *new_block = createBlock(current->index + 1, data, current->hash);
-	if (!new_block)
-		return 0;
-
-	current->next = new_block;
-	chain->length++;
-
-	// Validate chain after adding new block
-	return validateChain(chain);
+	printf("Blocks mined: %d, final chain length: %d\n", report.blocks_mined, report.chain_length);
+	printf("Stale blocks: %d (fork rate %.2f%%)\n", report.stale_blocks, report.fork_rate * 100);
+	printf("Transactions: %ld made, %ld confirmed\n", report.transactions_made, report.transactions_confirmed);
+	printf("Propagation: mean %.1f ms, p50 %.1f ms, p90 %.1f ms, max %.1f ms\n", report.propagation_mean_ms,
+	       report.propagation_p50_ms, report.propagation_p90_ms, report.propagation_max_ms);
+	printf("Reaching every node: p50 %.1f ms, p90 %.1f ms\n", report.full_reach_p50_ms, report.full_reach_p90_ms);
+	printf("Convergence: mean %.1f ms, p90 %.1f ms, max %.1f ms\n", report.convergence_mean_ms,
+	       report.convergence_p90_ms, report.convergence_max_ms);
+	if (report.settle_ms >= 0)
+		printf("Settled on one tip %.1f ms after mining stopped\n", report.settle_ms);
+	else
+		printf("Still split between %d tips %.0f s after mining stopped\n", report.final_tips, config.timeout_s);
+	printf("Messages: %ld sent, %ld dropped, %.1f MB\n", report.messages_sent, report.messages_dropped,
+	       report.bytes_sent / 1e6);
+	return 1;
 }
 
 /**
- * Displays the contents of a block
- * @param block Pointer to the block to display
+ * Prints a message from the chain library on a line of its own
+ * @param context Stream to print to
+ * @param message Message without its line break
  */
-void displayBlock(Block *block)
+static void printMessage(void *context, const char *message)
 {
-	printf("\nBlock #%d\n", block->index);
-	printf("Timestamp: %ld\n", block->timestamp);
-	printf("Data: %s\n", block->data);
-	printf("Previous Hash: %s\n", block->previous_hash);
-	printf("Hash: %s\n", block->hash);
+	fprintf((FILE *)context, "%s\n", message);
+	fflush((FILE *)context);
 }
 
-/**
- * Displays the entire blockchain
- * @param chain Pointer to the blockchain
- */
-void displayBlockchain(Blockchain *chain)
+int main(int argc, char *argv[])
 {
-	Block *current = chain->head;
-	while (current)
+	setChainMessageCallback(printMessage, stdout);
+	if (argc > 1 && strcmp(argv[1], "--network") == 0)
+		return runNetwork(argc - 2, argv + 2) ? 0 : 1;
+	if (argc > 1)
 	{
-		displayBlock(current);
-		current = current->next;
+		printf("Usage: %s [--network [--nodes N] [--peers N] [--latency MS] [--jitter MS] [--loss PERCENT]\n"
+		       "                       [--bandwidth KBITS] [--interval MS] [--tx-rate N] [--duration S]\n"
+		       "                       [--timeout S] [--speed FACTOR] [--seed N]]\n",
+		       argv[0]);
+		return 1;
 	}
-}
 
-/**
- * Frees all memory allocated for the blockchain
- * @param chain Pointer to the blockchain
- */
-void freeBlockchain(Blockchain *chain)
-{
-	Block *current = chain->head;
-	while (current)
+	Blockchain *chain = createBlockchain();
+	char data[MAX_DATA_SIZE];
+
+	if (!chain)
 	{
-		Block *temp = current;
-		current = current->next;
-		free(temp);
+		printf("Failed to create blockchain!\n");
+		return 1;
 	}
-	chain->head = NULL;
-	chain->length = 0;
-}
-
-int main()
-{
-	Blockchain chain = {NULL, 0};
-	char data[MAX_DATA_SIZE];
 
 	printf("Simple Blockchain Simulation\n\n");
 
 	// Create Genesis block
 	printf("Creating Genesis Block...\n");
-	if (!addBlock(&chain, "Genesis Block"))
+	if (!addBlock(chain, "Genesis Block"))
 	{
 		printf("Failed to create genesis block!\n");
+		freeBlockchain(chain);
 		return 1;
 	}
 	sleep(1);
@@ -228,7 +141,8 @@ int main()
 			// Remove newline
 			data[strcspn(data, "\n")] = 0;
 
-			if (!addBlock(&chain, data))
+			// Validate chain after adding new block
+			if (!addBlock(chain, data) || !validateBlockchain(chain))
 			{
 				printf("Failed to add block!\n");
 				break;
@@ -236,15 +150,15 @@ int main()
 
 			printf("Block added successfully!\n");
 			printf("Chain validation: %s\n",
-			       validateChain(&chain) ? "VALID" : "INVALID");
+			       validateBlockchain(chain) ? "VALID" : "INVALID");
 		}
 	}
 
 	// Display the entire blockchain
 	printf("\nFinal Blockchain State:");
-	displayBlockchain(&chain);
+	displayBlockchain(chain, stdout);
 
 	// Cleanup
-	freeBlockchain(&chain);
+	freeBlockchain(chain);
 	return 0;
 }
\ No newline at end of file
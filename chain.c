@@ -0,0 +1,11866 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <zlib.h>
+#include "chain.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define TRANS_STR_SIZE 150
+#define HEADER_STR_SIZE 64
+#define MAX_BLOCK_DATA_SIZE (16 * 1024 * 1024)
+#define MAX_BLOCK_TRANSACTIONS (1 << 24)
+#define MIN_TRANSACTION_CAPACITY 4
+
+#define POOL_ALIGNMENT 16
+#define POOL_MIN_PAGE_SIZE (64 * 1024)
+#define POOL_MAX_PAGE_SIZE (4 * 1024 * 1024)
+#define POOL_SMALL_CLASS_LIMIT 128
+#define POOL_MAX_CLASS_SIZE (64 * 1024)
+#define POOL_SIZE_CLASSES 44
+
+#define INDEX_MIN_BUCKETS 1024
+#define STATE_MIN_BUCKETS 256
+#define UNDO_MIN_CAPACITY 8
+#define VIEW_MIN_CAPACITY 1024
+#define CACHE_LINE_SIZE 64
+
+#define BLOCK_PRUNED 0x1
+#define BLOCK_PERSISTED 0x2
+#define BLOCK_DIRTY 0x4
+#define BLOCK_MAPPED_DATA 0x8
+#define BLOCK_MAPPED_TRANSACTIONS 0x10
+#define BLOCK_SNAPSHOT 0x20
+#define BLOCK_EVICTED 0x40
+#define BLOCK_CACHED 0x80
+
+#define RECORD_BLOCK 1
+#define RECORD_TRANSACTIONS 2
+#define RECORD_INDEX 3
+#define RECORD_SEGMENT 4
+#define RECORD_COMPACT_BLOCK 5
+#define RECORD_COMPACT_TRANSACTIONS 6
+#define RECORD_TIP 7
+#define LOG_BUFFER_SIZE (1024 * 1024)
+#define RECORD_ALIGNMENT 8
+#define RECORD_ALIGN(size) (((size) + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1))
+
+#define FILE_MAGIC "ALUCHAIN"
+#define FILE_TRAILER_MAGIC "CHAINIDX"
+#define CHECKPOINT_MAGIC "CHAINCHK"
+#define CHECKPOINT_KEY_VARIABLE "ALUCHAIN_CHECKPOINT_KEY"
+#define STATE_MAGIC "CHAINSTA"
+#define LEGACY_DATA_SIZE 256
+#define LEGACY_MAX_TRANSACTIONS 10
+#define LEGACY_INPUT_SIZE 1024
+#define STATE_VERSION 1
+#define LOAD_BAD_CHECKPOINT 0x1
+#define LOAD_BAD_STATE 0x2
+#define FILE_VERSION 3
+#define FILE_BYTE_ORDER 0x01020304
+#define INDEX_NO_ENTRY UINT32_MAX
+#define INDEX_MIN_SLOTS 16
+#define CRC32C_POLYNOMIAL 0x82F63B78
+#define BTREE_MAGIC "CHAINBPT"
+#define BTREE_VERSION 2
+#define BTREE_PAGE_SIZE 4096
+#define BTREE_GROW_PAGES 256
+#define BTREE_MAX_DEPTH 16
+#define BTREE_BY_HASH 0
+#define BTREE_BY_ADDRESS 1
+#define BTREE_BY_TIME 2
+#define BTREE_BY_HEIGHT 3
+#define BTREE_TREES 4
+#define BTREE_HASH_KEY 32
+#define BTREE_ADDRESS_KEY (MAX_SENDER_SIZE + 17)
+#define BTREE_TIME_KEY 16
+#define BTREE_HEIGHT_KEY 4
+#define BTREE_MAX_ENTRY 128
+
+#define SEGMENT_MAX_RECORDS 1024
+#define LOAD_WINDOW_BYTES (1024 * 1024)
+#define LOAD_BATCH_BYTES (256 * 1024)
+
+#define IMPORT_BUFFER_SIZE (1024 * 1024)
+#define IMPORT_BATCH_TRANSACTIONS 1024
+#define IMPORT_MAX_COLUMNS 32
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+#define RPC_FRAME_HEADER 4
+#define RPC_MAX_REQUEST (64 * 1024)
+#define RPC_MAX_BACKLOG (4 * 1024 * 1024)
+#define RPC_READ_SIZE (64 * 1024)
+#define RPC_MAX_EVENTS 64
+#define SYNC_WINDOW 8               // Requests a sync keeps in flight
+#define SYNC_DENSE_LOCATOR 10       // Locator hashes one block apart before they thin out
+#define FEED_MAGIC "CHAINFED"
+#define FEED_VERSION 1
+#define FEED_DEFAULT_CAPACITY 4096
+#define FEED_MAX_CAPACITY (1 << 20)
+#define FEED_MAX_SUBSCRIBERS 64
+#define FEED_MAX_NAME 256
+#define FEED_SPIN_CHECKS 100        // Times a subscriber looks for an event, yielding in between, before it sleeps
+#define FEED_WAIT_CHECK_MS 100      // How often a waiting publisher checks that its subscriber is still alive
+#define FEED_CURSOR_FREE 0
+#define FEED_CURSOR_JOINING 1
+#define FEED_CURSOR_ACTIVE 2
+
+#define SIM_BLOCK 1
+#define SIM_GET_BLOCK 2
+#define SIM_TIP 3
+#define SIM_TRANSACTION 4
+#define SIM_HEADER_BYTES 80         // Header plus framing of a message on a simulated link
+#define SIM_TRANSACTION_BYTES 64
+#define SIM_MAX_ORPHANS 256
+#define SIM_MAX_POOL 10000
+#define SIM_BLOCK_TRANSACTIONS 100
+#define SIM_ACCOUNTS 1000
+#define SIM_ANNOUNCE_INTERVAL_MS 1000
+#define SIM_POLL_INTERVAL_MS 1
+#define IMPORT_TYPE 0
+#define IMPORT_BLOCK 1
+#define IMPORT_DATA 2
+#define IMPORT_SENDER 3
+#define IMPORT_RECEIVER 4
+#define IMPORT_AMOUNT 5
+#define IMPORT_TIMESTAMP 6
+#define IMPORT_FIELD_COUNT 7
+#define COMPRESS_MIN_SIZE 256
+#define BODY_COMPRESSED 0x1
+#define HASH_BINARY 0
+#define HASH_TEXT 1
+#define AMOUNT_RAW 0x1
+
+typedef struct Account
+{
+        char address[MAX_SENDER_SIZE];
+        double balance;
+        struct Account *next;
+} Account;
+
+typedef struct UndoEntry
+{
+        Account *account;
+        double previous_balance;
+} UndoEntry;
+
+/* Balance changes made while a block is on the active chain, undone in reverse */
+typedef struct BlockUndo
+{
+        int count;
+        int capacity;
+        UndoEntry entries[];
+} BlockUndo;
+
+struct Block
+{
+        int index;
+        time_t timestamp;
+        int data_length;
+        char *data;
+        Transaction *transactions;
+        int transaction_count;
+        int transaction_capacity;
+        char previous_hash[HASH_SIZE + 1];
+        char hash[HASH_SIZE + 1];
+        struct Block *next;         // Successor on the active chain
+        struct Block *parent;       // Block this one was built on, NULL for genesis
+        struct Block *skip;         // Exponentially further ancestor, see getSkipHeight
+        struct Block *hash_next;    // Next block in the same index bucket
+        BlockUndo *undo;            // Set while the block is applied to the active chain
+        struct Block *log_next;     // Next block in the order blocks joined the tree
+        struct Block *dirty_next;   // Next saved block with unsaved transactions
+        struct Block *lru_prev;     // More recently used neighbour in the payload cache
+        struct Block *lru_next;     // Less recently used neighbour in the payload cache
+        long file_offset;           // Offset of the block's record in the chain file
+        long amend_offset;          // Offset of the newest record of transactions added to it, 0 if none
+        long pending_offset;        // Offset of its record in the save being written
+        unsigned long long chain_work;
+        int child_count;
+        int saved_transaction_count;
+        unsigned int flags;
+};
+
+/* Large page that size-class slabs are carved from */
+typedef struct PoolPage
+{
+        struct PoolPage *next;
+        size_t size;
+} PoolPage;
+
+/* Allocation bigger than the largest size class, tracked for bulk release */
+typedef struct PoolLarge
+{
+        struct PoolLarge *prev;
+        struct PoolLarge *next;
+        size_t size;
+        size_t reserved;
+} PoolLarge;
+
+/* Slab allocator owning every block, data buffer and transaction list of a chain */
+typedef struct ChainPool
+{
+        PoolPage *pages;
+        char *cursor;
+        char *limit;
+        size_t next_page_size;
+        void *free_lists[POOL_SIZE_CLASSES];
+        PoolLarge *large;
+        PoolStats stats;
+} ChainPool;
+
+/*
+ * Start of every chain file. A chain is one file or a run of segment files
+ * named after it (blockchain.dat, blockchain.dat.1, ...); the header says
+ * where in the chain a file sits and how its records are encoded.
+ */
+typedef struct FileHeader
+{
+        char magic[8];              // FILE_MAGIC
+        uint32_t version;           // FILE_VERSION
+        uint32_t byte_order;        // FILE_BYTE_ORDER as stored by the writing machine
+        uint32_t layout_flags;      // LAYOUT_* bits
+        uint32_t header_size;       // Records start at this offset
+        uint32_t segment;           // Position of the file in its chain, 0 for the first
+        uint32_t reserved;
+        uint64_t base_offset;       // Chain offset of the file's first byte; records are addressed by chain offset
+        char boundary_hash[HASH_SIZE + 1]; // Hash in the last block record of the files before it, "" for the first
+} FileHeader;
+
+/* Every record in blockchain.dat starts with this header */
+typedef struct RecordHeader
+{
+        uint32_t type;
+        uint32_t length;            // Payload bytes following the header, a multiple of RECORD_ALIGNMENT
+        uint32_t checksum;          // CRC32C of the type, length and payload
+        uint32_t reserved;
+} RecordHeader;
+
+/* One piece of a record's payload; each piece is padded to RECORD_ALIGNMENT */
+typedef struct RecordPart
+{
+        const void *data;
+        size_t length;
+} RecordPart;
+
+/*
+ * Fixed layout of a block record. The data follows NUL-terminated and padded
+ * to RECORD_ALIGNMENT, then the transactions, so a mapped file can be used in place.
+ */
+typedef struct BlockRecord
+{
+        int32_t index;
+        int32_t data_length;
+        int64_t timestamp;
+        int32_t transaction_count;
+        uint32_t reserved;
+        char previous_hash[HASH_SIZE + 1];
+        char hash[HASH_SIZE + 1];
+} BlockRecord;
+
+/* Fixed layout of a record of transactions added to a saved block; they follow it */
+typedef struct TransactionsRecord
+{
+        char saved_hash[HASH_SIZE + 1];     // Block hash as of the previous save
+        char hash[HASH_SIZE + 1];           // Block hash with these transactions added
+        int32_t transaction_count;
+        uint32_t reserved;
+        uint64_t previous_offset;           // Previous such record for the block, 0 if none
+} TransactionsRecord;
+
+/*
+ * Compact layout: a segment record carries the base index and timestamp the
+ * records after it are delta-encoded against, plus the addresses their
+ * transactions refer to by number. Compact records start with their
+ * distance back to that segment record.
+ */
+typedef struct SegmentState
+{
+        long offset;                // Offset of the segment record, -1 before the first
+        int64_t base_index;
+        int64_t base_timestamp;
+        uint32_t address_count;
+        char (*addresses)[MAX_SENDER_SIZE];
+} SegmentState;
+
+/* Growable buffer compact records are encoded into; failed sticks after an allocation failure */
+typedef struct ByteBuffer
+{
+        unsigned char *data;
+        size_t length;
+        size_t capacity;
+        int failed;
+} ByteBuffer;
+
+/* Bounds-checked cursor over an encoded record; failed sticks after a read past its end */
+typedef struct ByteReader
+{
+        const unsigned char *data;
+        size_t length;
+        size_t position;
+        int failed;
+} ByteReader;
+
+/* Addresses used by one segment's transactions, numbered in first-use order */
+typedef struct AddressDictionary
+{
+        const char **addresses;
+        uint32_t count;
+        uint32_t *slots;            // Open-addressed address numbers plus one, 0 for empty
+        uint32_t slot_count;        // Power of two, at least twice count
+        int failed;
+} AddressDictionary;
+
+/* Transactions added to a saved block, as read back from either layout */
+typedef struct AmendRecord
+{
+        char saved_hash[HASH_SIZE + 1];
+        char hash[HASH_SIZE + 1];
+        int transaction_count;
+        uint64_t previous_offset;   // Previous such record for the block, 0 if none
+        const Transaction *transactions;
+        Transaction *decoded;       // Heap copy behind transactions for compact records
+} AmendRecord;
+
+/*
+ * Footer index written when a chain file is closed. The record holds this
+ * header, then the entry table in record order, then the active chain's
+ * entry number for each height, then an open-addressed hash table of
+ * entry numbers plus one (0 for an empty slot).
+ */
+typedef struct IndexRecord
+{
+        uint32_t entry_count;
+        uint32_t height_count;
+        uint32_t slot_count;        // Power of two
+        uint32_t reserved;
+} IndexRecord;
+
+typedef struct IndexEntry
+{
+        uint64_t offset;            // Offset of the block record
+        uint64_t amend_offset;      // Offset of the newest transactions record, 0 if none
+        uint64_t key;               // Leading 64 bits of the block's hash
+} IndexEntry;
+
+/* Last bytes of an indexed chain file */
+typedef struct FileTrailer
+{
+        uint64_t index_offset;      // Offset of the index record
+        char magic[8];              // FILE_TRAILER_MAGIC
+} FileTrailer;
+
+/*
+ * Contents of name.checkpoint, written beside a chain once its records are
+ * synced. A load that can check the signature trusts the block hashes
+ * stored before the offset instead of re-hashing those blocks.
+ */
+typedef struct Checkpoint
+{
+        char magic[8];              // CHECKPOINT_MAGIC
+        uint64_t offset;            // Chain offset where the trusted records end
+        int32_t height;
+        char hash[HASH_SIZE + 1];   // Hash of the block at that height once those records are replayed
+        unsigned char mac[SHA256_DIGEST_LENGTH]; // HMAC-SHA256 of the fields before it
+} Checkpoint;
+
+/* Shape of one tree of an index file */
+typedef struct BTreeRoot
+{
+        uint32_t root;              // Page of the root node, 0 while the tree is empty
+        uint32_t depth;             // Levels, the leaves included
+        uint32_t key_size;
+        uint32_t value_size;
+        uint64_t entries;
+} BTreeRoot;
+
+/*
+ * First page of name.index, the B+tree indexes kept beside a chain. The
+ * file is only trusted while clean is set and it ends where the chain does.
+ */
+typedef struct BTreeHeader
+{
+        char magic[8];              // BTREE_MAGIC
+        uint32_t version;
+        uint32_t page_size;
+        uint32_t page_count;        // Pages in use; the file may be longer
+        uint32_t clean;             // Cleared on disk before the first change, set once the pages are synced
+        uint64_t indexed_end;       // Chain offset where the indexed records end
+        char last_hash[HASH_SIZE + 1]; // Hash of the newest block record indexed
+        BTreeRoot trees[BTREE_TREES]; // Indexed by BTREE_BY_*
+} BTreeHeader;
+
+/* Page of an index file holding one tree node; entries are keys followed by values, or by child pages */
+typedef struct BTreeNode
+{
+        uint16_t leaf;
+        uint16_t count;
+        uint32_t link;              // Next leaf, or the child left of the first key of an inner node
+        unsigned char entries[BTREE_PAGE_SIZE - 8];
+} BTreeNode;
+
+/* Value of the hash index, keyed by the 32 bytes of a block hash */
+typedef struct HashIndexValue
+{
+        uint64_t offset;            // Chain offset of the block record
+        int64_t timestamp;
+        int32_t height;
+        int32_t unused;
+} HashIndexValue;
+
+/* Value of the address index, keyed by address, height, record offset, place in the block and side */
+typedef struct AddressIndexValue
+{
+        uint64_t offset;            // Chain offset of the block record
+        int64_t timestamp;
+        double amount;
+} AddressIndexValue;
+
+/* Value of the time index, keyed by timestamp and record offset */
+typedef struct TimeIndexValue
+{
+        int32_t height;
+        unsigned char hash[BTREE_HASH_KEY]; // Hash of the block as it was last indexed
+} TimeIndexValue;
+
+/* Value of the height index, keyed by height: the block the active chain had there when last saved */
+typedef struct HeightIndexValue
+{
+        uint64_t offset;            // Chain offset of the block record
+} HeightIndexValue;
+
+/* A block of the active chain whose height a save points the height index at */
+typedef struct ActiveHeight
+{
+        int height;
+        uint64_t offset;            // Chain offset of the block record, when already saved
+        const Block *pending;       // Block this save writes, whose pending_offset tells where; NULL if saved
+} ActiveHeight;
+
+/* Position in the leaves of a tree */
+typedef struct BTreeCursor
+{
+        uint32_t page;              // 0 past the last leaf
+        int position;
+} BTreeCursor;
+
+/* Index file mapped whole, for lookups or for a chain's saves to keep up to date */
+struct ChainIndex
+{
+        int fd;
+        unsigned char *base;
+        size_t mapped;
+        int dirty;                  // Marked unclean on disk; pages have changed since they were last synced
+};
+
+/*
+ * Header of name.state, the balance of every account as of one block of the
+ * active chain, written as saves go. A load that finds the block on the chain
+ * it loads starts the balances from here and only applies the blocks after it.
+ */
+typedef struct StateHeader
+{
+        char magic[8];              // STATE_MAGIC
+        uint32_t version;
+        int32_t height;
+        char hash[HASH_SIZE + 1];   // Hash of the block the balances stand at
+        uint64_t account_count;     // StateEntry records following the header
+        uint32_t checksum;          // CRC32C of those records
+        unsigned char mac[SHA256_DIGEST_LENGTH]; // HMAC-SHA256 of the fields before it, if the chain has a checkpoint key
+} StateHeader;
+
+/* Balance of one account in a state snapshot */
+typedef struct StateEntry
+{
+        char address[MAX_SENDER_SIZE];
+        double balance;
+} StateEntry;
+
+/* State snapshot read for a load */
+typedef struct StateSnapshot
+{
+        StateHeader header;
+        StateEntry *entries;
+} StateSnapshot;
+
+/* Account and its balance at an earlier block, while a state snapshot is taken */
+typedef struct StateBalance
+{
+        Account *account;
+        double balance;
+} StateBalance;
+
+/* Append-only chain file the blockchain saves into; only its newest segment is ever written */
+typedef struct ChainLog
+{
+        FILE *file;
+        char *filename;
+        char *buffer;
+        long size;                  // Chain offset of the end of the current segment file
+        long base;                  // Chain offset of the start of the current segment file
+        long index_offset;          // Chain offset of the file's footer index, 0 if it has none
+        uint32_t layout_flags;      // Encoding of the records in the file
+        int segment;                // Number of the segment file being appended to
+        int unsynced_records;       // Records written since the last fsync
+        char last_hash[HASH_SIZE + 1]; // Hash written in the newest block record, the next segment's boundary
+        ChainIndex *indexes;        // Disk indexes the saves keep up to date, NULL if not kept
+        int lock_fd;                // Descriptor of the first file holding the exclusive lock, when locked
+        int locked;                 // Whether this log holds the lock, so nothing else appends to the chain
+} ChainLog;
+
+/* Read-only mapping of a file a chain was loaded from; mapped blocks point into it */
+typedef struct ChainMap
+{
+        char *base;
+        size_t size;
+        dev_t device;
+        ino_t inode;
+} ChainMap;
+
+/* Pool buffer whose release waits until nothing can still be reading it */
+typedef struct RetiredBuffer
+{
+        void *data;
+        size_t size;
+        unsigned long epoch;        // Reader epoch it was retired in, for the chain's own list
+} RetiredBuffer;
+
+/*
+ * Snapshot of the active chain published to lock-free readers. It never
+ * changes once published; the writer publishes a new one instead.
+ */
+struct ChainView
+{
+        int length;
+        Block **heights;            // Active blocks by height; slots past length may be filled later
+        Block *tip;
+        int tip_transaction_count;  // The tip can still gain transactions, so its count and hash are copied
+        char tip_hash[HASH_SIZE + 1];
+};
+
+/* Thread reading a chain without its lock, on a cache line of its own */
+struct ChainReader
+{
+        unsigned long active;       // Epoch the read in progress started in, 0 between reads
+        Blockchain *chain;
+        struct ChainReader *next;
+        char padding[CACHE_LINE_SIZE - sizeof(unsigned long) - 2 * sizeof(void *)];
+};
+
+/* One event in a feed's ring */
+typedef struct FeedSlot
+{
+        uint64_t sequence;          // Sequence of the event held, 0 while the publisher rewrites it
+        FeedEvent event;
+} FeedSlot;
+
+/* A subscriber's place in a feed, on a cache line of its own */
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) FeedCursor
+{
+        uint32_t state;             // FEED_CURSOR_*
+        uint32_t policy;            // FEED_WAIT or FEED_DROP
+        uint64_t next;              // Sequence the subscriber reads next; the publisher moves it on to drop events
+        uint64_t dropped;
+        int32_t pid;                // Process subscribed, so a cursor whose process died can be reclaimed
+} FeedCursor;
+
+/*
+ * Shared part of a feed: a ring of fixed-size events and the cursors of
+ * its subscribers, in one mapping another process can open by name. The
+ * publisher writes each event straight into its slot and subscribers copy
+ * it out, checking the slot's sequence on both sides of the copy.
+ */
+typedef struct FeedRing
+{
+        char magic[8];              // FEED_MAGIC
+        uint32_t version;           // FEED_VERSION
+        uint32_t event_size;        // sizeof(FeedEvent) in the build that created the feed
+        uint32_t capacity;          // Slots, a power of two
+        uint32_t publishing;        // Set while a chain is attached
+        uint32_t closed;            // Set once the creator closes the feed
+        uint32_t space_waiting;     // Set while the publisher waits for a FEED_WAIT subscriber
+        uint32_t space_signal;      // Futex word advanced when a subscriber moves on while the publisher waits
+        uint64_t publisher_waits;
+        uint64_t head __attribute__((aligned(CACHE_LINE_SIZE))); // Sequence of the newest event, 0 before the first
+        uint32_t event_signal;      // Futex word advanced with every event
+        uint32_t sleepers;          // Subscribers asleep on event_signal
+        FeedCursor cursors[FEED_MAX_SUBSCRIBERS];
+        FeedSlot slots[];
+} FeedRing;
+
+/* A process's handle on a feed */
+struct ChainFeed
+{
+        FeedRing *ring;
+        size_t size;
+        int owner;                  // Created the feed, so closing it removes its name
+        char name[FEED_MAX_NAME];   // Shared memory object, empty for an anonymous feed
+};
+
+struct FeedSubscriber
+{
+        ChainFeed *feed;
+        FeedCursor *cursor;
+};
+
+/*
+ * Block tree keyed by hash. head is the genesis block and next links the
+ * active chain, which always ends at the tip with the most cumulative work.
+ */
+struct Blockchain
+{
+        Block *head;
+        Block *tip;
+        int length;
+        size_t block_count;
+        Block **index;
+        size_t index_size;
+        Account **accounts;
+        size_t accounts_size;
+        size_t account_count;
+        ChainConfig config;
+        Block *prune_point;         // Newest pruned block; its hash checkpoints the pruned prefix
+        Block *preferred;           // Tip a tie between equally heavy branches was broken for, until saved
+        size_t payload_bytes;       // Data and transaction bytes resident in the tree
+        ChainLog log;
+        ChainMap *maps;             // One mapping per segment file the chain was loaded from
+        int map_count;
+        long mapped_end;            // Chain offset where the intact records of those files end
+        Block *cache_head;          // Evictable payloads, most recently used first
+        Block *cache_tail;
+        CacheStats cache_stats;
+        Block *log_head;            // All blocks in the order they joined the tree
+        Block *log_tail;
+        Block *unsaved;             // First block in that order not yet in the log
+        Block *dirty;               // Saved blocks that gained transactions since
+        struct SaveJob *save;       // Save being written in the background, NULL if none
+        ChainPool pool;
+        pthread_mutex_t lock;       // Held by every public call on the chain
+        struct ChainReader *readers; // Threads reading without the lock, NULL if none
+        struct ChainView *view;     // Latest view published to them, NULL while there are none
+        Block **view_heights;       // Height list shared by the views since the last reorganisation
+        int view_capacity;
+        unsigned long epoch;        // Advanced once every reader in a read has started in it
+        RetiredBuffer *retired;     // Buffers readers may still hold, oldest first
+        int retired_count;
+        int retired_capacity;
+        ChainFeed *feed;            // Feed blocks and transactions are published into, NULL for none
+        const StateSnapshot *pending_state; // Snapshot a load starts the balances from once it reaches its block
+        Block *state_point;         // Block the balances were started from; it and its ancestors have no undo data
+        int state_height;           // Height of the newest state snapshot written or loaded
+        int state_conflict;         // A branch forking below the state point was refused, or seeding it failed
+};
+
+/*
+ * One segment file of a chain opened for random access. Its footer index
+ * covers the blocks whose record or newest transactions it holds.
+ */
+typedef struct ChainSegment
+{
+        ChainMap map;
+        uint64_t base;              // Chain offset of the file's first byte
+        uint32_t layout_flags;
+        const IndexRecord *index;
+        const IndexEntry *entries;
+        const uint32_t *heights;
+        const uint32_t *slots;
+} ChainSegment;
+
+/* Indexed chain file opened for random access without loading the chain */
+struct ChainFile
+{
+        ChainSegment *segments;     // Oldest first; lookups search newest first
+        int segment_count;
+        ChainPool pool;             // Blocks read from the file
+};
+
+/* Segment file being loaded; loader threads check it and fill in the results */
+typedef struct SegmentLoad
+{
+        char *filename;
+        ChainMap map;
+        size_t end;                 // Offset where its intact records end
+        size_t index_offset;        // Offset of its footer index, 0 if it has none
+        long records;               // Intact records, or the number of the bad one
+        int torn;                   // Ends in a record an interrupted save left unfinished
+        int ok;
+        char last_hash[HASH_SIZE + 1]; // Hash in the newest block record up to its end
+        size_t checked;             // Offset up to which records are checked and may be linked
+        int finished;               // Checking is over and the results above are final
+} SegmentLoad;
+
+/*
+ * Segment files shared out between loader threads. A reader thread faults
+ * the files in ahead of the checkers, the checkers hash records and hand
+ * them on in batches, and the loading thread links them as they come.
+ */
+typedef struct SegmentWork
+{
+        SegmentLoad *loads;
+        int count;
+        int next;                   // Next segment to hand out, taken atomically
+        uint64_t trusted_end;       // Chain offset before which block hashes are trusted, 0 for none
+        int stop;                   // Linking failed; the other stages give up
+        pthread_mutex_t lock;       // Guards the checked, finished and stop fields
+        pthread_cond_t progress;    // Signalled whenever a checker hands on records
+} SegmentWork;
+
+/*
+ * Save written from a snapshot of the blocks that changed, so the chain can
+ * keep growing while a thread writes it. Blocks that already have children
+ * can no longer change and are written in place; the rest are copied.
+ */
+struct SaveJob
+{
+        Blockchain *chain;
+        Block **blocks;             // Blocks to write: the dirty ones first, then the unsaved ones
+        Block **originals;          // Chain blocks they stand for
+        Block *copies;              // Shallow copies of the blocks that could still change
+        int dirty_count;
+        int block_count;
+        int sync_records;           // The chain's log_sync_records when the save started
+        long start;                 // Chain offset the save appends at
+        long end;                   // Chain offset the save ended at
+        char last_hash[HASH_SIZE + 1]; // Log's last_hash to restore if the save fails
+        Block *preferred;           // Tip to record after the blocks, NULL for none
+        char preferred_hash[HASH_SIZE + 1];
+        ActiveHeight *active;       // Heights of the height index the active chain took over since the last save
+        int active_count;
+        RetiredBuffer *retired;
+        int retired_count;
+        int retired_capacity;
+        pthread_t thread;
+        int threaded;               // Written on a thread of its own, to be joined
+        int records_total;
+        int records_written;        // Progress, updated atomically while the save runs
+        int done;                   // Set atomically once the records are written
+        int ok;
+        const char *error;          // What failed, NULL if nothing did
+        int index_failed;           // The records were written but the disk indexes could not be updated
+};
+
+/* Buffered reader handing out the lines of an import file in place */
+typedef struct LineReader
+{
+        FILE *file;
+        char *buffer;               // IMPORT_BUFFER_SIZE bytes plus room for a terminator
+        size_t length;              // Bytes read into the buffer
+        size_t position;            // Start of the next line
+        long line;                  // Number of the line last handed out
+        int csv;                    // Line breaks inside quoted CSV columns do not end a line
+        int eof;
+        int failed;                 // A line did not fit in the buffer, or reading failed
+} LineReader;
+
+/* Import progress carried from one record to the next */
+typedef struct ImportState
+{
+        Block *block;               // Block receiving transactions, NULL until one is opened
+        int batching;               // The block was opened for loose transactions, not by a block record
+        int appended;               // Transactions appended to it since it was last hashed
+        long blocks;
+        long transactions;
+} ImportState;
+
+/* Client connected to the RPC server */
+typedef struct RpcPeer
+{
+        int fd;
+        ByteBuffer input;           // Bytes read; the next request starts at consumed
+        size_t consumed;
+        ByteBuffer output;          // Answers to write; written up to sent
+        size_t sent;
+        uint32_t events;            // Events the peer is registered for
+        int closing;                // The client shut its end; close once its answers are out
+        struct RpcPeer *prev;
+        struct RpcPeer *next;
+} RpcPeer;
+
+/* RPC server running its event loop */
+typedef struct RpcServer
+{
+        Blockchain *chain;
+        const char *filename;       // File RPC_SAVE writes, NULL to refuse it
+        int epoll_fd;
+        RpcPeer *peers;
+        char *text;                 // Scratch for NUL-terminating block data, RPC_MAX_REQUEST + 1 bytes
+        long connections;
+        long requests;
+} RpcServer;
+
+/* Client end of an RPC connection */
+struct RpcConnection
+{
+        int fd;
+        ByteBuffer output;          // Requests queued; written up to sent
+        size_t sent;
+        ByteBuffer input;           // Bytes read; the next answer starts at consumed
+        size_t consumed;
+        char *text;                 // NUL-terminated data of the last block answer
+        size_t text_capacity;
+        Transaction *transactions;  // Transactions of the last RPC_GET_TRANSACTIONS or RPC_GET_BLOCKS answer
+        int transaction_capacity;
+        BlockHeader *headers;       // Headers of the last RPC_GET_HEADERS answer
+        int header_capacity;
+        RpcBlock *blocks;           // Blocks of the last RPC_GET_BLOCKS answer
+        int block_capacity;
+        size_t received;            // Bytes read over the connection's life
+};
+
+/* Block as it travels between simulated nodes, shared by every message carrying it */
+typedef struct SimBlock
+{
+        int refs;                   // Messages and orphan lists holding it; freed at zero
+        Block block;                // Header, data and transactions only; the tree links stay unset
+} SimBlock;
+
+/* Message queued on a simulated link */
+typedef struct SimMessage
+{
+        double deliver_at;          // Simulated time it reaches the receiver
+        unsigned long sequence;     // Keeps messages due at the same time in sending order
+        int type;                   // SIM_* message type
+        int from;                   // Sending node
+        SimBlock *block;            // SIM_BLOCK
+        char hash[HASH_SIZE + 1];   // Block asked for by SIM_GET_BLOCK, or announced by SIM_TIP
+        Transaction transaction;    // SIM_TRANSACTION
+        uint64_t transaction_id;
+} SimMessage;
+
+/* Outgoing side of a link between two simulated nodes */
+typedef struct SimLink
+{
+        int peer;
+        double busy_until;          // Simulated time the link finishes sending what is queued on it
+} SimLink;
+
+/* Open-addressed set of 64-bit keys with an int each; key 0 marks an empty slot */
+typedef struct SimTable
+{
+        uint64_t *keys;
+        int *values;
+        int capacity;               // Power of two
+        int count;
+} SimTable;
+
+/* Block the simulation is following, from the moment it was mined */
+typedef struct SimRecord
+{
+        char hash[HASH_SIZE + 1];
+        double mined_at;
+        double last_at;             // Simulated time the latest node accepted it
+        int reached;                // Nodes that have accepted it, the miner included
+} SimRecord;
+
+struct NetworkSim;
+
+/* One node of the simulated network, running on a thread of its own */
+typedef struct SimNode
+{
+        int id;
+        struct NetworkSim *sim;
+        Blockchain *chain;          // Used only by the node's thread while the simulation runs
+        ChainReader *reader;        // Lets the simulation check the node's tip without waiting on it
+        pthread_t thread;
+        int started;
+        pthread_mutex_t lock;       // Guards the inbox
+        pthread_cond_t wake;        // Signalled when a message that is due sooner arrives
+        SimMessage *inbox;          // Min-heap on deliver_at, then sequence
+        int inbox_count;
+        int inbox_capacity;
+        SimLink *links;
+        int link_count;
+        SimBlock **orphans;         // Blocks waiting for their parent, oldest first
+        int orphan_count;
+        Transaction *pool;          // Transactions waiting for a block
+        int pool_count;
+        SimTable seen;              // Transactions already relayed
+        uint32_t random;
+        double next_block;
+        double next_transaction;
+        double next_announce;
+        int blocks_mined;
+        long transactions_made;
+} SimNode;
+
+/* State shared by the nodes of one simulation */
+typedef struct NetworkSim
+{
+        NetworkConfig config;
+        SimNode *nodes;
+        struct timespec start;
+        int mining;                 // Cleared once the configured duration has passed
+        int stopping;               // Set when the node threads should exit
+        unsigned long sequence;
+        pthread_mutex_t lock;       // Guards the records, their table and the delays
+        SimRecord *records;
+        int record_count;
+        int record_capacity;
+        SimTable record_table;      // Leading bits of a hash -> index in records
+        double *delays;             // Mining to acceptance, one per non-mining node that accepted a block
+        long delay_count;
+        long delay_capacity;
+        double *spells;             // Lengths of the spells of disagreement, kept by the simulation's own thread
+        int spell_count;
+        int spell_capacity;
+        char *tips;                 // Scratch for counting distinct tips, HASH_SIZE + 1 bytes per node
+        long messages_sent;
+        long messages_dropped;
+        long bytes_sent;
+} NetworkSim;
+
+static void initPool(ChainPool *pool);
+static void *poolAlloc(ChainPool *pool, size_t size);
+static void poolFree(ChainPool *pool, void *ptr, size_t size);
+static void releasePool(ChainPool *pool);
+static void getPoolStatsLocked(Blockchain *chain, PoolStats *stats);
+static void displayPoolStatsLocked(Blockchain *chain, FILE *out);
+static void getCacheStatsLocked(Blockchain *chain, CacheStats *stats);
+static void displayCacheStatsLocked(Blockchain *chain, FILE *out);
+static int fetchBlockPayloadLocked(Blockchain *chain, Block *block);
+static Block *createBlock(ChainPool *pool, int index, const char *data, const char *previous_hash);
+static void freeBlock(ChainPool *pool, Block *block);
+static Block *findBlockLocked(Blockchain *chain, const char *hash);
+static Account *getAccount(Blockchain *chain, const char *address, int create);
+static double getBalanceLocked(Blockchain *chain, const char *address);
+static void displayBalancesLocked(Blockchain *chain, FILE *out);
+static Block *getBlockAtHeightLocked(Blockchain *chain, int height);
+static void lockChain(Blockchain *chain);
+static void unlockChain(Blockchain *chain);
+static int acceptBlockLocked(Blockchain *chain, const Block *block);
+static int addBlockLocked(Blockchain *chain, const char *data);
+static void pruneBlockchainLocked(Blockchain *chain);
+static void setPruneTargetLocked(Blockchain *chain, int keep_blocks, size_t keep_bytes);
+static int validateBlockchainLocked(Blockchain *chain);
+static void displayBlockchainLocked(Blockchain *chain, FILE *out);
+static int addTransactionLocked(Blockchain *chain, Block *block, const char *sender, const char *receiver, double amount);
+static int saveBlockchainLocked(Blockchain *chain, const char *filename);
+static SaveJob *saveBlockchainInBackgroundLocked(Blockchain *chain, const char *filename);
+static int waitForSaveLocked(Blockchain *chain);
+static int syncBlockchainLocked(Blockchain *chain);
+static void closeChainLog(Blockchain *chain);
+static int importBlockchainLocked(Blockchain *chain, const char *filename);
+static int exportBlockchainLocked(Blockchain *chain, const char *filename);
+
+/* Receiver of the library's messages, set by the program before it uses the library */
+static ChainMessageCallback message_callback;
+static void *message_context;
+
+/**
+ * Sets where the library's error and progress messages go; without a
+ * callback they are dropped, and the library writes nothing to stdout
+ * @param callback Function given each message, NULL to drop them
+ * @param context Passed through to the callback
+ */
+void setChainMessageCallback(ChainMessageCallback callback, void *context)
+{
+        message_callback = callback;
+        message_context = context;
+}
+
+/**
+ * Formats a message and hands it to the program's callback, if it set one
+ * @param format printf format of the message, without a line break
+ */
+__attribute__((format(printf, 1, 2))) static void reportMessage(const char *format, ...)
+{
+        if (!message_callback)
+                return;
+
+        char message[1024];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        message_callback(message_context, message);
+}
+
+/**
+ * Fills a configuration with the defaults: every payload stays resident
+ * @param config Configuration to initialise
+ */
+void initChainConfig(ChainConfig *config)
+{
+        memset(config, 0, sizeof(ChainConfig));
+        config->checkpoint_key = getenv(CHECKPOINT_KEY_VARIABLE);
+}
+
+/**
+ * Creates a new blockchain with the default configuration
+ * @return Pointer to new blockchain or NULL if creation fails
+ */
+Blockchain *createBlockchain(void)
+{
+        return createBlockchainWithConfig(NULL);
+}
+
+/**
+ * Creates a new blockchain
+ * @param config Configuration to use, NULL for the defaults
+ * @return Pointer to new blockchain or NULL if creation fails
+ */
+Blockchain *createBlockchainWithConfig(const ChainConfig *config)
+{
+        Blockchain *chain = (Blockchain *)malloc(sizeof(Blockchain));
+        if (chain)
+        {
+                memset(chain, 0, sizeof(Blockchain));
+                if (config)
+                        chain->config = *config;
+                else
+                        initChainConfig(&chain->config);
+                initPool(&chain->pool);
+                pthread_mutex_init(&chain->lock, NULL);
+                chain->epoch = 1;
+        }
+        return chain;
+}
+
+/**
+ * Initialises an empty pool; pages are only reserved on first allocation
+ * @param pool Pool to initialise
+ */
+static void initPool(ChainPool *pool)
+{
+        memset(pool, 0, sizeof(ChainPool));
+        pool->next_page_size = POOL_MIN_PAGE_SIZE;
+}
+
+/**
+ * Maps an allocation size to its slab size class
+ * @param size Requested size in bytes (1 to POOL_MAX_CLASS_SIZE)
+ * @param class_size Receives the rounded-up size served by the class
+ * @return Size class index
+ */
+static int poolSizeClass(size_t size, size_t *class_size)
+{
+        // 16-byte steps up to 128 bytes, then four classes per power of two
+        if (size <= POOL_SMALL_CLASS_LIMIT)
+        {
+                int index = (int)((size + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT) - 1;
+                if (index < 0)
+                        index = 0;
+                *class_size = (size_t)(index + 1) * POOL_ALIGNMENT;
+                return index;
+        }
+
+        int shift = 63 - __builtin_clzl((unsigned long)(size - 1));
+        size_t step = (size_t)1 << (shift - 2);
+        int sub = (int)((size - 1 - ((size_t)1 << shift)) / step);
+        *class_size = ((size_t)1 << shift) + step * (sub + 1);
+        return POOL_SMALL_CLASS_LIMIT / POOL_ALIGNMENT + (shift - 7) * 4 + sub;
+}
+
+/**
+ * Carves size bytes from the current page, reserving a new page when it runs out
+ * @param pool Pool to carve from
+ * @param size Bytes to carve, a multiple of POOL_ALIGNMENT
+ * @return Pointer to the carved memory or NULL if a page could not be reserved
+ */
+static void *poolCarve(ChainPool *pool, size_t size)
+{
+        if ((size_t)(pool->limit - pool->cursor) < size)
+        {
+                // Pages grow geometrically so large chains need only a handful
+                size_t header = (sizeof(PoolPage) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+                size_t page_size = pool->next_page_size;
+                // The largest class is as big as the first page, which would leave no room for the header
+                while (page_size < header + size)
+                        page_size *= 2;
+                PoolPage *page = (PoolPage *)malloc(page_size);
+                if (!page)
+                        return NULL;
+
+                page->next = pool->pages;
+                page->size = page_size;
+                pool->pages = page;
+                pool->cursor = (char *)page + header;
+                pool->limit = (char *)page + page_size;
+                if (pool->next_page_size < POOL_MAX_PAGE_SIZE)
+                        pool->next_page_size *= 2;
+
+                pool->stats.page_count++;
+                pool->stats.page_bytes += page_size;
+        }
+
+        void *ptr = pool->cursor;
+        pool->cursor += size;
+        return ptr;
+}
+
+/**
+ * Allocates memory from the pool
+ * @param pool Pool to allocate from
+ * @param size Number of bytes required
+ * @return Pointer to at least size bytes or NULL if allocation fails
+ */
+static void *poolAlloc(ChainPool *pool, size_t size)
+{
+        if (size == 0)
+                size = 1;
+
+        if (size > POOL_MAX_CLASS_SIZE)
+        {
+                size_t header = (sizeof(PoolLarge) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+                PoolLarge *large = (PoolLarge *)malloc(header + size);
+                if (!large)
+                        return NULL;
+
+                large->prev = NULL;
+                large->next = pool->large;
+                large->size = size;
+                if (pool->large)
+                        pool->large->prev = large;
+                pool->large = large;
+
+                pool->stats.large_count++;
+                pool->stats.large_bytes += size;
+                pool->stats.allocations++;
+                return (char *)large + header;
+        }
+
+        size_t class_size;
+        int index = poolSizeClass(size, &class_size);
+        void *ptr = pool->free_lists[index];
+        if (ptr)
+                pool->free_lists[index] = *(void **)ptr;
+        else if (!(ptr = poolCarve(pool, class_size)))
+                return NULL;
+
+        pool->stats.used_bytes += class_size;
+        pool->stats.allocations++;
+        return ptr;
+}
+
+/**
+ * Returns memory to the pool for reuse
+ * @param pool Pool the memory was allocated from
+ * @param ptr Pointer returned by poolAlloc (NULL is ignored)
+ * @param size Size that was passed to poolAlloc
+ */
+static void poolFree(ChainPool *pool, void *ptr, size_t size)
+{
+        if (!ptr)
+                return;
+        if (size == 0)
+                size = 1;
+
+        if (size > POOL_MAX_CLASS_SIZE)
+        {
+                size_t header = (sizeof(PoolLarge) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+                PoolLarge *large = (PoolLarge *)((char *)ptr - header);
+                if (large->prev)
+                        large->prev->next = large->next;
+                else
+                        pool->large = large->next;
+                if (large->next)
+                        large->next->prev = large->prev;
+
+                pool->stats.large_count--;
+                pool->stats.large_bytes -= large->size;
+                pool->stats.frees++;
+                free(large);
+                return;
+        }
+
+        size_t class_size;
+        int index = poolSizeClass(size, &class_size);
+        *(void **)ptr = pool->free_lists[index];
+        pool->free_lists[index] = ptr;
+
+        pool->stats.used_bytes -= class_size;
+        pool->stats.frees++;
+}
+
+/**
+ * Releases every page and large allocation owned by the pool at once
+ * @param pool Pool to release
+ */
+static void releasePool(ChainPool *pool)
+{
+        PoolPage *page = pool->pages;
+        while (page)
+        {
+                PoolPage *temp = page;
+                page = page->next;
+                free(temp);
+        }
+
+        PoolLarge *large = pool->large;
+        while (large)
+        {
+                PoolLarge *temp = large;
+                large = large->next;
+                free(temp);
+        }
+
+        initPool(pool);
+}
+
+/**
+ * Copies the pool statistics of a blockchain
+ * @param chain Pointer to the blockchain
+ * @param stats Receives the statistics
+ */
+static void getPoolStatsLocked(Blockchain *chain, PoolStats *stats)
+{
+        if (!chain || !stats)
+                return;
+        *stats = chain->pool.stats;
+}
+
+/**
+ * Displays the pool statistics of a blockchain
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+static void displayPoolStatsLocked(Blockchain *chain, FILE *out)
+{
+        PoolStats stats;
+
+        if (!chain)
+                return;
+
+        getPoolStatsLocked(chain, &stats);
+        fprintf(out, "\nMemory Pool Statistics:\n");
+        fprintf(out, "Pages: %zu (%zu bytes reserved)\n", stats.page_count, stats.page_bytes);
+        fprintf(out, "In use: %zu bytes\n", stats.used_bytes);
+        fprintf(out, "Large allocations: %zu (%zu bytes)\n", stats.large_count, stats.large_bytes);
+        fprintf(out, "Allocations: %zu, Frees: %zu\n", stats.allocations, stats.frees);
+}
+
+/**
+ * Copies the payload cache statistics of a blockchain
+ * @param chain Pointer to the blockchain
+ * @param stats Receives the statistics
+ */
+static void getCacheStatsLocked(Blockchain *chain, CacheStats *stats)
+{
+        if (!chain || !stats)
+                return;
+        *stats = chain->cache_stats;
+}
+
+/**
+ * Displays the payload cache statistics of a blockchain
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+static void displayCacheStatsLocked(Blockchain *chain, FILE *out)
+{
+        CacheStats stats;
+
+        if (!chain)
+                return;
+
+        fprintf(out, "\nPayload Cache Statistics:\n");
+        if (chain->config.cache_bytes == 0)
+        {
+                fprintf(out, "Cache: off, every payload stays resident\n");
+                return;
+        }
+
+        getCacheStatsLocked(chain, &stats);
+        size_t lookups = stats.hits + stats.misses;
+        fprintf(out, "Budget: %zu bytes, Resident: %zu bytes\n", chain->config.cache_bytes, chain->payload_bytes);
+        fprintf(out, "Hits: %zu, Misses: %zu (%.1f%% hit rate)\n", stats.hits, stats.misses,
+                lookups ? 100.0 * stats.hits / lookups : 0.0);
+        fprintf(out, "Evictions: %zu\n", stats.evictions);
+}
+
+/**
+ * Calculates SHA-256 hash for a block including transaction data
+ * @param block Block to be hashed
+ * @param output Buffer to store the resulting hash
+ */
+void calculateHash(Block *block, char *output)
+{
+        char header[HEADER_STR_SIZE];
+        char trans_str[TRANS_STR_SIZE];
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256_CTX sha256;
+        int len;
+
+        // Stream the same "%d%ld%s%s%s" sequence the fixed-size input buffer
+        // used to hold, so data and transaction lists of any length are covered
+        SHA256_Init(&sha256);
+
+        len = snprintf(header, sizeof(header), "%d%ld", block->index, block->timestamp);
+        SHA256_Update(&sha256, header, len);
+        SHA256_Update(&sha256, block->data, block->data_length);
+        SHA256_Update(&sha256, block->previous_hash, strlen(block->previous_hash));
+
+        for (int i = 0; i < block->transaction_count; i++)
+        {
+                len = snprintf(trans_str, TRANS_STR_SIZE, "%s%s%.2f",
+                               block->transactions[i].sender,
+                               block->transactions[i].receiver,
+                               block->transactions[i].amount);
+                if (len >= TRANS_STR_SIZE)
+                        len = TRANS_STR_SIZE - 1;
+                SHA256_Update(&sha256, trans_str, len);
+        }
+
+        SHA256_Final(hash, &sha256);
+
+        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+        {
+                sprintf(output + (i * 2), "%02x", hash[i]);
+        }
+        output[HASH_SIZE] = '\0';
+}
+
+/**
+ * Creates a new block
+ * @param pool Pool to allocate the block from
+ * @param index Block index
+ * @param data Block data
+ * @param previous_hash Hash of previous block
+ * @return Pointer to new block or NULL if creation fails
+ */
+static Block *createBlock(ChainPool *pool, int index, const char *data, const char *previous_hash)
+{
+        size_t data_length = strlen(data);
+        if (data_length > MAX_BLOCK_DATA_SIZE)
+                return NULL;
+
+        Block *block = (Block *)poolAlloc(pool, sizeof(Block));
+        if (!block)
+                return NULL;
+
+        // Payload is allocated to its exact length
+        block->data = (char *)poolAlloc(pool, data_length + 1);
+        if (!block->data)
+        {
+                poolFree(pool, block, sizeof(Block));
+                return NULL;
+        }
+        memcpy(block->data, data, data_length + 1);
+        block->data_length = (int)data_length;
+
+        block->index = index;
+        block->timestamp = time(NULL);
+        block->transactions = NULL;
+        block->transaction_count = 0;
+        block->transaction_capacity = 0;
+        strncpy(block->previous_hash, previous_hash, HASH_SIZE);
+        block->previous_hash[HASH_SIZE] = '\0';
+        block->next = NULL;
+        block->parent = NULL;
+        block->skip = NULL;
+        block->hash_next = NULL;
+        block->undo = NULL;
+        block->chain_work = 0;
+        block->log_next = NULL;
+        block->dirty_next = NULL;
+        block->file_offset = 0;
+        block->amend_offset = 0;
+        block->pending_offset = 0;
+        block->child_count = 0;
+        block->saved_transaction_count = 0;
+        block->flags = 0;
+
+        calculateHash(block, block->hash);
+        return block;
+}
+
+/**
+ * Frees a block's data and transactions, leaving anything that lives in the file mapping alone
+ * @param pool Pool the block was allocated from
+ * @param block Block whose payload is freed
+ */
+static void freePayload(ChainPool *pool, Block *block)
+{
+        if (block->data && !(block->flags & BLOCK_MAPPED_DATA))
+                poolFree(pool, block->data, block->data_length + 1);
+        if (!(block->flags & BLOCK_MAPPED_TRANSACTIONS))
+                poolFree(pool, block->transactions, block->transaction_capacity * sizeof(Transaction));
+        block->flags &= ~(BLOCK_MAPPED_DATA | BLOCK_MAPPED_TRANSACTIONS);
+}
+
+/**
+ * Returns a block together with its data and transactions to the pool
+ * @param pool Pool the block was allocated from
+ * @param block Block to free
+ */
+static void freeBlock(ChainPool *pool, Block *block)
+{
+        if (!block)
+                return;
+
+        freePayload(pool, block);
+        poolFree(pool, block, sizeof(Block));
+}
+
+/**
+ * Hashes a string key for the block index and account table
+ * @param key NUL-terminated key
+ * @return FNV-1a hash of the key
+ */
+static size_t hashKey(const char *key)
+{
+        size_t hash = 14695981039346656037ULL;
+        while (*key)
+        {
+                hash ^= (unsigned char)*key++;
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+/**
+ * Looks up a block anywhere in the block tree
+ * @param chain Pointer to the blockchain
+ * @param hash Hash of the block
+ * @return Matching block or NULL if unknown
+ */
+static Block *findBlockLocked(Blockchain *chain, const char *hash)
+{
+        if (!chain || !chain->index)
+                return NULL;
+
+        Block *block = chain->index[hashKey(hash) & (chain->index_size - 1)];
+        while (block && strcmp(block->hash, hash) != 0)
+                block = block->hash_next;
+        return block;
+}
+
+/**
+ * Inserts a block into the hash index, doubling the bucket array when it fills up
+ * @param chain Pointer to the blockchain
+ * @param block Block to index
+ * @return 1 if successful, 0 if failed
+ */
+static int indexBlock(Blockchain *chain, Block *block)
+{
+        if (chain->block_count >= chain->index_size * 3 / 4)
+        {
+                size_t size = chain->index_size ? chain->index_size * 2 : INDEX_MIN_BUCKETS;
+                Block **buckets = (Block **)poolAlloc(&chain->pool, size * sizeof(Block *));
+                if (buckets)
+                {
+                        memset(buckets, 0, size * sizeof(Block *));
+                        for (size_t i = 0; i < chain->index_size; i++)
+                        {
+                                Block *current = chain->index[i];
+                                while (current)
+                                {
+                                        Block *temp = current;
+                                        current = current->hash_next;
+                                        size_t slot = hashKey(temp->hash) & (size - 1);
+                                        temp->hash_next = buckets[slot];
+                                        buckets[slot] = temp;
+                                }
+                        }
+                        poolFree(&chain->pool, chain->index, chain->index_size * sizeof(Block *));
+                        chain->index = buckets;
+                        chain->index_size = size;
+                }
+                else if (!chain->index)
+                {
+                        return 0;
+                }
+        }
+
+        size_t slot = hashKey(block->hash) & (chain->index_size - 1);
+        block->hash_next = chain->index[slot];
+        chain->index[slot] = block;
+        chain->block_count++;
+        return 1;
+}
+
+/**
+ * Removes a block from the hash index
+ * @param chain Pointer to the blockchain
+ * @param block Block to remove
+ */
+static void unindexBlock(Blockchain *chain, Block *block)
+{
+        Block **link = &chain->index[hashKey(block->hash) & (chain->index_size - 1)];
+        while (*link && *link != block)
+                link = &(*link)->hash_next;
+        if (*link)
+        {
+                *link = block->hash_next;
+                block->hash_next = NULL;
+                chain->block_count--;
+        }
+}
+
+/**
+ * Looks up the account state of an address
+ * @param chain Pointer to the blockchain
+ * @param address Account address
+ * @param create Create a zero-balance account if the address is unknown
+ * @return Matching account or NULL if unknown or allocation fails
+ */
+static Account *getAccount(Blockchain *chain, const char *address, int create)
+{
+        if (!chain)
+                return NULL;
+
+        if (chain->accounts)
+        {
+                Account *account = chain->accounts[hashKey(address) & (chain->accounts_size - 1)];
+                while (account && strcmp(account->address, address) != 0)
+                        account = account->next;
+                if (account || !create)
+                        return account;
+        }
+        else if (!create)
+        {
+                return NULL;
+        }
+
+        if (chain->account_count >= chain->accounts_size * 3 / 4)
+        {
+                size_t size = chain->accounts_size ? chain->accounts_size * 2 : STATE_MIN_BUCKETS;
+                Account **buckets = (Account **)poolAlloc(&chain->pool, size * sizeof(Account *));
+                if (!buckets)
+                        return NULL;
+
+                memset(buckets, 0, size * sizeof(Account *));
+                for (size_t i = 0; i < chain->accounts_size; i++)
+                {
+                        Account *current = chain->accounts[i];
+                        while (current)
+                        {
+                                Account *temp = current;
+                                current = current->next;
+                                size_t slot = hashKey(temp->address) & (size - 1);
+                                temp->next = buckets[slot];
+                                buckets[slot] = temp;
+                        }
+                }
+                poolFree(&chain->pool, chain->accounts, chain->accounts_size * sizeof(Account *));
+                chain->accounts = buckets;
+                chain->accounts_size = size;
+        }
+
+        Account *account = (Account *)poolAlloc(&chain->pool, sizeof(Account));
+        if (!account)
+                return NULL;
+
+        strncpy(account->address, address, MAX_SENDER_SIZE - 1);
+        account->address[MAX_SENDER_SIZE - 1] = '\0';
+        account->balance = 0.0;
+
+        size_t slot = hashKey(account->address) & (chain->accounts_size - 1);
+        account->next = chain->accounts[slot];
+        chain->accounts[slot] = account;
+        chain->account_count++;
+        return account;
+}
+
+/**
+ * Gets the balance of an address on the active chain
+ * @param chain Pointer to the blockchain
+ * @param address Account address
+ * @return Balance, 0 for unknown addresses
+ */
+static double getBalanceLocked(Blockchain *chain, const char *address)
+{
+        Account *account = getAccount(chain, address, 0);
+        return account ? account->balance : 0.0;
+}
+
+/**
+ * Displays the balance of every account on the active chain
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+static void displayBalancesLocked(Blockchain *chain, FILE *out)
+{
+        if (!chain || chain->account_count == 0)
+        {
+                fprintf(out, "No accounts yet\n");
+                return;
+        }
+
+        fprintf(out, "\nAccount Balances:\n");
+        for (size_t i = 0; i < chain->accounts_size; i++)
+        {
+                for (Account *account = chain->accounts[i]; account; account = account->next)
+                {
+                        fprintf(out, "  %s: %.2f\n", account->address, account->balance);
+                }
+        }
+}
+
+/**
+ * Makes room for more undo entries in a block's undo record
+ * @param chain Pointer to the blockchain
+ * @param block Block being applied
+ * @param needed Number of entries that must fit
+ * @return 1 if successful, 0 if failed
+ */
+static int reserveUndo(Blockchain *chain, Block *block, int needed)
+{
+        BlockUndo *undo = block->undo;
+        if (undo && undo->count + needed <= undo->capacity)
+                return 1;
+
+        // Sized exactly for a whole block, grown geometrically for the open tip
+        int capacity = needed;
+        if (undo)
+        {
+                capacity = undo->capacity * 2;
+                if (capacity < UNDO_MIN_CAPACITY)
+                        capacity = UNDO_MIN_CAPACITY;
+                while (capacity < undo->count + needed)
+                        capacity *= 2;
+        }
+
+        BlockUndo *grown = (BlockUndo *)poolAlloc(&chain->pool, sizeof(BlockUndo) + capacity * sizeof(UndoEntry));
+        if (!grown)
+                return 0;
+
+        grown->count = 0;
+        grown->capacity = capacity;
+        if (undo)
+        {
+                grown->count = undo->count;
+                memcpy(grown->entries, undo->entries, undo->count * sizeof(UndoEntry));
+                poolFree(&chain->pool, undo, sizeof(BlockUndo) + undo->capacity * sizeof(UndoEntry));
+        }
+        block->undo = grown;
+        return 1;
+}
+
+/**
+ * Restores the balances recorded in a block's undo record back to a given length
+ * @param block Block whose changes are reverted
+ * @param count Number of undo entries to keep
+ */
+static void rewindUndo(Block *block, int count)
+{
+        BlockUndo *undo = block->undo;
+        while (undo->count > count)
+        {
+                undo->count--;
+                undo->entries[undo->count].account->balance = undo->entries[undo->count].previous_balance;
+        }
+}
+
+/**
+ * Applies a transaction of an active block to the account state
+ * @param chain Pointer to the blockchain
+ * @param block Active block containing the transaction
+ * @param trans Transaction to apply
+ * @return 1 if successful, 0 if failed
+ */
+static int applyTransaction(Blockchain *chain, Block *block, const Transaction *trans)
+{
+        if (!reserveUndo(chain, block, 2))
+                return 0;
+
+        Account *sender = getAccount(chain, trans->sender, 1);
+        Account *receiver = getAccount(chain, trans->receiver, 1);
+        if (!sender || !receiver)
+                return 0;
+
+        BlockUndo *undo = block->undo;
+        undo->entries[undo->count].account = sender;
+        undo->entries[undo->count].previous_balance = sender->balance;
+        undo->count++;
+        sender->balance -= trans->amount;
+
+        undo->entries[undo->count].account = receiver;
+        undo->entries[undo->count].previous_balance = receiver->balance;
+        undo->count++;
+        receiver->balance += trans->amount;
+        return 1;
+}
+
+/**
+ * Starts the balances of a chain being loaded from its state snapshot when the
+ * block after the snapshot's joins the active chain. Blocks linked before
+ * then left the balances alone.
+ * @param chain Chain being loaded
+ * @param block Block joining the active chain
+ * @return 1 if the balances now stand at the block's parent, 0 if the snapshot's block is not reached yet
+ */
+static int seedStateSnapshot(Blockchain *chain, Block *block)
+{
+        const StateSnapshot *state = chain->pending_state;
+        Block *parent = block->parent;
+        if (!parent || parent->index != state->header.height || strcmp(parent->hash, state->header.hash) != 0)
+                return 0;
+
+        chain->pending_state = NULL;
+        for (uint64_t i = 0; i < state->header.account_count; i++)
+        {
+                Account *account = getAccount(chain, state->entries[i].address, 1);
+                if (!account)
+                {
+                        // The load starts over and applies every block instead
+                        chain->state_conflict = 1;
+                        return 0;
+                }
+                account->balance = state->entries[i].balance;
+        }
+        chain->state_point = parent;
+        chain->state_height = parent->index;
+        return 1;
+}
+
+/**
+ * Applies every transaction of a block to the account state, recording undo data
+ * @param chain Pointer to the blockchain
+ * @param block Block joining the active chain
+ * @return 1 if successful, 0 if failed (the state is left unchanged)
+ */
+static int applyBlock(Blockchain *chain, Block *block)
+{
+        // Until a load reaches its state snapshot's block, the snapshot stands in for the balances
+        if (chain->pending_state && !seedStateSnapshot(chain, block))
+                return 1;
+
+        if (!reserveUndo(chain, block, block->transaction_count * 2))
+                return 0;
+
+        for (int i = 0; i < block->transaction_count; i++)
+        {
+                if (!applyTransaction(chain, block, &block->transactions[i]))
+                {
+                        rewindUndo(block, 0);
+                        poolFree(&chain->pool, block->undo,
+                                 sizeof(BlockUndo) + block->undo->capacity * sizeof(UndoEntry));
+                        block->undo = NULL;
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/**
+ * Reverts a block's changes to the account state using its undo record
+ * @param chain Pointer to the blockchain
+ * @param block Block leaving the active chain
+ */
+static void revertBlock(Blockchain *chain, Block *block)
+{
+        if (!block->undo)
+                return;
+
+        rewindUndo(block, 0);
+        poolFree(&chain->pool, block->undo, sizeof(BlockUndo) + block->undo->capacity * sizeof(UndoEntry));
+        block->undo = NULL;
+}
+
+/**
+ * Amount of work a block contributes to its branch
+ * @param block Block to weigh
+ * @return Work of the block
+ */
+unsigned long long blockWork(const Block *block)
+{
+        // Blocks carry no difficulty target, so every block weighs the same and
+        // the heaviest branch is the longest one
+        (void)block;
+        return 1;
+}
+
+/**
+ * Clears the lowest set bit of a number
+ * @param n Number to modify
+ * @return n without its lowest set bit
+ */
+static int clearLowestBit(int n)
+{
+        return n & (n - 1);
+}
+
+/**
+ * Height the skip pointer of a block at the given height points to. Heights
+ * are spread so that any ancestor is reachable in O(log n) jumps.
+ * @param height Height of the block
+ * @return Height of the skip target
+ */
+static int getSkipHeight(int height)
+{
+        if (height < 2)
+                return 0;
+
+        // Clearing the lowest set bit gives power-of-two sized jumps; odd heights
+        // clear two bits of height - 1 so neighbouring jumps do not overlap
+        return (height & 1) ? clearLowestBit(clearLowestBit(height - 1)) + 1
+                            : clearLowestBit(height);
+}
+
+/**
+ * Finds the ancestor of a block at the given height using skip pointers
+ * @param block Block to start from
+ * @param height Height of the wanted ancestor
+ * @return Ancestor at that height, or NULL if height is out of range
+ */
+Block *getAncestor(Block *block, int height)
+{
+        if (!block || height > block->index || height < 0)
+                return NULL;
+
+        Block *walk = block;
+        int walk_height = block->index;
+        while (walk_height > height)
+        {
+                int skip_height = getSkipHeight(walk_height);
+                int skip_height_prev = getSkipHeight(walk_height - 1);
+                if (walk->skip &&
+                    (skip_height == height ||
+                     (skip_height > height && !(skip_height_prev < skip_height - 2 && skip_height_prev >= height))))
+                {
+                        // Take the long jump unless the parent's jump lands closer
+                        walk = walk->skip;
+                        walk_height = skip_height;
+                }
+                else
+                {
+                        walk = walk->parent;
+                        walk_height--;
+                }
+        }
+        return walk;
+}
+
+/**
+ * Finds the last block shared by the branches ending at two blocks
+ * @param a First branch tip
+ * @param b Second branch tip
+ * @return Fork point of the two branches, NULL if they share no block
+ */
+Block *findCommonAncestor(Block *a, Block *b)
+{
+        if (!a || !b)
+                return NULL;
+
+        if (a->index > b->index)
+                a = getAncestor(a, b->index);
+        else if (b->index > a->index)
+                b = getAncestor(b, a->index);
+
+        // Both walks sit at the same height, so their skip targets share a height too
+        while (a && b && a != b)
+        {
+                if (a->skip != b->skip)
+                {
+                        a = a->skip;
+                        b = b->skip;
+                }
+                else
+                {
+                        a = a->parent;
+                        b = b->parent;
+                }
+        }
+        return a == b ? a : NULL;
+}
+
+/**
+ * Finds the block at a height on the active chain
+ * @param chain Pointer to the blockchain
+ * @param height Height of the block
+ * @return Block at that height or NULL if out of range
+ */
+static Block *getBlockAtHeightLocked(Blockchain *chain, int height)
+{
+        if (!chain)
+                return NULL;
+        return getAncestor(chain->tip, height);
+}
+
+/**
+ * Switches the active chain to a heavier branch, reverting and applying only
+ * the blocks after the fork point
+ * @param chain Pointer to the blockchain
+ * @param new_tip Tip of the branch to activate
+ * @return 1 if successful, 0 if failed (the previous branch stays active)
+ */
+static int reorganizeChain(Blockchain *chain, Block *new_tip)
+{
+        Block *old_tip = chain->tip;
+        Block *fork = findCommonAncestor(old_tip, new_tip);
+        if (!fork)
+                return 0;
+
+        // Unwind the old branch down to the fork point
+        for (Block *current = old_tip; current != fork; current = current->parent)
+        {
+                revertBlock(chain, current);
+                current->next = NULL;
+        }
+
+        // Link the new branch into the active chain, then apply it forwards
+        for (Block *current = new_tip; current != fork; current = current->parent)
+                current->parent->next = current;
+        new_tip->next = NULL;
+
+        for (Block *current = fork->next; current; current = current->next)
+        {
+                if (fetchBlockPayloadLocked(chain, current) && applyBlock(chain, current))
+                        continue;
+
+                // Roll back to the branch we started from
+                for (Block *undo = current->parent; undo != fork; undo = undo->parent)
+                        revertBlock(chain, undo);
+                for (Block *undo = new_tip; undo != fork; undo = undo->parent)
+                        undo->next = NULL;
+                fork->next = NULL;
+                for (Block *redo = old_tip; redo != fork; redo = redo->parent)
+                        redo->parent->next = redo;
+                for (Block *redo = fork->next; redo; redo = redo->next)
+                {
+                        if (fetchBlockPayloadLocked(chain, redo))
+                                applyBlock(chain, redo);
+                }
+                return 0;
+        }
+
+        chain->tip = new_tip;
+        chain->length = new_tip->index + 1;
+        return 1;
+}
+
+/*
+ * Lock-free readers. The writer, holding the chain's lock, publishes an
+ * immutable ChainView after each change; readers pin it by announcing the
+ * epoch they started in. Anything a reader could still reach is retired
+ * rather than freed, and returned to the pool two epochs later, once every
+ * reader that might hold it has finished.
+ */
+
+/**
+ * Frees a pool buffer once no reader can still be reading it
+ * @param chain Pointer to the blockchain
+ * @param data Buffer, already unlinked from everything readers can reach
+ * @param size Size it was allocated with
+ */
+static void deferFree(Blockchain *chain, void *data, size_t size)
+{
+        if (!data)
+                return;
+        if (!chain->readers)
+        {
+                poolFree(&chain->pool, data, size);
+                return;
+        }
+
+        if (chain->retired_count == chain->retired_capacity)
+        {
+                int capacity = chain->retired_capacity ? chain->retired_capacity * 2 : 8;
+                RetiredBuffer *grown = (RetiredBuffer *)realloc(chain->retired, capacity * sizeof(RetiredBuffer));
+
+                // Leaking the buffer is the only safe choice while a reader may hold it
+                if (!grown)
+                        return;
+                chain->retired = grown;
+                chain->retired_capacity = capacity;
+        }
+        chain->retired[chain->retired_count].data = data;
+        chain->retired[chain->retired_count].size = size;
+        chain->retired[chain->retired_count].epoch = chain->epoch;
+        chain->retired_count++;
+}
+
+/**
+ * Advances the epoch if every reader in a read started in the current one,
+ * then frees the buffers retired two or more epochs ago
+ * @param chain Pointer to the blockchain
+ */
+static void reclaimRetired(Blockchain *chain)
+{
+        unsigned long epoch = chain->epoch;
+        int advance = 1;
+
+        for (ChainReader *reader = chain->readers; reader && advance; reader = reader->next)
+        {
+                unsigned long active = __atomic_load_n(&reader->active, __ATOMIC_SEQ_CST);
+                advance = !active || active == epoch;
+        }
+        if (advance)
+                __atomic_store_n(&chain->epoch, ++epoch, __ATOMIC_SEQ_CST);
+
+        // Retired buffers are in epoch order, so the ones that can go are at the front
+        int freed = 0;
+        while (freed < chain->retired_count && chain->retired[freed].epoch + 2 <= epoch)
+        {
+                poolFree(&chain->pool, chain->retired[freed].data, chain->retired[freed].size);
+                freed++;
+        }
+        if (freed > 0)
+        {
+                chain->retired_count -= freed;
+                memmove(chain->retired, chain->retired + freed, chain->retired_count * sizeof(RetiredBuffer));
+        }
+}
+
+/**
+ * Waits until every read that started before now has finished, for the rare
+ * change that cannot be deferred, such as unmapping a file
+ * @param chain Pointer to the blockchain
+ */
+static void waitForReaders(Blockchain *chain)
+{
+        if (!chain->readers)
+                return;
+
+        unsigned long epoch = chain->epoch + 1;
+        __atomic_store_n(&chain->epoch, epoch, __ATOMIC_SEQ_CST);
+        for (ChainReader *reader = chain->readers; reader; reader = reader->next)
+        {
+                unsigned long active;
+                while ((active = __atomic_load_n(&reader->active, __ATOMIC_SEQ_CST)) != 0 && active < epoch)
+                        sched_yield();
+        }
+}
+
+/**
+ * Publishes the active chain as a new view for lock-free readers, if it changed since the last one
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if out of memory (readers keep the previous view)
+ */
+static int publishView(Blockchain *chain)
+{
+        ChainView *old = chain->view;
+        Block *tip = chain->tip;
+
+        // Only a new tip or transactions added to it change what readers see
+        if (!chain->readers || (old && old->tip == tip && (!tip || old->tip_transaction_count == tip->transaction_count)))
+                return 1;
+        int length = tip ? chain->length : 0;
+
+        // Slots below start stay valid; an extension of the last view keeps its list and fills in the rest
+        int start = 0;
+        if (old && old->tip && tip)
+        {
+                Block *fork = findCommonAncestor(old->tip, tip);
+                start = fork ? fork->index + 1 : 0;
+        }
+
+        ChainView *view = (ChainView *)poolAlloc(&chain->pool, sizeof(ChainView));
+        if (!view)
+                return 0;
+
+        // Views still being read may share the list, so a reorganisation copies it rather than overwrite their slots
+        if ((old && start < old->length) || length > chain->view_capacity)
+        {
+                int capacity = chain->view_capacity ? chain->view_capacity : VIEW_MIN_CAPACITY;
+                while (capacity < length)
+                        capacity *= 2;
+                Block **heights = (Block **)poolAlloc(&chain->pool, capacity * sizeof(Block *));
+                if (!heights)
+                {
+                        poolFree(&chain->pool, view, sizeof(ChainView));
+                        return 0;
+                }
+                if (start > 0)
+                        memcpy(heights, chain->view_heights, start * sizeof(Block *));
+                deferFree(chain, chain->view_heights, chain->view_capacity * sizeof(Block *));
+                chain->view_heights = heights;
+                chain->view_capacity = capacity;
+        }
+        for (Block *current = tip; current && current->index >= start; current = current->parent)
+                chain->view_heights[current->index] = current;
+
+        view->length = length;
+        view->heights = chain->view_heights;
+        view->tip = tip;
+        view->tip_transaction_count = tip ? tip->transaction_count : 0;
+        if (tip)
+                memcpy(view->tip_hash, tip->hash, HASH_SIZE + 1);
+        else
+                view->tip_hash[0] = '\0';
+
+        __atomic_store_n(&chain->view, view, __ATOMIC_SEQ_CST);
+        if (old)
+                deferFree(chain, old, sizeof(ChainView));
+        return 1;
+}
+
+/**
+ * Registers a reader and publishes a first view for it if it is the only one
+ * @param chain Pointer to the blockchain
+ * @param reader Reader to register
+ * @return 1 if successful, 0 if out of memory
+ */
+static int addReaderLocked(Blockchain *chain, ChainReader *reader)
+{
+        reader->next = chain->readers;
+        chain->readers = reader;
+        if (chain->view)
+                return 1;
+
+        if (!publishView(chain))
+        {
+                chain->readers = reader->next;
+                return 0;
+        }
+        return 1;
+}
+
+/**
+ * Unregisters a reader, releasing the views and retired buffers once the last one goes
+ * @param chain Pointer to the blockchain
+ * @param reader Reader to unregister, not in a read
+ */
+static void removeReaderLocked(Blockchain *chain, ChainReader *reader)
+{
+        ChainReader **link = &chain->readers;
+        while (*link && *link != reader)
+                link = &(*link)->next;
+        if (*link)
+                *link = reader->next;
+        if (chain->readers)
+                return;
+
+        for (int i = 0; i < chain->retired_count; i++)
+                poolFree(&chain->pool, chain->retired[i].data, chain->retired[i].size);
+        chain->retired_count = 0;
+        poolFree(&chain->pool, chain->view, sizeof(ChainView));
+        poolFree(&chain->pool, chain->view_heights, chain->view_capacity * sizeof(Block *));
+        chain->view = NULL;
+        chain->view_heights = NULL;
+        chain->view_capacity = 0;
+}
+
+/**
+ * Starts a lock-free read, pinning the chain's latest view until endChainRead
+ * @param reader Reader of the chain, not already in a read
+ * @return The view, unchanged for the whole read
+ */
+const ChainView *beginChainRead(ChainReader *reader)
+{
+        Blockchain *chain = reader->chain;
+
+        // The epoch is announced before the view is loaded, so the writer cannot free a view it missed
+        __atomic_store_n(&reader->active, __atomic_load_n(&chain->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+        return __atomic_load_n(&chain->view, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Ends a lock-free read; nothing from its view may be used afterwards
+ * @param reader Reader in a read
+ */
+void endChainRead(ChainReader *reader)
+{
+        __atomic_store_n(&reader->active, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Counts the blocks on a view
+ * @param view View pinned by a read
+ * @return Number of blocks, genesis included
+ */
+int getViewLength(const ChainView *view)
+{
+        return view ? view->length : 0;
+}
+
+/**
+ * Copies the header of the block at a height on a view
+ * @param view View pinned by a read
+ * @param height Height to look up
+ * @param header Receives the header
+ * @return 1 if successful, 0 if the view is shorter
+ */
+int getViewHeader(const ChainView *view, int height, BlockHeader *header)
+{
+        if (!view || height < 0 || height >= view->length)
+                return 0;
+
+        // Only the tip can still change, and the view carries its own copy of what can
+        const Block *block = view->heights[height];
+        int is_tip = height == view->length - 1;
+        header->index = block->index;
+        header->timestamp = block->timestamp;
+        header->data_length = block->data_length;
+        header->transaction_count = is_tip ? view->tip_transaction_count : block->transaction_count;
+        memcpy(header->previous_hash, block->previous_hash, HASH_SIZE + 1);
+        memcpy(header->hash, is_tip ? view->tip_hash : block->hash, HASH_SIZE + 1);
+        return 1;
+}
+
+/**
+ * Reads the data of the block at a height on a view
+ * @param view View pinned by a read
+ * @param height Height to look up
+ * @return The data, valid until the read ends, or NULL if the view is shorter or the payload is not resident
+ */
+const char *getViewData(const ChainView *view, int height)
+{
+        if (!view || height < 0 || height >= view->length)
+                return NULL;
+        return __atomic_load_n(&view->heights[height]->data, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Reads the transactions of the block at a height on a view
+ * @param view View pinned by a read
+ * @param height Height to look up
+ * @param count Receives the number of transactions
+ * @return The transactions, valid until the read ends, or NULL if there are none or the payload is not resident
+ */
+const Transaction *getViewTransactions(const ChainView *view, int height, int *count)
+{
+        *count = 0;
+        if (!view || height < 0 || height >= view->length)
+                return NULL;
+
+        const Block *block = view->heights[height];
+        Transaction *transactions = __atomic_load_n(&block->transactions, __ATOMIC_ACQUIRE);
+        if (transactions)
+                *count = height == view->length - 1 ? view->tip_transaction_count : block->transaction_count;
+        return transactions;
+}
+
+/**
+ * Sleeps until a futex word is woken or no longer holds a value
+ * @param word Futex word, possibly in shared memory
+ * @param value Value the caller saw in it
+ * @param timeout_ms Longest to sleep, negative for no limit
+ */
+static void futexWait(uint32_t *word, uint32_t value, int timeout_ms)
+{
+        struct timespec timeout;
+
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        syscall(SYS_futex, word, FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+/**
+ * Wakes every thread, in any process, sleeping on a futex word
+ * @param word Futex word
+ */
+static void futexWake(uint32_t *word)
+{
+        syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Reads the monotonic clock feed events are stamped with
+ * @return Nanoseconds since an arbitrary point shared by every process
+ */
+static int64_t feedNow(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Bytes a feed's mapping takes
+ * @param capacity Slots in its ring
+ * @return Mapping size
+ */
+static size_t feedSize(uint32_t capacity)
+{
+        return sizeof(FeedRing) + (size_t)capacity * sizeof(FeedSlot);
+}
+
+/**
+ * Checks whether the process that took a cursor still runs
+ * @param cursor Cursor to check
+ * @return 1 if it runs or cannot be checked, 0 if it is gone
+ */
+static int feedSubscriberAlive(const FeedCursor *cursor)
+{
+        pid_t pid = (pid_t)__atomic_load_n(&cursor->pid, __ATOMIC_RELAXED);
+        return pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/**
+ * Creates a feed for a chain to publish into
+ * @param name Shared memory name other processes open it by, NULL for a feed private to this process
+ * @param capacity Events the ring holds, rounded up to a power of two, 0 for the default
+ * @return The feed, or NULL if it could not be created
+ */
+ChainFeed *createChainFeed(const char *name, int capacity)
+{
+        uint32_t slots = 1;
+
+        if (capacity < 0 || capacity > FEED_MAX_CAPACITY || (name && strlen(name) + 2 > FEED_MAX_NAME))
+        {
+                reportMessage("Error: Invalid feed settings");
+                return NULL;
+        }
+        while (slots < (uint32_t)(capacity > 0 ? capacity : FEED_DEFAULT_CAPACITY))
+                slots <<= 1;
+
+        ChainFeed *feed = (ChainFeed *)calloc(1, sizeof(ChainFeed));
+        if (!feed)
+                return NULL;
+        feed->size = feedSize(slots);
+        feed->owner = 1;
+
+        int fd = -1;
+        if (name)
+        {
+                // Shared memory names start with a slash; a feed left by a process that died is replaced
+                snprintf(feed->name, FEED_MAX_NAME, "%s%s", name[0] == '/' ? "" : "/", name);
+                shm_unlink(feed->name);
+                fd = shm_open(feed->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+                if (fd < 0 || ftruncate(fd, (off_t)feed->size) != 0)
+                {
+                        reportMessage("Error: Could not create feed %s", feed->name);
+                        if (fd >= 0)
+                        {
+                                close(fd);
+                                shm_unlink(feed->name);
+                        }
+                        free(feed);
+                        return NULL;
+                }
+        }
+
+        void *base = mmap(NULL, feed->size, PROT_READ | PROT_WRITE, MAP_SHARED | (fd < 0 ? MAP_ANONYMOUS : 0), fd,
+                          0);
+        if (fd >= 0)
+                close(fd);
+        if (base == MAP_FAILED)
+        {
+                reportMessage("Error: Could not map feed %s", feed->name);
+                if (feed->name[0])
+                        shm_unlink(feed->name);
+                free(feed);
+                return NULL;
+        }
+
+        // A new mapping is zeroed, which leaves every cursor free and every slot empty
+        feed->ring = (FeedRing *)base;
+        feed->ring->version = FEED_VERSION;
+        feed->ring->event_size = sizeof(FeedEvent);
+        feed->ring->capacity = slots;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(feed->ring->magic, FEED_MAGIC, sizeof(feed->ring->magic));
+        return feed;
+}
+
+/**
+ * Opens a feed another process created with a name
+ * @param name Name it was created with
+ * @return The feed, or NULL if there is none by that name or it was built differently
+ */
+ChainFeed *openChainFeed(const char *name)
+{
+        struct stat info;
+
+        if (!name || strlen(name) + 2 > FEED_MAX_NAME)
+                return NULL;
+        ChainFeed *feed = (ChainFeed *)calloc(1, sizeof(ChainFeed));
+        if (!feed)
+                return NULL;
+        snprintf(feed->name, FEED_MAX_NAME, "%s%s", name[0] == '/' ? "" : "/", name);
+
+        int fd = shm_open(feed->name, O_RDWR, 0);
+        if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FeedRing))
+        {
+                reportMessage("Error: Could not open feed %s", feed->name);
+                if (fd >= 0)
+                        close(fd);
+                free(feed);
+                return NULL;
+        }
+        feed->size = (size_t)info.st_size;
+        void *base = mmap(NULL, feed->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+                reportMessage("Error: Could not map feed %s", feed->name);
+                free(feed);
+                return NULL;
+        }
+
+        FeedRing *ring = (FeedRing *)base;
+        if (memcmp(ring->magic, FEED_MAGIC, sizeof(ring->magic)) != 0 || ring->version != FEED_VERSION ||
+            ring->event_size != sizeof(FeedEvent) || ring->capacity == 0 ||
+            (ring->capacity & (ring->capacity - 1)) != 0 || feedSize(ring->capacity) != feed->size)
+        {
+                reportMessage("Error: %s is not a feed this build can read", feed->name);
+                munmap(base, feed->size);
+                free(feed);
+                return NULL;
+        }
+        feed->ring = ring;
+        return feed;
+}
+
+/**
+ * Closes a feed. Closing it in the process that created it wakes every
+ * subscriber, which reads what is left and is then told the feed closed,
+ * and removes its name.
+ * @param feed Feed to close, NULL for none
+ */
+void closeChainFeed(ChainFeed *feed)
+{
+        if (!feed)
+                return;
+
+        if (feed->owner)
+        {
+                __atomic_store_n(&feed->ring->closed, 1, __ATOMIC_SEQ_CST);
+                __atomic_add_fetch(&feed->ring->event_signal, 1, __ATOMIC_SEQ_CST);
+                futexWake(&feed->ring->event_signal);
+                if (feed->name[0])
+                        shm_unlink(feed->name);
+        }
+        munmap(feed->ring, feed->size);
+        free(feed);
+}
+
+/**
+ * Subscribes to a feed from the next event published on
+ * @param feed Feed to read
+ * @param policy FEED_WAIT to hold the publisher back when a whole ring behind, FEED_DROP to lose events instead
+ * @return The subscriber, or NULL if every cursor is taken
+ */
+FeedSubscriber *subscribeFeed(ChainFeed *feed, int policy)
+{
+        if (!feed || (policy != FEED_WAIT && policy != FEED_DROP))
+                return NULL;
+        FeedSubscriber *subscriber = (FeedSubscriber *)malloc(sizeof(FeedSubscriber));
+        if (!subscriber)
+                return NULL;
+
+        FeedRing *ring = feed->ring;
+        for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++)
+        {
+                // Take a free cursor, or one left behind by a process that died
+                FeedCursor *cursor = &ring->cursors[i];
+                uint32_t state = __atomic_load_n(&cursor->state, __ATOMIC_ACQUIRE);
+                if (state == FEED_CURSOR_JOINING || (state == FEED_CURSOR_ACTIVE && feedSubscriberAlive(cursor)) ||
+                    !__atomic_compare_exchange_n(&cursor->state, &state, FEED_CURSOR_JOINING, 0, __ATOMIC_SEQ_CST,
+                                                 __ATOMIC_RELAXED))
+                        continue;
+
+                // The publisher passes over a cursor set past every sequence until it is placed
+                cursor->policy = (uint32_t)policy;
+                __atomic_store_n(&cursor->pid, (int32_t)getpid(), __ATOMIC_RELAXED);
+                __atomic_store_n(&cursor->dropped, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&cursor->next, UINT64_MAX, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&cursor->state, FEED_CURSOR_ACTIVE, __ATOMIC_SEQ_CST);
+                __atomic_store_n(&cursor->next, __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) + 1, __ATOMIC_SEQ_CST);
+
+                subscriber->feed = feed;
+                subscriber->cursor = cursor;
+                return subscriber;
+        }
+
+        reportMessage("Error: The feed has no room for another subscriber");
+        free(subscriber);
+        return NULL;
+}
+
+/**
+ * Tells a publisher waiting for room that a subscriber moved on or left
+ * @param ring Feed's ring
+ */
+static void wakeFeedPublisher(FeedRing *ring)
+{
+        if (__atomic_load_n(&ring->space_waiting, __ATOMIC_SEQ_CST))
+        {
+                __atomic_add_fetch(&ring->space_signal, 1, __ATOMIC_SEQ_CST);
+                futexWake(&ring->space_signal);
+        }
+}
+
+/**
+ * Gives up a subscriber's cursor
+ * @param subscriber Subscriber to end, NULL for none
+ */
+void unsubscribeFeed(FeedSubscriber *subscriber)
+{
+        if (!subscriber)
+                return;
+
+        __atomic_store_n(&subscriber->cursor->state, FEED_CURSOR_FREE, __ATOMIC_SEQ_CST);
+        wakeFeedPublisher(subscriber->feed->ring);
+        free(subscriber);
+}
+
+/**
+ * Moves a subscriber that the publisher lapped on to the oldest event still intact
+ * @param ring Feed's ring
+ * @param cursor Subscriber's cursor
+ * @param next Sequence it was about to read
+ */
+static void skipLappedEvents(FeedRing *ring, FeedCursor *cursor, uint64_t next)
+{
+        // The slot after the newest may be being rewritten, so the oldest safe event is one later than it looks
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t oldest = head + 2 > ring->capacity ? head + 2 - ring->capacity : 1;
+        uint64_t skipped = oldest > next + 1 ? oldest : next + 1;
+
+        if (__atomic_compare_exchange_n(&cursor->next, &next, skipped, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+                __atomic_add_fetch(&cursor->dropped, skipped - next, __ATOMIC_RELAXED);
+                wakeFeedPublisher(ring);
+        }
+}
+
+/**
+ * Reads the next event from a feed, waiting for one if there is none yet.
+ * Events arrive in the order they were published; a gap in their sequence
+ * numbers counts events a FEED_DROP subscriber lost.
+ * @param subscriber Subscriber reading
+ * @param event Receives the event
+ * @param timeout_ms Longest to wait, 0 to only look, negative for no limit
+ * @return 1 if an event was read, 0 if none came in time, -1 if the feed closed and every event has been read
+ */
+int readFeedEvent(FeedSubscriber *subscriber, FeedEvent *event, int timeout_ms)
+{
+        FeedRing *ring = subscriber->feed->ring;
+        FeedCursor *cursor = subscriber->cursor;
+        int64_t deadline = timeout_ms > 0 ? feedNow() + (int64_t)timeout_ms * 1000000 : 0;
+        int checks = 0;
+
+        for (;;)
+        {
+                uint64_t next = __atomic_load_n(&cursor->next, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= next)
+                {
+                        // The slot's sequence brackets the copy, so an event rewritten under it is never returned
+                        FeedSlot *slot = &ring->slots[next & (ring->capacity - 1)];
+                        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != next)
+                        {
+                                skipLappedEvents(ring, cursor, next);
+                                continue;
+                        }
+                        memcpy(event, &slot->event, sizeof(FeedEvent));
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != next)
+                        {
+                                skipLappedEvents(ring, cursor, next);
+                                continue;
+                        }
+
+                        // Fails only if the publisher dropped this event meanwhile, and then the copy may be torn
+                        if (!__atomic_compare_exchange_n(&cursor->next, &next, next + 1, 0, __ATOMIC_SEQ_CST,
+                                                         __ATOMIC_RELAXED))
+                                continue;
+                        wakeFeedPublisher(ring);
+                        return 1;
+                }
+
+                if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+                        return -1;
+                if (timeout_ms == 0)
+                        return 0;
+
+                // Spin briefly first: a sleep and a wake-up cost tens of microseconds
+                if (checks++ < FEED_SPIN_CHECKS)
+                {
+                        sched_yield();
+                        continue;
+                }
+                int wait_ms = -1;
+                if (timeout_ms > 0)
+                {
+                        int64_t left = deadline - feedNow();
+                        if (left <= 0)
+                                return 0;
+                        wait_ms = (int)((left + 999999) / 1000000);
+                }
+
+                uint32_t signal = __atomic_load_n(&ring->event_signal, __ATOMIC_SEQ_CST);
+                __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) < next &&
+                    !__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST))
+                        futexWait(&ring->event_signal, signal, wait_ms);
+                __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+        }
+}
+
+/**
+ * Reads how a feed has fared
+ * @param feed Feed to look at
+ * @param stats Receives the counts
+ */
+void getFeedStats(const ChainFeed *feed, FeedStats *stats)
+{
+        const FeedRing *ring = feed->ring;
+
+        memset(stats, 0, sizeof(FeedStats));
+        stats->published = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        stats->publisher_waits = __atomic_load_n(&ring->publisher_waits, __ATOMIC_RELAXED);
+        for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++)
+        {
+                const FeedCursor *cursor = &ring->cursors[i];
+                if (__atomic_load_n(&cursor->state, __ATOMIC_ACQUIRE) != FEED_CURSOR_ACTIVE)
+                        continue;
+                stats->subscribers++;
+                stats->dropped += __atomic_load_n(&cursor->dropped, __ATOMIC_RELAXED);
+        }
+}
+
+/**
+ * Makes sure no subscriber still needs an event before its slot is reused,
+ * waiting for FEED_WAIT subscribers and moving FEED_DROP ones past it
+ * @param ring Feed's ring
+ * @param oldest Sequence of the event in the slot about to be reused
+ */
+static void makeFeedRoom(FeedRing *ring, uint64_t oldest)
+{
+        int waited = 0;
+
+        for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++)
+        {
+                FeedCursor *cursor = &ring->cursors[i];
+                for (;;)
+                {
+                        uint64_t next = __atomic_load_n(&cursor->next, __ATOMIC_SEQ_CST);
+                        if (__atomic_load_n(&cursor->state, __ATOMIC_SEQ_CST) != FEED_CURSOR_ACTIVE || next > oldest)
+                                break;
+
+                        if (cursor->policy == FEED_DROP)
+                        {
+                                if (__atomic_compare_exchange_n(&cursor->next, &next, oldest + 1, 0, __ATOMIC_SEQ_CST,
+                                                                __ATOMIC_RELAXED))
+                                {
+                                        __atomic_add_fetch(&cursor->dropped, oldest + 1 - next, __ATOMIC_RELAXED);
+                                        break;
+                                }
+                                continue;
+                        }
+
+                        // Backpressure, unless the subscriber's process has gone and cannot catch up
+                        if (!feedSubscriberAlive(cursor))
+                        {
+                                uint32_t state = FEED_CURSOR_ACTIVE;
+                                __atomic_compare_exchange_n(&cursor->state, &state, FEED_CURSOR_FREE, 0,
+                                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+                                continue;
+                        }
+                        if (!waited)
+                        {
+                                __atomic_add_fetch(&ring->publisher_waits, 1, __ATOMIC_RELAXED);
+                                waited = 1;
+                        }
+                        uint32_t signal = __atomic_load_n(&ring->space_signal, __ATOMIC_SEQ_CST);
+                        __atomic_store_n(&ring->space_waiting, 1, __ATOMIC_SEQ_CST);
+                        if (__atomic_load_n(&cursor->next, __ATOMIC_SEQ_CST) <= oldest &&
+                            __atomic_load_n(&cursor->state, __ATOMIC_SEQ_CST) == FEED_CURSOR_ACTIVE)
+                                futexWait(&ring->space_signal, signal, FEED_WAIT_CHECK_MS);
+                }
+        }
+        if (waited)
+                __atomic_store_n(&ring->space_waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Publishes an event about a block into a chain's feed
+ * @param feed Feed to publish into
+ * @param type FEED_BLOCK or FEED_TRANSACTION
+ * @param block Block that joined the tree or gained the transaction
+ * @param trans Transaction added, NULL for FEED_BLOCK
+ */
+static void publishFeedEvent(ChainFeed *feed, int type, const Block *block, const Transaction *trans)
+{
+        FeedRing *ring = feed->ring;
+        uint64_t sequence = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + 1;
+
+        if (sequence > ring->capacity)
+                makeFeedRoom(ring, sequence - ring->capacity);
+
+        // Mark the slot as being rewritten before touching the event in it
+        FeedSlot *slot = &ring->slots[sequence & (ring->capacity - 1)];
+        __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        FeedEvent *event = &slot->event;
+        memset(event, 0, sizeof(FeedEvent));
+        event->sequence = sequence;
+        event->type = type;
+        event->header.index = block->index;
+        event->header.timestamp = block->timestamp;
+        event->header.data_length = block->data_length;
+        event->header.transaction_count = block->transaction_count;
+        memcpy(event->header.previous_hash, block->previous_hash, HASH_SIZE + 1);
+        memcpy(event->header.hash, block->hash, HASH_SIZE + 1);
+        if (trans)
+                event->transaction = *trans;
+        event->published_ns = feedNow();
+
+        __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->head, sequence, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&ring->event_signal, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->sleepers, __ATOMIC_SEQ_CST) > 0)
+                futexWake(&ring->event_signal);
+}
+
+/**
+ * Attaches a feed to a chain, replacing any it had
+ * @param chain Pointer to the blockchain
+ * @param feed Feed to publish into, NULL to detach
+ * @return 1 if successful, 0 if the feed already has a publisher
+ */
+static int attachChainFeedLocked(Blockchain *chain, ChainFeed *feed)
+{
+        uint32_t idle = 0;
+
+        if (!chain)
+                return 0;
+        if (feed && feed != chain->feed &&
+            !__atomic_compare_exchange_n(&feed->ring->publishing, &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+                reportMessage("Error: The feed already has a publisher");
+                return 0;
+        }
+        if (chain->feed && chain->feed != feed)
+                __atomic_store_n(&chain->feed->ring->publishing, 0, __ATOMIC_SEQ_CST);
+        chain->feed = feed;
+        return 1;
+}
+
+/**
+ * Bytes of data and transactions a block keeps resident
+ * @param block Block to measure
+ * @return Resident payload size in bytes
+ */
+static size_t blockPayloadSize(const Block *block)
+{
+        if (block->flags & (BLOCK_PRUNED | BLOCK_EVICTED))
+                return 0;
+        return block->data_length + 1 + block->transaction_capacity * sizeof(Transaction);
+}
+
+/**
+ * Takes a block out of the payload cache's recency list, if it is in it
+ * @param chain Pointer to the blockchain
+ * @param block Block to take out
+ */
+static void uncacheBlock(Blockchain *chain, Block *block)
+{
+        if (!(block->flags & BLOCK_CACHED))
+                return;
+
+        if (block->lru_prev)
+                block->lru_prev->lru_next = block->lru_next;
+        else
+                chain->cache_head = block->lru_next;
+        if (block->lru_next)
+                block->lru_next->lru_prev = block->lru_prev;
+        else
+                chain->cache_tail = block->lru_prev;
+        block->lru_prev = NULL;
+        block->lru_next = NULL;
+        block->flags &= ~BLOCK_CACHED;
+}
+
+/**
+ * Marks a block's payload as the most recently used. Only payloads that
+ * match a record in the mapped files can be read back, so only those are
+ * kept in the cache's recency list and ever evicted.
+ * @param chain Pointer to the blockchain
+ * @param block Block whose payload is resident
+ */
+static void touchBlock(Blockchain *chain, Block *block)
+{
+        uncacheBlock(chain, block);
+        if (chain->config.cache_bytes == 0 || !(block->flags & BLOCK_PERSISTED) ||
+            (block->flags & (BLOCK_PRUNED | BLOCK_EVICTED | BLOCK_DIRTY | BLOCK_SNAPSHOT)) ||
+            block->transaction_count != block->saved_transaction_count ||
+            block->file_offset >= chain->mapped_end || block->amend_offset >= chain->mapped_end)
+                return;
+
+        block->lru_next = chain->cache_head;
+        if (chain->cache_head)
+                chain->cache_head->lru_prev = block;
+        else
+                chain->cache_tail = block;
+        chain->cache_head = block;
+        block->flags |= BLOCK_CACHED;
+}
+
+/**
+ * Frees a block's data and transactions, leaving its header
+ * @param chain Pointer to the blockchain
+ * @param block Block whose payload goes
+ */
+static void dropPayload(Blockchain *chain, Block *block)
+{
+        uncacheBlock(chain, block);
+        chain->payload_bytes -= blockPayloadSize(block);
+
+        // Lock-free readers may still be reading the payload, so it is only unlinked here
+        char *data = block->data;
+        Transaction *transactions = block->transactions;
+        __atomic_store_n(&block->data, NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(&block->transactions, NULL, __ATOMIC_RELEASE);
+        if (!(block->flags & BLOCK_MAPPED_DATA))
+                deferFree(chain, data, block->data_length + 1);
+        if (!(block->flags & BLOCK_MAPPED_TRANSACTIONS))
+                deferFree(chain, transactions, block->transaction_capacity * sizeof(Transaction));
+        block->flags &= ~(BLOCK_MAPPED_DATA | BLOCK_MAPPED_TRANSACTIONS);
+        block->transaction_capacity = 0;
+}
+
+/**
+ * Evicts the least recently used payloads until the resident payloads fit the cache budget
+ * @param chain Pointer to the blockchain
+ * @param keep Block just asked for, kept even if it alone is over budget
+ */
+static void trimCache(Blockchain *chain, const Block *keep)
+{
+        size_t budget = chain->config.cache_bytes;
+
+        while (budget > 0 && chain->payload_bytes > budget && chain->cache_tail && chain->cache_tail != keep)
+        {
+                Block *victim = chain->cache_tail;
+                dropPayload(chain, victim);
+                victim->flags |= BLOCK_EVICTED;
+                chain->cache_stats.evictions++;
+        }
+}
+
+/**
+ * Collapses a block to its header, dropping its payload and undo record
+ * @param chain Pointer to the blockchain
+ * @param block Active block below the retained window
+ */
+static void pruneBlock(Blockchain *chain, Block *block)
+{
+        dropPayload(chain, block);
+
+        // The balances it produced stay; it just can no longer be reverted
+        if (block->undo)
+        {
+                poolFree(&chain->pool, block->undo, sizeof(BlockUndo) + block->undo->capacity * sizeof(UndoEntry));
+                block->undo = NULL;
+        }
+
+        block->flags |= BLOCK_PRUNED;
+}
+
+/**
+ * Prunes the oldest active blocks until the retained window fits the
+ * configured block count and byte budget. The tip is never pruned, and
+ * neither is a block whose payload is not saved yet, so a chain that was
+ * never saved keeps every payload until its first save.
+ * @param chain Pointer to the blockchain
+ */
+static void pruneBlockchainLocked(Blockchain *chain)
+{
+        if (!chain || !chain->tip)
+                return;
+
+        // A save in flight still reads the payloads it snapshotted; it prunes once it finishes
+        if (chain->save)
+                return;
+
+        int keep_blocks = chain->config.prune_keep_blocks;
+        size_t keep_bytes = chain->config.prune_keep_bytes;
+        if (keep_blocks <= 0 && keep_bytes == 0)
+                return;
+
+        Block *oldest = chain->prune_point ? chain->prune_point->next : chain->head;
+        while (oldest && oldest != chain->tip)
+        {
+                int window = chain->tip->index - oldest->index + 1;
+                if (!(keep_blocks > 0 && window > keep_blocks) &&
+                    !(keep_bytes > 0 && chain->payload_bytes > keep_bytes))
+                        break;
+                // A payload the file does not hold yet would be lost, and the next save would have to rewrite it
+                if (!(oldest->flags & BLOCK_PERSISTED) || (oldest->flags & BLOCK_DIRTY))
+                        break;
+
+                pruneBlock(chain, oldest);
+                chain->prune_point = oldest;
+                oldest = oldest->next;
+        }
+}
+
+/**
+ * Changes the pruning target and prunes right away
+ * @param chain Pointer to the blockchain
+ * @param keep_blocks Number of most recent payloads to keep, 0 for all
+ * @param keep_bytes Payload byte budget, 0 for no limit
+ */
+static void setPruneTargetLocked(Blockchain *chain, int keep_blocks, size_t keep_bytes)
+{
+        if (!chain)
+                return;
+
+        chain->config.prune_keep_blocks = keep_blocks;
+        chain->config.prune_keep_bytes = keep_bytes;
+        pruneBlockchainLocked(chain);
+}
+
+/**
+ * Activates the branch of a block already in the tree, as long as it forks
+ * above any history the chain can no longer revert
+ * @param chain Pointer to the blockchain
+ * @param block Tip of the branch to activate
+ * @return 1 if successful, 0 if failed (the previous branch stays active)
+ */
+static int switchBranch(Blockchain *chain, Block *block)
+{
+        // Pruned blocks have lost their undo records and cannot be reverted, nor can those a load skipped
+        Block *fork = findCommonAncestor(chain->tip, block);
+        int below_pruned = chain->prune_point && fork && fork->index < chain->prune_point->index;
+        int below_state = chain->state_point && fork && fork->index < chain->state_point->index;
+        chain->state_conflict |= below_state;
+        if (below_pruned)
+                reportMessage("Error: Heavier branch forks below the pruned history");
+        else if (below_state)
+                reportMessage("Error: Heavier branch forks below the state snapshot the chain was loaded from");
+        else if (!reorganizeChain(chain, block))
+                reportMessage("Error: Could not switch to the heavier branch");
+        else
+                return 1;
+        return 0;
+}
+
+/**
+ * Links a pool-allocated block into the block tree and activates it if its
+ * branch becomes the heaviest
+ * @param chain Pointer to the blockchain
+ * @param block Block whose header fields and hash are already set
+ * @return ACCEPT_OK, or ACCEPT_FAILED/ACCEPT_DUPLICATE/ACCEPT_ORPHAN with the block left unlinked
+ */
+static int connectBlock(Blockchain *chain, Block *block)
+{
+        Block *parent = NULL;
+
+        if (findBlockLocked(chain, block->hash))
+                return ACCEPT_DUPLICATE;
+
+        if (chain->head)
+        {
+                parent = findBlockLocked(chain, block->previous_hash);
+                if (!parent)
+                        return ACCEPT_ORPHAN;
+                if (block->index != parent->index + 1)
+                        return ACCEPT_FAILED;
+        }
+        else if (block->index != 0)
+        {
+                return ACCEPT_ORPHAN;
+        }
+
+        block->parent = parent;
+        block->skip = getAncestor(parent, getSkipHeight(block->index));
+        block->next = NULL;
+        block->undo = NULL;
+        block->child_count = 0;
+        block->chain_work = (parent ? parent->chain_work : 0) + blockWork(block);
+        if (!indexBlock(chain, block))
+                return ACCEPT_FAILED;
+        if (parent)
+                parent->child_count++;
+
+        if (!chain->head || parent == chain->tip)
+        {
+                // Common case: the block extends the active tip
+                if (!applyBlock(chain, block))
+                {
+                        if (parent)
+                                parent->child_count--;
+                        unindexBlock(chain, block);
+                        return ACCEPT_FAILED;
+                }
+                if (parent)
+                        parent->next = block;
+                else
+                        chain->head = block;
+                chain->tip = block;
+                chain->length = block->index + 1;
+        }
+        else if (block->chain_work > chain->tip->chain_work && !switchBranch(chain, block))
+        {
+                parent->child_count--;
+                unindexBlock(chain, block);
+                return ACCEPT_FAILED;
+        }
+
+        // Remember the order blocks arrived in; the log is written in that order
+        block->log_next = NULL;
+        if (chain->log_tail)
+                chain->log_tail->log_next = block;
+        else
+                chain->log_head = block;
+        chain->log_tail = block;
+        if (!chain->unsaved && !(block->flags & BLOCK_PERSISTED))
+                chain->unsaved = block;
+
+        chain->payload_bytes += blockPayloadSize(block);
+        if (chain->feed)
+                publishFeedEvent(chain->feed, FEED_BLOCK, block, NULL);
+        pruneBlockchainLocked(chain);
+        return ACCEPT_OK;
+}
+
+/**
+ * Accepts a block built elsewhere (a competing fork or a peer's block) into the
+ * block tree, switching the active chain if the block's branch is heavier
+ * @param chain Pointer to the blockchain
+ * @param block Block to copy in; its data and transactions are not retained
+ * @return ACCEPT_OK, ACCEPT_FAILED, ACCEPT_DUPLICATE or ACCEPT_ORPHAN
+ */
+static int acceptBlockLocked(Blockchain *chain, const Block *block)
+{
+        char calculated_hash[HASH_SIZE + 1];
+
+        if (!chain || !block || block->data_length < 0 || block->data_length > MAX_BLOCK_DATA_SIZE ||
+            block->transaction_count < 0 || block->transaction_count > MAX_BLOCK_TRANSACTIONS)
+                return ACCEPT_FAILED;
+
+        if (findBlockLocked(chain, block->hash))
+                return ACCEPT_DUPLICATE;
+
+        calculateHash((Block *)block, calculated_hash);
+        if (strcmp(calculated_hash, block->hash) != 0)
+                return ACCEPT_FAILED;
+
+        Block *copy = (Block *)poolAlloc(&chain->pool, sizeof(Block));
+        if (!copy)
+                return ACCEPT_FAILED;
+
+        memset(copy, 0, sizeof(Block));
+        copy->index = block->index;
+        copy->timestamp = block->timestamp;
+        copy->data_length = block->data_length;
+        copy->transaction_count = block->transaction_count;
+        copy->transaction_capacity = block->transaction_count;
+        memcpy(copy->previous_hash, block->previous_hash, HASH_SIZE + 1);
+        memcpy(copy->hash, block->hash, HASH_SIZE + 1);
+
+        copy->data = (char *)poolAlloc(&chain->pool, copy->data_length + 1);
+        if (copy->transaction_count > 0)
+                copy->transactions = (Transaction *)poolAlloc(&chain->pool,
+                                                              copy->transaction_count * sizeof(Transaction));
+        if (!copy->data || (copy->transaction_count > 0 && !copy->transactions))
+        {
+                freeBlock(&chain->pool, copy);
+                return ACCEPT_FAILED;
+        }
+        memcpy(copy->data, block->data, copy->data_length);
+        copy->data[copy->data_length] = '\0';
+        if (copy->transaction_count > 0)
+                memcpy(copy->transactions, block->transactions, copy->transaction_count * sizeof(Transaction));
+
+        int status = connectBlock(chain, copy);
+        if (status != ACCEPT_OK)
+                freeBlock(&chain->pool, copy);
+        return status;
+}
+
+/**
+ * Adds a new block on top of the active chain
+ * @param chain Pointer to the blockchain
+ * @param data Data for the new block
+ * @return 1 if successful, 0 if failed
+ */
+static int addBlockLocked(Blockchain *chain, const char *data)
+{
+        if (!chain)
+                return 0;
+
+        Block *tip = chain->tip;
+        Block *newBlock = createBlock(&chain->pool, tip ? tip->index + 1 : 0, data, tip ? tip->hash : "0");
+        if (!newBlock)
+                return 0;
+
+        if (connectBlock(chain, newBlock) != ACCEPT_OK)
+        {
+                freeBlock(&chain->pool, newBlock);
+                return 0;
+        }
+
+        return 1;
+}
+
+/**
+ * Validates the integrity of the blockchain, or of the retained window when pruned
+ * @param chain Pointer to the blockchain
+ * @return 1 if valid, 0 if invalid
+ */
+static int validateBlockchainLocked(Blockchain *chain)
+{
+        if (!chain || !chain->head)
+                return 1;
+
+        // Pruned headers are trusted up to the checkpoint; only the retained window is re-hashed
+        Block *previous = chain->prune_point ? chain->prune_point : chain->head;
+        Block *current = previous->next;
+        char calculated_hash[HASH_SIZE + 1];
+
+        while (current)
+        {
+                if (previous->flags & BLOCK_PRUNED)
+                        strcpy(calculated_hash, previous->hash);
+                else if (fetchBlockPayloadLocked(chain, previous))
+                        calculateHash(previous, calculated_hash);
+                else
+                        return 0;
+                if (strcmp(current->previous_hash, calculated_hash) != 0)
+                {
+                        return 0;
+                }
+
+                if (!fetchBlockPayloadLocked(chain, current))
+                        return 0;
+                calculateHash(current, calculated_hash);
+                if (strcmp(current->hash, calculated_hash) != 0)
+                {
+                        return 0;
+                }
+
+                previous = current;
+                current = current->next;
+        }
+
+        return 1;
+}
+
+/**
+ * Hands a pool buffer to the save in flight to free once it has finished reading it
+ * @param job Save in flight
+ * @param data Buffer no longer used by the chain
+ * @param size Size it was allocated with
+ * @return 1 if successful, 0 if out of memory
+ */
+static int retireBuffer(SaveJob *job, void *data, size_t size)
+{
+        if (job->retired_count == job->retired_capacity)
+        {
+                int capacity = job->retired_capacity ? job->retired_capacity * 2 : 8;
+                RetiredBuffer *grown = (RetiredBuffer *)realloc(job->retired, capacity * sizeof(RetiredBuffer));
+                if (!grown)
+                        return 0;
+                job->retired = grown;
+                job->retired_capacity = capacity;
+        }
+        job->retired[job->retired_count].data = data;
+        job->retired[job->retired_count].size = size;
+        job->retired_count++;
+        return 1;
+}
+
+/**
+ * Appends a transaction to a block and applies it if the block is active,
+ * leaving the block's hash to be recomputed by the caller
+ * @param chain Blockchain owning the block
+ * @param block Target block
+ * @param source Transaction to copy in
+ * @return 1 if successful, 0 if failed
+ */
+static int appendTransaction(Blockchain *chain, Block *block, const Transaction *source)
+{
+        if (block->transaction_count >= MAX_BLOCK_TRANSACTIONS || (block->flags & (BLOCK_PRUNED | BLOCK_EVICTED)))
+                return 0;
+
+        // Grow the transaction list geometrically so appends stay amortised O(1)
+        if (block->transaction_count == block->transaction_capacity)
+        {
+                int capacity = block->transaction_capacity ? block->transaction_capacity * 2
+                                                           : MIN_TRANSACTION_CAPACITY;
+                Transaction *grown = (Transaction *)poolAlloc(&chain->pool, capacity * sizeof(Transaction));
+                if (!grown)
+                        return 0;
+
+                // A save in flight may still be writing the old list from its copy of the block
+                size_t old_size = block->transaction_capacity * sizeof(Transaction);
+                int retire = (block->flags & BLOCK_SNAPSHOT) && !(block->flags & BLOCK_MAPPED_TRANSACTIONS);
+                if (retire && !retireBuffer(chain->save, block->transactions, old_size))
+                {
+                        poolFree(&chain->pool, grown, capacity * sizeof(Transaction));
+                        return 0;
+                }
+                if (block->transaction_count > 0)
+                        memcpy(grown, block->transactions, block->transaction_count * sizeof(Transaction));
+
+                // Transactions read from a mapped file are copied out on the first append
+                if (block->flags & BLOCK_MAPPED_TRANSACTIONS)
+                        block->flags &= ~BLOCK_MAPPED_TRANSACTIONS;
+                else if (!retire)
+                        deferFree(chain, block->transactions, old_size);
+                chain->payload_bytes += (capacity - block->transaction_capacity) * sizeof(Transaction);
+                __atomic_store_n(&block->transactions, grown, __ATOMIC_RELEASE);
+                block->transaction_capacity = capacity;
+        }
+
+        Transaction *trans = &block->transactions[block->transaction_count];
+        *trans = *source;
+
+        if (block->undo && !applyTransaction(chain, block, trans))
+                return 0;
+
+        block->transaction_count++;
+        return 1;
+}
+
+/**
+ * Queues a saved block whose transactions changed for the next save
+ * @param chain Blockchain owning the block
+ * @param block Saved block
+ */
+static void markDirty(Blockchain *chain, Block *block)
+{
+        if (block->flags & BLOCK_DIRTY)
+                return;
+
+        // Its payload no longer matches the file, so it must stay resident until saved
+        uncacheBlock(chain, block);
+        block->flags |= BLOCK_DIRTY;
+        block->dirty_next = chain->dirty;
+        chain->dirty = block;
+}
+
+/**
+ * Recomputes a block's hash after its contents changed and re-keys it in the index
+ * @param chain Blockchain owning the block
+ * @param block Block to rehash
+ */
+static void rehashBlock(Blockchain *chain, Block *block)
+{
+        unindexBlock(chain, block);
+        calculateHash(block, block->hash);
+        indexBlock(chain, block);
+}
+
+/**
+ * Adds a new transaction to a block that has nothing built on it yet
+ * @param chain Blockchain owning the block
+ * @param block Target block
+ * @param sender Transaction sender
+ * @param receiver Transaction receiver
+ * @param amount Transaction amount
+ * @return 1 if successful, 0 if failed
+ */
+static int addTransactionLocked(Blockchain *chain, Block *block, const char *sender, const char *receiver, double amount)
+{
+        Transaction trans;
+
+        if (!chain || !block)
+                return 0;
+
+        // Changing the hash of a block that others build on would orphan them
+        if (block->child_count > 0 || !fetchBlockPayloadLocked(chain, block))
+                return 0;
+
+        memset(&trans, 0, sizeof(Transaction));
+        strncpy(trans.sender, sender, MAX_SENDER_SIZE - 1);
+        strncpy(trans.receiver, receiver, MAX_RECEIVER_SIZE - 1);
+        trans.amount = amount;
+        trans.timestamp = time(NULL);
+
+        if (!appendTransaction(chain, block, &trans))
+                return 0;
+
+        rehashBlock(chain, block);
+        if (chain->feed)
+                publishFeedEvent(chain->feed, FEED_TRANSACTION, block, &trans);
+
+        // A saved block now needs its new transactions appended to the log
+        if (block->flags & BLOCK_PERSISTED)
+                markDirty(chain, block);
+        return 1;
+}
+
+/**
+ * Displays transactions in a block
+ * @param block Block containing transactions
+ * @param out Stream to write to
+ */
+void displayTransactions(Block *block, FILE *out)
+{
+        if (block->transaction_count == 0)
+        {
+                fprintf(out, "No transactions in this block\n");
+                return;
+        }
+
+        fprintf(out, "\nTransactions:\n");
+        for (int i = 0; i < block->transaction_count; i++)
+        {
+                fprintf(out, "Transaction #%d:\n", i + 1);
+                fprintf(out, "  From: %s\n", block->transactions[i].sender);
+                fprintf(out, "  To: %s\n", block->transactions[i].receiver);
+                fprintf(out, "  Amount: %.2f\n", block->transactions[i].amount);
+                fprintf(out, "  Time: %s", ctime(&block->transactions[i].timestamp));
+        }
+}
+
+/**
+ * Displays information of a single block including transactions
+ * @param block Block to display
+ * @param out Stream to write to
+ */
+void displayBlock(Block *block, FILE *out)
+{
+        fprintf(out, "\nBlock #%d\n", block->index);
+        fprintf(out, "Timestamp: %s", ctime(&block->timestamp));
+        if (block->flags & BLOCK_PRUNED)
+                fprintf(out, "Data: (pruned, %d bytes)\n", block->data_length);
+        else if (block->flags & BLOCK_EVICTED)
+                fprintf(out, "Data: (on disk, %d bytes)\n", block->data_length);
+        else
+                fprintf(out, "Data: %s\n", block->data);
+        fprintf(out, "Previous Hash: %s\n", block->previous_hash);
+        fprintf(out, "Hash: %s\n", block->hash);
+        if (block->flags & BLOCK_PRUNED)
+                fprintf(out, "Transactions: %d (pruned)\n", block->transaction_count);
+        else if (block->flags & BLOCK_EVICTED)
+                fprintf(out, "Transactions: %d (on disk)\n", block->transaction_count);
+        else
+                displayTransactions(block, out);
+}
+
+/**
+ * Displays the entire blockchain
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+static void displayBlockchainLocked(Blockchain *chain, FILE *out)
+{
+        if (!chain || !chain->head)
+        {
+                fprintf(out, "Blockchain is empty\n");
+                return;
+        }
+
+        Block *current = chain->head;
+        while (current)
+        {
+                // Evicted payloads are read back one block at a time
+                if (current->flags & BLOCK_EVICTED)
+                        fetchBlockPayloadLocked(chain, current);
+                displayBlock(current, out);
+                current = current->next;
+        }
+}
+
+/**
+ * Frees all memory allocated for the blockchain
+ * @param chain Pointer to the blockchain
+ */
+void freeBlockchain(Blockchain *chain)
+{
+        if (!chain)
+                return;
+
+        closeChainLog(chain);
+        if (chain->feed)
+                __atomic_store_n(&chain->feed->ring->publishing, 0, __ATOMIC_SEQ_CST);
+
+        // Blocks never outlive their pool, so the pages are released wholesale
+        releasePool(&chain->pool);
+        free(chain->retired);
+        for (int i = 0; i < chain->map_count; i++)
+        {
+                if (chain->maps[i].base)
+                        munmap(chain->maps[i].base, chain->maps[i].size);
+        }
+        free(chain->maps);
+        pthread_mutex_destroy(&chain->lock);
+        free(chain);
+}
+
+static uint32_t crc32c_table[256];
+static int crc32c_hardware;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Builds the CRC32C lookup table and checks for the crc32 instruction;
+ * run through pthread_once since loader threads checksum concurrently
+ */
+static void initCrc32c(void)
+{
+        for (uint32_t i = 0; i < 256; i++)
+        {
+                uint32_t entry = i;
+                for (int bit = 0; bit < 8; bit++)
+                        entry = (entry >> 1) ^ ((entry & 1) ? CRC32C_POLYNOMIAL : 0);
+                crc32c_table[i] = entry;
+        }
+#if defined(__x86_64__)
+        crc32c_hardware = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#endif
+}
+
+/**
+ * Extends a CRC32C one byte at a time with a lookup table
+ * @param crc Running CRC, already inverted
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Updated running CRC
+ */
+static uint32_t crc32cSoftware(uint32_t crc, const unsigned char *data, size_t length)
+{
+        while (length--)
+                crc = crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Extends a CRC32C eight bytes at a time with the SSE4.2 crc32 instruction
+ * @param crc Running CRC, already inverted
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Updated running CRC
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(uint32_t crc, const unsigned char *data,
+                                                                  size_t length)
+{
+        uint64_t wide = crc;
+        while (length >= sizeof(uint64_t))
+        {
+                uint64_t word;
+                memcpy(&word, data, sizeof(uint64_t));
+                wide = _mm_crc32_u64(wide, word);
+                data += sizeof(uint64_t);
+                length -= sizeof(uint64_t);
+        }
+
+        crc = (uint32_t)wide;
+        while (length--)
+                crc = _mm_crc32_u8(crc, *data++);
+        return crc;
+}
+#endif
+
+/**
+ * Extends a CRC32C (Castagnoli) checksum, using the CPU's crc32 instruction when it has one
+ * @param crc Checksum so far, 0 to start a new one
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return Checksum including the new bytes
+ */
+static uint32_t crc32c(uint32_t crc, const void *data, size_t length)
+{
+        pthread_once(&crc32c_once, initCrc32c);
+#if defined(__x86_64__)
+        if (crc32c_hardware)
+                return ~crc32cHardware(~crc, (const unsigned char *)data, length);
+#endif
+        return ~crc32cSoftware(~crc, (const unsigned char *)data, length);
+}
+
+/**
+ * Computes the checksum a record header should carry for its payload
+ * @param header Header of the record; its payload follows it
+ * @return CRC32C of the type, length and payload
+ */
+static uint32_t recordChecksum(const RecordHeader *header)
+{
+        uint32_t crc = crc32c(0, header, 2 * sizeof(uint32_t));
+        return crc32c(crc, header + 1, header->length);
+}
+
+/**
+ * Appends a checksummed record made of the given payload pieces
+ * @param log Log to append to
+ * @param type Record type
+ * @param parts Payload pieces, written in order and each padded to RECORD_ALIGNMENT
+ * @param count Number of pieces
+ * @return 1 if successful, 0 if failed
+ */
+static int writeRecord(ChainLog *log, uint32_t type, const RecordPart *parts, int count)
+{
+        static const char padding[RECORD_ALIGNMENT];
+        RecordHeader header;
+        size_t length = 0;
+
+        for (int i = 0; i < count; i++)
+                length += RECORD_ALIGN(parts[i].length);
+        if (length > UINT32_MAX)
+                return 0;
+
+        memset(&header, 0, sizeof(RecordHeader));
+        header.type = type;
+        header.length = (uint32_t)length;
+
+        // The header goes first, so the checksum is computed over the pieces before writing them
+        uint32_t crc = crc32c(0, &header, 2 * sizeof(uint32_t));
+        for (int i = 0; i < count; i++)
+        {
+                crc = crc32c(crc, parts[i].data, parts[i].length);
+                crc = crc32c(crc, padding, RECORD_ALIGN(parts[i].length) - parts[i].length);
+        }
+        header.checksum = crc;
+
+        if (fwrite(&header, sizeof(RecordHeader), 1, log->file) != 1)
+                return 0;
+        for (int i = 0; i < count; i++)
+        {
+                size_t pad = RECORD_ALIGN(parts[i].length) - parts[i].length;
+                if ((parts[i].length > 0 && fwrite(parts[i].data, 1, parts[i].length, log->file) != parts[i].length) ||
+                    (pad > 0 && fwrite(padding, 1, pad, log->file) != pad))
+                        return 0;
+        }
+
+        log->size += sizeof(RecordHeader) + length;
+        return 1;
+}
+
+/**
+ * Converts a lowercase hex digit, as calculateHash writes them
+ * @param c Character to convert
+ * @return Value of the digit, or -1 if c is not one
+ */
+static int hexValue(char c)
+{
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        return -1;
+}
+
+/**
+ * Makes room for more bytes at the end of a buffer, growing it geometrically
+ * @param buffer Buffer to grow
+ * @param length Number of bytes needed past its length
+ * @return 1 if successful, 0 if out of memory
+ */
+static int reserveBytes(ByteBuffer *buffer, size_t length)
+{
+        if (length <= buffer->capacity - buffer->length)
+                return 1;
+
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity - buffer->length < length)
+                capacity *= 2;
+        unsigned char *grown = (unsigned char *)realloc(buffer->data, capacity);
+        if (!grown)
+                return 0;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+        return 1;
+}
+
+/**
+ * Appends bytes to an encoding buffer, growing it geometrically
+ * @param buffer Buffer to append to
+ * @param data Bytes to append
+ * @param length Number of bytes
+ */
+static void putBytes(ByteBuffer *buffer, const void *data, size_t length)
+{
+        if (buffer->failed || length == 0)
+                return;
+
+        if (!reserveBytes(buffer, length))
+        {
+                buffer->failed = 1;
+                return;
+        }
+
+        memcpy(buffer->data + buffer->length, data, length);
+        buffer->length += length;
+}
+
+/**
+ * Appends an unsigned LEB128 varint: seven bits per byte, high bit set on all but the last
+ * @param buffer Buffer to append to
+ * @param value Value to encode
+ */
+static void putVarint(ByteBuffer *buffer, uint64_t value)
+{
+        unsigned char bytes[10];
+        int count = 0;
+
+        while (value >= 0x80)
+        {
+                bytes[count++] = (unsigned char)(value | 0x80);
+                value >>= 7;
+        }
+        bytes[count++] = (unsigned char)value;
+        putBytes(buffer, bytes, count);
+}
+
+/**
+ * Maps a signed value onto an unsigned one so small magnitudes of either sign encode short
+ * @param value Signed value
+ * @return Zigzag encoding of the value
+ */
+static uint64_t zigzagEncode(int64_t value)
+{
+        return ((uint64_t)value << 1) ^ (value < 0 ? UINT64_MAX : 0);
+}
+
+/**
+ * Reverses zigzagEncode
+ * @param value Zigzag-encoded value
+ * @return Signed value
+ */
+static int64_t zigzagDecode(uint64_t value)
+{
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Appends a block hash: 32 binary bytes for a hash calculateHash produced, the text otherwise
+ * @param buffer Buffer to append to
+ * @param hash NUL-terminated hash, such as the genesis block's "0"
+ */
+static void putHash(ByteBuffer *buffer, const char *hash)
+{
+        unsigned char binary[HASH_SIZE / 2];
+        size_t length = strlen(hash);
+        int hex = length == HASH_SIZE;
+
+        for (int i = 0; hex && i < HASH_SIZE / 2; i++)
+        {
+                int high = hexValue(hash[2 * i]);
+                int low = hexValue(hash[2 * i + 1]);
+                hex = high >= 0 && low >= 0;
+                binary[i] = (unsigned char)(high << 4 | low);
+        }
+
+        if (hex)
+        {
+                putVarint(buffer, HASH_BINARY);
+                putBytes(buffer, binary, sizeof(binary));
+        }
+        else
+        {
+                putVarint(buffer, HASH_TEXT);
+                putVarint(buffer, length);
+                putBytes(buffer, hash, length);
+        }
+}
+
+/**
+ * Appends an amount as a varint count of cents when that round-trips exactly, as raw bits otherwise
+ * @param buffer Buffer to append to
+ * @param amount Amount to encode
+ */
+static void putAmount(ByteBuffer *buffer, double amount)
+{
+        if (amount > -1e15 && amount < 1e15)
+        {
+                int64_t cents = (int64_t)(amount * 100.0 + (amount < 0 ? -0.5 : 0.5));
+                double decoded = (double)cents / 100.0;
+                if (memcmp(&decoded, &amount, sizeof(double)) == 0)
+                {
+                        putVarint(buffer, zigzagEncode(cents) << 1);
+                        return;
+                }
+        }
+
+        putVarint(buffer, AMOUNT_RAW);
+        putBytes(buffer, &amount, sizeof(double));
+}
+
+/**
+ * Numbers an address within a segment, adding it to the dictionary on first use
+ * @param dictionary Dictionary of the segment being written
+ * @param address Address to look up; must stay valid while the dictionary is used
+ * @return Number of the address
+ */
+static uint32_t internAddress(AddressDictionary *dictionary, const char *address)
+{
+        if (dictionary->failed)
+                return 0;
+
+        // Keep the table at most half full; the address array grows with it
+        if (2 * (dictionary->count + 1) > dictionary->slot_count)
+        {
+                uint32_t slot_count = dictionary->slot_count ? dictionary->slot_count * 2 : 64;
+                uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+                const char **addresses =
+                    (const char **)realloc(dictionary->addresses, slot_count / 2 * sizeof(const char *));
+                if (addresses)
+                        dictionary->addresses = addresses;
+                if (!slots || !addresses)
+                {
+                        free(slots);
+                        dictionary->failed = 1;
+                        return 0;
+                }
+
+                for (uint32_t i = 0; i < dictionary->count; i++)
+                {
+                        uint32_t slot = (uint32_t)hashKey(addresses[i]) & (slot_count - 1);
+                        while (slots[slot])
+                                slot = (slot + 1) & (slot_count - 1);
+                        slots[slot] = i + 1;
+                }
+                free(dictionary->slots);
+                dictionary->slots = slots;
+                dictionary->slot_count = slot_count;
+        }
+
+        uint32_t mask = dictionary->slot_count - 1;
+        uint32_t slot = (uint32_t)hashKey(address) & mask;
+        while (dictionary->slots[slot])
+        {
+                uint32_t number = dictionary->slots[slot] - 1;
+                if (strcmp(dictionary->addresses[number], address) == 0)
+                        return number;
+                slot = (slot + 1) & mask;
+        }
+
+        dictionary->addresses[dictionary->count] = address;
+        dictionary->slots[slot] = dictionary->count + 1;
+        return dictionary->count++;
+}
+
+/**
+ * Appends transactions with their addresses replaced by dictionary numbers
+ * @param buffer Buffer to append to
+ * @param transactions Transactions to encode
+ * @param count Number of transactions
+ * @param dictionary Dictionary of the segment being written
+ * @param base_timestamp Segment timestamp the transaction times are relative to
+ */
+static void putTransactions(ByteBuffer *buffer, const Transaction *transactions, int count,
+                            AddressDictionary *dictionary, int64_t base_timestamp)
+{
+        for (int i = 0; i < count; i++)
+        {
+                putVarint(buffer, internAddress(dictionary, transactions[i].sender));
+                putVarint(buffer, internAddress(dictionary, transactions[i].receiver));
+                putAmount(buffer, transactions[i].amount);
+                putVarint(buffer, zigzagEncode((int64_t)transactions[i].timestamp - base_timestamp));
+        }
+}
+
+/**
+ * Appends a record body, deflated when the file allows it and that makes it smaller
+ * @param buffer Record buffer to append to
+ * @param body Encoded body
+ * @param compress Whether the file allows compressed bodies
+ */
+static void putBody(ByteBuffer *buffer, const ByteBuffer *body, int compress)
+{
+        if (body->failed)
+                buffer->failed = 1;
+
+        if (compress && !body->failed && body->length >= COMPRESS_MIN_SIZE)
+        {
+                uLongf packed_length = compressBound(body->length);
+                unsigned char *packed = (unsigned char *)malloc(packed_length);
+                if (packed && compress2(packed, &packed_length, body->data, body->length, Z_DEFAULT_COMPRESSION) == Z_OK &&
+                    packed_length < body->length)
+                {
+                        putVarint(buffer, BODY_COMPRESSED);
+                        putVarint(buffer, body->length);
+                        putVarint(buffer, packed_length);
+                        putBytes(buffer, packed, packed_length);
+                        free(packed);
+                        return;
+                }
+                free(packed);
+        }
+
+        putVarint(buffer, 0);
+        putBytes(buffer, body->data, body->length);
+}
+
+/**
+ * Reads bytes from an encoded record
+ * @param reader Reader to take the bytes from
+ * @param output Receives the bytes
+ * @param length Number of bytes
+ */
+static void getBytes(ByteReader *reader, void *output, size_t length)
+{
+        if (reader->failed || length > reader->length - reader->position)
+        {
+                reader->failed = 1;
+                memset(output, 0, length);
+                return;
+        }
+        memcpy(output, reader->data + reader->position, length);
+        reader->position += length;
+}
+
+/**
+ * Steps over bytes of an encoded record, returning where they are
+ * @param reader Reader to take the bytes from
+ * @param length Number of bytes
+ * @return Pointer to the bytes, or NULL if the record is too short
+ */
+static const unsigned char *getSpan(ByteReader *reader, uint64_t length)
+{
+        if (reader->failed || length > reader->length - reader->position)
+        {
+                reader->failed = 1;
+                return NULL;
+        }
+        const unsigned char *span = reader->data + reader->position;
+        reader->position += length;
+        return span;
+}
+
+/**
+ * Reads a varint written by putVarint
+ * @param reader Reader to take it from
+ * @return Decoded value, 0 if the record is malformed
+ */
+static uint64_t getVarint(ByteReader *reader)
+{
+        uint64_t value = 0;
+
+        for (int shift = 0; shift < 64 && !reader->failed && reader->position < reader->length; shift += 7)
+        {
+                unsigned char byte = reader->data[reader->position++];
+                value |= (uint64_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                        return value;
+        }
+        reader->failed = 1;
+        return 0;
+}
+
+/**
+ * Reads a hash written by putHash
+ * @param reader Reader to take it from
+ * @param hash Receives the NUL-terminated hash
+ */
+static void getHash(ByteReader *reader, char *hash)
+{
+        static const char digits[] = "0123456789abcdef";
+        uint64_t tag = getVarint(reader);
+
+        hash[0] = '\0';
+        if (tag == HASH_BINARY)
+        {
+                unsigned char binary[HASH_SIZE / 2];
+                getBytes(reader, binary, sizeof(binary));
+                for (int i = 0; i < HASH_SIZE / 2; i++)
+                {
+                        hash[2 * i] = digits[binary[i] >> 4];
+                        hash[2 * i + 1] = digits[binary[i] & 0xF];
+                }
+                hash[HASH_SIZE] = '\0';
+        }
+        else if (tag == HASH_TEXT)
+        {
+                uint64_t length = getVarint(reader);
+                if (length > HASH_SIZE)
+                {
+                        reader->failed = 1;
+                        return;
+                }
+                getBytes(reader, hash, length);
+                hash[length] = '\0';
+        }
+        else
+        {
+                reader->failed = 1;
+        }
+}
+
+/**
+ * Reads an amount written by putAmount
+ * @param reader Reader to take it from
+ * @return Decoded amount
+ */
+static double getAmount(ByteReader *reader)
+{
+        uint64_t value = getVarint(reader);
+        double amount = 0;
+
+        if (value & AMOUNT_RAW)
+                getBytes(reader, &amount, sizeof(double));
+        else
+                amount = (double)zigzagDecode(value >> 1) / 100.0;
+        return amount;
+}
+
+/**
+ * Reads transactions written by putTransactions
+ * @param reader Reader to take them from
+ * @param transactions Receives the transactions
+ * @param count Number of transactions
+ * @param segment Segment the record belongs to
+ */
+static void getTransactions(ByteReader *reader, Transaction *transactions, int count, const SegmentState *segment)
+{
+        for (int i = 0; i < count && !reader->failed; i++)
+        {
+                Transaction *trans = &transactions[i];
+                uint64_t sender = getVarint(reader);
+                uint64_t receiver = getVarint(reader);
+
+                if (sender >= segment->address_count || receiver >= segment->address_count)
+                {
+                        reader->failed = 1;
+                        return;
+                }
+                memset(trans, 0, sizeof(Transaction));
+                strcpy(trans->sender, segment->addresses[sender]);
+                strcpy(trans->receiver, segment->addresses[receiver]);
+                trans->amount = getAmount(reader);
+                trans->timestamp = (time_t)(segment->base_timestamp + zigzagDecode(getVarint(reader)));
+        }
+}
+
+/**
+ * Positions a reader at a record body, inflating it first if it was compressed
+ * @param reader Reader at the body flags; afterwards reads the body itself
+ * @param inflated Receives the inflated body for the caller to free, NULL if stored as is
+ * @return 1 if successful, 0 if the body is malformed
+ */
+static int openBody(ByteReader *reader, unsigned char **inflated)
+{
+        *inflated = NULL;
+        uint64_t flags = getVarint(reader);
+        if (reader->failed || (flags & ~(uint64_t)BODY_COMPRESSED))
+                return 0;
+        if (!(flags & BODY_COMPRESSED))
+                return 1;
+
+        uint64_t length = getVarint(reader);
+        uint64_t packed_length = getVarint(reader);
+        const unsigned char *packed = getSpan(reader, packed_length);
+
+        // Deflate expands at most about 1032:1, which bounds what a damaged record can ask for
+        if (!packed || length > packed_length * 1032 + 64 || length > UINT32_MAX)
+                return 0;
+
+        uLongf inflated_length = (uLongf)length;
+        *inflated = (unsigned char *)malloc(length ? length : 1);
+        if (!*inflated || uncompress(*inflated, &inflated_length, packed, (uLong)packed_length) != Z_OK ||
+            inflated_length != length)
+        {
+                free(*inflated);
+                *inflated = NULL;
+                return 0;
+        }
+
+        reader->data = *inflated;
+        reader->length = length;
+        reader->position = 0;
+        return 1;
+}
+
+/**
+ * Frees the address dictionary of a decoded segment
+ * @param segment Segment to reset
+ */
+static void freeSegment(SegmentState *segment)
+{
+        free(segment->addresses);
+        memset(segment, 0, sizeof(SegmentState));
+        segment->offset = -1;
+}
+
+/**
+ * Decodes a segment record
+ * @param payload Record payload
+ * @param length Payload length
+ * @param offset Offset of the record in the file
+ * @param segment Receives the segment; any previous one is freed
+ * @return 1 if successful, 0 if the record is malformed
+ */
+static int decodeSegmentRecord(const char *payload, uint32_t length, long offset, SegmentState *segment)
+{
+        ByteReader reader = {(const unsigned char *)payload, length, 0, 0};
+
+        freeSegment(segment);
+        segment->base_index = zigzagDecode(getVarint(&reader));
+        segment->base_timestamp = zigzagDecode(getVarint(&reader));
+        uint64_t count = getVarint(&reader);
+
+        // Every address takes at least a byte, which bounds the count
+        if (reader.failed || count > length)
+                return 0;
+        segment->addresses = (char (*)[MAX_SENDER_SIZE])malloc((count ? count : 1) * MAX_SENDER_SIZE);
+        if (!segment->addresses)
+                return 0;
+
+        for (uint64_t i = 0; i < count && !reader.failed; i++)
+        {
+                uint64_t address_length = getVarint(&reader);
+                if (address_length >= MAX_SENDER_SIZE)
+                        return 0;
+                getBytes(&reader, segment->addresses[i], address_length);
+                segment->addresses[i][address_length] = '\0';
+        }
+
+        segment->address_count = (uint32_t)count;
+        segment->offset = offset;
+        return !reader.failed;
+}
+
+/**
+ * Decodes the body of a compact block record into a block allocated from a pool
+ * @param pool Pool receiving the block
+ * @param reader Reader positioned after the segment distance
+ * @param segment Segment the record belongs to
+ * @return Decoded block or NULL if the record is malformed
+ */
+static Block *decodeCompactBlock(ChainPool *pool, ByteReader *reader, const SegmentState *segment)
+{
+        unsigned char *inflated;
+        if (!openBody(reader, &inflated))
+                return NULL;
+
+        Block *block = (Block *)poolAlloc(pool, sizeof(Block));
+        if (!block)
+        {
+                free(inflated);
+                return NULL;
+        }
+        memset(block, 0, sizeof(Block));
+
+        int64_t index = segment->base_index + zigzagDecode(getVarint(reader));
+        block->timestamp = (time_t)(segment->base_timestamp + zigzagDecode(getVarint(reader)));
+        uint64_t data_length = getVarint(reader);
+        const unsigned char *data = data_length <= MAX_BLOCK_DATA_SIZE ? getSpan(reader, data_length) : NULL;
+        getHash(reader, block->previous_hash);
+        getHash(reader, block->hash);
+        uint64_t count = getVarint(reader);
+
+        // Every transaction takes at least four bytes, which bounds the count
+        int ok = !reader->failed && data && index >= 0 && index <= INT32_MAX && count <= MAX_BLOCK_TRANSACTIONS &&
+                 count <= reader->length - reader->position;
+        if (ok)
+        {
+                block->index = (int)index;
+                block->data_length = (int)data_length;
+                block->data = (char *)poolAlloc(pool, data_length + 1);
+                block->transactions = count ? (Transaction *)poolAlloc(pool, count * sizeof(Transaction)) : NULL;
+                block->transaction_count = (int)count;
+                block->transaction_capacity = (int)count;
+                ok = block->data && (count == 0 || block->transactions);
+        }
+        if (ok)
+        {
+                memcpy(block->data, data, data_length);
+                block->data[data_length] = '\0';
+                getTransactions(reader, block->transactions, (int)count, segment);
+                ok = !reader->failed;
+        }
+
+        free(inflated);
+        if (!ok)
+        {
+                freeBlock(pool, block);
+                return NULL;
+        }
+        return block;
+}
+
+/**
+ * Decodes the body of a compact transactions record
+ * @param reader Reader positioned after the segment distance
+ * @param offset Offset of the record in the file
+ * @param segment Segment the record belongs to
+ * @param amend Receives the record; free amend->decoded when done
+ * @return 1 if successful, 0 if the record is malformed
+ */
+static int decodeCompactAmend(ByteReader *reader, long offset, const SegmentState *segment, AmendRecord *amend)
+{
+        unsigned char *inflated;
+
+        memset(amend, 0, sizeof(AmendRecord));
+        if (!openBody(reader, &inflated))
+                return 0;
+
+        getHash(reader, amend->saved_hash);
+        getHash(reader, amend->hash);
+        uint64_t distance = getVarint(reader);
+        uint64_t count = getVarint(reader);
+
+        int ok = !reader->failed && distance <= (uint64_t)offset && count <= MAX_BLOCK_TRANSACTIONS &&
+                 count <= reader->length - reader->position;
+        if (ok)
+        {
+                amend->decoded = (Transaction *)malloc((count ? count : 1) * sizeof(Transaction));
+                ok = amend->decoded != NULL;
+        }
+        if (ok)
+        {
+                getTransactions(reader, amend->decoded, (int)count, segment);
+                ok = !reader->failed;
+        }
+
+        free(inflated);
+        if (!ok)
+        {
+                free(amend->decoded);
+                amend->decoded = NULL;
+                return 0;
+        }
+
+        amend->previous_offset = distance ? (uint64_t)offset - distance : 0;
+        amend->transaction_count = (int)count;
+        amend->transactions = amend->decoded;
+        return 1;
+}
+
+/**
+ * Flushes and fsyncs the records appended to a log
+ * @param log Log to sync
+ * @return 1 if successful, 0 if failed
+ */
+static int syncChainLog(ChainLog *log)
+{
+        if (!log->file)
+                return 1;
+
+        if (fflush(log->file) != 0)
+                return 0;
+        if (log->unsynced_records > 0)
+        {
+                if (fsync(fileno(log->file)) != 0)
+                        return 0;
+                log->unsynced_records = 0;
+        }
+        return 1;
+}
+
+/**
+ * Names the checkpoint file kept beside a chain
+ * @param filename Name of the chain
+ * @return Allocated name for the caller to free, NULL if out of memory
+ */
+static char *checkpointFileName(const char *filename)
+{
+        size_t size = strlen(filename) + 16;
+        char *name = (char *)malloc(size);
+
+        if (name)
+                snprintf(name, size, "%s.checkpoint", filename);
+        return name;
+}
+
+/**
+ * Signs a checkpoint with the configured key
+ * @param checkpoint Checkpoint with every field before the signature set
+ * @param key HMAC key
+ * @param mac Receives the signature
+ */
+static void signCheckpoint(const Checkpoint *checkpoint, const char *key, unsigned char *mac)
+{
+        unsigned int length = SHA256_DIGEST_LENGTH;
+        HMAC(EVP_sha256(), key, (int)strlen(key), (const unsigned char *)checkpoint, offsetof(Checkpoint, mac), mac,
+             &length);
+}
+
+/**
+ * Records the newest block on the active chain whose records are all synced
+ * to the chain's file, so the next load can trust the records before it.
+ * Only written while the chain has a signing key and nothing is left unsynced.
+ * @param chain Pointer to the blockchain
+ */
+static void writeCheckpoint(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+        const char *key = chain->config.checkpoint_key;
+        if (!key || !*key || !log->file || log->unsynced_records > 0)
+                return;
+
+        // Blocks above it are unsaved or have transactions the file does not hold yet
+        Block *block = chain->tip;
+        while (block && (!(block->flags & BLOCK_PERSISTED) || (block->flags & (BLOCK_DIRTY | BLOCK_SNAPSHOT)) ||
+                         block->transaction_count != block->saved_transaction_count))
+                block = block->parent;
+        if (!block)
+                return;
+
+        Checkpoint checkpoint;
+        memset(&checkpoint, 0, sizeof(Checkpoint));
+        memcpy(checkpoint.magic, CHECKPOINT_MAGIC, sizeof(checkpoint.magic));
+        checkpoint.offset = (uint64_t)log->size;
+        checkpoint.height = block->index;
+        memcpy(checkpoint.hash, block->hash, HASH_SIZE + 1);
+        signCheckpoint(&checkpoint, key, checkpoint.mac);
+
+        // Replace the old checkpoint in one step; a lost one only costs a full load
+        char *name = checkpointFileName(log->filename);
+        char *temporary = name ? (char *)malloc(strlen(name) + 8) : NULL;
+        FILE *file = NULL;
+        if (temporary)
+        {
+                sprintf(temporary, "%s.tmp", name);
+                file = fopen(temporary, "wb");
+        }
+        if (file)
+        {
+                int written = fwrite(&checkpoint, sizeof(Checkpoint), 1, file) == 1;
+                if (fclose(file) == 0 && written)
+                        rename(temporary, name);
+                else
+                        unlink(temporary);
+        }
+        free(temporary);
+        free(name);
+}
+
+/**
+ * Reads the checkpoint kept beside a chain, checking its signature
+ * @param filename Name of the chain
+ * @param key HMAC key, NULL if there is none
+ * @param checkpoint Receives the checkpoint
+ * @return 1 if there is a checkpoint signed with the key, 0 if not
+ */
+static int readCheckpoint(const char *filename, const char *key, Checkpoint *checkpoint)
+{
+        unsigned char mac[SHA256_DIGEST_LENGTH];
+        if (!key || !*key)
+                return 0;
+
+        char *name = checkpointFileName(filename);
+        FILE *file = name ? fopen(name, "rb") : NULL;
+        int ok = file && fread(checkpoint, sizeof(Checkpoint), 1, file) == 1;
+        if (file)
+                fclose(file);
+        free(name);
+        if (!ok || memcmp(checkpoint->magic, CHECKPOINT_MAGIC, sizeof(checkpoint->magic)) != 0 ||
+            checkpoint->hash[HASH_SIZE] != '\0' || checkpoint->height < 0)
+                return 0;
+
+        signCheckpoint(checkpoint, key, mac);
+        return CRYPTO_memcmp(mac, checkpoint->mac, SHA256_DIGEST_LENGTH) == 0;
+}
+
+/**
+ * Names the state snapshot kept beside a chain
+ * @param filename Name of the chain
+ * @return Allocated name for the caller to free, NULL if out of memory
+ */
+static char *stateFileName(const char *filename)
+{
+        size_t size = strlen(filename) + 16;
+        char *name = (char *)malloc(size);
+
+        if (name)
+                snprintf(name, size, "%s.state", filename);
+        return name;
+}
+
+/**
+ * Signs a state snapshot's header, whose checksum covers its balances
+ * @param header Header with every field before the signature set
+ * @param key HMAC key
+ * @param mac Receives the signature
+ */
+static void signStateSnapshot(const StateHeader *header, const char *key, unsigned char *mac)
+{
+        unsigned int length = SHA256_DIGEST_LENGTH;
+        HMAC(EVP_sha256(), key, (int)strlen(key), (const unsigned char *)header, offsetof(StateHeader, mac), mac,
+             &length);
+}
+
+/**
+ * Orders balances by the address of their account, for bsearch
+ * @param a First balance
+ * @param b Second balance
+ * @return Negative, zero or positive
+ */
+static int compareStateBalances(const void *a, const void *b)
+{
+        uintptr_t left = (uintptr_t)((const StateBalance *)a)->account;
+        uintptr_t right = (uintptr_t)((const StateBalance *)b)->account;
+        return (left > right) - (left < right);
+}
+
+/**
+ * Writes the balances as of a block just below the tip to name.state, once the
+ * saves have gone the configured number of blocks past the last snapshot. The
+ * block needs a saved child, so its hash can no longer change, and the
+ * balances are wound back to it through the undo data of the blocks above.
+ * @param chain Pointer to the blockchain
+ */
+static void writeStateSnapshot(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+        if (chain->config.state_snapshot_blocks <= 0 || !log->file || !chain->tip)
+                return;
+
+        Block *child = chain->tip;
+        while (child->parent && !((child->flags & BLOCK_PERSISTED) && (child->parent->flags & BLOCK_PERSISTED)))
+                child = child->parent;
+        Block *block = child->parent;
+        if (!block || block->index - chain->state_height < chain->config.state_snapshot_blocks)
+                return;
+        for (Block *current = chain->tip; current != block; current = current->parent)
+        {
+                if (!current->undo)
+                        return;
+        }
+
+        size_t count = chain->account_count;
+        StateBalance *balances = (StateBalance *)malloc((count ? count : 1) * sizeof(StateBalance));
+        StateEntry *entries = (StateEntry *)calloc(count ? count : 1, sizeof(StateEntry));
+        if (!balances || !entries)
+        {
+                free(balances);
+                free(entries);
+                return;
+        }
+
+        size_t n = 0;
+        for (size_t i = 0; i < chain->accounts_size; i++)
+        {
+                for (Account *account = chain->accounts[i]; account; account = account->next, n++)
+                {
+                        balances[n].account = account;
+                        balances[n].balance = account->balance;
+                }
+        }
+        qsort(balances, count, sizeof(StateBalance), compareStateBalances);
+
+        // Each account ends up with the balance it had before the first change above the block
+        for (Block *current = chain->tip; current != block; current = current->parent)
+        {
+                for (int i = current->undo->count - 1; i >= 0; i--)
+                {
+                        StateBalance key = {current->undo->entries[i].account, 0.0};
+                        StateBalance *found = (StateBalance *)bsearch(&key, balances, count, sizeof(StateBalance),
+                                                                      compareStateBalances);
+                        if (found)
+                                found->balance = current->undo->entries[i].previous_balance;
+                }
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+                memcpy(entries[i].address, balances[i].account->address, MAX_SENDER_SIZE);
+                entries[i].balance = balances[i].balance;
+        }
+        free(balances);
+
+        StateHeader header;
+        memset(&header, 0, sizeof(StateHeader));
+        memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+        header.version = STATE_VERSION;
+        header.height = block->index;
+        memcpy(header.hash, block->hash, HASH_SIZE + 1);
+        header.account_count = count;
+        header.checksum = crc32c(0, entries, count * sizeof(StateEntry));
+        if (chain->config.checkpoint_key && *chain->config.checkpoint_key)
+                signStateSnapshot(&header, chain->config.checkpoint_key, header.mac);
+
+        // Replace the old snapshot in one step; a lost one only costs applying every block
+        char *name = stateFileName(log->filename);
+        char *temporary = name ? (char *)malloc(strlen(name) + 8) : NULL;
+        FILE *file = NULL;
+        if (temporary)
+        {
+                sprintf(temporary, "%s.tmp", name);
+                file = fopen(temporary, "wb");
+        }
+        if (file)
+        {
+                int written = fwrite(&header, sizeof(StateHeader), 1, file) == 1 &&
+                              fwrite(entries, sizeof(StateEntry), count, file) == count;
+                if (fclose(file) == 0 && written && rename(temporary, name) == 0)
+                        chain->state_height = block->index;
+                else
+                        unlink(temporary);
+        }
+        free(temporary);
+        free(name);
+        free(entries);
+}
+
+/**
+ * Frees a state snapshot read by readStateSnapshot
+ * @param state Snapshot to free, NULL for none
+ */
+static void freeStateSnapshot(StateSnapshot *state)
+{
+        if (!state)
+                return;
+        free(state->entries);
+        free(state);
+}
+
+/**
+ * Reads the state snapshot kept beside a chain, checking its checksum, and
+ * its signature when there is a key to check it with
+ * @param filename Name of the chain
+ * @param key HMAC key, NULL if there is none
+ * @return The snapshot, or NULL if there is none that can be trusted
+ */
+static StateSnapshot *readStateSnapshot(const char *filename, const char *key)
+{
+        unsigned char mac[SHA256_DIGEST_LENGTH];
+        struct stat info;
+
+        char *name = stateFileName(filename);
+        FILE *file = name ? fopen(name, "rb") : NULL;
+        free(name);
+        StateSnapshot *state = file ? (StateSnapshot *)calloc(1, sizeof(StateSnapshot)) : NULL;
+        StateHeader *header = state ? &state->header : NULL;
+        int ok = state && fstat(fileno(file), &info) == 0 && fread(header, sizeof(StateHeader), 1, file) == 1 &&
+                 memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == STATE_VERSION && header->hash[HASH_SIZE] == '\0' && header->height >= 0 &&
+                 header->account_count == (uint64_t)(info.st_size - sizeof(StateHeader)) / sizeof(StateEntry) &&
+                 (uint64_t)info.st_size == sizeof(StateHeader) + header->account_count * sizeof(StateEntry);
+        if (ok)
+        {
+                state->entries = (StateEntry *)malloc((header->account_count ? header->account_count : 1) *
+                                                      sizeof(StateEntry));
+                ok = state->entries && fread(state->entries, sizeof(StateEntry), header->account_count, file) ==
+                                               header->account_count;
+        }
+        if (file)
+                fclose(file);
+        ok = ok && crc32c(0, state->entries, header->account_count * sizeof(StateEntry)) == header->checksum;
+        if (ok && key && *key)
+        {
+                signStateSnapshot(header, key, mac);
+                ok = CRYPTO_memcmp(mac, header->mac, SHA256_DIGEST_LENGTH) == 0;
+        }
+        if (!ok)
+        {
+                freeStateSnapshot(state);
+                return NULL;
+        }
+
+        for (uint64_t i = 0; i < header->account_count; i++)
+                state->entries[i].address[MAX_SENDER_SIZE - 1] = '\0';
+        return state;
+}
+
+/**
+ * Flushes and fsyncs the records appended to the chain's file, once any save in flight is done
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if failed
+ */
+static int syncBlockchainLocked(Blockchain *chain)
+{
+        if (!chain)
+                return 1;
+
+        waitForSaveLocked(chain);
+        if (!syncChainLog(&chain->log))
+                return 0;
+        writeCheckpoint(chain);
+        return 1;
+}
+
+/**
+ * Names a segment file of a chain: the chain's own name for the first, then name.1, name.2, ...
+ * @param filename Name of the chain
+ * @param segment Number of the segment
+ * @return Allocated name for the caller to free, NULL if out of memory
+ */
+static char *segmentFileName(const char *filename, int segment)
+{
+        size_t size = strlen(filename) + 16;
+        char *name = (char *)malloc(size);
+
+        if (name && segment == 0)
+                snprintf(name, size, "%s", filename);
+        else if (name)
+                snprintf(name, size, "%s.%d", filename, segment);
+        return name;
+}
+
+/**
+ * Opens the segment file the log is positioned at, writing the header of a new one
+ * @param log Log with its filename, segment, base and layout set
+ * @param truncate Start the file over instead of appending to it
+ * @return 1 if successful, 0 if failed
+ */
+static int openLogFile(ChainLog *log, int truncate)
+{
+        char *name = segmentFileName(log->filename, log->segment);
+        if (!name)
+                return 0;
+
+        // One appender per chain, in this process or any other: the first file is locked, whichever segment is
+        // appended to, and before anything is cut
+        if (!log->locked)
+        {
+                log->lock_fd = open(log->filename, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+                if (log->lock_fd < 0)
+                {
+                        reportMessage("Error: Could not open file for writing");
+                        free(name);
+                        return 0;
+                }
+                if (flock(log->lock_fd, LOCK_EX | LOCK_NB) != 0)
+                {
+                        reportMessage("Error: %s is already open for writing", log->filename);
+                        close(log->lock_fd);
+                        free(name);
+                        return 0;
+                }
+                log->locked = 1;
+        }
+
+        log->file = fopen(name, truncate ? "wb" : "ab");
+        if (!log->file)
+        {
+                reportMessage("Error: Could not open file for writing");
+                free(name);
+                return 0;
+        }
+
+        // Records reach the kernel in large batches rather than field by field
+        if (!log->buffer)
+                log->buffer = (char *)malloc(LOG_BUFFER_SIZE);
+        if (log->buffer)
+                setvbuf(log->file, log->buffer, _IOFBF, LOG_BUFFER_SIZE);
+
+        fseek(log->file, 0, SEEK_END);
+        log->size = log->base + ftell(log->file);
+
+        // A new file starts with the header describing its records
+        if (truncate)
+        {
+                FileHeader header;
+                memset(&header, 0, sizeof(FileHeader));
+                memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+                header.version = FILE_VERSION;
+                header.byte_order = FILE_BYTE_ORDER;
+                header.layout_flags = log->layout_flags;
+                header.header_size = sizeof(FileHeader);
+                header.segment = (uint32_t)log->segment;
+                header.base_offset = (uint64_t)log->base;
+                memcpy(header.boundary_hash, log->last_hash, HASH_SIZE + 1);
+                if (fwrite(&header, sizeof(FileHeader), 1, log->file) != 1)
+                {
+                        reportMessage("Error: Could not write to %s", name);
+                        fclose(log->file);
+                        log->file = NULL;
+                        free(name);
+                        return 0;
+                }
+                log->size = log->base + sizeof(FileHeader);
+        }
+        free(name);
+        return 1;
+}
+
+/**
+ * Opens the file the chain appends its records to
+ * @param chain Pointer to the blockchain
+ * @param filename Name of the chain
+ * @param segment Segment file to append to; a new chain starts at 0
+ * @param base Chain offset of that segment file
+ * @param truncate Start the chain over instead of appending to it
+ * @return 1 if successful, 0 if failed
+ */
+static int openChainLog(Blockchain *chain, const char *filename, int segment, long base, int truncate)
+{
+        ChainLog *log = &chain->log;
+        char *name = strdup(filename);
+        if (!name)
+                return 0;
+
+        closeChainLog(chain);
+        log->filename = name;
+        log->segment = segment;
+        log->base = base;
+
+        if (truncate)
+                log->layout_flags = chain->config.file_layout ? chain->config.file_layout : LAYOUT_ALIGNED;
+
+        if (!openLogFile(log, truncate))
+        {
+                closeChainLog(chain);
+                return 0;
+        }
+
+        // Segments of whatever chain was saved under this name before would be loaded after it
+        for (int i = 1; truncate; i++)
+        {
+                char *old = segmentFileName(filename, i);
+                int removed = old && unlink(old) == 0;
+                free(old);
+                if (!removed)
+                        break;
+        }
+        return 1;
+}
+
+/**
+ * Computes the hash a block had when it was last saved
+ * @param block Saved block
+ * @param output Buffer receiving the hash
+ */
+static void calculateSavedHash(Block *block, char *output)
+{
+        // Hashed from a copy, since lock-free readers may be reading the block's count
+        Block saved = *block;
+        saved.transaction_count = block->saved_transaction_count;
+        calculateHash(&saved, output);
+}
+
+/**
+ * Reads the leading 64 bits of a hex block hash, the key the footer index hashes on
+ * @param hash Hex block hash
+ * @return Key of the hash
+ */
+static uint64_t hashIndexKey(const char *hash)
+{
+        uint64_t key = 0;
+        for (int i = 0; i < 16 && hash[i]; i++)
+        {
+                int digit = hexValue(hash[i]);
+                key = (key << 4) | (uint64_t)(digit < 0 ? 0 : digit);
+        }
+        return key;
+}
+
+/**
+ * Checks whether the current segment file holds a saved block's record or its newest transactions
+ * @param log Log of the chain
+ * @param block Saved block
+ * @return 1 if the segment's index covers the block, 0 if an older one does
+ */
+static int segmentHoldsBlock(const ChainLog *log, const Block *block)
+{
+        return (block->flags & BLOCK_PERSISTED) && (block->file_offset >= log->base || block->amend_offset >= log->base);
+}
+
+/**
+ * Appends the footer index of the segment file's blocks, followed by the trailer locating it
+ * @param chain Chain whose file is being closed
+ * @return 1 if successful, 0 if failed
+ */
+static int writeFileIndex(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+        long start = log->size;
+        IndexRecord index;
+        FileTrailer trailer;
+        char hash[HASH_SIZE + 1];
+
+        memset(&index, 0, sizeof(IndexRecord));
+        for (Block *current = chain->log_head; current; current = current->log_next)
+        {
+                if (segmentHoldsBlock(log, current))
+                {
+                        index.entry_count++;
+                        if (current->index + 1 > (int)index.height_count &&
+                            getAncestor(chain->tip, current->index) == current)
+                                index.height_count = current->index + 1;
+                }
+        }
+        index.slot_count = INDEX_MIN_SLOTS;
+        while (index.slot_count < 2 * index.entry_count)
+                index.slot_count *= 2;
+
+        IndexEntry *entries = (IndexEntry *)calloc(index.entry_count ? index.entry_count : 1, sizeof(IndexEntry));
+        uint32_t *heights = (uint32_t *)malloc((index.height_count ? index.height_count : 1) * sizeof(uint32_t));
+        uint32_t *slots = (uint32_t *)calloc(index.slot_count, sizeof(uint32_t));
+        int ok = entries && heights && slots;
+
+        if (ok)
+        {
+                uint32_t entry = 0;
+                for (uint32_t i = 0; i < index.height_count; i++)
+                        heights[i] = INDEX_NO_ENTRY;
+
+                for (Block *current = chain->log_head; current; current = current->log_next)
+                {
+                        if (!segmentHoldsBlock(log, current))
+                                continue;
+
+                        // Unsaved transactions are not in the file, so index the hash it has there
+                        if (current->flags & BLOCK_DIRTY)
+                                calculateSavedHash(current, hash);
+                        else
+                                memcpy(hash, current->hash, HASH_SIZE + 1);
+
+                        entries[entry].offset = (uint64_t)current->file_offset;
+                        entries[entry].amend_offset = (uint64_t)current->amend_offset;
+                        entries[entry].key = hashIndexKey(hash);
+
+                        uint32_t slot = (uint32_t)entries[entry].key & (index.slot_count - 1);
+                        while (slots[slot])
+                                slot = (slot + 1) & (index.slot_count - 1);
+                        slots[slot] = entry + 1;
+
+                        if ((uint32_t)current->index < index.height_count &&
+                            getAncestor(chain->tip, current->index) == current)
+                                heights[current->index] = entry;
+                        entry++;
+                }
+
+                RecordPart parts[] = {
+                    {&index, sizeof(IndexRecord)},
+                    {entries, index.entry_count * sizeof(IndexEntry)},
+                    {heights, index.height_count * sizeof(uint32_t)},
+                    {slots, index.slot_count * sizeof(uint32_t)},
+                };
+                memset(&trailer, 0, sizeof(FileTrailer));
+                trailer.index_offset = (uint64_t)(start - log->base);
+                memcpy(trailer.magic, FILE_TRAILER_MAGIC, sizeof(trailer.magic));
+
+                ok = writeRecord(log, RECORD_INDEX, parts, 4) &&
+                     fwrite(&trailer, sizeof(FileTrailer), 1, log->file) == 1;
+        }
+
+        free(entries);
+        free(heights);
+        free(slots);
+
+        if (!ok)
+        {
+                // Leave the file ending on its last block rather than half an index
+                fflush(log->file);
+                if (ftruncate(fileno(log->file), start - log->base) == 0)
+                        fseek(log->file, start - log->base, SEEK_SET);
+                log->size = start;
+                return 0;
+        }
+
+        log->index_offset = start;
+        log->size += sizeof(FileTrailer);
+        log->unsynced_records++;
+        return 1;
+}
+
+/**
+ * Cuts the footer index off the end of the chain file so records can be appended
+ * @param log Log about to be appended to
+ * @return 1 if successful, 0 if failed
+ */
+static int dropFileIndex(ChainLog *log)
+{
+        if (!log->index_offset)
+                return 1;
+
+        fflush(log->file);
+        if (ftruncate(fileno(log->file), log->index_offset - log->base) != 0)
+                return 0;
+        fseek(log->file, log->index_offset - log->base, SEEK_SET);
+        log->size = log->index_offset;
+        log->index_offset = 0;
+        return 1;
+}
+
+/**
+ * Names the index file kept beside a chain
+ * @param filename Name of the chain
+ * @return Allocated name for the caller to free, NULL if out of memory
+ */
+static char *indexFileName(const char *filename)
+{
+        size_t size = strlen(filename) + 16;
+        char *name = (char *)malloc(size);
+
+        if (name)
+                snprintf(name, size, "%s.index", filename);
+        return name;
+}
+
+/**
+ * Finds a page of an index file in its mapping
+ * @param index Index file
+ * @param page Page number
+ * @return The page
+ */
+static BTreeNode *indexPage(const ChainIndex *index, uint32_t page)
+{
+        return (BTreeNode *)(index->base + (size_t)page * BTREE_PAGE_SIZE);
+}
+
+/**
+ * Tells whether a page lies within an index file's mapping. A lookup maps the
+ * file as it was when opened, while saves may go on adding pages past it.
+ * @param index Index file
+ * @param page Page number
+ * @return 1 if the page can be read, 0 if not
+ */
+static int indexPageMapped(const ChainIndex *index, uint32_t page)
+{
+        return (size_t)page < index->mapped / BTREE_PAGE_SIZE;
+}
+
+/**
+ * Finds the header of an index file
+ * @param index Index file
+ * @return Its header, on the first page
+ */
+static BTreeHeader *indexHeader(const ChainIndex *index)
+{
+        return (BTreeHeader *)index->base;
+}
+
+/**
+ * Fills in the shape of each tree in a new index file
+ * @param header Header to fill in
+ */
+static void initIndexHeader(BTreeHeader *header)
+{
+        static const uint32_t key_sizes[BTREE_TREES] = {BTREE_HASH_KEY, BTREE_ADDRESS_KEY, BTREE_TIME_KEY,
+                                                        BTREE_HEIGHT_KEY};
+        static const uint32_t value_sizes[BTREE_TREES] = {sizeof(HashIndexValue), sizeof(AddressIndexValue),
+                                                          sizeof(TimeIndexValue), sizeof(HeightIndexValue)};
+
+        memset(header, 0, sizeof(BTreeHeader));
+        memcpy(header->magic, BTREE_MAGIC, sizeof(header->magic));
+        header->version = BTREE_VERSION;
+        header->page_size = BTREE_PAGE_SIZE;
+        header->page_count = 1;
+        header->clean = 1;
+        for (int i = 0; i < BTREE_TREES; i++)
+        {
+                header->trees[i].key_size = key_sizes[i];
+                header->trees[i].value_size = value_sizes[i];
+        }
+}
+
+/**
+ * Maps an index file whole, creating it afresh if asked to
+ * @param name Name of the index file
+ * @param writable Map it for a chain's saves to update rather than for lookups
+ * @param create Start it over, empty
+ * @return The index, or NULL if it is missing, unreadable or of another shape
+ */
+static ChainIndex *mapIndexFile(const char *name, int writable, int create)
+{
+        struct stat info;
+        BTreeHeader expected;
+
+        ChainIndex *index = (ChainIndex *)calloc(1, sizeof(ChainIndex));
+        if (!index)
+                return NULL;
+        index->fd = open(name, writable ? O_RDWR | (create ? O_CREAT | O_TRUNC : 0) : O_RDONLY, 0644);
+        if (index->fd < 0 || (create && ftruncate(index->fd, BTREE_GROW_PAGES * BTREE_PAGE_SIZE) != 0) ||
+            fstat(index->fd, &info) != 0 || info.st_size < BTREE_PAGE_SIZE || info.st_size % BTREE_PAGE_SIZE != 0)
+        {
+                if (index->fd >= 0)
+                        close(index->fd);
+                free(index);
+                return NULL;
+        }
+
+        index->mapped = (size_t)info.st_size;
+        index->base = (unsigned char *)mmap(NULL, index->mapped, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                                            MAP_SHARED, index->fd, 0);
+        if (index->base == MAP_FAILED)
+        {
+                close(index->fd);
+                free(index);
+                return NULL;
+        }
+
+        initIndexHeader(&expected);
+        BTreeHeader *header = indexHeader(index);
+        if (create)
+                *header = expected;
+
+        // Trees of another shape or pages past the end would be misread
+        int ok = memcmp(header->magic, expected.magic, sizeof(header->magic)) == 0 && header->version == BTREE_VERSION &&
+                 header->page_size == BTREE_PAGE_SIZE && header->page_count >= 1 &&
+                 (size_t)header->page_count * BTREE_PAGE_SIZE <= index->mapped;
+        for (int i = 0; ok && i < BTREE_TREES; i++)
+                ok = header->trees[i].key_size == expected.trees[i].key_size &&
+                     header->trees[i].value_size == expected.trees[i].value_size &&
+                     header->trees[i].root < header->page_count && header->trees[i].depth <= BTREE_MAX_DEPTH;
+        if (!ok)
+        {
+                munmap(index->base, index->mapped);
+                close(index->fd);
+                free(index);
+                return NULL;
+        }
+        return index;
+}
+
+/**
+ * Unmaps an index file
+ * @param index Index file, NULL for none
+ */
+static void unmapIndexFile(ChainIndex *index)
+{
+        if (!index)
+                return;
+
+        munmap(index->base, index->mapped);
+        close(index->fd);
+        free(index);
+}
+
+/**
+ * Marks an index file unclean on disk before its first change, so a crash
+ * that leaves its pages half written is caught when it is next opened
+ * @param index Index file about to change
+ * @return 1 if successful, 0 if the mark could not be synced
+ */
+static int touchIndexFile(ChainIndex *index)
+{
+        if (index->dirty)
+                return 1;
+
+        indexHeader(index)->clean = 0;
+        if (msync(index->base, BTREE_PAGE_SIZE, MS_SYNC) != 0)
+                return 0;
+        index->dirty = 1;
+        return 1;
+}
+
+/**
+ * Syncs the changed pages of an index file and only then marks it clean, so
+ * lookups can trust it again until the next save starts changing it
+ * @param index Index file that was changed
+ * @return 1 if successful, 0 if the pages could not be synced
+ */
+static int commitIndexFile(ChainIndex *index)
+{
+        if (!index->dirty)
+                return 1;
+        if (msync(index->base, index->mapped, MS_SYNC) != 0)
+                return 0;
+
+        indexHeader(index)->clean = 1;
+        if (msync(index->base, BTREE_PAGE_SIZE, MS_SYNC) != 0)
+                return 0;
+        index->dirty = 0;
+        return 1;
+}
+
+/**
+ * Takes a fresh page at the end of an index file, growing the file and its mapping when full.
+ * Growing can move the mapping, so node pointers taken before are stale afterwards.
+ * @param index Index file
+ * @return Number of the zeroed page, 0 if the file could not grow
+ */
+static uint32_t allocateIndexPage(ChainIndex *index)
+{
+        BTreeHeader *header = indexHeader(index);
+
+        if ((size_t)(header->page_count + 1) * BTREE_PAGE_SIZE > index->mapped)
+        {
+                // Grow by half again, so a large index is remapped only a handful of times
+                size_t grown = index->mapped + index->mapped / 2;
+                if (grown < index->mapped + BTREE_GROW_PAGES * BTREE_PAGE_SIZE)
+                        grown = index->mapped + BTREE_GROW_PAGES * BTREE_PAGE_SIZE;
+                grown -= grown % BTREE_PAGE_SIZE;
+                if (grown / BTREE_PAGE_SIZE > UINT32_MAX || ftruncate(index->fd, (off_t)grown) != 0)
+                        return 0;
+                // The pages live in the file, so the mapping can be dropped and taken again larger
+                void *moved = mmap(NULL, grown, PROT_READ | PROT_WRITE, MAP_SHARED, index->fd, 0);
+                if (moved == MAP_FAILED)
+                        return 0;
+                munmap(index->base, index->mapped);
+                index->base = (unsigned char *)moved;
+                index->mapped = grown;
+                header = indexHeader(index);
+        }
+
+        uint32_t page = header->page_count++;
+        memset(indexPage(index, page), 0, BTREE_PAGE_SIZE);
+        return page;
+}
+
+/**
+ * Bytes one entry of a node takes
+ * @param tree Tree the node belongs to
+ * @param leaf Whether the node is a leaf
+ * @return Key and value size for a leaf, key and child page size for an inner node
+ */
+static size_t btreeEntrySize(const BTreeRoot *tree, int leaf)
+{
+        return tree->key_size + (leaf ? tree->value_size : sizeof(uint32_t));
+}
+
+/**
+ * Finds an entry of a node
+ * @param node Node
+ * @param tree Tree the node belongs to
+ * @param position Entry number
+ * @return The entry's key, followed by its value or child page
+ */
+static unsigned char *btreeEntry(BTreeNode *node, const BTreeRoot *tree, int position)
+{
+        return node->entries + (size_t)position * btreeEntrySize(tree, node->leaf);
+}
+
+/**
+ * Reads the child page stored after an inner node's key
+ * @param node Inner node
+ * @param tree Tree the node belongs to
+ * @param position Entry number, -1 for the child left of the first key
+ * @return Child page
+ */
+static uint32_t btreeChild(BTreeNode *node, const BTreeRoot *tree, int position)
+{
+        uint32_t child;
+
+        if (position < 0)
+                return node->link;
+        memcpy(&child, btreeEntry(node, tree, position) + tree->key_size, sizeof(uint32_t));
+        return child;
+}
+
+/**
+ * Counts a node's entries whose key is below a key, or not above it
+ * @param node Node to search
+ * @param tree Tree the node belongs to
+ * @param key Key to place
+ * @param inclusive Count equal keys as well
+ * @return Number of entries before the key's place
+ */
+static int btreeRank(BTreeNode *node, const BTreeRoot *tree, const unsigned char *key, int inclusive)
+{
+        int low = 0;
+        int high = node->count;
+
+        while (low < high)
+        {
+                int middle = (low + high) / 2;
+                int order = memcmp(btreeEntry(node, tree, middle), key, tree->key_size);
+                if (order < 0 || (inclusive && order == 0))
+                        low = middle + 1;
+                else
+                        high = middle;
+        }
+        return low;
+}
+
+/**
+ * Walks from the root of a tree down to the leaf where a key belongs
+ * @param index Index file
+ * @param tree Tree to search
+ * @param key Key to place
+ * @param path Receives the inner pages passed through, root first; may be NULL
+ * @param rightmost Receives whether every step took the last child; may be NULL
+ * @return Page of the leaf, 0 if the tree is empty
+ */
+static uint32_t btreeDescend(const ChainIndex *index, const BTreeRoot *tree, const unsigned char *key, uint32_t *path,
+                             int *rightmost)
+{
+        uint32_t page = tree->root;
+
+        if (rightmost)
+                *rightmost = 1;
+        for (uint32_t level = 0; page && level + 1 < tree->depth; level++)
+        {
+                if (!indexPageMapped(index, page))
+                        return 0;
+                BTreeNode *node = indexPage(index, page);
+                int position = btreeRank(node, tree, key, 1) - 1;
+                if (path)
+                        path[level] = page;
+                if (rightmost && position != node->count - 1)
+                        *rightmost = 0;
+                page = btreeChild(node, tree, position);
+        }
+        return indexPageMapped(index, page) ? page : 0;
+}
+
+/**
+ * Adds an entry to a node that has room for it
+ * @param node Node to add to
+ * @param tree Tree the node belongs to
+ * @param position Place of the entry
+ * @param entry Key followed by the value or child page
+ */
+static void btreePlace(BTreeNode *node, const BTreeRoot *tree, int position, const unsigned char *entry)
+{
+        size_t size = btreeEntrySize(tree, node->leaf);
+        unsigned char *at = btreeEntry(node, tree, position);
+
+        memmove(at + size, at, (size_t)(node->count - position) * size);
+        memcpy(at, entry, size);
+        node->count++;
+}
+
+/**
+ * Adds or replaces an entry in one of an index file's trees, splitting full
+ * nodes on the way back up. A full rightmost node that gains a key at its end
+ * keeps its entries and starts a new node, so keys added in order fill pages.
+ * @param index Index file open for writing
+ * @param which BTREE_BY_* tree
+ * @param key Key of the entry
+ * @param value Value of the entry
+ * @return 1 if successful, 0 if the file could not grow
+ */
+static int btreeInsert(ChainIndex *index, int which, const unsigned char *key, const void *value)
+{
+        uint32_t path[BTREE_MAX_DEPTH];
+        unsigned char entry[BTREE_MAX_ENTRY];
+        unsigned char merged[BTREE_PAGE_SIZE + BTREE_MAX_ENTRY];
+        int rightmost;
+
+        BTreeRoot *tree = &indexHeader(index)->trees[which];
+        if (!tree->root)
+        {
+                uint32_t root = allocateIndexPage(index);
+                if (!root)
+                        return 0;
+                tree = &indexHeader(index)->trees[which];
+                indexPage(index, root)->leaf = 1;
+                tree->root = root;
+                tree->depth = 1;
+        }
+
+        uint32_t page = btreeDescend(index, tree, key, path, &rightmost);
+        BTreeNode *node = indexPage(index, page);
+        int position = btreeRank(node, tree, key, 0);
+        if (position < node->count && memcmp(btreeEntry(node, tree, position), key, tree->key_size) == 0)
+        {
+                memcpy(btreeEntry(node, tree, position) + tree->key_size, value, tree->value_size);
+                return 1;
+        }
+
+        memcpy(entry, key, tree->key_size);
+        memcpy(entry + tree->key_size, value, tree->value_size);
+        tree->entries++;
+
+        // Split from the leaf up for as long as the node gaining an entry is full
+        for (int level = (int)tree->depth - 1;; level--)
+        {
+                size_t size = btreeEntrySize(tree, node->leaf);
+                int capacity = (int)(sizeof(node->entries) / size);
+                if (node->count < capacity)
+                {
+                        btreePlace(node, tree, position, entry);
+                        return 1;
+                }
+
+                int leaf = node->leaf;
+                int total = node->count + 1;
+                int append = rightmost && position == node->count;
+                memcpy(merged, node->entries, (size_t)position * size);
+                memcpy(merged + (size_t)position * size, entry, size);
+                memcpy(merged + (size_t)(position + 1) * size, btreeEntry(node, tree, position),
+                       (size_t)(node->count - position) * size);
+
+                uint32_t right_page = allocateIndexPage(index);
+                if (!right_page)
+                {
+                        tree->entries--;
+                        return 0;
+                }
+                tree = &indexHeader(index)->trees[which];
+                node = indexPage(index, page);
+                BTreeNode *right = indexPage(index, right_page);
+                right->leaf = (uint16_t)leaf;
+
+                // A leaf's first right key is copied up; an inner node's middle key moves up, its child going left of the right node
+                int split = append ? total - 1 : total / 2;
+                node->count = (uint16_t)split;
+                memcpy(node->entries, merged, (size_t)split * size);
+                if (leaf)
+                {
+                        right->count = (uint16_t)(total - split);
+                        memcpy(right->entries, merged + (size_t)split * size, (size_t)right->count * size);
+                        right->link = node->link;
+                        node->link = right_page;
+                        memcpy(entry, right->entries, tree->key_size);
+                }
+                else
+                {
+                        right->count = (uint16_t)(total - split - 1);
+                        memcpy(&right->link, merged + (size_t)split * size + tree->key_size, sizeof(uint32_t));
+                        memcpy(right->entries, merged + (size_t)(split + 1) * size, (size_t)right->count * size);
+                        memcpy(entry, merged + (size_t)split * size, tree->key_size);
+                }
+                memcpy(entry + tree->key_size, &right_page, sizeof(uint32_t));
+
+                if (level == 0)
+                {
+                        // The root split, so the tree grows a level
+                        uint32_t root = allocateIndexPage(index);
+                        if (!root)
+                                return 0;
+                        tree = &indexHeader(index)->trees[which];
+                        BTreeNode *top = indexPage(index, root);
+                        top->link = tree->root;
+                        btreePlace(top, tree, 0, entry);
+                        tree->root = root;
+                        tree->depth++;
+                        return tree->depth <= BTREE_MAX_DEPTH;
+                }
+                page = path[level - 1];
+                node = indexPage(index, page);
+                position = btreeRank(node, tree, entry, 1);
+        }
+}
+
+/**
+ * Looks an entry up in one of an index file's trees
+ * @param index Index file
+ * @param which BTREE_BY_* tree
+ * @param key Key of the entry
+ * @param value Receives the value, may be NULL
+ * @return 1 if found, 0 if not
+ */
+static int btreeFind(const ChainIndex *index, int which, const unsigned char *key, void *value)
+{
+        const BTreeRoot *tree = &indexHeader(index)->trees[which];
+        uint32_t page = btreeDescend(index, tree, key, NULL, NULL);
+        if (!page)
+                return 0;
+
+        BTreeNode *node = indexPage(index, page);
+        int position = btreeRank(node, tree, key, 0);
+        if (position >= node->count || memcmp(btreeEntry(node, tree, position), key, tree->key_size) != 0)
+                return 0;
+        if (value)
+                memcpy(value, btreeEntry(node, tree, position) + tree->key_size, tree->value_size);
+        return 1;
+}
+
+/**
+ * Removes an entry from one of an index file's trees. Nodes are not merged:
+ * the trees mostly grow, and a leaf left sparse or empty is still searched
+ * and walked correctly.
+ * @param index Index file open for writing
+ * @param which BTREE_BY_* tree
+ * @param key Key of the entry
+ */
+static void btreeRemove(ChainIndex *index, int which, const unsigned char *key)
+{
+        BTreeRoot *tree = &indexHeader(index)->trees[which];
+        uint32_t page = btreeDescend(index, tree, key, NULL, NULL);
+        if (!page)
+                return;
+
+        BTreeNode *node = indexPage(index, page);
+        int position = btreeRank(node, tree, key, 0);
+        if (position >= node->count || memcmp(btreeEntry(node, tree, position), key, tree->key_size) != 0)
+                return;
+
+        size_t size = btreeEntrySize(tree, 1);
+        unsigned char *at = btreeEntry(node, tree, position);
+        memmove(at, at + size, (size_t)(node->count - position - 1) * size);
+        node->count--;
+        tree->entries--;
+}
+
+/**
+ * Places a cursor on the first entry of a tree whose key is not below a key, or above it
+ * @param index Index file
+ * @param which BTREE_BY_* tree
+ * @param key Key to start from
+ * @param after Skip an entry with exactly that key
+ * @param cursor Receives the position
+ */
+static void btreeSeek(const ChainIndex *index, int which, const unsigned char *key, int after, BTreeCursor *cursor)
+{
+        const BTreeRoot *tree = &indexHeader(index)->trees[which];
+
+        cursor->page = btreeDescend(index, tree, key, NULL, NULL);
+        cursor->position = cursor->page ? btreeRank(indexPage(index, cursor->page), tree, key, after) : 0;
+}
+
+/**
+ * Reads the entry under a cursor and moves the cursor on, along the leaves
+ * @param index Index file
+ * @param which BTREE_BY_* tree
+ * @param cursor Cursor to advance
+ * @return The entry's key, followed by its value; NULL past the last entry
+ */
+static const unsigned char *btreeNext(const ChainIndex *index, int which, BTreeCursor *cursor)
+{
+        const BTreeRoot *tree = &indexHeader(index)->trees[which];
+
+        while (cursor->page && indexPageMapped(index, cursor->page))
+        {
+                BTreeNode *node = indexPage(index, cursor->page);
+                if (cursor->position < node->count)
+                        return btreeEntry(node, tree, cursor->position++);
+                cursor->page = node->link;
+                cursor->position = 0;
+        }
+        return NULL;
+}
+
+/**
+ * Writes an integer big-endian, so keys sort by it under memcmp
+ * @param output Bytes to write
+ * @param value Value to write
+ * @param size Bytes to use, 1 to 8
+ */
+static void putKeyNumber(unsigned char *output, uint64_t value, int size)
+{
+        for (int i = size - 1; i >= 0; i--)
+        {
+                output[i] = (unsigned char)value;
+                value >>= 8;
+        }
+}
+
+/**
+ * Reads an integer written by putKeyNumber
+ * @param input Bytes to read
+ * @param size Bytes used, 1 to 8
+ * @return The value
+ */
+static uint64_t getKeyNumber(const unsigned char *input, int size)
+{
+        uint64_t value = 0;
+        for (int i = 0; i < size; i++)
+                value = (value << 8) | input[i];
+        return value;
+}
+
+/**
+ * Builds the key of the hash index
+ * @param hash Hex block hash
+ * @param key Receives the 32 bytes the hash encodes
+ * @return 1 if successful, 0 if the hash is not 64 hex digits
+ */
+static int hashTreeKey(const char *hash, unsigned char *key)
+{
+        if (strlen(hash) != HASH_SIZE)
+                return 0;
+        for (int i = 0; i < BTREE_HASH_KEY; i++)
+        {
+                int high = hexValue(hash[2 * i]);
+                int low = hexValue(hash[2 * i + 1]);
+                if (high < 0 || low < 0)
+                        return 0;
+                key[i] = (unsigned char)(high << 4 | low);
+        }
+        return 1;
+}
+
+/**
+ * Turns 32 hash bytes back into hex
+ * @param key Hash bytes
+ * @param hash Receives the NUL-terminated hex hash
+ */
+static void hashFromIndexKey(const unsigned char *key, char *hash)
+{
+        static const char digits[] = "0123456789abcdef";
+
+        for (int i = 0; i < BTREE_HASH_KEY; i++)
+        {
+                hash[2 * i] = digits[key[i] >> 4];
+                hash[2 * i + 1] = digits[key[i] & 0xF];
+        }
+        hash[HASH_SIZE] = '\0';
+}
+
+/**
+ * Builds the key of the address index: the address, then where the
+ * transaction is and which side of it the address was on. The record offset
+ * tells apart blocks of competing branches at the same height.
+ * @param address Sender or receiver
+ * @param height Height of the block
+ * @param offset Chain offset of the block's record
+ * @param position Place of the transaction in the block
+ * @param sent 1 for the sender, 0 for the receiver
+ * @param key Receives the key
+ */
+static void addressIndexKey(const char *address, int height, uint64_t offset, int position, int sent,
+                            unsigned char *key)
+{
+        memset(key, 0, BTREE_ADDRESS_KEY);
+        strncpy((char *)key, address, MAX_SENDER_SIZE - 1);
+        putKeyNumber(key + MAX_SENDER_SIZE, (uint32_t)height, 4);
+        putKeyNumber(key + MAX_SENDER_SIZE + 4, offset, 8);
+        putKeyNumber(key + MAX_SENDER_SIZE + 12, (uint32_t)position, 4);
+        key[MAX_SENDER_SIZE + 16] = (unsigned char)sent;
+}
+
+/**
+ * Builds the key of the time index; the record offset tells apart blocks with the same timestamp
+ * @param timestamp Block timestamp
+ * @param offset Chain offset of the block's record
+ * @param key Receives the key
+ */
+static void timeIndexKey(time_t timestamp, uint64_t offset, unsigned char *key)
+{
+        // Flipping the sign bit makes negative times sort before positive ones
+        putKeyNumber(key, (uint64_t)(int64_t)timestamp ^ (UINT64_C(1) << 63), 8);
+        putKeyNumber(key + 8, offset, 8);
+}
+
+/**
+ * Adds a block, or the transactions it gained since it was last indexed, to an index file
+ * @param index Index file open for writing
+ * @param block Block as it was just written
+ * @param offset Chain offset of the block's record
+ * @param first First transaction not yet indexed; above 0 when the block was indexed before
+ * @return 1 if successful, 0 if the file could not grow
+ */
+static int addIndexedBlock(ChainIndex *index, const Block *block, uint64_t offset, int first)
+{
+        unsigned char key[BTREE_MAX_ENTRY];
+        HashIndexValue hash_value;
+        TimeIndexValue time_value;
+        AddressIndexValue address_value;
+
+        // Block hashes are always calculateHash output, but anything else is left out rather than misfiled
+        if (!hashTreeKey(block->hash, time_value.hash))
+                return 1;
+
+        // Added transactions change the block's hash; the time index remembers the one to replace
+        timeIndexKey(block->timestamp, offset, key);
+        TimeIndexValue previous;
+        if (first > 0 && btreeFind(index, BTREE_BY_TIME, key, &previous))
+                btreeRemove(index, BTREE_BY_HASH, previous.hash);
+        time_value.height = block->index;
+        if (!btreeInsert(index, BTREE_BY_TIME, key, &time_value))
+                return 0;
+
+        memset(&hash_value, 0, sizeof(HashIndexValue));
+        hash_value.offset = offset;
+        hash_value.timestamp = (int64_t)block->timestamp;
+        hash_value.height = block->index;
+        if (!btreeInsert(index, BTREE_BY_HASH, time_value.hash, &hash_value))
+                return 0;
+
+        address_value.offset = offset;
+        address_value.timestamp = (int64_t)block->timestamp;
+        for (int i = first; i < block->transaction_count; i++)
+        {
+                const Transaction *trans = &block->transactions[i];
+                address_value.amount = trans->amount;
+                addressIndexKey(trans->sender, block->index, offset, i, 1, key);
+                if (!btreeInsert(index, BTREE_BY_ADDRESS, key, &address_value))
+                        return 0;
+                addressIndexKey(trans->receiver, block->index, offset, i, 0, key);
+                if (!btreeInsert(index, BTREE_BY_ADDRESS, key, &address_value))
+                        return 0;
+        }
+        return 1;
+}
+
+/**
+ * Points the height index at the block the active chain has at a height
+ * @param index Index file open for writing
+ * @param height Height of the block
+ * @param offset Chain offset of its record
+ * @return 1 if successful, 0 if the file could not grow
+ */
+static int setActiveHeight(ChainIndex *index, int height, uint64_t offset)
+{
+        unsigned char key[BTREE_HEIGHT_KEY];
+        HeightIndexValue value = {offset};
+
+        putKeyNumber(key, (uint32_t)height, BTREE_HEIGHT_KEY);
+        return btreeInsert(index, BTREE_BY_HEIGHT, key, &value);
+}
+
+/**
+ * Tells whether a block was on the active chain when the index was last written
+ * @param index Index file
+ * @param height Height of the block
+ * @param offset Chain offset of its record
+ * @return 1 if it was, 0 if a competing block held its height
+ */
+static int isActiveHeight(const ChainIndex *index, int height, uint64_t offset)
+{
+        unsigned char key[BTREE_HEIGHT_KEY];
+        HeightIndexValue value;
+
+        putKeyNumber(key, (uint32_t)height, BTREE_HEIGHT_KEY);
+        return btreeFind(index, BTREE_BY_HEIGHT, key, &value) && value.offset == offset;
+}
+
+/**
+ * Records in an index file's header how far into the chain it reaches
+ * @param index Index file open for writing
+ * @param log Log of the chain, positioned after its last record
+ */
+static void markIndexedEnd(ChainIndex *index, const ChainLog *log)
+{
+        BTreeHeader *header = indexHeader(index);
+        header->indexed_end = (uint64_t)log->size;
+        memcpy(header->last_hash, log->last_hash, HASH_SIZE + 1);
+}
+
+/**
+ * Adds the blocks of a written save to the chain's index file
+ * @param log Log the save was written to
+ * @param job Save whose records were just written
+ * @return 1 if successful, 0 if the index could not be updated
+ */
+static int indexSavedBlocks(ChainLog *log, SaveJob *job)
+{
+        ChainIndex *index = log->indexes;
+
+        if (!touchIndexFile(index))
+                return 0;
+        for (int i = 0; i < job->block_count; i++)
+        {
+                const Block *block = job->blocks[i];
+                int amended = i < job->dirty_count;
+                uint64_t offset = (uint64_t)(amended ? block->file_offset : block->pending_offset);
+                if (!addIndexedBlock(index, block, offset, amended ? block->saved_transaction_count : 0))
+                        return 0;
+        }
+        for (int i = 0; i < job->active_count; i++)
+        {
+                const ActiveHeight *active = &job->active[i];
+                if (!setActiveHeight(index, active->height,
+                                     active->pending ? (uint64_t)active->pending->pending_offset : active->offset))
+                        return 0;
+        }
+        markIndexedEnd(index, log);
+        return commitIndexFile(index);
+}
+
+/**
+ * Stops keeping a chain's disk indexes and deletes the file, so indexes that
+ * fell behind the chain are never trusted
+ * @param log Log of the chain
+ * @param filename Name of the chain
+ */
+static void removeChainIndexes(ChainLog *log, const char *filename)
+{
+        char *name = indexFileName(filename);
+        if (name)
+                unlink(name);
+        free(name);
+
+        // A file that could not be deleted is still marked unclean
+        unmapIndexFile(log->indexes);
+        log->indexes = NULL;
+}
+
+/**
+ * Opens the index file of a loaded chain for its saves to keep up to date,
+ * rebuilding it from the chain when it is missing, was not closed cleanly or
+ * does not end where the chain's records do
+ * @param chain Loaded chain, with its log open
+ * @return 1 if successful, 0 if the index could not be written
+ */
+static int openChainIndexes(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+        char *name = indexFileName(log->filename);
+        if (!name)
+                return 0;
+
+        long records_end = log->index_offset ? log->index_offset : log->size;
+        ChainIndex *index = mapIndexFile(name, 1, 0);
+        if (index)
+        {
+                const BTreeHeader *header = indexHeader(index);
+                if (header->clean && header->indexed_end == (uint64_t)records_end &&
+                    strcmp(header->last_hash, log->last_hash) == 0)
+                {
+                        log->indexes = index;
+                        free(name);
+                        return 1;
+                }
+                unmapIndexFile(index);
+        }
+
+        reportMessage("Rebuilding the indexes of %s", log->filename);
+        index = mapIndexFile(name, 1, 1);
+        free(name);
+        int ok = index && touchIndexFile(index);
+        for (Block *current = chain->log_head; ok && current; current = current->log_next)
+        {
+                // Pruned blocks keep their header but not their transactions
+                if (!(current->flags & BLOCK_PERSISTED))
+                        continue;
+                Block header_only = *current;
+                if (current->flags & BLOCK_PRUNED)
+                        header_only.transaction_count = 0;
+                else if (!fetchBlockPayloadLocked(chain, current))
+                        ok = 0;
+                ok = ok && addIndexedBlock(index, (current->flags & BLOCK_PRUNED) ? &header_only : current,
+                                      (uint64_t)current->file_offset, 0);
+        }
+        for (Block *current = chain->tip; ok && current; current = current->parent)
+        {
+                if (current->flags & BLOCK_PERSISTED)
+                        ok = setActiveHeight(index, current->index, (uint64_t)current->file_offset);
+        }
+        if (ok)
+        {
+                indexHeader(index)->indexed_end = (uint64_t)records_end;
+                memcpy(indexHeader(index)->last_hash, log->last_hash, HASH_SIZE + 1);
+                ok = commitIndexFile(index);
+        }
+        log->indexes = index;
+        if (!ok)
+        {
+                reportMessage("Error: Could not write the indexes of %s", log->filename);
+                removeChainIndexes(log, log->filename);
+        }
+        return ok;
+}
+
+/**
+ * Opens the disk indexes kept beside a chain file for lookups, without
+ * loading the chain: only the file's header is read until a lookup walks
+ * down a tree
+ * @param filename Name of the chain file
+ * @return The index, or NULL if there is none or a save is changing it
+ */
+ChainIndex *openChainIndex(const char *filename)
+{
+        char *name = indexFileName(filename);
+        ChainIndex *index = name ? mapIndexFile(name, 0, 0) : NULL;
+
+        if (!index)
+                reportMessage("Error: %s has no readable index", filename);
+        else if (!indexHeader(index)->clean)
+        {
+                reportMessage("Error: The index of %s is being written, or was left half written", filename);
+                unmapIndexFile(index);
+                index = NULL;
+        }
+        free(name);
+        return index;
+}
+
+/**
+ * Closes an index opened with openChainIndex
+ * @param index Index to close, NULL for none
+ */
+void closeChainIndex(ChainIndex *index)
+{
+        unmapIndexFile(index);
+}
+
+/**
+ * Looks a block up by hash in a chain's disk index
+ * @param index Index from openChainIndex
+ * @param hash Block hash
+ * @param hit Receives the block's height, timestamp, record offset and whether it is active
+ * @return 1 if found, 0 if not
+ */
+int findIndexedBlock(ChainIndex *index, const char *hash, IndexHit *hit)
+{
+        unsigned char key[BTREE_HASH_KEY];
+        HashIndexValue value;
+
+        if (!index || !hashTreeKey(hash, key) || !btreeFind(index, BTREE_BY_HASH, key, &value))
+                return 0;
+
+        memset(hit, 0, sizeof(IndexHit));
+        hit->height = value.height;
+        hit->position = -1;
+        hit->timestamp = (time_t)value.timestamp;
+        hit->offset = value.offset;
+        hit->active = isActiveHeight(index, hit->height, hit->offset);
+        hashFromIndexKey(key, hit->hash);
+        return 1;
+}
+
+/**
+ * Lists the transactions an address sent or received, by height and place in the
+ * block, those of blocks a reorg left behind included and marked inactive
+ * @param index Index from openChainIndex
+ * @param address Address to look up
+ * @param after Last hit of the previous call, to carry on from; NULL to start at the beginning
+ * @param hits Receives the transactions found
+ * @param max Most to return
+ * @return Number of hits; fewer than max once the address has no more
+ */
+int findIndexedTransactions(ChainIndex *index, const char *address, const IndexHit *after, IndexHit *hits, int max)
+{
+        unsigned char key[BTREE_ADDRESS_KEY];
+        unsigned char prefix[MAX_SENDER_SIZE];
+        BTreeCursor cursor;
+        const unsigned char *entry;
+        int count = 0;
+
+        if (!index || !address)
+                return 0;
+        if (after)
+                addressIndexKey(address, after->height, after->offset, after->position, after->sent, key);
+        else
+                addressIndexKey(address, 0, 0, 0, 0, key);
+        memcpy(prefix, key, MAX_SENDER_SIZE);
+
+        btreeSeek(index, BTREE_BY_ADDRESS, key, after != NULL, &cursor);
+        while (count < max && (entry = btreeNext(index, BTREE_BY_ADDRESS, &cursor)) &&
+               memcmp(entry, prefix, MAX_SENDER_SIZE) == 0)
+        {
+                AddressIndexValue value;
+                memcpy(&value, entry + BTREE_ADDRESS_KEY, sizeof(AddressIndexValue));
+
+                IndexHit *hit = &hits[count++];
+                memset(hit, 0, sizeof(IndexHit));
+                hit->height = (int)getKeyNumber(entry + MAX_SENDER_SIZE, 4);
+                hit->position = (int)getKeyNumber(entry + MAX_SENDER_SIZE + 12, 4);
+                hit->sent = entry[MAX_SENDER_SIZE + 16];
+                hit->amount = value.amount;
+                hit->timestamp = (time_t)value.timestamp;
+                hit->offset = value.offset;
+                hit->active = isActiveHeight(index, hit->height, hit->offset);
+        }
+        return count;
+}
+
+/**
+ * Lists the blocks with timestamps in a range, oldest first, those a reorg left
+ * behind included and marked inactive
+ * @param index Index from openChainIndex
+ * @param from Earliest timestamp
+ * @param to Latest timestamp
+ * @param after Last hit of the previous call, to carry on from; NULL to start at from
+ * @param hits Receives the blocks found
+ * @param max Most to return
+ * @return Number of hits; fewer than max once the range has no more
+ */
+int findIndexedBlocksByTime(ChainIndex *index, time_t from, time_t to, const IndexHit *after, IndexHit *hits,
+                            int max)
+{
+        unsigned char key[BTREE_TIME_KEY];
+        BTreeCursor cursor;
+        const unsigned char *entry;
+        int count = 0;
+
+        if (!index)
+                return 0;
+        if (after)
+                timeIndexKey(after->timestamp, after->offset, key);
+        else
+                timeIndexKey(from, 0, key);
+
+        btreeSeek(index, BTREE_BY_TIME, key, after != NULL, &cursor);
+        while (count < max && (entry = btreeNext(index, BTREE_BY_TIME, &cursor)))
+        {
+                time_t timestamp = (time_t)(int64_t)(getKeyNumber(entry, 8) ^ (UINT64_C(1) << 63));
+                if (timestamp > to)
+                        break;
+
+                TimeIndexValue value;
+                memcpy(&value, entry + BTREE_TIME_KEY, sizeof(TimeIndexValue));
+
+                IndexHit *hit = &hits[count++];
+                memset(hit, 0, sizeof(IndexHit));
+                hit->height = value.height;
+                hit->position = -1;
+                hit->timestamp = timestamp;
+                hit->offset = getKeyNumber(entry + 8, 8);
+                hit->active = isActiveHeight(index, hit->height, hit->offset);
+                hashFromIndexKey(value.hash, hit->hash);
+        }
+        return count;
+}
+
+/**
+ * Syncs and closes the chain's file, if any, leaving a footer index at its end
+ * @param chain Pointer to the blockchain
+ */
+static void closeChainLog(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+
+        waitForSaveLocked(chain);
+        if (log->file)
+        {
+                if (!log->index_offset && !writeFileIndex(chain))
+                        reportMessage("Error: Could not write the index of %s", log->filename);
+                if (syncChainLog(log))
+                        writeCheckpoint(chain);
+                fclose(log->file);
+        }
+        if (log->locked)
+                close(log->lock_fd);
+        unmapIndexFile(log->indexes);
+        free(log->filename);
+        free(log->buffer);
+        memset(log, 0, sizeof(ChainLog));
+}
+
+/**
+ * Seals the segment file being appended to with its footer index and starts the next one
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if failed
+ */
+static int startNextSegment(Blockchain *chain)
+{
+        ChainLog *log = &chain->log;
+
+        if (!log->index_offset && !writeFileIndex(chain))
+                return 0;
+        if (!syncChainLog(log))
+                return 0;
+        fclose(log->file);
+
+        // The new file carries on at the chain offset where the sealed one ends
+        log->file = NULL;
+        log->segment++;
+        log->base = log->size;
+        log->index_offset = 0;
+        return openLogFile(log, 1);
+}
+
+/**
+ * Appends a record holding a whole block
+ * @param log Log to append to
+ * @param block Block to write
+ * @return 1 if successful, 0 if failed
+ */
+static int writeBlockRecord(ChainLog *log, Block *block)
+{
+        BlockRecord record;
+
+        block->pending_offset = log->size;
+
+        memset(&record, 0, sizeof(BlockRecord));
+        record.index = block->index;
+        record.data_length = block->data_length;
+        record.timestamp = block->timestamp;
+        record.transaction_count = block->transaction_count;
+        memcpy(record.previous_hash, block->previous_hash, HASH_SIZE + 1);
+        memcpy(record.hash, block->hash, HASH_SIZE + 1);
+
+        memcpy(log->last_hash, block->hash, HASH_SIZE + 1);
+
+        RecordPart parts[] = {
+            {&record, sizeof(BlockRecord)},
+            {block->data, (size_t)block->data_length + 1},
+            {block->transactions, block->transaction_count * sizeof(Transaction)},
+        };
+        return writeRecord(log, RECORD_BLOCK, parts, 3);
+}
+
+/**
+ * Appends a record holding the transactions a saved block gained since it was saved
+ * @param log Log to append to
+ * @param block Block that gained transactions
+ * @return 1 if successful, 0 if failed
+ */
+static int writeTransactionsRecord(ChainLog *log, Block *block)
+{
+        TransactionsRecord record;
+        int count = block->transaction_count - block->saved_transaction_count;
+
+        block->pending_offset = log->size;
+        // The log knows the block by the hash it had when last saved
+        memset(&record, 0, sizeof(TransactionsRecord));
+        calculateSavedHash(block, record.saved_hash);
+        memcpy(record.hash, block->hash, HASH_SIZE + 1);
+        record.transaction_count = count;
+        record.previous_offset = (uint64_t)block->amend_offset;
+
+        RecordPart parts[] = {
+            {&record, sizeof(TransactionsRecord)},
+            {block->transactions + block->saved_transaction_count, count * sizeof(Transaction)},
+        };
+        return writeRecord(log, RECORD_TRANSACTIONS, parts, 2);
+}
+
+/**
+ * Appends one compact segment: the segment record with its base values and
+ * address dictionary, then a record relative to it for each block
+ * @param log Log to append to
+ * @param blocks Blocks to write
+ * @param count Number of blocks, at most SEGMENT_MAX_RECORDS
+ * @param amending Write the transactions blocks gained rather than whole blocks
+ * @param records Incremented atomically for every record written
+ * @return 1 if successful, 0 if failed
+ */
+static int writeCompactSegment(ChainLog *log, Block **blocks, int count, int amending, int *records)
+{
+        AddressDictionary dictionary;
+        ByteBuffer buffer;
+        ByteBuffer body;
+        Block *first = blocks[0];
+
+        memset(&dictionary, 0, sizeof(AddressDictionary));
+        memset(&buffer, 0, sizeof(ByteBuffer));
+        memset(&body, 0, sizeof(ByteBuffer));
+
+        // Number every address the segment's transactions use before anything is written
+        for (int n = 0; n < count; n++)
+        {
+                Block *current = blocks[n];
+                for (int i = amending ? current->saved_transaction_count : 0; i < current->transaction_count; i++)
+                {
+                        internAddress(&dictionary, current->transactions[i].sender);
+                        internAddress(&dictionary, current->transactions[i].receiver);
+                }
+        }
+
+        int64_t base_index = first->index;
+        int64_t base_timestamp = first->timestamp;
+        putVarint(&buffer, zigzagEncode(base_index));
+        putVarint(&buffer, zigzagEncode(base_timestamp));
+        putVarint(&buffer, dictionary.count);
+        for (uint32_t i = 0; i < dictionary.count; i++)
+        {
+                size_t length = strlen(dictionary.addresses[i]);
+                putVarint(&buffer, length);
+                putBytes(&buffer, dictionary.addresses[i], length);
+        }
+
+        long segment_offset = log->size;
+        RecordPart part = {buffer.data, buffer.length};
+        int ok = !buffer.failed && !dictionary.failed && writeRecord(log, RECORD_SEGMENT, &part, 1);
+        if (ok)
+                __atomic_add_fetch(records, 1, __ATOMIC_RELAXED);
+
+        for (int n = 0; ok && n < count; n++)
+        {
+                Block *current = blocks[n];
+                buffer.length = 0;
+                body.length = 0;
+                current->pending_offset = log->size;
+
+                if (amending)
+                {
+                        // The log knows the block by the hash it had when last saved
+                        char saved_hash[HASH_SIZE + 1];
+                        int first_new = current->saved_transaction_count;
+                        calculateSavedHash(current, saved_hash);
+                        putHash(&body, saved_hash);
+                        putHash(&body, current->hash);
+                        putVarint(&body, current->amend_offset ? current->pending_offset - current->amend_offset : 0);
+                        putVarint(&body, current->transaction_count - first_new);
+                        putTransactions(&body, current->transactions + first_new, current->transaction_count - first_new,
+                                        &dictionary, base_timestamp);
+                }
+                else
+                {
+                        memcpy(log->last_hash, current->hash, HASH_SIZE + 1);
+                        putVarint(&body, zigzagEncode(current->index - base_index));
+                        putVarint(&body, zigzagEncode((int64_t)current->timestamp - base_timestamp));
+                        putVarint(&body, current->data_length);
+                        putBytes(&body, current->data, current->data_length);
+                        putHash(&body, current->previous_hash);
+                        putHash(&body, current->hash);
+                        putVarint(&body, current->transaction_count);
+                        putTransactions(&body, current->transactions, current->transaction_count, &dictionary,
+                                        base_timestamp);
+                }
+
+                putVarint(&buffer, (uint64_t)(current->pending_offset - segment_offset));
+                putBody(&buffer, &body, (log->layout_flags & LAYOUT_COMPRESSED) != 0);
+                part.data = buffer.data;
+                part.length = buffer.length;
+                ok = !buffer.failed &&
+                     writeRecord(log, amending ? RECORD_COMPACT_TRANSACTIONS : RECORD_COMPACT_BLOCK, &part, 1);
+                if (ok)
+                        __atomic_add_fetch(records, 1, __ATOMIC_RELAXED);
+        }
+
+        free(dictionary.addresses);
+        free(dictionary.slots);
+        free(buffer.data);
+        free(body.data);
+        return ok;
+}
+
+/**
+ * Appends a save's blocks in the compact layout, SEGMENT_MAX_RECORDS to a segment
+ * @param log Log to append to
+ * @param job Save being written
+ * @return 1 if successful, 0 if failed
+ */
+static int writeCompactRecords(ChainLog *log, SaveJob *job)
+{
+        int ok = 1;
+
+        for (int i = 0; ok && i < job->dirty_count; i += SEGMENT_MAX_RECORDS)
+        {
+                int count = job->dirty_count - i < SEGMENT_MAX_RECORDS ? job->dirty_count - i : SEGMENT_MAX_RECORDS;
+                ok = writeCompactSegment(log, job->blocks + i, count, 1, &job->records_written);
+        }
+        for (int i = job->dirty_count; ok && i < job->block_count; i += SEGMENT_MAX_RECORDS)
+        {
+                int count = job->block_count - i < SEGMENT_MAX_RECORDS ? job->block_count - i : SEGMENT_MAX_RECORDS;
+                ok = writeCompactSegment(log, job->blocks + i, count, 0, &job->records_written);
+        }
+        return ok;
+}
+
+/**
+ * Reads every evicted payload back and stops caching. A rewrite gives the
+ * blocks offsets in a new file, so none can be read back from the old ones.
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if failed
+ */
+static int restorePayloads(Blockchain *chain)
+{
+        chain->mapped_end = 0;
+        while (chain->cache_head)
+                uncacheBlock(chain, chain->cache_head);
+
+        for (Block *current = chain->log_head; current; current = current->log_next)
+        {
+                if ((current->flags & BLOCK_EVICTED) && !fetchBlockPayloadLocked(chain, current))
+                        return 0;
+        }
+        return 1;
+}
+
+/**
+ * Copies payloads that still live in the file mappings into the pool and drops the mappings
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if failed
+ */
+static int unmapBlockchain(Blockchain *chain)
+{
+        for (Block *current = chain->log_head; current; current = current->log_next)
+        {
+                if (current->flags & BLOCK_MAPPED_DATA)
+                {
+                        char *data = (char *)poolAlloc(&chain->pool, current->data_length + 1);
+                        if (!data)
+                                return 0;
+                        memcpy(data, current->data, current->data_length + 1);
+                        __atomic_store_n(&current->data, data, __ATOMIC_RELEASE);
+                        current->flags &= ~BLOCK_MAPPED_DATA;
+                }
+                if (current->flags & BLOCK_MAPPED_TRANSACTIONS)
+                {
+                        Transaction *transactions = (Transaction *)poolAlloc(
+                            &chain->pool, current->transaction_capacity * sizeof(Transaction));
+                        if (!transactions)
+                                return 0;
+                        memcpy(transactions, current->transactions, current->transaction_count * sizeof(Transaction));
+                        __atomic_store_n(&current->transactions, transactions, __ATOMIC_RELEASE);
+                        current->flags &= ~BLOCK_MAPPED_TRANSACTIONS;
+                }
+        }
+
+        // Reads that started before the copies were swapped in may still be in the mappings
+        waitForReaders(chain);
+        for (int i = 0; i < chain->map_count; i++)
+        {
+                if (chain->maps[i].base)
+                        munmap(chain->maps[i].base, chain->maps[i].size);
+        }
+        free(chain->maps);
+        chain->maps = NULL;
+        chain->map_count = 0;
+        chain->mapped_end = 0;
+        return 1;
+}
+
+/**
+ * Frees a save and its snapshot
+ * @param job Save to free, may be NULL
+ */
+static void freeSaveJob(SaveJob *job)
+{
+        if (!job)
+                return;
+
+        free(job->blocks);
+        free(job->originals);
+        free(job->copies);
+        free(job->retired);
+        free(job->active);
+        free(job);
+}
+
+/**
+ * Opens the file a save goes to and snapshots the blocks that changed since
+ * the last one. The chain can change freely afterwards: the blocks are
+ * handed to the save and the chain starts collecting changes afresh.
+ * @param chain Pointer to the blockchain
+ * @param filename Name of the file to save to
+ * @return The save, set as the chain's save in flight, or NULL if failed
+ */
+static SaveJob *prepareSave(Blockchain *chain, const char *filename)
+{
+        // Saves go one at a time; the next one builds on the offsets the last one wrote
+        waitForSaveLocked(chain);
+
+        int append = chain->log.file && strcmp(chain->log.filename, filename) == 0;
+        if (!append)
+        {
+                struct stat target;
+
+                if (chain->prune_point)
+                {
+                        reportMessage("Error: Cannot rewrite a pruned chain, its early payloads are gone");
+                        return NULL;
+                }
+
+                if (!restorePayloads(chain))
+                        return NULL;
+
+                // Truncating a mapped file would pull the payloads out from under its blocks
+                int mapped = 0;
+                for (int i = 0; i < chain->map_count && stat(filename, &target) == 0; i++)
+                        mapped |= target.st_dev == chain->maps[i].device && target.st_ino == chain->maps[i].inode;
+                if (mapped && !unmapBlockchain(chain))
+                {
+                        reportMessage("Error: Not enough memory to rewrite %s", filename);
+                        return NULL;
+                }
+                if (!openChainLog(chain, filename, 0, 0, 1))
+                        return NULL;
+
+                // The indexes start over with the file
+                if (chain->config.disk_indexes)
+                {
+                        char *index_name = indexFileName(filename);
+                        chain->log.indexes = index_name ? mapIndexFile(index_name, 1, 1) : NULL;
+                        free(index_name);
+                        if (!chain->log.indexes)
+                        {
+                                reportMessage("Error: Could not create the indexes of %s", filename);
+                                removeChainIndexes(&chain->log, filename);
+                        }
+                }
+
+                // The old checkpoint vouches for records that are gone, and the old snapshot for their balances
+                char *checkpoint_name = checkpointFileName(filename);
+                if (checkpoint_name)
+                        unlink(checkpoint_name);
+                free(checkpoint_name);
+                char *state_name = stateFileName(filename);
+                if (state_name)
+                        unlink(state_name);
+                free(state_name);
+                chain->state_height = 0;
+
+                // A new file starts from scratch, so every block goes into it
+                for (Block *current = chain->log_head; current; current = current->log_next)
+                {
+                        current->flags &= ~(BLOCK_PERSISTED | BLOCK_DIRTY);
+                        current->saved_transaction_count = 0;
+                        current->amend_offset = 0;
+                        current->dirty_next = NULL;
+                }
+                chain->dirty = NULL;
+                chain->unsaved = chain->log_head;
+        }
+
+        // Segment files are sealed once full and never written again
+        ChainLog *log = &chain->log;
+        if (chain->config.segment_bytes > 0 && (chain->unsaved || chain->dirty) &&
+            (size_t)(log->size - log->base) >= chain->config.segment_bytes && !startNextSegment(chain))
+        {
+                reportMessage("Error: Could not start a new segment of %s", filename);
+                return NULL;
+        }
+        if (!dropFileIndex(log))
+        {
+                reportMessage("Error: Could not write to %s", filename);
+                return NULL;
+        }
+
+        // Indexes the saves do not keep up to date would fall behind the chain
+        if (!log->indexes && (chain->unsaved || chain->dirty))
+                removeChainIndexes(log, filename);
+
+        int dirty_count = 0;
+        int unsaved_count = 0;
+        int copy_count = 0;
+        for (Block *current = chain->dirty; current; current = current->dirty_next)
+                dirty_count++;
+        for (Block *current = chain->unsaved; current; current = current->log_next)
+        {
+                unsaved_count++;
+                copy_count += current->child_count == 0;
+        }
+        copy_count += dirty_count;
+
+        // The height index follows the active chain down to where it already agrees with it
+        int active_count = 0;
+        for (Block *current = chain->tip; log->indexes && current; current = current->parent, active_count++)
+        {
+                if ((current->flags & BLOCK_PERSISTED) &&
+                    isActiveHeight(log->indexes, current->index, (uint64_t)current->file_offset))
+                        break;
+        }
+
+        int block_count = dirty_count + unsaved_count;
+        SaveJob *job = (SaveJob *)calloc(1, sizeof(SaveJob));
+        if (job && block_count > 0)
+        {
+                job->blocks = (Block **)malloc(block_count * sizeof(Block *));
+                job->originals = (Block **)malloc(block_count * sizeof(Block *));
+                job->copies = copy_count > 0 ? (Block *)malloc(copy_count * sizeof(Block)) : NULL;
+        }
+        if (job && active_count > 0)
+                job->active = (ActiveHeight *)malloc(active_count * sizeof(ActiveHeight));
+        if (!job || (block_count > 0 && (!job->blocks || !job->originals)) || (copy_count > 0 && !job->copies) ||
+            (active_count > 0 && !job->active))
+        {
+                reportMessage("Error: Not enough memory to save %s", filename);
+                freeSaveJob(job);
+                return NULL;
+        }
+
+        // Transactions of saved blocks first, so new children find their parent's final hash
+        int n = 0;
+        int copied = 0;
+        for (Block *current = chain->dirty; current; current = current->dirty_next, n++)
+        {
+                job->copies[copied] = *current;
+                job->blocks[n] = &job->copies[copied++];
+                job->originals[n] = current;
+                current->flags = (current->flags & ~BLOCK_DIRTY) | BLOCK_SNAPSHOT;
+        }
+        for (Block *current = chain->unsaved; current; current = current->log_next, n++)
+        {
+                // A block with children can no longer gain transactions, so it is written as it stands
+                if (current->child_count > 0)
+                {
+                        job->blocks[n] = current;
+                }
+                else
+                {
+                        job->copies[copied] = *current;
+                        job->blocks[n] = &job->copies[copied++];
+                        current->flags |= BLOCK_SNAPSHOT;
+                }
+                job->originals[n] = current;
+        }
+
+        job->chain = chain;
+        job->dirty_count = dirty_count;
+        job->block_count = block_count;
+        job->sync_records = chain->config.log_sync_records;
+        job->start = log->size;
+        memcpy(job->last_hash, log->last_hash, HASH_SIZE + 1);
+        job->records_total = block_count;
+        if (log->layout_flags & LAYOUT_COMPACT)
+                job->records_total += (dirty_count + SEGMENT_MAX_RECORDS - 1) / SEGMENT_MAX_RECORDS +
+                                      (unsaved_count + SEGMENT_MAX_RECORDS - 1) / SEGMENT_MAX_RECORDS;
+
+        // Loads keep the first of equally heavy branches, so a tie broken otherwise is recorded; a new file records
+        // the active tip whenever a side branch could tie with it
+        job->preferred = !append && chain->block_count > (size_t)chain->length ? chain->tip : chain->preferred;
+        if (job->preferred)
+        {
+                memcpy(job->preferred_hash, job->preferred->hash, HASH_SIZE + 1);
+                job->records_total++;
+        }
+        chain->preferred = NULL;
+
+        // A block with children is written as it stands, and the childless tip from its copy
+        Block *active_block = chain->tip;
+        for (int i = 0; i < active_count; i++, active_block = active_block->parent)
+        {
+                ActiveHeight *active = &job->active[i];
+                active->height = active_block->index;
+                active->offset = (uint64_t)active_block->file_offset;
+                active->pending = NULL;
+                if (!(active_block->flags & BLOCK_PERSISTED))
+                        active->pending = active_block;
+                for (int n = dirty_count; active->pending && active_block->child_count == 0 && n < block_count; n++)
+                {
+                        if (job->originals[n] == active_block)
+                                active->pending = job->blocks[n];
+                }
+        }
+        job->active_count = active_count;
+
+        chain->dirty = NULL;
+        chain->unsaved = NULL;
+        chain->save = job;
+        return job;
+}
+
+/**
+ * Writes a save's snapshot to the log. Touches nothing of the chain but its
+ * log and the snapshotted blocks, so it can run beside the chain's thread.
+ * @param job Save to write
+ */
+static void writeSave(SaveJob *job)
+{
+        ChainLog *log = &job->chain->log;
+        int ok = 1;
+
+        if (log->layout_flags & LAYOUT_COMPACT)
+        {
+                ok = writeCompactRecords(log, job);
+        }
+        else
+        {
+                for (int i = 0; ok && i < job->block_count; i++)
+                {
+                        ok = i < job->dirty_count ? writeTransactionsRecord(log, job->blocks[i])
+                                                  : writeBlockRecord(log, job->blocks[i]);
+                        if (ok)
+                                __atomic_add_fetch(&job->records_written, 1, __ATOMIC_RELAXED);
+                }
+        }
+        if (ok && job->preferred)
+        {
+                RecordPart part = {job->preferred_hash, HASH_SIZE + 1};
+                ok = writeRecord(log, RECORD_TIP, &part, 1);
+                if (ok)
+                        __atomic_add_fetch(&job->records_written, 1, __ATOMIC_RELAXED);
+        }
+
+        if (!ok || fflush(log->file) != 0)
+        {
+                // Drop the partial batch so the file still ends on a whole record
+                job->error = "Could not write to";
+                fflush(log->file);
+                if (ftruncate(fileno(log->file), job->start - log->base) == 0)
+                        fseek(log->file, job->start - log->base, SEEK_SET);
+                log->size = job->start;
+                memcpy(log->last_hash, job->last_hash, HASH_SIZE + 1);
+        }
+        else
+        {
+                // Group commit: fsync once enough records have accumulated
+                log->unsynced_records += job->records_written;
+                if (log->unsynced_records >= job->sync_records && !syncChainLog(log))
+                        job->error = "Could not sync";
+                if (log->indexes && (job->block_count > 0 || job->active_count > 0) && !indexSavedBlocks(log, job))
+                        job->index_failed = 1;
+        }
+
+        job->end = log->size;
+        job->ok = !job->error;
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Thread body of a background save
+ * @param arg Save to write
+ * @return NULL
+ */
+static void *saveWorker(void *arg)
+{
+        writeSave((SaveJob *)arg);
+        return NULL;
+}
+
+/**
+ * Applies a written save to the chain: its blocks learn where their records
+ * went, or go back to waiting for the next save if it failed
+ * @param chain Pointer to the blockchain whose save has been written
+ * @return 1 if the save succeeded, 0 if it failed
+ */
+static int finishSave(Blockchain *chain)
+{
+        SaveJob *job = chain->save;
+        int ok = job->ok;
+
+        chain->save = NULL;
+        for (int i = 0; i < job->block_count; i++)
+        {
+                Block *block = job->originals[i];
+                const Block *saved = job->blocks[i];
+
+                block->flags &= ~BLOCK_SNAPSHOT;
+                if (ok)
+                {
+                        if (i < job->dirty_count)
+                        {
+                                block->amend_offset = saved->pending_offset;
+                        }
+                        else
+                        {
+                                block->file_offset = saved->pending_offset;
+                                block->flags |= BLOCK_PERSISTED;
+                        }
+                        block->saved_transaction_count = saved->transaction_count;
+                }
+
+                // Transactions added while the save ran, or that it failed to write, wait for the next one
+                if ((block->flags & BLOCK_PERSISTED) && block->transaction_count > block->saved_transaction_count)
+                        markDirty(chain, block);
+        }
+        if (!ok && job->dirty_count < job->block_count)
+                chain->unsaved = job->originals[job->dirty_count];
+        if (!ok && !chain->preferred)
+                chain->preferred = job->preferred;
+        for (int i = 0; i < job->retired_count; i++)
+                poolFree(&chain->pool, job->retired[i].data, job->retired[i].size);
+
+        // Pruning waited for the save; blocks held back until they were saved can go now too
+        pruneBlockchainLocked(chain);
+        if (ok)
+        {
+                writeCheckpoint(chain);
+                writeStateSnapshot(chain);
+        }
+
+        if (ok)
+                reportMessage("Blockchain saved successfully to %s (%d records, %ld bytes appended)",
+                              chain->log.filename, job->records_written, job->end - job->start);
+        else
+                reportMessage("Error: %s %s", job->error, chain->log.filename);
+        if (job->index_failed)
+        {
+                reportMessage("Error: Could not update the indexes of %s", chain->log.filename);
+                removeChainIndexes(&chain->log, chain->log.filename);
+        }
+        freeSaveJob(job);
+        return ok;
+}
+
+/**
+ * Saves the blockchain to a file. Saving again to the file the chain was
+ * saved to or loaded from only appends what changed since.
+ * @param chain Pointer to the blockchain
+ * @param filename Name of the file to save to
+ * @return 1 if successful, 0 if failed
+ */
+static int saveBlockchainLocked(Blockchain *chain, const char *filename)
+{
+        if (!chain || !prepareSave(chain, filename))
+                return 0;
+
+        writeSave(chain->save);
+        return finishSave(chain);
+}
+
+/**
+ * Saves the blockchain like saveBlockchain, but writes it on a thread of its
+ * own so blocks and transactions can still be added meanwhile. The chain
+ * finishes the save the next time it waits for it: in waitForSave, in the
+ * next save, sync or close.
+ * @param chain Pointer to the blockchain
+ * @param filename Name of the file to save to
+ * @return Handle to poll with getSaveProgress, valid until the save finishes; NULL if failed
+ */
+static SaveJob *saveBlockchainInBackgroundLocked(Blockchain *chain, const char *filename)
+{
+        if (!chain)
+                return NULL;
+
+        SaveJob *job = prepareSave(chain, filename);
+        if (!job)
+                return NULL;
+
+        // Without a thread the save is written here and finishes on the next wait
+        job->threaded = pthread_create(&job->thread, NULL, saveWorker, job) == 0;
+        if (!job->threaded)
+                writeSave(job);
+        return job;
+}
+
+/**
+ * Reports how far a background save has got, without waiting for it
+ * @param job Save in flight
+ * @param progress Receives the records written so far and the total
+ * @return 1 once all records are written and waitForSave will not block, 0 before
+ */
+int getSaveProgress(const SaveJob *job, SaveProgress *progress)
+{
+        progress->records_written = __atomic_load_n(&job->records_written, __ATOMIC_RELAXED);
+        progress->records_total = job->records_total;
+        progress->done = __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+        return progress->done;
+}
+
+/**
+ * Waits for the chain's background save, if any, and finishes it
+ * @param chain Pointer to the blockchain
+ * @return 1 if there was none or it succeeded, 0 if it failed
+ */
+static int waitForSaveLocked(Blockchain *chain)
+{
+        if (!chain || !chain->save)
+                return 1;
+
+        if (chain->save->threaded)
+                pthread_join(chain->save->thread, NULL);
+        return finishSave(chain);
+}
+
+/**
+ * Builds a block over a block record without copying its payload
+ * @param pool Pool receiving the block header
+ * @param payload Record payload inside the file mapping
+ * @param length Payload length
+ * @return Decoded block or NULL if the record is malformed
+ */
+static Block *decodeBlockRecord(ChainPool *pool, char *payload, uint32_t length)
+{
+        const BlockRecord *record = (const BlockRecord *)payload;
+
+        if (length < sizeof(BlockRecord) || record->data_length < 0 || record->data_length > MAX_BLOCK_DATA_SIZE ||
+            record->transaction_count < 0 || record->transaction_count > MAX_BLOCK_TRANSACTIONS)
+                return NULL;
+
+        size_t data_size = RECORD_ALIGN((size_t)record->data_length + 1);
+        if (length != sizeof(BlockRecord) + data_size + record->transaction_count * sizeof(Transaction))
+                return NULL;
+
+        // Data is used in place as a C string, so its terminator must be in the file
+        char *data = payload + sizeof(BlockRecord);
+        if (data[record->data_length] != '\0' || record->previous_hash[HASH_SIZE] != '\0' ||
+            record->hash[HASH_SIZE] != '\0')
+                return NULL;
+
+        Block *block = (Block *)poolAlloc(pool, sizeof(Block));
+        if (!block)
+                return NULL;
+
+        memset(block, 0, sizeof(Block));
+        block->index = record->index;
+        block->timestamp = (time_t)record->timestamp;
+        block->data_length = record->data_length;
+        block->data = data;
+        block->flags = BLOCK_MAPPED_DATA;
+        if (record->transaction_count > 0)
+        {
+                block->transactions = (Transaction *)(data + data_size);
+                block->transaction_count = record->transaction_count;
+                block->transaction_capacity = record->transaction_count;
+                block->flags |= BLOCK_MAPPED_TRANSACTIONS;
+        }
+        memcpy(block->previous_hash, record->previous_hash, HASH_SIZE + 1);
+        memcpy(block->hash, record->hash, HASH_SIZE + 1);
+        return block;
+}
+
+/**
+ * Reads a transactions record of the aligned layout, leaving the transactions in place
+ * @param payload Record payload
+ * @param length Payload length
+ * @param amend Receives the record
+ * @return 1 if successful, 0 if the record is malformed
+ */
+static int decodeAmendRecord(const char *payload, uint32_t length, AmendRecord *amend)
+{
+        const TransactionsRecord *record = (const TransactionsRecord *)payload;
+
+        memset(amend, 0, sizeof(AmendRecord));
+        if (length < sizeof(TransactionsRecord) || record->transaction_count < 0 ||
+            record->saved_hash[HASH_SIZE] != '\0' || record->hash[HASH_SIZE] != '\0' ||
+            length != sizeof(TransactionsRecord) + record->transaction_count * sizeof(Transaction))
+                return 0;
+
+        memcpy(amend->saved_hash, record->saved_hash, HASH_SIZE + 1);
+        memcpy(amend->hash, record->hash, HASH_SIZE + 1);
+        amend->transaction_count = record->transaction_count;
+        amend->previous_offset = record->previous_offset;
+        amend->transactions = (const Transaction *)(payload + sizeof(TransactionsRecord));
+        return 1;
+}
+
+/**
+ * Replays transactions appended to an earlier block
+ * @param chain Chain being loaded
+ * @param amend Transactions record read from the file
+ * @param offset Offset of the record in the file
+ * @param trusted Whether the record lies before a trusted checkpoint
+ * @return 1 if successful, 0 if the record does not match the chain
+ */
+static int replayTransactions(Blockchain *chain, const AmendRecord *amend, long offset, int trusted)
+{
+        Block *block = findBlockLocked(chain, amend->saved_hash);
+        if (!block || block->child_count > 0 || !fetchBlockPayloadLocked(chain, block))
+                return 0;
+
+        for (int i = 0; i < amend->transaction_count; i++)
+        {
+                if (!appendTransaction(chain, block, &amend->transactions[i]))
+                        return 0;
+        }
+        if (trusted)
+        {
+                unindexBlock(chain, block);
+                memcpy(block->hash, amend->hash, HASH_SIZE + 1);
+                indexBlock(chain, block);
+        }
+        else
+        {
+                rehashBlock(chain, block);
+        }
+        block->saved_transaction_count = block->transaction_count;
+        block->amend_offset = offset;
+        touchBlock(chain, block);
+
+        return strcmp(block->hash, amend->hash) == 0;
+}
+
+/**
+ * Links a block read from the file into the chain being loaded
+ * @param chain Chain being loaded
+ * @param block Decoded block, its hash already checked
+ * @param offset Chain offset of its record
+ * @return 1 if successful, 0 if the block does not fit the chain
+ */
+static int linkLoadedBlock(Blockchain *chain, Block *block, long offset)
+{
+        // Link block into the tree; the parent is found by hash, not by walking the list
+        block->flags |= BLOCK_PERSISTED;
+        block->saved_transaction_count = block->transaction_count;
+        block->file_offset = offset;
+        if (connectBlock(chain, block) != ACCEPT_OK)
+                return 0;
+
+        // Past the cache budget, older payloads are dropped again as the load goes on
+        touchBlock(chain, block);
+        trimCache(chain, block);
+        return 1;
+}
+
+/**
+ * Decodes one record of a chain file. Loader threads pass no chain and only
+ * check the record, hashing the block in it; the loader then passes the
+ * chain to link the records in file order.
+ * @param chain Chain being loaded, NULL to only check the record
+ * @param pool Pool receiving the decoded block
+ * @param segment Compact segment the record belongs to, replaced by segment records
+ * @param header Header of an intact record
+ * @param offset Chain offset of the record
+ * @param layout Encoding of the file's records
+ * @param trusted Whether the record lies before a trusted checkpoint, so its block hash is taken as stored
+ * @param block_hash Receives the hash in a checked block record, unused when linking
+ * @return 1 if successful, 0 if the record is malformed or does not fit the chain
+ */
+static int readChainRecord(Blockchain *chain, ChainPool *pool, SegmentState *segment, const RecordHeader *header,
+                           long offset, uint32_t layout, int trusted, char *block_hash)
+{
+        char *payload = (char *)(header + 1);
+        Block *block = NULL;
+        AmendRecord amend;
+        int amending = 0;
+        int ok;
+
+        if (header->length % RECORD_ALIGNMENT != 0)
+                return 0;
+
+        // A tie the chain broke when it was saved is broken the same way again
+        if (header->type == RECORD_TIP)
+        {
+                if (header->length < HASH_SIZE + 1 || payload[HASH_SIZE] != '\0')
+                        return 0;
+                Block *tip = chain ? findBlockLocked(chain, payload) : NULL;
+                if (tip && getAncestor(chain->tip, tip->index) != tip && tip->chain_work >= chain->tip->chain_work)
+                        return switchBranch(chain, tip);
+                return 1;
+        }
+
+        if (layout & LAYOUT_COMPACT)
+        {
+                ByteReader reader = {(const unsigned char *)payload, header->length, 0, 0};
+
+                if (header->type == RECORD_SEGMENT)
+                        return decodeSegmentRecord(payload, header->length, offset, segment);
+                if (header->type != RECORD_COMPACT_BLOCK && header->type != RECORD_COMPACT_TRANSACTIONS)
+                        return 0;
+
+                // Compact records only make sense against the segment before them
+                uint64_t distance = getVarint(&reader);
+                if (reader.failed || segment->offset < 0 || distance != (uint64_t)(offset - segment->offset))
+                        return 0;
+                if (header->type == RECORD_COMPACT_BLOCK)
+                        ok = (block = decodeCompactBlock(pool, &reader, segment)) != NULL;
+                else
+                        ok = amending = decodeCompactAmend(&reader, offset, segment, &amend);
+        }
+        else if (header->type == RECORD_BLOCK)
+        {
+                ok = (block = decodeBlockRecord(pool, payload, header->length)) != NULL;
+        }
+        else if (header->type == RECORD_TRANSACTIONS)
+        {
+                ok = amending = decodeAmendRecord(payload, header->length, &amend);
+        }
+        else
+        {
+                return 0;
+        }
+
+        if (block && chain)
+        {
+                ok = linkLoadedBlock(chain, block, offset);
+        }
+        else if (block)
+        {
+                // Hashing is the bulk of a load, so it happens here on the loader threads
+                char calculated_hash[HASH_SIZE + 1];
+                if (!trusted)
+                        calculateHash(block, calculated_hash);
+                ok = trusted || strcmp(calculated_hash, block->hash) == 0;
+                memcpy(block_hash, block->hash, HASH_SIZE + 1);
+                freeBlock(pool, block);
+        }
+        if (amending)
+        {
+                if (chain)
+                        ok = replayTransactions(chain, &amend, offset, trusted);
+                free(amend.decoded);
+        }
+        return ok;
+}
+
+/**
+ * Hands the records a checker has passed on to the linker
+ * @param work Shared SegmentWork
+ * @param load Segment file being checked
+ * @param offset Offset up to which its records are checked
+ * @param finished Whether checking of the file is over
+ * @return 1 to go on checking, 0 if the load is being abandoned
+ */
+static int handOnRecords(SegmentWork *work, SegmentLoad *load, size_t offset, int finished)
+{
+        pthread_mutex_lock(&work->lock);
+        load->checked = offset;
+        load->finished = finished;
+        int stop = work->stop;
+        pthread_cond_broadcast(&work->progress);
+        pthread_mutex_unlock(&work->lock);
+        return !stop;
+}
+
+/**
+ * Tells a damaged record in the middle of a file from the unfinished one an
+ * interrupted save leaves at its end: appends stop at the first failure, so
+ * nothing whole is ever written after a torn record
+ * @param map Mapped segment file
+ * @param offset Offset of the damaged record
+ * @return 1 if a checksummed record or the trailer of a closed file lies past it, 0 if not
+ */
+static int followedByIntactRecords(const ChainMap *map, size_t offset)
+{
+        // The trailer is the last thing a clean close writes
+        if (map->size % RECORD_ALIGNMENT == 0 && map->size - offset >= sizeof(FileTrailer) + RECORD_ALIGNMENT)
+        {
+                const FileTrailer *trailer = (const FileTrailer *)(map->base + map->size - sizeof(FileTrailer));
+                if (memcmp(trailer->magic, FILE_TRAILER_MAGIC, sizeof(trailer->magic)) == 0)
+                        return 1;
+        }
+
+        // Records start on aligned offsets, so only those can hold a header
+        for (size_t at = offset + RECORD_ALIGNMENT; at + sizeof(RecordHeader) <= map->size; at += RECORD_ALIGNMENT)
+        {
+                const RecordHeader *header = (const RecordHeader *)(map->base + at);
+                if (header->type >= RECORD_BLOCK && header->type <= RECORD_TIP &&
+                    header->reserved == 0 && header->length % RECORD_ALIGNMENT == 0 &&
+                    header->length <= map->size - at - sizeof(RecordHeader) && header->checksum == recordChecksum(header))
+                        return 1;
+        }
+        return 0;
+}
+
+/**
+ * Checks every record of a segment file and hashes its blocks, without touching any chain
+ * @param work Shared SegmentWork receiving the checker's progress
+ * @param load Mapped segment file with a valid header; receives the results
+ */
+static void checkSegmentFile(SegmentWork *work, SegmentLoad *load)
+{
+        const FileHeader *file_header = (const FileHeader *)load->map.base;
+        size_t offset = file_header->header_size;
+        size_t handed_on = offset;
+        SegmentState segment;
+        ChainPool pool;
+
+        initPool(&pool);
+        memset(&segment, 0, sizeof(SegmentState));
+        segment.offset = -1;
+        memcpy(load->last_hash, file_header->boundary_hash, HASH_SIZE + 1);
+        load->ok = 1;
+
+        while (offset < load->map.size)
+        {
+                const RecordHeader *header = (const RecordHeader *)(load->map.base + offset);
+
+                // A short or damaged record is where an interrupted save stopped, unless something intact follows it
+                if (load->map.size - offset < sizeof(RecordHeader) ||
+                    header->length > load->map.size - offset - sizeof(RecordHeader) ||
+                    header->checksum != recordChecksum(header))
+                {
+                        if (followedByIntactRecords(&load->map, offset))
+                                load->ok = 0;
+                        else
+                                load->torn = 1;
+                        break;
+                }
+
+                // The footer index is rebuilt on close; only the trailer may follow it
+                if (header->type == RECORD_INDEX)
+                {
+                        size_t after = offset + sizeof(RecordHeader) + header->length;
+                        if (after + sizeof(FileTrailer) == load->map.size)
+                                load->index_offset = offset;
+                        else if (load->map.size - after < sizeof(FileTrailer))
+                                load->torn = 1;
+                        else
+                                load->ok = 0;
+                        break;
+                }
+
+                uint64_t chain_offset = file_header->base_offset + offset;
+                if (!readChainRecord(NULL, &pool, &segment, header, (long)chain_offset, file_header->layout_flags,
+                                     chain_offset < work->trusted_end, load->last_hash))
+                {
+                        load->ok = 0;
+                        break;
+                }
+                offset += sizeof(RecordHeader) + header->length;
+                load->records++;
+
+                // Linking keeps pace in batches rather than waiting for the whole file
+                if (offset - handed_on >= LOAD_BATCH_BYTES)
+                {
+                        if (!handOnRecords(work, load, offset, 0))
+                                break;
+                        handed_on = offset;
+                }
+        }
+
+        load->end = offset;
+        freeSegment(&segment);
+        releasePool(&pool);
+        handOnRecords(work, load, offset, 1);
+}
+
+/**
+ * Loader thread body: checks segment files until none are left
+ * @param arg Shared SegmentWork
+ * @return NULL
+ */
+static void *checkSegmentWorker(void *arg)
+{
+        SegmentWork *work = (SegmentWork *)arg;
+        int i;
+
+        while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count)
+                checkSegmentFile(work, &work->loads[i]);
+        return NULL;
+}
+
+/**
+ * Reader thread body: faults the segment files in a window at a time, at
+ * most two windows ahead of their checker, so disk reads overlap hashing
+ * instead of stalling the checkers on page faults
+ * @param arg Shared SegmentWork
+ * @return NULL
+ */
+static void *readAheadWorker(void *arg)
+{
+        SegmentWork *work = (SegmentWork *)arg;
+        long page = sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+
+        for (int i = 0; i < work->count; i++)
+        {
+                SegmentLoad *load = &work->loads[i];
+                for (size_t offset = 0; offset < load->map.size; offset += LOAD_WINDOW_BYTES)
+                {
+                        // One window is being checked while the next is read in
+                        pthread_mutex_lock(&work->lock);
+                        while (!work->stop && !load->finished && offset >= load->checked + 2 * LOAD_WINDOW_BYTES)
+                                pthread_cond_wait(&work->progress, &work->lock);
+                        int stop = work->stop;
+                        int finished = load->finished;
+                        pthread_mutex_unlock(&work->lock);
+                        if (stop)
+                                return NULL;
+                        if (finished)
+                                break;
+
+                        size_t length = load->map.size - offset < LOAD_WINDOW_BYTES ? load->map.size - offset
+                                                                                    : LOAD_WINDOW_BYTES;
+                        madvise(load->map.base + offset, length, MADV_WILLNEED);
+                        for (size_t at = 0; at < length; at += (size_t)page)
+                                sink += load->map.base[offset + at];
+                }
+        }
+        return NULL;
+}
+
+/**
+ * Waits until a checker has passed the record at an offset of a segment file
+ * @param work Shared SegmentWork
+ * @param load Segment file being linked
+ * @param offset Offset of the next record to link
+ * @return Offset up to which records may be linked; no more than offset once checking is over
+ */
+static size_t waitForRecords(SegmentWork *work, SegmentLoad *load, size_t offset)
+{
+        pthread_mutex_lock(&work->lock);
+        while (!load->finished && load->checked <= offset)
+                pthread_cond_wait(&work->progress, &work->lock);
+        size_t checked = load->checked;
+        pthread_mutex_unlock(&work->lock);
+        return checked;
+}
+
+/**
+ * Maps a chain file read-only into memory
+ * @param map Receives the mapping
+ * @param filename Name of the file to map
+ * @return 1 if successful, 0 if failed
+ */
+static int mapChainFile(ChainMap *map, const char *filename)
+{
+        struct stat info;
+        int fd = open(filename, O_RDONLY);
+
+        memset(map, 0, sizeof(ChainMap));
+        if (fd < 0)
+                return 0;
+        if (fstat(fd, &info) != 0)
+        {
+                close(fd);
+                return 0;
+        }
+
+        map->size = (size_t)info.st_size;
+        map->device = info.st_dev;
+        map->inode = info.st_ino;
+        if (map->size > 0)
+        {
+                void *base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base == MAP_FAILED)
+                {
+                        close(fd);
+                        return 0;
+                }
+                map->base = (char *)base;
+        }
+
+        // The mapping keeps the file contents reachable on its own
+        close(fd);
+        return 1;
+}
+
+/**
+ * Checks that a mapped file starts with a header this program can read
+ * @param map Mapped chain file
+ * @param filename Name of the file, for messages
+ * @return 1 if the records after the header can be read, 0 if not
+ */
+static int checkFileHeader(const ChainMap *map, const char *filename)
+{
+        const FileHeader *header = (const FileHeader *)map->base;
+
+        if (map->size < sizeof(FileHeader) || memcmp(header->magic, FILE_MAGIC, sizeof(header->magic)) != 0)
+        {
+                reportMessage("Error: %s is not a blockchain file", filename);
+                return 0;
+        }
+        if (header->byte_order != FILE_BYTE_ORDER)
+        {
+                reportMessage("Error: %s was written on a machine with a different byte order", filename);
+                return 0;
+        }
+        if (header->version != FILE_VERSION || header->boundary_hash[HASH_SIZE] != '\0' ||
+            (header->layout_flags != LAYOUT_ALIGNED && header->layout_flags != LAYOUT_COMPACT &&
+             header->layout_flags != (LAYOUT_COMPACT | LAYOUT_COMPRESSED)) ||
+            header->header_size < sizeof(FileHeader) || header->header_size % RECORD_ALIGNMENT != 0 ||
+            header->header_size > map->size)
+        {
+                reportMessage("Error: %s uses unsupported format version %u", filename, header->version);
+                return 0;
+        }
+        return 1;
+}
+
+/**
+ * Unmaps and frees segment files opened by openSegmentFiles
+ * @param loads Segment files
+ * @param count Number of segment files
+ */
+static void closeSegmentFiles(SegmentLoad *loads, int count)
+{
+        for (int i = 0; i < count; i++)
+        {
+                if (loads[i].map.base)
+                        munmap(loads[i].map.base, loads[i].map.size);
+                free(loads[i].filename);
+        }
+        free(loads);
+}
+
+/**
+ * Maps every segment file of a chain
+ * @param filename Name of the chain
+ * @param count Receives the number of segment files
+ * @return Segment files to close with closeSegmentFiles, or NULL if one cannot be read
+ */
+static SegmentLoad *openSegmentFiles(const char *filename, int *count)
+{
+        SegmentLoad *loads = NULL;
+        int capacity = 0;
+
+        *count = 0;
+        for (int segment = 0;; segment++)
+        {
+                struct stat info;
+                char *name = segmentFileName(filename, segment);
+                int ok = name != NULL;
+
+                // The chain ends at the first segment number with no file
+                if (ok && segment > 0 && stat(name, &info) != 0)
+                {
+                        free(name);
+                        return loads;
+                }
+                if (ok && segment == capacity)
+                {
+                        capacity = capacity ? capacity * 2 : 4;
+                        SegmentLoad *grown = (SegmentLoad *)realloc(loads, capacity * sizeof(SegmentLoad));
+                        if (grown)
+                                loads = grown;
+                        ok = grown != NULL;
+                }
+                if (ok)
+                {
+                        memset(&loads[segment], 0, sizeof(SegmentLoad));
+                        loads[segment].filename = name;
+                        *count = segment + 1;
+                        ok = mapChainFile(&loads[segment].map, name);
+                }
+                if (!ok)
+                {
+                        reportMessage("Error: Could not open file for reading");
+                        if (segment >= *count)
+                                free(name);
+                        closeSegmentFiles(loads, *count);
+                        return NULL;
+                }
+        }
+}
+
+/**
+ * Links the records of a segment file into the chain being loaded as the checkers pass them
+ * @param chain Chain being loaded
+ * @param work Shared SegmentWork
+ * @param number Position of the segment file in the chain
+ * @return 1 if successful, 0 if the file is damaged or does not fit the chain
+ */
+static int linkSegmentFile(Blockchain *chain, SegmentWork *work, int number)
+{
+        SegmentLoad *load = &work->loads[number];
+        const ChainMap *map = &chain->maps[number];
+        const FileHeader *file_header = (const FileHeader *)map->base;
+        size_t offset = file_header->header_size;
+        SegmentState segment;
+        long records = 0;
+        int ok = 1;
+
+        // The segment before it is fully linked, so the hash it ended on is final
+        if (number > 0 && strcmp(file_header->boundary_hash, work->loads[number - 1].last_hash) != 0)
+        {
+                reportMessage("Error: %s does not continue the segments before it", load->filename);
+                return 0;
+        }
+
+        memset(&segment, 0, sizeof(SegmentState));
+        segment.offset = -1;
+        while (ok)
+        {
+                size_t checked = waitForRecords(work, load, offset);
+                if (offset >= checked)
+                        break;
+
+                while (ok && offset < checked)
+                {
+                        const RecordHeader *header = (const RecordHeader *)(map->base + offset);
+                        uint64_t chain_offset = file_header->base_offset + offset;
+                        ok = readChainRecord(chain, &chain->pool, &segment, header, (long)chain_offset,
+                                             file_header->layout_flags, chain_offset < work->trusted_end, NULL);
+                        if (!ok)
+                                reportMessage("Error: Record %ld of %s is invalid", records, load->filename);
+                        offset += sizeof(RecordHeader) + header->length;
+                        records++;
+                }
+        }
+        freeSegment(&segment);
+        madvise(map->base, map->size, MADV_NORMAL);
+
+        // Linking stopped where checking did; now the checker's verdict is final
+        if (ok && !load->ok)
+        {
+                reportMessage("Error: Record %ld of %s is invalid", load->records, load->filename);
+                ok = 0;
+        }
+        else if (ok && load->torn && number + 1 < work->count)
+        {
+                reportMessage("Error: %s is damaged; only the newest segment may end in unfinished records",
+                              load->filename);
+                ok = 0;
+        }
+        return ok;
+}
+
+/**
+ * Runs the load pipeline: a reader thread faults the files in, checker
+ * threads (one per core, up to one per file) hash their records, and the
+ * calling thread links the checked records in file order
+ * @param chain Chain being loaded, owning the mappings of the files
+ * @param loads Mapped segment files with valid headers
+ * @param count Number of segment files
+ * @param trusted_end Chain offset before which block hashes are trusted, 0 for none
+ * @return 1 if every file was linked, 0 if failed
+ */
+static int loadSegmentFiles(Blockchain *chain, SegmentLoad *loads, int count, uint64_t trusted_end)
+{
+        SegmentWork work;
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int checkers = cores < count ? (int)cores : count;
+        pthread_t *threads = (pthread_t *)malloc((checkers + 1) * sizeof(pthread_t));
+        int started = 0;
+        int reading = 0;
+        int ok = 1;
+
+        memset(&work, 0, sizeof(SegmentWork));
+        work.loads = loads;
+        work.count = count;
+        work.trusted_end = trusted_end;
+        pthread_mutex_init(&work.lock, NULL);
+        pthread_cond_init(&work.progress, NULL);
+
+        while (threads && started < checkers && pthread_create(&threads[started], NULL, checkSegmentWorker, &work) == 0)
+                started++;
+        if (threads && started > 0)
+                reading = pthread_create(&threads[started], NULL, readAheadWorker, &work) == 0;
+
+        // Without threads the files are checked up front and linking simply finds them done
+        if (started == 0)
+                checkSegmentWorker(&work);
+
+        for (int i = 0; ok && i < count; i++)
+                ok = linkSegmentFile(chain, &work, i);
+
+        pthread_mutex_lock(&work.lock);
+        work.stop = 1;
+        pthread_cond_broadcast(&work.progress);
+        pthread_mutex_unlock(&work.lock);
+        for (int i = 0; i < started + reading; i++)
+                pthread_join(threads[i], NULL);
+
+        free(threads);
+        pthread_cond_destroy(&work.progress);
+        pthread_mutex_destroy(&work.lock);
+        return ok;
+}
+
+/**
+ * Loads the blockchain from a file with the default configuration
+ * @param filename Name of the file to load from
+ * @return Pointer to loaded blockchain or NULL if failed
+ */
+Blockchain *loadBlockchain(const char *filename)
+{
+        return loadBlockchainWithConfig(filename, NULL);
+}
+
+/**
+ * Loads the blockchain from a file by replaying its records, trusting the
+ * block hashes stored before a checkpoint if one is given and starting the
+ * balances from a state snapshot if one is given
+ * @param filename Name of the file to load from
+ * @param config Configuration of the loaded chain
+ * @param checkpoint Checkpoint whose signature was checked, NULL to hash every block
+ * @param state State snapshot to start the balances from, NULL to apply every block
+ * @param mismatch Receives LOAD_BAD_CHECKPOINT or LOAD_BAD_STATE if the chain the file holds does not fit either
+ * @return Pointer to loaded blockchain or NULL if failed
+ */
+static Blockchain *loadChainFiles(const char *filename, const ChainConfig *config, const Checkpoint *checkpoint,
+                                  const StateSnapshot *state, int *mismatch)
+{
+        int count;
+        SegmentLoad *loads = openSegmentFiles(filename, &count);
+        if (!loads)
+                return NULL;
+
+        int ok = 1;
+        for (int i = 0; ok && i < count; i++)
+        {
+                ok = checkFileHeader(&loads[i].map, loads[i].filename);
+                if (ok && ((const FileHeader *)loads[i].map.base)->segment != (uint32_t)i)
+                {
+                        reportMessage("Error: %s is not segment %d of %s", loads[i].filename, i, filename);
+                        ok = 0;
+                }
+                if (ok)
+                        madvise(loads[i].map.base, loads[i].map.size, MADV_SEQUENTIAL);
+        }
+
+        // Each segment must start where the one before it ends; its boundary hash is checked as it is linked
+        for (int i = 1; ok && i < count; i++)
+        {
+                const FileHeader *header = (const FileHeader *)loads[i].map.base;
+                const FileHeader *before = (const FileHeader *)loads[i - 1].map.base;
+                if (header->base_offset != before->base_offset + loads[i - 1].map.size)
+                {
+                        reportMessage("Error: %s does not continue the segments before it", loads[i].filename);
+                        ok = 0;
+                }
+        }
+
+        Blockchain *chain = ok ? createBlockchainWithConfig(config) : NULL;
+        if (chain)
+                chain->maps = (ChainMap *)malloc(count * sizeof(ChainMap));
+        if (!chain || !chain->maps || !(chain->log.filename = strdup(filename)))
+        {
+                closeSegmentFiles(loads, count);
+                freeBlockchain(chain);
+                return NULL;
+        }
+
+        // Blocks point into the mappings, so they live as long as the chain
+        for (int i = 0; i < count; i++)
+                chain->maps[i] = loads[i].map;
+        chain->pending_state = state;
+        chain->map_count = count;
+
+        // Only checked records are linked, so until the newest file's end is known its size bounds them
+        const FileHeader *newest = (const FileHeader *)chain->maps[count - 1].base;
+        chain->mapped_end = (long)(newest->base_offset + chain->maps[count - 1].size);
+
+        // Segments do not depend on each other until they are stitched, so they are checked in parallel
+        ok = loadSegmentFiles(chain, loads, count, checkpoint ? checkpoint->offset : 0);
+        for (int i = 0; i < count; i++)
+                memset(&loads[i].map, 0, sizeof(ChainMap));
+        chain->mapped_end = (long)(newest->base_offset + loads[count - 1].end);
+
+        // A single hash match vouches for the whole trusted prefix
+        if (ok && checkpoint)
+        {
+                Block *block = findBlockLocked(chain, checkpoint->hash);
+                if (!block || block->index != checkpoint->height)
+                {
+                        *mismatch |= LOAD_BAD_CHECKPOINT;
+                        ok = 0;
+                }
+        }
+
+        // Balances started from the snapshot only hold if its block stayed on the active chain
+        if (state && (chain->state_conflict || (ok && chain->pending_state)))
+        {
+                *mismatch |= LOAD_BAD_STATE;
+                ok = 0;
+        }
+
+        SegmentLoad *last = &loads[count - 1];
+        const ChainMap *last_map = &chain->maps[count - 1];
+
+        /*
+         * No second validation pass: block records were hashed above and
+         * replaying added transactions re-hashes and compares their block,
+         * while linking by previous hash and refusing to amend a block with
+         * children keeps every link intact. Before a checkpoint the stored
+         * hashes are trusted instead, their records still checksummed.
+         */
+
+        // Later saves append to the newest segment
+        const FileHeader *last_header = (const FileHeader *)last_map->base;
+        long base = (long)last_header->base_offset;
+        uint32_t layout = last_header->layout_flags;
+        if (!ok || !openChainLog(chain, filename, count - 1, base, 0))
+        {
+                closeSegmentFiles(loads, count);
+                freeBlockchain(chain);
+                return NULL;
+        }
+
+        // Cut the torn tail off so the newest segment ends on its last intact record again
+        if (last->torn)
+        {
+                reportMessage("Recovered %s: dropped %zu bytes of unfinished records after record %ld", last->filename,
+                              last_map->size - last->end, last->records);
+                if (ftruncate(fileno(chain->log.file), (off_t)last->end) != 0)
+                {
+                        reportMessage("Error: Could not truncate %s", last->filename);
+                        // Closed as it is, since no index belongs behind the torn records
+                        fclose(chain->log.file);
+                        chain->log.file = NULL;
+                        closeSegmentFiles(loads, count);
+                        freeBlockchain(chain);
+                        return NULL;
+                }
+                fseek(chain->log.file, 0, SEEK_END);
+                chain->log.size = base + (long)last->end;
+        }
+        chain->log.index_offset = last->index_offset ? base + (long)last->index_offset : 0;
+        chain->log.layout_flags = layout;
+        memcpy(chain->log.last_hash, last->last_hash, HASH_SIZE + 1);
+        closeSegmentFiles(loads, count);
+
+        // A chain loads without its indexes if they cannot be written; its saves then leave none
+        if (chain->config.disk_indexes)
+                openChainIndexes(chain);
+
+        if (checkpoint)
+                reportMessage("Blocks up to #%d matched the trusted checkpoint; only later blocks were re-hashed",
+                              checkpoint->height);
+        if (state)
+                reportMessage("Balances up to #%d came from the state snapshot; only later blocks were applied",
+                              state->header.height);
+        reportMessage("Blockchain loaded and validated successfully from %s", filename);
+        return chain;
+}
+
+/**
+ * Hashes a block the way the original program did: its fixed buffers left
+ * out transactions that no longer fit in 511 characters
+ * @param block Block to hash
+ * @param output Buffer receiving the hash
+ */
+static void calculateLegacyHash(const Block *block, char *output)
+{
+        char input[LEGACY_INPUT_SIZE];
+        char trans_data[LEGACY_INPUT_SIZE / 2] = "";
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256_CTX sha256;
+
+        for (int i = 0; i < block->transaction_count; i++)
+        {
+                char trans_str[TRANS_STR_SIZE];
+                snprintf(trans_str, TRANS_STR_SIZE, "%s%s%.2f", block->transactions[i].sender,
+                         block->transactions[i].receiver, block->transactions[i].amount);
+                if (strlen(trans_data) + strlen(trans_str) < sizeof(trans_data) - 1)
+                        strcat(trans_data, trans_str);
+        }
+        snprintf(input, sizeof(input), "%d%ld%s%s%s", block->index, block->timestamp, block->data,
+                 block->previous_hash, trans_data);
+
+        SHA256_Init(&sha256);
+        SHA256_Update(&sha256, input, strlen(input));
+        SHA256_Final(hash, &sha256);
+        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+                sprintf(output + (i * 2), "%02x", hash[i]);
+        output[HASH_SIZE] = '\0';
+}
+
+/**
+ * Loads a chain file written by the original program: the block count, then
+ * each block's fixed-size fields. Blocks are checked against the original
+ * hashing, then hashed again the current way, which only differs for blocks
+ * whose transactions overflowed the original buffers. The chain is not tied
+ * to the file, so saving it under the same name rewrites it in the current
+ * format.
+ * @param filename Name of the file to load from
+ * @param config Configuration of the loaded chain
+ * @return Pointer to loaded blockchain or NULL if the file is not a complete original chain file
+ */
+static Blockchain *loadLegacyChain(const char *filename, const ChainConfig *config)
+{
+        char data[LEGACY_DATA_SIZE];
+        Transaction transactions[LEGACY_MAX_TRANSACTIONS];
+        char legacy_hash[HASH_SIZE + 1];
+        char stored_hash[HASH_SIZE + 1];
+        char previous_stored[HASH_SIZE + 1] = "";
+        char previous_hash[HASH_SIZE + 1] = "";
+        int length;
+        int rehashed = 0;
+
+        FILE *file = fopen(filename, "rb");
+        if (!file)
+                return NULL;
+        Blockchain *chain = createBlockchainWithConfig(config);
+        int ok = chain && fread(&length, sizeof(int), 1, file) == 1 && length > 0;
+
+        for (int i = 0; ok && i < length; i++)
+        {
+                Block block;
+                memset(&block, 0, sizeof(Block));
+                ok = fread(&block.index, sizeof(int), 1, file) == 1 &&
+                     fread(&block.timestamp, sizeof(time_t), 1, file) == 1 &&
+                     fread(data, sizeof(char), LEGACY_DATA_SIZE, file) == LEGACY_DATA_SIZE &&
+                     fread(&block.transaction_count, sizeof(int), 1, file) == 1 && block.index == i &&
+                     block.transaction_count >= 0 && block.transaction_count <= LEGACY_MAX_TRANSACTIONS &&
+                     fread(transactions, sizeof(Transaction), block.transaction_count, file) ==
+                             (size_t)block.transaction_count &&
+                     fread(block.previous_hash, sizeof(char), HASH_SIZE + 1, file) == HASH_SIZE + 1 &&
+                     fread(stored_hash, sizeof(char), HASH_SIZE + 1, file) == HASH_SIZE + 1;
+                if (!ok)
+                        break;
+
+                data[LEGACY_DATA_SIZE - 1] = '\0';
+                block.previous_hash[HASH_SIZE] = '\0';
+                stored_hash[HASH_SIZE] = '\0';
+                for (int j = 0; j < block.transaction_count; j++)
+                {
+                        transactions[j].sender[MAX_SENDER_SIZE - 1] = '\0';
+                        transactions[j].receiver[MAX_RECEIVER_SIZE - 1] = '\0';
+                }
+                block.data = data;
+                block.data_length = (int)strlen(data);
+                block.transactions = block.transaction_count > 0 ? transactions : NULL;
+
+                // The original program's validation: each hash recomputes and links to the block before
+                calculateLegacyHash(&block, legacy_hash);
+                ok = strcmp(legacy_hash, stored_hash) == 0 &&
+                     (i == 0 || strcmp(block.previous_hash, previous_stored) == 0);
+                if (!ok)
+                        break;
+                memcpy(previous_stored, stored_hash, HASH_SIZE + 1);
+
+                if (i > 0)
+                        memcpy(block.previous_hash, previous_hash, HASH_SIZE + 1);
+                calculateHash(&block, block.hash);
+                rehashed += strcmp(block.hash, stored_hash) != 0;
+                ok = acceptBlockLocked(chain, &block) == ACCEPT_OK;
+                memcpy(previous_hash, block.hash, HASH_SIZE + 1);
+        }
+        ok = ok && fgetc(file) == EOF;
+        fclose(file);
+
+        if (!ok)
+        {
+                freeBlockchain(chain);
+                return NULL;
+        }
+        if (rehashed > 0)
+                reportMessage("%d blocks of %s overflowed the original hashing and were re-hashed", rehashed, filename);
+        reportMessage("Blockchain loaded from %s, a file of the original format; saving it converts it", filename);
+        return chain;
+}
+
+/**
+ * Tells whether a file predates the versioned format, which starts with FILE_MAGIC
+ * @param filename Name of the file
+ * @return 1 if the file exists and does not start with the magic, 0 if not
+ */
+static int isLegacyChainFile(const char *filename)
+{
+        char magic[sizeof(FILE_MAGIC) - 1];
+
+        FILE *file = fopen(filename, "rb");
+        if (!file)
+                return 0;
+        int legacy = fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+                     memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0;
+        fclose(file);
+        return legacy;
+}
+
+/**
+ * Loads the blockchain from a file by replaying its records. Each segment
+ * file is mapped, then checked and hashed on its own thread; the segments
+ * are stitched together by their boundary hashes and linked into the chain
+ * in order. Blocks of the aligned layout use their data and transactions
+ * in place, while compact records are decoded into the pool; the loaded
+ * chain also keeps the newest segment open so later saves append to it.
+ * With a checkpoint signed by the configured key, blocks up to it are not
+ * re-hashed; if the file turns out not to hold its block, the load starts
+ * over and hashes everything. Likewise the balances start from the state
+ * snapshot beside the file, applying only the blocks after its block, and
+ * the load starts over applying every block if that block does not end up
+ * on the active chain.
+ * @param filename Name of the file to load from
+ * @param config Configuration of the loaded chain, NULL for the defaults
+ * @return Pointer to loaded blockchain or NULL if failed
+ */
+Blockchain *loadBlockchainWithConfig(const char *filename, const ChainConfig *config)
+{
+        ChainConfig defaults;
+        Checkpoint checkpoint;
+        int mismatch = 0;
+
+        if (!config)
+        {
+                initChainConfig(&defaults);
+                config = &defaults;
+        }
+
+        // Files of the original format are read once and converted by the next save
+        if (isLegacyChainFile(filename))
+        {
+                Blockchain *legacy = loadLegacyChain(filename, config);
+                if (!legacy)
+                        reportMessage("Error: %s is not a blockchain file", filename);
+                return legacy;
+        }
+
+        int trusted = readCheckpoint(filename, config->checkpoint_key, &checkpoint);
+        StateSnapshot *state = readStateSnapshot(filename, config->checkpoint_key);
+        Blockchain *chain = loadChainFiles(filename, config, trusted ? &checkpoint : NULL, state, &mismatch);
+        while (!chain && mismatch)
+        {
+                if (mismatch & LOAD_BAD_CHECKPOINT)
+                {
+                        reportMessage("Checkpoint of %s does not match the file; verifying every block", filename);
+                        trusted = 0;
+                }
+                if (mismatch & LOAD_BAD_STATE)
+                {
+                        reportMessage("State snapshot of %s is not on the loaded chain; applying every block",
+                                      filename);
+                        freeStateSnapshot(state);
+                        state = NULL;
+                }
+                mismatch = 0;
+                chain = loadChainFiles(filename, config, trusted ? &checkpoint : NULL, state, &mismatch);
+        }
+        freeStateSnapshot(state);
+        return chain;
+}
+
+/**
+ * Opens one segment file of a chain for random access, locating its footer index
+ * @param segment Receives the segment
+ * @param filename Name of the segment file
+ * @param number Position the file should have in the chain
+ * @return 1 if successful, 0 if it cannot be opened or has no index
+ */
+static int openFileSegment(ChainSegment *segment, const char *filename, int number)
+{
+        if (!mapChainFile(&segment->map, filename))
+        {
+                reportMessage("Error: Could not open file for reading");
+                return 0;
+        }
+
+        ChainMap *map = &segment->map;
+        const FileTrailer *trailer = NULL;
+        const RecordHeader *header = NULL;
+
+        // A cleanly closed file ends on whole records followed by the trailer
+        if (checkFileHeader(map, filename) && map->size >= sizeof(FileHeader) + sizeof(FileTrailer) &&
+            map->size % RECORD_ALIGNMENT == 0 && ((const FileHeader *)map->base)->segment == (uint32_t)number)
+                trailer = (const FileTrailer *)(map->base + map->size - sizeof(FileTrailer));
+
+        if (trailer && memcmp(trailer->magic, FILE_TRAILER_MAGIC, sizeof(trailer->magic)) == 0 &&
+            trailer->index_offset % RECORD_ALIGNMENT == 0 &&
+            trailer->index_offset + sizeof(RecordHeader) + sizeof(IndexRecord) <= map->size - sizeof(FileTrailer))
+        {
+                header = (const RecordHeader *)(map->base + trailer->index_offset);
+                segment->index = (const IndexRecord *)(header + 1);
+        }
+
+        // Every table must sit inside the index record
+        const IndexRecord *index = segment->index;
+        if (!index || header->type != RECORD_INDEX ||
+            trailer->index_offset + sizeof(RecordHeader) + header->length + sizeof(FileTrailer) != map->size ||
+            header->checksum != recordChecksum(header) ||
+            index->slot_count == 0 || (index->slot_count & (index->slot_count - 1)) != 0 ||
+            header->length != sizeof(IndexRecord) + index->entry_count * sizeof(IndexEntry) +
+                                  RECORD_ALIGN(index->height_count * sizeof(uint32_t)) +
+                                  RECORD_ALIGN(index->slot_count * sizeof(uint32_t)))
+        {
+                reportMessage("Error: %s has no footer index; it was not closed cleanly", filename);
+                return 0;
+        }
+
+        segment->base = ((const FileHeader *)map->base)->base_offset;
+        segment->layout_flags = ((const FileHeader *)map->base)->layout_flags;
+        segment->entries = (const IndexEntry *)(index + 1);
+        segment->heights = (const uint32_t *)(segment->entries + index->entry_count);
+        segment->slots = (const uint32_t *)((const char *)segment->heights +
+                                            RECORD_ALIGN(index->height_count * sizeof(uint32_t)));
+        return 1;
+}
+
+/**
+ * Opens an indexed chain file for random access. Only the footer indexes
+ * of its segment files are read up front; blocks are read on demand
+ * straight from their records.
+ * @param filename Name of the chain file
+ * @return Opened file or NULL if it cannot be opened or has no index
+ */
+ChainFile *openChainFile(const char *filename)
+{
+        ChainFile *file = (ChainFile *)malloc(sizeof(ChainFile));
+        if (!file)
+                return NULL;
+
+        memset(file, 0, sizeof(ChainFile));
+        initPool(&file->pool);
+
+        // The chain ends at the first segment number with no file
+        for (int number = 0;; number++)
+        {
+                struct stat info;
+                char *name = segmentFileName(filename, number);
+                if (name && number > 0 && stat(name, &info) != 0)
+                {
+                        free(name);
+                        return file;
+                }
+
+                ChainSegment *grown =
+                    name ? (ChainSegment *)realloc(file->segments, (number + 1) * sizeof(ChainSegment)) : NULL;
+                if (grown)
+                {
+                        file->segments = grown;
+                        file->segment_count = number + 1;
+                        memset(&grown[number], 0, sizeof(ChainSegment));
+                }
+                if (!grown || !openFileSegment(&file->segments[number], name, number))
+                {
+                        free(name);
+                        closeChainFile(file);
+                        return NULL;
+                }
+                free(name);
+        }
+}
+
+/**
+ * Finds an intact record in an opened chain file
+ * @param file Opened chain file
+ * @param offset Chain offset of the record
+ * @param layout Receives the encoding of the segment file holding it, may be NULL
+ * @return Header of the record, or NULL if there is no intact record there
+ */
+static const RecordHeader *readFileRecord(ChainFile *file, uint64_t offset, uint32_t *layout)
+{
+        for (int i = file->segment_count - 1; i >= 0; i--)
+        {
+                const ChainSegment *segment = &file->segments[i];
+                if (offset < segment->base)
+                        continue;
+
+                uint64_t local = offset - segment->base;
+                if (local < sizeof(FileHeader) || local % RECORD_ALIGNMENT != 0 ||
+                    local + sizeof(RecordHeader) > segment->map.size)
+                        return NULL;
+
+                const RecordHeader *header = (const RecordHeader *)(segment->map.base + local);
+                if (header->length > segment->map.size - local - sizeof(RecordHeader) ||
+                    header->checksum != recordChecksum(header))
+                        return NULL;
+                if (layout)
+                        *layout = segment->layout_flags;
+                return header;
+        }
+        return NULL;
+}
+
+/**
+ * Opens a compact record: reads its distance back to its segment and decodes that segment
+ * @param file Opened chain file
+ * @param offset Offset of the compact record
+ * @param reader Receives a reader positioned after the distance
+ * @param segment Receives the decoded segment
+ * @return 1 if successful, 0 if the records are damaged
+ */
+static int readFileSegment(ChainFile *file, uint64_t offset, ByteReader *reader, SegmentState *segment)
+{
+        const RecordHeader *header = readFileRecord(file, offset, NULL);
+        if (!header)
+                return 0;
+
+        reader->data = (const unsigned char *)(header + 1);
+        reader->length = header->length;
+        reader->position = 0;
+        reader->failed = 0;
+
+        uint64_t distance = getVarint(reader);
+        if (reader->failed || distance == 0 || distance > offset)
+                return 0;
+
+        const RecordHeader *start = readFileRecord(file, offset - distance, NULL);
+        return start && start->type == RECORD_SEGMENT &&
+               decodeSegmentRecord((const char *)(start + 1), start->length, (long)(offset - distance), segment);
+}
+
+/**
+ * Reads a record of transactions added to a saved block
+ * @param file Opened chain file
+ * @param offset Offset of the record
+ * @param amend Receives the record; free amend->decoded when done
+ * @return 1 if successful, 0 if the record is damaged
+ */
+static int readFileAmend(ChainFile *file, uint64_t offset, AmendRecord *amend)
+{
+        uint32_t layout = 0;
+        const RecordHeader *header = readFileRecord(file, offset, &layout);
+        int ok = 0;
+
+        memset(amend, 0, sizeof(AmendRecord));
+        if (!header)
+                return 0;
+
+        if (layout & LAYOUT_COMPACT)
+        {
+                SegmentState segment;
+                ByteReader reader;
+
+                memset(&segment, 0, sizeof(SegmentState));
+                ok = header->type == RECORD_COMPACT_TRANSACTIONS && readFileSegment(file, offset, &reader, &segment) &&
+                     decodeCompactAmend(&reader, (long)offset, &segment, amend);
+                freeSegment(&segment);
+        }
+        else if (header->type == RECORD_TRANSACTIONS)
+        {
+                ok = decodeAmendRecord((const char *)(header + 1), header->length, amend);
+        }
+        return ok;
+}
+
+/**
+ * Reads the block an index entry points at, along with any transactions added to it later
+ * @param file Opened chain file
+ * @param pool Pool receiving the block
+ * @param found Index entry of the block
+ * @return Block allocated from the pool, or NULL if the records are damaged
+ */
+static Block *readFileBlock(ChainFile *file, ChainPool *pool, const IndexEntry *found)
+{
+        uint32_t layout = 0;
+        const RecordHeader *header = readFileRecord(file, found->offset, &layout);
+        Block *block = NULL;
+
+        if (!header)
+                return NULL;
+
+        // Aligned records are used in place; compact ones are decoded against their segment
+        if (layout & LAYOUT_COMPACT)
+        {
+                SegmentState segment;
+                ByteReader reader;
+
+                memset(&segment, 0, sizeof(SegmentState));
+                if (header->type == RECORD_COMPACT_BLOCK && readFileSegment(file, found->offset, &reader, &segment))
+                        block = decodeCompactBlock(pool, &reader, &segment);
+                freeSegment(&segment);
+        }
+        else if (header->type == RECORD_BLOCK)
+        {
+                block = decodeBlockRecord(pool, (char *)(header + 1), header->length);
+        }
+        if (!block || !found->amend_offset)
+                return block;
+
+        // Collect the records of transactions added later by following their back links
+        AmendRecord *amends = NULL;
+        int amend_count = 0;
+        int amend_capacity = 0;
+        long total = block->transaction_count;
+        uint64_t offset = found->amend_offset;
+        int ok = 1;
+
+        while (ok && offset)
+        {
+                if (amend_count == amend_capacity)
+                {
+                        amend_capacity = amend_capacity ? amend_capacity * 2 : 4;
+                        AmendRecord *grown = (AmendRecord *)realloc(amends, amend_capacity * sizeof(AmendRecord));
+                        if (!grown)
+                        {
+                                ok = 0;
+                                break;
+                        }
+                        amends = grown;
+                }
+
+                AmendRecord *amend = &amends[amend_count];
+                if (offset <= found->offset || !readFileAmend(file, offset, amend))
+                {
+                        ok = 0;
+                        break;
+                }
+                amend_count++;
+                total += amend->transaction_count;
+                ok = amend->previous_offset < offset && total <= MAX_BLOCK_TRANSACTIONS;
+                offset = amend->previous_offset;
+        }
+
+        // The transactions span several records, so they are gathered into one list
+        Transaction *transactions = ok ? (Transaction *)poolAlloc(pool, total * sizeof(Transaction)) : NULL;
+        if (transactions)
+        {
+                long filled = block->transaction_count;
+                if (filled > 0)
+                        memcpy(transactions, block->transactions, filled * sizeof(Transaction));
+
+                // The newest record was read first, so take them from the back
+                for (int i = amend_count - 1; i >= 0; i--)
+                {
+                        memcpy(transactions + filled, amends[i].transactions,
+                               amends[i].transaction_count * sizeof(Transaction));
+                        filled += amends[i].transaction_count;
+                }
+                memcpy(block->hash, amends[0].hash, HASH_SIZE + 1);
+
+                if (block->transactions && !(block->flags & BLOCK_MAPPED_TRANSACTIONS))
+                        poolFree(pool, block->transactions, block->transaction_capacity * sizeof(Transaction));
+                block->transactions = transactions;
+                block->transaction_count = (int)total;
+                block->transaction_capacity = (int)total;
+                block->flags &= ~BLOCK_MAPPED_TRANSACTIONS;
+        }
+
+        for (int i = 0; i < amend_count; i++)
+                free(amends[i].decoded);
+        free(amends);
+
+        if (!transactions)
+        {
+                freeBlock(pool, block);
+                return NULL;
+        }
+        return block;
+}
+
+/**
+ * Reads an evicted block's payload back from the files the chain was loaded from
+ * @param chain Pointer to the blockchain
+ * @param block Evicted block; its records lie before the chain's mapped end
+ * @return 1 if successful, 0 if the records are damaged or no longer match the block
+ */
+static int readBackPayload(Blockchain *chain, Block *block)
+{
+        ChainFile view;
+        IndexEntry entry;
+
+        // The mappings stand in for an opened file; their footer indexes are not needed
+        memset(&view, 0, sizeof(ChainFile));
+        view.segments = (ChainSegment *)calloc(chain->map_count, sizeof(ChainSegment));
+        if (!view.segments)
+                return 0;
+        view.segment_count = chain->map_count;
+        for (int i = 0; i < chain->map_count; i++)
+        {
+                view.segments[i].map = chain->maps[i];
+                view.segments[i].base = ((const FileHeader *)chain->maps[i].base)->base_offset;
+                view.segments[i].layout_flags = ((const FileHeader *)chain->maps[i].base)->layout_flags;
+        }
+
+        memset(&entry, 0, sizeof(IndexEntry));
+        entry.offset = (uint64_t)block->file_offset;
+        entry.amend_offset = (uint64_t)block->amend_offset;
+        Block *read = readFileBlock(&view, &chain->pool, &entry);
+        free(view.segments);
+
+        int ok = read && read->data_length == block->data_length &&
+                 read->transaction_count == block->transaction_count && strcmp(read->hash, block->hash) == 0;
+        if (ok)
+        {
+                // Take the payload over, whether it was decoded or still lives in the mapping
+                __atomic_store_n(&block->data, read->data, __ATOMIC_RELEASE);
+                __atomic_store_n(&block->transactions, read->transactions, __ATOMIC_RELEASE);
+                block->transaction_capacity = read->transaction_capacity;
+                block->flags |= read->flags & (BLOCK_MAPPED_DATA | BLOCK_MAPPED_TRANSACTIONS);
+                read->data = NULL;
+                read->transactions = NULL;
+                read->transaction_capacity = 0;
+                read->flags &= ~(BLOCK_MAPPED_DATA | BLOCK_MAPPED_TRANSACTIONS);
+        }
+        freeBlock(&chain->pool, read);
+        return ok;
+}
+
+/**
+ * Makes sure a block's payload is resident, reading it back if the cache
+ * evicted it, and marks it as the most recently used
+ * @param chain Pointer to the blockchain
+ * @param block Block whose data and transactions are needed
+ * @return 1 if the payload is resident, 0 if the block is pruned or cannot be read back
+ */
+static int fetchBlockPayloadLocked(Blockchain *chain, Block *block)
+{
+        if (!chain || !block || (block->flags & BLOCK_PRUNED))
+                return 0;
+
+        if (!(block->flags & BLOCK_EVICTED))
+        {
+                if (block->flags & BLOCK_CACHED)
+                {
+                        chain->cache_stats.hits++;
+                        touchBlock(chain, block);
+                }
+                return 1;
+        }
+
+        chain->cache_stats.misses++;
+        if (!readBackPayload(chain, block))
+        {
+                reportMessage("Error: Could not read block #%d back from %s", block->index, chain->log.filename);
+                return 0;
+        }
+        block->flags &= ~BLOCK_EVICTED;
+        chain->payload_bytes += blockPayloadSize(block);
+        touchBlock(chain, block);
+        trimCache(chain, block);
+        return 1;
+}
+
+/**
+ * Reads the block at a height of the chain as it was when the file was closed
+ * @param file Opened chain file
+ * @param height Height of the block
+ * @return Block allocated from the file's pool, or NULL if there is none
+ */
+Block *readFileBlockAtHeight(ChainFile *file, int height)
+{
+        if (!file || height < 0)
+                return NULL;
+
+        // The newest segment indexing the height has the block's latest state
+        for (int i = file->segment_count - 1; i >= 0; i--)
+        {
+                const ChainSegment *segment = &file->segments[i];
+                if ((uint32_t)height >= segment->index->height_count)
+                        continue;
+
+                uint32_t entry = segment->heights[height];
+                if (entry < segment->index->entry_count)
+                        return readFileBlock(file, &file->pool, &segment->entries[entry]);
+        }
+        return NULL;
+}
+
+/**
+ * Reads the block with the given hash from the file
+ * @param file Opened chain file
+ * @param hash Hash of the block
+ * @return Block allocated from the file's pool, or NULL if there is none
+ */
+Block *readFileBlockByHash(ChainFile *file, const char *hash)
+{
+        if (!file || !hash)
+                return NULL;
+
+        uint64_t key = hashIndexKey(hash);
+
+        for (int i = file->segment_count - 1; i >= 0; i--)
+        {
+                const ChainSegment *segment = &file->segments[i];
+                uint32_t mask = segment->index->slot_count - 1;
+
+                // Probe until an empty slot; each candidate costs one record read
+                for (uint32_t slot = (uint32_t)key & mask, probes = 0; segment->slots[slot] && probes <= mask;
+                     slot = (slot + 1) & mask, probes++)
+                {
+                        uint32_t entry = segment->slots[slot] - 1;
+                        if (entry >= segment->index->entry_count || segment->entries[entry].key != key)
+                                continue;
+
+                        Block *block = readFileBlock(file, &file->pool, &segment->entries[entry]);
+                        if (block && strcmp(block->hash, hash) == 0)
+                                return block;
+                        freeBlock(&file->pool, block);
+                }
+        }
+        return NULL;
+}
+
+/**
+ * Closes a chain file opened for random access, releasing every block read from it
+ * @param file Opened chain file
+ */
+void closeChainFile(ChainFile *file)
+{
+        if (!file)
+                return;
+
+        releasePool(&file->pool);
+        for (int i = 0; i < file->segment_count; i++)
+        {
+                if (file->segments[i].map.base)
+                        munmap(file->segments[i].map.base, file->segments[i].map.size);
+        }
+        free(file->segments);
+        free(file);
+}
+
+/**
+ * Tells whether an import or export file is CSV, by its extension
+ * @param filename Name of the file
+ * @return 1 for a .csv file, 0 for JSONL
+ */
+static int isCsvFile(const char *filename)
+{
+        size_t length = strlen(filename);
+        return length >= 4 && strcmp(filename + length - 4, ".csv") == 0;
+}
+
+/**
+ * Finds the newline ending a line, skipping those inside quoted CSV columns
+ * @param start Start of the line
+ * @param available Bytes buffered from the start
+ * @param csv Whether quotes can hide newlines
+ * @return The newline, or NULL if the buffered bytes hold none
+ */
+static char *findLineEnd(char *start, size_t available, int csv)
+{
+        if (!csv)
+                return (char *)memchr(start, '\n', available);
+
+        // A doubled quote flips the state twice, so it never ends a column
+        int quoted = 0;
+        for (size_t i = 0; i < available; i++)
+        {
+                if (start[i] == '"')
+                        quoted = !quoted;
+                else if (start[i] == '\n' && !quoted)
+                        return start + i;
+        }
+        return NULL;
+}
+
+/**
+ * Hands out the next line of an import file, terminated in place in the
+ * reader's buffer; the line stays valid until the next call
+ * @param reader Reader over the file
+ * @return The line without its line ending, or NULL at the end or on failure
+ */
+static char *readLine(LineReader *reader)
+{
+        for (;;)
+        {
+                char *start = reader->buffer + reader->position;
+                size_t available = reader->length - reader->position;
+                char *end = findLineEnd(start, available, reader->csv);
+
+                // The last line may lack its newline; the spare byte holds its terminator
+                if (!end && reader->eof && available > 0)
+                        end = reader->buffer + reader->length;
+                if (end)
+                {
+                        reader->position = (size_t)(end - reader->buffer);
+                        if (reader->position < reader->length)
+                                reader->position++;
+                        *end = '\0';
+                        if (end > start && end[-1] == '\r')
+                                end[-1] = '\0';
+                        reader->line++;
+                        return start;
+                }
+                if (reader->eof)
+                        return NULL;
+
+                // Move the partial line to the front and refill behind it
+                if (available == IMPORT_BUFFER_SIZE)
+                {
+                        reader->failed = 1;
+                        return NULL;
+                }
+                memmove(reader->buffer, start, available);
+                reader->length = available;
+                reader->position = 0;
+
+                size_t space = IMPORT_BUFFER_SIZE - reader->length;
+                size_t read = fread(reader->buffer + reader->length, 1, space, reader->file);
+                if (read == 0)
+                {
+                        reader->failed = ferror(reader->file) != 0;
+                        reader->eof = 1;
+                }
+                reader->length += read;
+        }
+}
+
+/**
+ * Maps an import field name, a JSON key or CSV column, to its IMPORT_* slot
+ * @param name Field name
+ * @return Slot of the field, or -1 if it is not one the import uses
+ */
+static int importField(const char *name)
+{
+        if (strcmp(name, "type") == 0)
+                return IMPORT_TYPE;
+        if (strcmp(name, "block") == 0)
+                return IMPORT_BLOCK;
+        if (strcmp(name, "data") == 0)
+                return IMPORT_DATA;
+        if (strcmp(name, "sender") == 0)
+                return IMPORT_SENDER;
+        if (strcmp(name, "receiver") == 0)
+                return IMPORT_RECEIVER;
+        if (strcmp(name, "amount") == 0)
+                return IMPORT_AMOUNT;
+        if (strcmp(name, "timestamp") == 0)
+                return IMPORT_TIMESTAMP;
+        return -1;
+}
+
+/**
+ * Skips spaces and tabs
+ * @param cursor Position in a line
+ * @return First position that is neither
+ */
+static char *skipSpace(char *cursor)
+{
+        while (*cursor == ' ' || *cursor == '\t')
+                cursor++;
+        return cursor;
+}
+
+/**
+ * Reads the four hex digits of a JSON \u escape, in either case
+ * @param text The digits
+ * @param code Receives their value
+ * @return 1 if successful, 0 if they are not four hex digits
+ */
+static int parseHex4(const char *text, unsigned int *code)
+{
+        *code = 0;
+        for (int i = 0; i < 4; i++)
+        {
+                char c = text[i];
+                int digit = hexValue(c >= 'A' && c <= 'F' ? (char)(c - 'A' + 'a') : c);
+                if (digit < 0)
+                        return 0;
+                *code = *code * 16 + (unsigned int)digit;
+        }
+        return 1;
+}
+
+/**
+ * Decodes a JSON string in place; the decoded text is never longer than its escapes
+ * @param cursor Position of the opening quote, moved past the closing one
+ * @return The decoded string, or NULL if it is malformed
+ */
+static char *parseJsonString(char **cursor)
+{
+        char *read = *cursor + 1;
+        char *start = read;
+        char *write = read;
+
+        while (*read != '"')
+        {
+                if ((unsigned char)*read < 0x20)
+                        return NULL;
+                if (*read != '\\')
+                {
+                        *write++ = *read++;
+                        continue;
+                }
+
+                read++;
+                char escape = *read++;
+                unsigned int code;
+                unsigned int low;
+                switch (escape)
+                {
+                case '"':
+                case '\\':
+                case '/':
+                        *write++ = escape;
+                        break;
+                case 'b':
+                        *write++ = '\b';
+                        break;
+                case 'f':
+                        *write++ = '\f';
+                        break;
+                case 'n':
+                        *write++ = '\n';
+                        break;
+                case 'r':
+                        *write++ = '\r';
+                        break;
+                case 't':
+                        *write++ = '\t';
+                        break;
+                case 'u':
+                        if (!parseHex4(read, &code))
+                                return NULL;
+                        read += 4;
+
+                        // Characters outside the basic plane come as a surrogate pair
+                        if (code >= 0xD800 && code < 0xDC00 && read[0] == '\\' && read[1] == 'u' &&
+                            parseHex4(read + 2, &low) && low >= 0xDC00 && low < 0xE000)
+                        {
+                                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                                read += 6;
+                        }
+                        if (code == 0)
+                                return NULL;
+                        if (code < 0x80)
+                        {
+                                *write++ = (char)code;
+                        }
+                        else if (code < 0x800)
+                        {
+                                *write++ = (char)(0xC0 | (code >> 6));
+                                *write++ = (char)(0x80 | (code & 0x3F));
+                        }
+                        else if (code < 0x10000)
+                        {
+                                *write++ = (char)(0xE0 | (code >> 12));
+                                *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                                *write++ = (char)(0x80 | (code & 0x3F));
+                        }
+                        else
+                        {
+                                *write++ = (char)(0xF0 | (code >> 18));
+                                *write++ = (char)(0x80 | ((code >> 12) & 0x3F));
+                                *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                                *write++ = (char)(0x80 | (code & 0x3F));
+                        }
+                        break;
+                default:
+                        return NULL;
+                }
+        }
+
+        *write = '\0';
+        *cursor = read + 1;
+        return start;
+}
+
+/**
+ * Splits a JSONL line, one flat JSON object, into import fields in place.
+ * Keys the import does not use are skipped, and null counts as absent.
+ * @param line Line to parse
+ * @param fields Receives the fields present, the rest left NULL
+ * @return 1 if successful, 0 if the line is not a flat JSON object
+ */
+static int parseJsonLine(char *line, const char **fields)
+{
+        char *cursor = skipSpace(line);
+        if (*cursor++ != '{')
+                return 0;
+
+        cursor = skipSpace(cursor);
+        if (*cursor == '}')
+                return *skipSpace(cursor + 1) == '\0';
+
+        for (;;)
+        {
+                if (*cursor != '"')
+                        return 0;
+                char *key = parseJsonString(&cursor);
+                if (!key)
+                        return 0;
+                cursor = skipSpace(cursor);
+                if (*cursor++ != ':')
+                        return 0;
+                cursor = skipSpace(cursor);
+
+                char *value;
+                char next;
+                if (*cursor == '"')
+                {
+                        value = parseJsonString(&cursor);
+                        if (!value)
+                                return 0;
+                        cursor = skipSpace(cursor);
+                        next = *cursor;
+                }
+                else
+                {
+                        // Numbers and literals are cut off where they end; records hold no nested values
+                        value = cursor;
+                        while (*cursor && *cursor != ',' && *cursor != '}' && *cursor != ' ' && *cursor != '\t')
+                                cursor++;
+                        if (cursor == value || *value == '{' || *value == '[')
+                                return 0;
+                        char *end = cursor;
+                        cursor = skipSpace(cursor);
+                        next = *cursor;
+                        *end = '\0';
+                        if (strcmp(value, "null") == 0)
+                                value = NULL;
+                }
+
+                int field = importField(key);
+                if (field >= 0)
+                        fields[field] = value;
+
+                if (next == ',')
+                {
+                        cursor = skipSpace(cursor + 1);
+                        continue;
+                }
+                return next == '}' && *skipSpace(cursor + 1) == '\0';
+        }
+}
+
+/**
+ * Splits a CSV line into its columns in place, undoing quoting
+ * @param line Line to split
+ * @param columns Receives the columns
+ * @return Number of columns, or -1 if the line is malformed or has too many
+ */
+static int splitCsvLine(char *line, char **columns)
+{
+        char *read = line;
+        int count = 0;
+
+        for (;;)
+        {
+                if (count == IMPORT_MAX_COLUMNS)
+                        return -1;
+
+                char *start = read;
+                char *write = read;
+                if (*read == '"')
+                {
+                        // A doubled quote inside a quoted column stands for one quote
+                        read++;
+                        for (;;)
+                        {
+                                if (*read == '\0')
+                                        return -1;
+                                if (*read == '"' && read[1] == '"')
+                                {
+                                        *write++ = '"';
+                                        read += 2;
+                                }
+                                else if (*read == '"')
+                                {
+                                        read++;
+                                        break;
+                                }
+                                else
+                                {
+                                        *write++ = *read++;
+                                }
+                        }
+                        if (*read != ',' && *read != '\0')
+                                return -1;
+                }
+                else
+                {
+                        while (*read && *read != ',')
+                                read++;
+                        write = read;
+                }
+
+                char end = *read;
+                *write = '\0';
+                columns[count++] = start;
+                if (end == '\0')
+                        return count;
+                read++;
+        }
+}
+
+/**
+ * Hashes the block an import has been appending to, if it changed
+ * @param chain Chain being imported into
+ * @param state Import progress
+ */
+static void finishImportBlock(Blockchain *chain, ImportState *state)
+{
+        if (state->block && state->appended > 0)
+                rehashBlock(chain, state->block);
+        state->appended = 0;
+}
+
+/**
+ * Applies one import record: a block record opens a new block on the tip,
+ * and transactions go into the open block. Loose transactions are batched
+ * into blocks of IMPORT_BATCH_TRANSACTIONS, and each block is hashed once
+ * when the import moves past it rather than once per transaction.
+ * @param chain Chain being imported into
+ * @param state Import progress
+ * @param fields Fields of the record, NULL where absent
+ * @return 1 if successful, 0 if the record is invalid or the chain refused it
+ */
+static int importRecord(Blockchain *chain, ImportState *state, const char **fields)
+{
+        const char *type = fields[IMPORT_TYPE];
+        int is_block = type ? strcmp(type, "block") == 0 : fields[IMPORT_DATA] && !fields[IMPORT_SENDER];
+        if (type && !is_block && strcmp(type, "transaction") != 0)
+                return 0;
+
+        if (is_block)
+        {
+                finishImportBlock(chain, state);
+                state->block = NULL;
+
+                // The exported chain's genesis block stands in for this chain's own
+                if (chain->head && fields[IMPORT_BLOCK] && strcmp(fields[IMPORT_BLOCK], "0") == 0)
+                        return 1;
+                if (!addBlockLocked(chain, fields[IMPORT_DATA] ? fields[IMPORT_DATA] : ""))
+                        return 0;
+                state->block = chain->tip;
+                state->batching = 0;
+                state->blocks++;
+                return 1;
+        }
+
+        Transaction trans;
+        char *end;
+        const char *sender = fields[IMPORT_SENDER];
+        const char *receiver = fields[IMPORT_RECEIVER];
+        if (!sender || !receiver || !fields[IMPORT_AMOUNT] || !*sender || !*receiver ||
+            strlen(sender) >= MAX_SENDER_SIZE || strlen(receiver) >= MAX_RECEIVER_SIZE)
+                return 0;
+
+        memset(&trans, 0, sizeof(Transaction));
+        memcpy(trans.sender, sender, strlen(sender));
+        memcpy(trans.receiver, receiver, strlen(receiver));
+        trans.amount = strtod(fields[IMPORT_AMOUNT], &end);
+        if (end == fields[IMPORT_AMOUNT] || *end)
+                return 0;
+        trans.timestamp = time(NULL);
+        if (fields[IMPORT_TIMESTAMP])
+        {
+                trans.timestamp = (time_t)strtoll(fields[IMPORT_TIMESTAMP], &end, 10);
+                if (end == fields[IMPORT_TIMESTAMP] || *end)
+                        return 0;
+        }
+
+        if (!state->block || (state->batching && state->block->transaction_count >= IMPORT_BATCH_TRANSACTIONS))
+        {
+                finishImportBlock(chain, state);
+                state->block = NULL;
+                if (!addBlockLocked(chain, "Imported transactions"))
+                        return 0;
+                state->block = chain->tip;
+                state->batching = 1;
+                state->blocks++;
+        }
+        if (!appendTransaction(chain, state->block, &trans))
+                return 0;
+        state->appended++;
+        state->transactions++;
+        return 1;
+}
+
+/**
+ * Streams blocks and transactions from a JSONL or CSV file onto the tip of
+ * the chain. Lines are parsed in place in one read buffer, so nothing is
+ * allocated per record. JSONL holds one flat object per line; CSV starts
+ * with a header naming its columns. Either way the fields used are type,
+ * block, data, sender, receiver, amount and timestamp, and others are
+ * ignored. New blocks get fresh timestamps and hashes, while transactions
+ * keep the timestamps they bring. Records before a bad line stay imported.
+ * @param chain Pointer to the blockchain
+ * @param filename File to import, CSV if it ends in .csv
+ * @return 1 if every record was imported, 0 if failed
+ */
+static int importBlockchainLocked(Blockchain *chain, const char *filename)
+{
+        if (!chain || !filename)
+                return 0;
+
+        LineReader reader;
+        memset(&reader, 0, sizeof(LineReader));
+        reader.file = fopen(filename, "rb");
+        if (!reader.file)
+        {
+                reportMessage("Error: Could not open %s for reading", filename);
+                return 0;
+        }
+        reader.buffer = (char *)malloc(IMPORT_BUFFER_SIZE + 1);
+        if (!reader.buffer)
+        {
+                reportMessage("Error: Not enough memory to import %s", filename);
+                fclose(reader.file);
+                return 0;
+        }
+
+        int csv = isCsvFile(filename);
+        int map[IMPORT_MAX_COLUMNS];
+        reader.csv = csv;
+        int column_count = 0;
+        ImportState state;
+        int ok = 1;
+        char *line;
+
+        memset(&state, 0, sizeof(ImportState));
+        while (ok && (line = readLine(&reader)) != NULL)
+        {
+                const char *fields[IMPORT_FIELD_COUNT] = {NULL};
+                char *columns[IMPORT_MAX_COLUMNS];
+
+                if (*skipSpace(line) == '\0')
+                        continue;
+
+                if (!csv)
+                {
+                        ok = parseJsonLine(line, fields);
+                }
+                else if (column_count == 0)
+                {
+                        // The header says which column holds which field
+                        int count = splitCsvLine(line, columns);
+                        int known = 0;
+                        for (int i = 0; i < count; i++)
+                        {
+                                map[i] = importField(columns[i]);
+                                known += map[i] >= 0;
+                        }
+                        if (known == 0)
+                        {
+                                reportMessage("Error: Line %ld of %s is not a header naming the columns", reader.line,
+                                              filename);
+                                ok = 0;
+                                break;
+                        }
+                        column_count = count;
+                        continue;
+                }
+                else
+                {
+                        // Empty columns count as absent
+                        int count = splitCsvLine(line, columns);
+                        ok = count == column_count;
+                        for (int i = 0; ok && i < count; i++)
+                        {
+                                if (map[i] >= 0 && columns[i][0] != '\0')
+                                        fields[map[i]] = columns[i];
+                        }
+                }
+
+                ok = ok && importRecord(chain, &state, fields);
+                if (!ok)
+                        reportMessage("Error: Line %ld of %s is not a valid record", reader.line, filename);
+        }
+        finishImportBlock(chain, &state);
+
+        if (ok && reader.failed)
+        {
+                reportMessage("Error: Line %ld of %s is unreadable or longer than %d bytes", reader.line + 1, filename,
+                              IMPORT_BUFFER_SIZE);
+                ok = 0;
+        }
+
+        fclose(reader.file);
+        free(reader.buffer);
+        reportMessage("Imported %ld blocks and %ld transactions from %s", state.blocks, state.transactions, filename);
+        return ok;
+}
+
+/**
+ * Writes a string as a JSON string literal
+ * @param file Export file
+ * @param text String to write
+ */
+static void writeJsonString(FILE *file, const char *text)
+{
+        putc('"', file);
+        for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+        {
+                if (*c == '"' || *c == '\\')
+                {
+                        putc('\\', file);
+                        putc(*c, file);
+                }
+                else if (*c == '\n')
+                {
+                        fputs("\\n", file);
+                }
+                else if (*c < 0x20)
+                {
+                        fprintf(file, "\\u%04x", *c);
+                }
+                else
+                {
+                        putc(*c, file);
+                }
+        }
+        putc('"', file);
+}
+
+/**
+ * Writes a CSV column, quoting it if it holds a comma, quote or line break
+ * @param file Export file
+ * @param text Column to write
+ */
+static void writeCsvColumn(FILE *file, const char *text)
+{
+        if (!strpbrk(text, ",\"\r\n"))
+        {
+                fputs(text, file);
+                return;
+        }
+
+        putc('"', file);
+        for (const char *c = text; *c; c++)
+        {
+                if (*c == '"')
+                        putc('"', file);
+                putc(*c, file);
+        }
+        putc('"', file);
+}
+
+/**
+ * Formats an amount with the fewest digits that read back as the same value
+ * @param amount Amount to format
+ * @param output Buffer of at least 32 bytes
+ */
+static void formatAmount(double amount, char *output)
+{
+        snprintf(output, 32, "%.15g", amount);
+        if (strtod(output, NULL) != amount)
+                snprintf(output, 32, "%.17g", amount);
+}
+
+/**
+ * Streams the active chain, block by block with their transactions, to a
+ * JSONL or CSV file through a large write buffer, in the format
+ * importBlockchain reads
+ * @param chain Pointer to the blockchain
+ * @param filename File to export to, CSV if it ends in .csv
+ * @return 1 if successful, 0 if failed
+ */
+static int exportBlockchainLocked(Blockchain *chain, const char *filename)
+{
+        if (!chain || !filename)
+                return 0;
+
+        if (chain->prune_point)
+        {
+                reportMessage("Error: Cannot export a pruned chain, its early payloads are gone");
+                return 0;
+        }
+
+        FILE *file = fopen(filename, "wb");
+        char *buffer = (char *)malloc(EXPORT_BUFFER_SIZE);
+        if (!file || !buffer)
+        {
+                reportMessage("Error: Could not open %s for writing", filename);
+                if (file)
+                        fclose(file);
+                free(buffer);
+                return 0;
+        }
+        setvbuf(file, buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+
+        int csv = isCsvFile(filename);
+        long blocks = 0;
+        long transactions = 0;
+        char amount[32];
+        int ok = 1;
+
+        if (csv)
+                fputs("type,block,timestamp,data,previous_hash,hash,sender,receiver,amount\n", file);
+        for (Block *block = chain->head; block; block = block->next)
+        {
+                // Evicted payloads are read back one block at a time
+                if (!fetchBlockPayloadLocked(chain, block))
+                {
+                        ok = 0;
+                        break;
+                }
+
+                if (csv)
+                {
+                        fprintf(file, "block,%d,%lld,", block->index, (long long)block->timestamp);
+                        writeCsvColumn(file, block->data);
+                        fprintf(file, ",%s,%s,,,\n", block->previous_hash, block->hash);
+                }
+                else
+                {
+                        fprintf(file, "{\"type\":\"block\",\"block\":%d,\"timestamp\":%lld,\"data\":", block->index,
+                                (long long)block->timestamp);
+                        writeJsonString(file, block->data);
+                        fprintf(file, ",\"previous_hash\":\"%s\",\"hash\":\"%s\"}\n", block->previous_hash,
+                                block->hash);
+                }
+
+                for (int i = 0; i < block->transaction_count; i++)
+                {
+                        const Transaction *trans = &block->transactions[i];
+                        formatAmount(trans->amount, amount);
+                        if (csv)
+                        {
+                                fprintf(file, "transaction,%d,%lld,,,,", block->index, (long long)trans->timestamp);
+                                writeCsvColumn(file, trans->sender);
+                                putc(',', file);
+                                writeCsvColumn(file, trans->receiver);
+                                fprintf(file, ",%s\n", amount);
+                        }
+                        else
+                        {
+                                fprintf(file, "{\"type\":\"transaction\",\"block\":%d,\"timestamp\":%lld,\"sender\":",
+                                        block->index, (long long)trans->timestamp);
+                                writeJsonString(file, trans->sender);
+                                fputs(",\"receiver\":", file);
+                                writeJsonString(file, trans->receiver);
+                                fprintf(file, ",\"amount\":%s}\n", amount);
+                        }
+                }
+                blocks++;
+                transactions += block->transaction_count;
+        }
+
+        ok = ok && !ferror(file);
+        ok = fclose(file) == 0 && ok;
+        free(buffer);
+        if (!ok)
+        {
+                reportMessage("Error: Could not write %s", filename);
+                return 0;
+        }
+        reportMessage("Exported %ld blocks and %ld transactions to %s", blocks, transactions, filename);
+        return 1;
+}
+
+/**
+ * Splits the next space-separated word off a command line
+ * @param cursor Position in the line, moved past the word
+ * @return The word, or NULL if the line has no more
+ */
+static char *nextWord(char **cursor)
+{
+        char *start = skipSpace(*cursor);
+        if (*start == '\0')
+        {
+                *cursor = start;
+                return NULL;
+        }
+
+        char *end = start + strcspn(start, " \t");
+        *cursor = end;
+        if (*end)
+        {
+                *end = '\0';
+                *cursor = end + 1;
+        }
+        return start;
+}
+
+/**
+ * Runs commands from a file without prompts, one per line:
+ *   add-block DATA                    adds a block holding the rest of the line
+ *   add-tx SENDER RECEIVER AMOUNT     adds a transaction to the tip
+ *   validate                          checks every block on the active chain
+ *   save [FILE]                       saves to FILE, blockchain.dat by default
+ *   load [FILE]                       replaces the chain with the one in FILE
+ *   query [HEIGHT]                    shows the chain length and tip, or one block
+ * Blank lines and lines starting with # are skipped. Each command writes
+ * one line to the output, "ok ..." or "error LINE message"; messages from
+ * saving and loading go to the message callback instead. Saves run in the
+ * foreground so each result is final.
+ * @param chain Pointer to the blockchain, replaced by a load
+ * @param input Command stream
+ * @param output Stream the result lines are written to, flushed at the end
+ * @param config Configuration for loaded chains, NULL for the defaults
+ * @return 1 if every command succeeded, 0 if any failed
+ */
+int runBatch(Blockchain **chain, FILE *input, FILE *output, const ChainConfig *config)
+{
+        char *line = NULL;
+        size_t capacity = 0;
+        long number = 0;
+        int ok = 1;
+
+        while (getline(&line, &capacity, input) != -1)
+        {
+                Blockchain *current = *chain;
+                number++;
+                line[strcspn(line, "\r\n")] = '\0';
+
+                char *cursor = line;
+                char *command = nextWord(&cursor);
+                if (!command || command[0] == '#')
+                        continue;
+
+                if (strcmp(command, "add-block") == 0)
+                {
+                        if (addBlock(current, skipSpace(cursor)))
+                        {
+                                Block *tip = getChainTip(current);
+                                fprintf(output, "ok block %d %s\n", getBlockIndex(tip), getBlockHash(tip));
+                                continue;
+                        }
+                        fprintf(output, "error %ld could not add block\n", number);
+                }
+                else if (strcmp(command, "add-tx") == 0)
+                {
+                        char *sender = nextWord(&cursor);
+                        char *receiver = nextWord(&cursor);
+                        char *amount = nextWord(&cursor);
+                        char *end = NULL;
+                        double value = amount ? strtod(amount, &end) : 0;
+                        if (!amount || *end || nextWord(&cursor))
+                        {
+                                fprintf(output, "error %ld usage: add-tx SENDER RECEIVER AMOUNT\n", number);
+                        }
+                        else if (addTransaction(current, getChainTip(current), sender, receiver, value))
+                        {
+                                Block *tip = getChainTip(current);
+                                fprintf(output, "ok tx %d %d %s\n", getBlockIndex(tip), getBlockTransactionCount(tip),
+                                        getBlockHash(tip));
+                                continue;
+                        }
+                        else
+                        {
+                                fprintf(output, "error %ld could not add transaction\n", number);
+                        }
+                }
+                else if (strcmp(command, "validate") == 0)
+                {
+                        fprintf(output, "ok %s\n", validateBlockchain(current) ? "valid" : "invalid");
+                        continue;
+                }
+                else if (strcmp(command, "save") == 0)
+                {
+                        const char *filename = nextWord(&cursor);
+                        if (!filename)
+                                filename = FILENAME;
+                        if (saveBlockchain(current, filename))
+                        {
+                                fprintf(output, "ok saved %d %s\n", getChainLength(current), filename);
+                                continue;
+                        }
+                        fprintf(output, "error %ld could not save %s\n", number, filename);
+                }
+                else if (strcmp(command, "load") == 0)
+                {
+                        const char *filename = nextWord(&cursor);
+                        if (!filename)
+                                filename = FILENAME;
+                        // The current chain lets go of the file first, or both would append to it
+                        releaseBlockchainFile(current);
+                        Blockchain *loaded = loadBlockchainWithConfig(filename, config);
+                        if (loaded)
+                        {
+                                freeBlockchain(current);
+                                *chain = loaded;
+                                Block *tip = getChainTip(loaded);
+                                fprintf(output, "ok loaded %d %s\n", getChainLength(loaded),
+                                        tip ? getBlockHash(tip) : "0");
+                                continue;
+                        }
+                        fprintf(output, "error %ld could not load %s\n", number, filename);
+                }
+                else if (strcmp(command, "query") == 0)
+                {
+                        char *height = nextWord(&cursor);
+                        if (!height)
+                        {
+                                Block *tip = getChainTip(current);
+                                fprintf(output, "ok length %d tip %s\n", getChainLength(current),
+                                        tip ? getBlockHash(tip) : "0");
+                                continue;
+                        }
+
+                        // Pruned payloads are gone, so their blocks are shown without data
+                        Block *block = getBlockAtHeight(current, atoi(height));
+                        if (block && (fetchBlockPayload(current, block) || (block->flags & BLOCK_PRUNED)))
+                        {
+                                const char *data = getBlockData(block);
+                                fprintf(output, "ok block %d %lld %d %s %s %s\n", getBlockIndex(block),
+                                        (long long)getBlockTimestamp(block), getBlockTransactionCount(block),
+                                        getBlockPreviousHash(block), getBlockHash(block), data ? data : "");
+                                continue;
+                        }
+                        fprintf(output, "error %ld no block at height %s\n", number, height);
+                }
+                else
+                {
+                        fprintf(output, "error %ld unknown command %s\n", number, command);
+                }
+                ok = 0;
+        }
+
+        free(line);
+        fflush(output);
+        return ok;
+}
+
+/*
+ * Local RPC over a Unix socket. A frame is a 4-byte little-endian body
+ * length and a body encoded like the compact file records. A request body is
+ * its type byte, a varint id and the type's fields; an answer body is a
+ * status byte, the type byte, the id and, if the status is RPC_OK, the
+ * answer's fields. Clients may send any number of requests without waiting;
+ * each connection's requests are answered in order.
+ */
+
+/**
+ * Appends a string as a varint length and its bytes
+ * @param buffer Buffer to append to
+ * @param text String to append
+ * @param length Its length in bytes
+ */
+static void putString(ByteBuffer *buffer, const char *text, size_t length)
+{
+        putVarint(buffer, length);
+        putBytes(buffer, text, length);
+}
+
+/**
+ * Reads a string written by putString
+ * @param reader Reader to take it from
+ * @param text Receives the NUL-terminated string
+ * @param size Size of text
+ * @return 1 if successful, 0 if it is malformed or does not fit
+ */
+static int getString(ByteReader *reader, char *text, size_t size)
+{
+        uint64_t length = getVarint(reader);
+        const unsigned char *span = length < size ? getSpan(reader, length) : NULL;
+
+        text[0] = '\0';
+        if (!span)
+        {
+                reader->failed = 1;
+                return 0;
+        }
+        memcpy(text, span, length);
+        text[length] = '\0';
+        return 1;
+}
+
+/**
+ * Starts a frame, leaving room for its length
+ * @param buffer Buffer to append to
+ * @return Offset of the frame, for endFrame
+ */
+static size_t beginFrame(ByteBuffer *buffer)
+{
+        static const unsigned char length[RPC_FRAME_HEADER];
+        size_t start = buffer->length;
+        putBytes(buffer, length, sizeof(length));
+        return start;
+}
+
+/**
+ * Finishes a frame by filling in its length
+ * @param buffer Buffer holding the frame
+ * @param start Offset beginFrame returned
+ */
+static void endFrame(ByteBuffer *buffer, size_t start)
+{
+        if (buffer->failed)
+                return;
+
+        uint32_t length = (uint32_t)(buffer->length - start - RPC_FRAME_HEADER);
+        for (int i = 0; i < RPC_FRAME_HEADER; i++)
+                buffer->data[start + i] = (unsigned char)(length >> (8 * i));
+}
+
+/**
+ * Measures the complete frame at the start of some bytes
+ * @param data Bytes received
+ * @param length Number of bytes
+ * @param body Receives the length of the frame's body
+ * @return 1 if the whole frame is there, 0 if more bytes are needed
+ */
+static int completeFrame(const unsigned char *data, size_t length, uint32_t *body)
+{
+        if (length < RPC_FRAME_HEADER)
+                return 0;
+
+        *body = (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+        return length - RPC_FRAME_HEADER >= *body;
+}
+
+/**
+ * Appends the header fields of a block
+ * @param buffer Buffer to append to
+ * @param block Block to describe
+ */
+static void putBlockHeader(ByteBuffer *buffer, const Block *block)
+{
+        putVarint(buffer, getBlockIndex(block));
+        putVarint(buffer, zigzagEncode(getBlockTimestamp(block)));
+        putVarint(buffer, getBlockDataLength(block));
+        putVarint(buffer, getBlockTransactionCount(block));
+        putHash(buffer, getBlockPreviousHash(block));
+        putHash(buffer, getBlockHash(block));
+}
+
+/**
+ * Reads header fields written by putBlockHeader
+ * @param reader Reader to take them from
+ * @param header Receives the header
+ */
+static void getBlockHeader(ByteReader *reader, BlockHeader *header)
+{
+        // Short hashes such as the genesis "0" must not leave stale bytes behind for a record to copy
+        memset(header, 0, sizeof(BlockHeader));
+        header->index = (int)getVarint(reader);
+        header->timestamp = (time_t)zigzagDecode(getVarint(reader));
+        header->data_length = (int)getVarint(reader);
+        header->transaction_count = (int)getVarint(reader);
+        getHash(reader, header->previous_hash);
+        getHash(reader, header->hash);
+}
+
+/**
+ * Appends the transactions of a block whose payload is resident
+ * @param buffer Buffer to append to
+ * @param block Block whose transactions to write
+ */
+static void putRpcTransactions(ByteBuffer *buffer, const Block *block)
+{
+        const Transaction *transactions = getBlockTransactions(block);
+
+        for (int i = 0; i < getBlockTransactionCount(block); i++)
+        {
+                putString(buffer, transactions[i].sender, strlen(transactions[i].sender));
+                putString(buffer, transactions[i].receiver, strlen(transactions[i].receiver));
+                putAmount(buffer, transactions[i].amount);
+                putVarint(buffer, zigzagEncode(transactions[i].timestamp));
+        }
+}
+
+/**
+ * Height of the first locator hash that names a block on the active chain
+ * @param chain Chain being served
+ * @param request Reader positioned at the locator
+ * @return The height, -1 if none does or -2 if the locator is malformed
+ */
+static int locateFork(Blockchain *chain, ByteReader *request)
+{
+        char hash[HASH_SIZE + 1];
+        uint64_t count = getVarint(request);
+        int height = -1;
+
+        if (count > RPC_MAX_LOCATOR)
+                return -2;
+        for (uint64_t i = 0; i < count; i++)
+        {
+                getHash(request, hash);
+                Block *block = request->failed || height >= 0 ? NULL : findBlock(chain, hash);
+                if (block && getBlockAtHeight(chain, getBlockIndex(block)) == block)
+                        height = getBlockIndex(block);
+        }
+        return request->failed ? -2 : height;
+}
+
+/**
+ * Looks a block up for an RPC_GET_BLOCK or RPC_GET_TRANSACTIONS request
+ * @param chain Chain being served
+ * @param request Reader positioned at the request's height
+ * @return The block, or NULL if the chain is shorter
+ */
+static Block *requestedBlock(Blockchain *chain, ByteReader *request)
+{
+        uint64_t height = getVarint(request);
+        return height <= INT32_MAX ? getBlockAtHeight(chain, (int)height) : NULL;
+}
+
+/**
+ * Carries out one request and appends its fields to the answer
+ * @param server Running server
+ * @param type Request type
+ * @param request Reader positioned at the request's fields
+ * @param output Buffer receiving the answer's fields
+ * @return RPC_OK, or the status to answer with instead of fields
+ */
+static int serveRpcRequest(RpcServer *server, int type, ByteReader *request, ByteBuffer *output)
+{
+        Blockchain *chain = server->chain;
+        char sender[MAX_SENDER_SIZE];
+        char receiver[MAX_RECEIVER_SIZE];
+        char hash[HASH_SIZE + 1];
+        Block *block = NULL;
+
+        switch (type)
+        {
+        case RPC_CHAIN_INFO:
+                block = getChainTip(chain);
+                if (!block)
+                        return RPC_NOT_FOUND;
+                putBlockHeader(output, block);
+                return RPC_OK;
+
+        case RPC_GET_BLOCK:
+        case RPC_FIND_BLOCK:
+                if (type == RPC_GET_BLOCK)
+                {
+                        block = requestedBlock(chain, request);
+                }
+                else
+                {
+                        getHash(request, hash);
+                        block = request->failed ? NULL : findBlock(chain, hash);
+                }
+                if (request->failed)
+                        return RPC_BAD_REQUEST;
+                if (!block)
+                        return RPC_NOT_FOUND;
+
+                // Pruned payloads are gone, so their blocks are answered without data
+                fetchBlockPayload(chain, block);
+                putBlockHeader(output, block);
+                putVarint(output, getBlockData(block) != NULL);
+                if (getBlockData(block))
+                        putBytes(output, getBlockData(block), getBlockDataLength(block));
+                return RPC_OK;
+
+        case RPC_GET_TRANSACTIONS:
+        {
+                block = requestedBlock(chain, request);
+                if (request->failed)
+                        return RPC_BAD_REQUEST;
+                if (!block || !fetchBlockPayload(chain, block))
+                        return RPC_NOT_FOUND;
+
+                putVarint(output, getBlockTransactionCount(block));
+                putRpcTransactions(output, block);
+                return RPC_OK;
+        }
+
+        case RPC_LOCATE_FORK:
+        {
+                int height = locateFork(chain, request);
+                if (height == -2)
+                        return RPC_BAD_REQUEST;
+                if (height < 0)
+                        return RPC_NOT_FOUND;
+                putVarint(output, height);
+                return RPC_OK;
+        }
+
+        case RPC_GET_HEADERS:
+        case RPC_GET_BLOCKS:
+        {
+                uint64_t height = getVarint(request);
+                uint64_t count = getVarint(request);
+                uint64_t limit = type == RPC_GET_HEADERS ? RPC_MAX_HEADERS : RPC_MAX_BLOCKS;
+                if (request->failed || count > limit || height > INT32_MAX)
+                        return RPC_BAD_REQUEST;
+
+                // Heights past the tip are left off, so the answer may hold fewer blocks than asked for
+                int length = getChainLength(chain);
+                int end = height + count < (uint64_t)length ? (int)(height + count) : length;
+                int first = height < (uint64_t)end ? (int)height : end;
+                putVarint(output, end - first);
+                for (int i = first; i < end; i++)
+                {
+                        block = getBlockAtHeight(chain, i);
+                        if (type == RPC_GET_HEADERS)
+                        {
+                                putBlockHeader(output, block);
+                                continue;
+                        }
+
+                        // Pruned history cannot be handed out block by block
+                        if (!fetchBlockPayload(chain, block))
+                                return RPC_NOT_FOUND;
+                        putBlockHeader(output, block);
+                        putBytes(output, getBlockData(block), getBlockDataLength(block));
+                        putRpcTransactions(output, block);
+                }
+                return RPC_OK;
+        }
+
+        case RPC_GET_BALANCE:
+                if (!getString(request, sender, sizeof(sender)))
+                        return RPC_BAD_REQUEST;
+                putAmount(output, getBalance(chain, sender));
+                return RPC_OK;
+
+        case RPC_SUBMIT_TRANSACTION:
+        {
+                getString(request, sender, sizeof(sender));
+                getString(request, receiver, sizeof(receiver));
+                double amount = getAmount(request);
+                if (request->failed)
+                        return RPC_BAD_REQUEST;
+                if (!addTransaction(chain, getChainTip(chain), sender, receiver, amount))
+                        return RPC_REJECTED;
+                putBlockHeader(output, getChainTip(chain));
+                return RPC_OK;
+        }
+
+        case RPC_ADD_BLOCK:
+                if (!getString(request, server->text, RPC_MAX_REQUEST + 1))
+                        return RPC_BAD_REQUEST;
+                if (!addBlock(chain, server->text))
+                        return RPC_REJECTED;
+                putBlockHeader(output, getChainTip(chain));
+                return RPC_OK;
+
+        case RPC_VALIDATE:
+                return validateBlockchain(chain) ? RPC_OK : RPC_REJECTED;
+
+        case RPC_SAVE:
+                return server->filename && saveBlockchain(chain, server->filename) ? RPC_OK : RPC_REJECTED;
+
+        default:
+                return RPC_BAD_REQUEST;
+        }
+}
+
+/**
+ * Answers one request frame
+ * @param server Running server
+ * @param request Reader over the frame's body
+ * @param output Buffer receiving the answer frame
+ */
+static void answerRpcRequest(RpcServer *server, ByteReader *request, ByteBuffer *output)
+{
+        unsigned char head[2] = {RPC_OK, 0};
+
+        getBytes(request, &head[1], 1);
+        uint32_t id = (uint32_t)getVarint(request);
+
+        size_t start = beginFrame(output);
+        putBytes(output, head, sizeof(head));
+        putVarint(output, id);
+
+        // A refused request is answered with its status alone
+        size_t fields = output->length;
+        int status = request->failed ? RPC_BAD_REQUEST : serveRpcRequest(server, head[1], request, output);
+        if (output->failed)
+                return;
+        if (status != RPC_OK)
+                output->length = fields;
+        output->data[start + RPC_FRAME_HEADER] = (unsigned char)status;
+        endFrame(output, start);
+}
+
+/**
+ * Reads what a client has sent, once per wakeup so busy clients take turns
+ * @param peer Client to read from
+ * @return 1 if it is still open, 0 if it shut its end, -1 if the connection failed
+ */
+static int readRpcPeer(RpcPeer *peer)
+{
+        ByteBuffer *input = &peer->input;
+
+        // Requests already answered make room before the buffer grows
+        if (peer->consumed > 0)
+        {
+                input->length -= peer->consumed;
+                memmove(input->data, input->data + peer->consumed, input->length);
+                peer->consumed = 0;
+        }
+        if (!reserveBytes(input, RPC_READ_SIZE))
+                return -1;
+
+        ssize_t count = read(peer->fd, input->data + input->length, input->capacity - input->length);
+        if (count > 0)
+        {
+                input->length += count;
+                return 1;
+        }
+        if (count == 0)
+                return 0;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 1 : -1;
+}
+
+/**
+ * Answers every complete request a client has sent
+ * @param server Running server
+ * @param peer Client whose requests are answered
+ * @return 1 if successful, 0 if the client broke the protocol or memory ran out
+ */
+static int handleRpcRequests(RpcServer *server, RpcPeer *peer)
+{
+        ByteBuffer *input = &peer->input;
+        uint32_t length = 0;
+
+        while (completeFrame(input->data + peer->consumed, input->length - peer->consumed, &length))
+        {
+                if (length > RPC_MAX_REQUEST)
+                        return 0;
+
+                ByteReader request = {input->data + peer->consumed + RPC_FRAME_HEADER, length, 0, 0};
+                answerRpcRequest(server, &request, &peer->output);
+                peer->consumed += RPC_FRAME_HEADER + length;
+                server->requests++;
+        }
+
+        // A partial frame that can never fit is as bad as a complete one
+        return input->length - peer->consumed < RPC_FRAME_HEADER + RPC_MAX_REQUEST && !peer->output.failed;
+}
+
+/**
+ * Writes a client's answers until its socket is full, then registers for what the client is waiting on
+ * @param server Running server
+ * @param peer Client to write to
+ * @return 1 if it stays open, 0 if it failed or is done
+ */
+static int flushRpcPeer(RpcServer *server, RpcPeer *peer)
+{
+        ByteBuffer *output = &peer->output;
+
+        while (peer->sent < output->length)
+        {
+                ssize_t count = send(peer->fd, output->data + peer->sent, output->length - peer->sent, MSG_NOSIGNAL);
+                if (count > 0)
+                        peer->sent += count;
+                else if (count < 0 && errno == EINTR)
+                        continue;
+                else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        break;
+                else
+                        return 0;
+        }
+
+        if (peer->sent == output->length)
+        {
+                output->length = 0;
+                peer->sent = 0;
+        }
+        else if (peer->sent > output->length / 2)
+        {
+                output->length -= peer->sent;
+                memmove(output->data, output->data + peer->sent, output->length);
+                peer->sent = 0;
+        }
+        if (peer->closing && output->length == 0)
+                return 0;
+
+        // A client that does not read its answers is not read from until it catches up
+        uint32_t events = 0;
+        if (!peer->closing && output->length - peer->sent < RPC_MAX_BACKLOG)
+                events |= EPOLLIN;
+        if (peer->sent < output->length)
+                events |= EPOLLOUT;
+        if (events != peer->events)
+        {
+                struct epoll_event event;
+                event.events = events;
+                event.data.ptr = peer;
+                if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, peer->fd, &event) != 0)
+                        return 0;
+                peer->events = events;
+        }
+        return 1;
+}
+
+/**
+ * Disconnects a client, dropping any answers it has not read
+ * @param server Running server
+ * @param peer Client to disconnect
+ */
+static void closeRpcPeer(RpcServer *server, RpcPeer *peer)
+{
+        if (peer->prev)
+                peer->prev->next = peer->next;
+        else
+                server->peers = peer->next;
+        if (peer->next)
+                peer->next->prev = peer->prev;
+
+        close(peer->fd);
+        free(peer->input.data);
+        free(peer->output.data);
+        free(peer);
+}
+
+/**
+ * Reads from, answers and writes to a client the event loop woke up for
+ * @param server Running server
+ * @param peer Client to service
+ * @param events Events reported for it
+ */
+static void serviceRpcPeer(RpcServer *server, RpcPeer *peer, uint32_t events)
+{
+        int open = !(events & EPOLLERR);
+
+        if (open && (events & (EPOLLIN | EPOLLHUP)) && !peer->closing)
+        {
+                int status = readRpcPeer(peer);
+                open = status >= 0;
+                peer->closing = status == 0;
+        }
+        if (open)
+                open = handleRpcRequests(server, peer);
+        if (open)
+                open = flushRpcPeer(server, peer);
+        if (!open)
+                closeRpcPeer(server, peer);
+}
+
+/**
+ * Makes a connected socket a client of the server
+ * @param server Running server
+ * @param fd Connected socket; closed if it cannot be added
+ * @return 1 if successful, 0 if failed
+ */
+static int addRpcPeer(RpcServer *server, int fd)
+{
+        RpcPeer *peer = (RpcPeer *)calloc(1, sizeof(RpcPeer));
+        struct epoll_event event;
+
+        event.events = EPOLLIN;
+        event.data.ptr = peer;
+        if (!peer || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 ||
+            epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+                free(peer);
+                close(fd);
+                return 0;
+        }
+
+        peer->fd = fd;
+        peer->events = EPOLLIN;
+        peer->next = server->peers;
+        if (server->peers)
+                server->peers->prev = peer;
+        server->peers = peer;
+        server->connections++;
+        return 1;
+}
+
+/**
+ * Accepts every pending connection
+ * @param server Running server
+ * @param listen_fd Listening socket
+ */
+static void acceptRpcPeers(RpcServer *server, int listen_fd)
+{
+        while (1)
+        {
+                int fd = accept(listen_fd, NULL, NULL);
+                if (fd < 0)
+                {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                                reportMessage("Error: Could not accept a connection");
+                        return;
+                }
+                addRpcPeer(server, fd);
+        }
+}
+
+/**
+ * Takes the stop signals that arrived off a signalfd, so none is still
+ * pending when the signal mask is restored
+ * @param signal_fd Non-blocking signalfd
+ * @return 1 if any signal arrived, 0 if none had
+ */
+static int drainSignals(int signal_fd)
+{
+        struct signalfd_siginfo info;
+        int received = 0;
+
+        while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info))
+                received = 1;
+        return received;
+}
+
+/**
+ * Serves a chain over a Unix socket until SIGINT or SIGTERM. One thread runs
+ * a non-blocking epoll loop; each wakeup reads what a client has sent, answers
+ * every complete request in it and writes the answers back in one go.
+ * @param chain Chain to serve
+ * @param socket_path Path to listen on; a socket left there by an earlier server is replaced
+ * @param filename File RPC_SAVE writes, NULL to refuse saves
+ * @return 1 if the server ran and stopped cleanly, 0 if failed
+ */
+int runServer(Blockchain *chain, const char *socket_path, const char *filename)
+{
+        struct sockaddr_un address;
+        struct stat existing;
+        struct epoll_event event;
+        RpcServer server;
+        RpcPeer listener;           // Stand-ins telling the listening socket and the signals apart from clients
+        RpcPeer stopper;
+        sigset_t signals;
+        sigset_t previous;
+
+        if (!chain || strlen(socket_path) >= sizeof(address.sun_path))
+        {
+                reportMessage("Error: Cannot serve on %s", socket_path);
+                return 0;
+        }
+
+        memset(&server, 0, sizeof(RpcServer));
+        server.chain = chain;
+        server.filename = filename;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, socket_path);
+
+        // A socket left behind by a server that died is replaced; any other file is not
+        if (lstat(socket_path, &existing) == 0 && S_ISSOCK(existing.st_mode))
+                unlink(socket_path);
+
+        // Signals arrive as events so the loop can stop between requests
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        server.text = (char *)malloc(RPC_MAX_REQUEST + 1);
+        int bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        int ok = bound && signal_fd >= 0 && server.epoll_fd >= 0 && server.text && listen(listen_fd, SOMAXCONN) == 0;
+        if (ok)
+        {
+                event.events = EPOLLIN;
+                event.data.ptr = &listener;
+                ok = epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+        }
+        if (ok)
+        {
+                event.data.ptr = &stopper;
+                ok = epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == 0;
+        }
+        if (ok)
+                reportMessage("Serving the chain on %s", socket_path);
+        else
+                reportMessage("Error: Could not serve on %s", socket_path);
+
+        int running = ok;
+        while (running)
+        {
+                struct epoll_event events[RPC_MAX_EVENTS];
+                int count = epoll_wait(server.epoll_fd, events, RPC_MAX_EVENTS, -1);
+                if (count < 0 && errno != EINTR)
+                {
+                        reportMessage("Error: Event loop failed");
+                        ok = 0;
+                        break;
+                }
+
+                // Each descriptor is reported once per wakeup, so closing one client leaves the rest valid
+                for (int i = 0; i < count; i++)
+                {
+                        RpcPeer *peer = (RpcPeer *)events[i].data.ptr;
+                        if (peer == &listener)
+                                acceptRpcPeers(&server, listen_fd);
+                        else if (peer == &stopper)
+                                running = !drainSignals(signal_fd);
+                        else
+                                serviceRpcPeer(&server, peer, events[i].events);
+                }
+        }
+
+        while (server.peers)
+                closeRpcPeer(&server, server.peers);
+        if (bound)
+                unlink(socket_path);
+        if (listen_fd >= 0)
+                close(listen_fd);
+        if (signal_fd >= 0)
+                close(signal_fd);
+        if (server.epoll_fd >= 0)
+                close(server.epoll_fd);
+        free(server.text);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+        if (ok)
+                reportMessage("Server stopped after %ld requests from %ld connections", server.requests,
+                              server.connections);
+        return ok;
+}
+
+/**
+ * Serves a chain to the one client at the other end of a connected socket,
+ * such as one end of a socketpair, until the client closes its end. RPC_SAVE
+ * is refused.
+ * @param chain Chain to serve
+ * @param fd Connected socket; closed when the client is done
+ * @return 1 if the client was served until it closed its end, 0 if failed
+ */
+int serveRpc(Blockchain *chain, int fd)
+{
+        RpcServer server;
+
+        memset(&server, 0, sizeof(RpcServer));
+        server.chain = chain;
+        server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        server.text = (char *)malloc(RPC_MAX_REQUEST + 1);
+        int ok = chain && server.epoll_fd >= 0 && server.text;
+        if (ok)
+                ok = addRpcPeer(&server, fd);
+        else
+                close(fd);
+
+        while (ok && server.peers)
+        {
+                struct epoll_event event;
+                int count = epoll_wait(server.epoll_fd, &event, 1, -1);
+                if (count < 0 && errno != EINTR)
+                        ok = 0;
+                else if (count > 0)
+                        serviceRpcPeer(&server, (RpcPeer *)event.data.ptr, event.events);
+        }
+
+        while (server.peers)
+                closeRpcPeer(&server, server.peers);
+        if (server.epoll_fd >= 0)
+                close(server.epoll_fd);
+        free(server.text);
+        return ok;
+}
+
+/**
+ * Connects to a server started by runServer
+ * @param socket_path Path the server listens on
+ * @return The connection, or NULL if failed
+ */
+RpcConnection *connectRpc(const char *socket_path)
+{
+        struct sockaddr_un address;
+
+        if (strlen(socket_path) >= sizeof(address.sun_path))
+        {
+                reportMessage("Error: Cannot connect to %s", socket_path);
+                return NULL;
+        }
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, socket_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        {
+                reportMessage("Error: Could not connect to %s", socket_path);
+                if (fd >= 0)
+                        close(fd);
+                return NULL;
+        }
+        return openRpc(fd);
+}
+
+/**
+ * Talks RPC over an already connected socket, such as the other end of a
+ * socketpair handed to serveRpc
+ * @param fd Connected socket; the connection owns it from here on
+ * @return The connection, or NULL if out of memory, in which case fd is closed
+ */
+RpcConnection *openRpc(int fd)
+{
+        RpcConnection *connection = (RpcConnection *)calloc(1, sizeof(RpcConnection));
+        if (!connection)
+        {
+                close(fd);
+                return NULL;
+        }
+        connection->fd = fd;
+        return connection;
+}
+
+/**
+ * Closes a connection, dropping any requests not yet sent
+ * @param connection Connection to close, may be NULL
+ */
+void closeRpc(RpcConnection *connection)
+{
+        if (!connection)
+                return;
+
+        if (connection->fd >= 0)
+                close(connection->fd);
+        free(connection->output.data);
+        free(connection->input.data);
+        free(connection->text);
+        free(connection->transactions);
+        free(connection->headers);
+        free(connection->blocks);
+        free(connection);
+}
+
+/**
+ * Writes queued requests and reads answers as they arrive, so neither side
+ * can fill its socket while the other waits
+ * @param connection Connection to drive
+ * @param answer Also wait until a whole answer has been read
+ * @return 1 if successful, 0 if the connection failed or the server closed it
+ */
+static int pumpRpc(RpcConnection *connection, int answer)
+{
+        ByteBuffer *input = &connection->input;
+        ByteBuffer *output = &connection->output;
+        uint32_t length;
+
+        while (connection->sent < output->length ||
+               (answer && !completeFrame(input->data + connection->consumed, input->length - connection->consumed,
+                                         &length)))
+        {
+                struct pollfd poller;
+                poller.fd = connection->fd;
+                poller.events = POLLIN | (connection->sent < output->length ? POLLOUT : 0);
+                if (poll(&poller, 1, -1) < 0)
+                {
+                        if (errno == EINTR)
+                                continue;
+                        return 0;
+                }
+
+                if (poller.revents & POLLOUT)
+                {
+                        ssize_t count = send(connection->fd, output->data + connection->sent,
+                                             output->length - connection->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                                return 0;
+                        if (count > 0)
+                                connection->sent += count;
+                }
+                if (poller.revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                        // Answers already handed out are dropped before the buffer grows
+                        if (connection->consumed > 0)
+                        {
+                                input->length -= connection->consumed;
+                                memmove(input->data, input->data + connection->consumed, input->length);
+                                connection->consumed = 0;
+                        }
+                        if (!reserveBytes(input, RPC_READ_SIZE))
+                                return 0;
+
+                        ssize_t count = recv(connection->fd, input->data + input->length,
+                                             input->capacity - input->length, MSG_DONTWAIT);
+                        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                                return 0;
+                        if (count > 0)
+                        {
+                                input->length += count;
+                                connection->received += count;
+                        }
+                }
+        }
+
+        if (connection->sent == output->length)
+        {
+                output->length = 0;
+                connection->sent = 0;
+        }
+        return 1;
+}
+
+/**
+ * Queues a request; it is sent by the time the next answer is read, so any
+ * number can be in flight. Keep the number bounded: the server stops reading
+ * from a client whose answers pile up unread.
+ * @param connection Connection to send on
+ * @param request Request to send; its type and id, and the fields that type uses
+ * @return 1 if successful, 0 if failed
+ */
+int sendRpcRequest(RpcConnection *connection, const RpcMessage *request)
+{
+        ByteBuffer *output = &connection->output;
+        unsigned char type = (unsigned char)request->type;
+
+        size_t start = beginFrame(output);
+        putBytes(output, &type, 1);
+        putVarint(output, request->id);
+        switch (request->type)
+        {
+        case RPC_GET_BLOCK:
+        case RPC_GET_TRANSACTIONS:
+                putVarint(output, request->height < 0 ? UINT64_MAX : (uint64_t)request->height);
+                break;
+        case RPC_FIND_BLOCK:
+                putHash(output, request->hash);
+                break;
+        case RPC_GET_BALANCE:
+                putString(output, request->transaction.sender, strlen(request->transaction.sender));
+                break;
+        case RPC_SUBMIT_TRANSACTION:
+                putString(output, request->transaction.sender, strlen(request->transaction.sender));
+                putString(output, request->transaction.receiver, strlen(request->transaction.receiver));
+                putAmount(output, request->transaction.amount);
+                break;
+        case RPC_ADD_BLOCK:
+                putString(output, request->data, request->data_length);
+                break;
+        case RPC_LOCATE_FORK:
+                putVarint(output, request->locator_count);
+                for (int i = 0; i < request->locator_count; i++)
+                        putHash(output, request->locator[i]);
+                break;
+        case RPC_GET_HEADERS:
+        case RPC_GET_BLOCKS:
+                putVarint(output, request->height < 0 ? UINT64_MAX : (uint64_t)request->height);
+                putVarint(output, request->count < 0 ? UINT64_MAX : (uint64_t)request->count);
+                break;
+        }
+        endFrame(output, start);
+        if (output->failed)
+                return 0;
+
+        // Long runs of requests go out as they build up rather than all at once
+        return output->length - connection->sent < RPC_READ_SIZE || pumpRpc(connection, 0);
+}
+
+/**
+ * Reads transactions written by putRpcTransactions into a connection's transaction list
+ * @param connection Connection the answer arrived on
+ * @param reader Reader positioned at the transactions
+ * @param offset Position in the list to read them into
+ * @param count Number of transactions
+ * @param length Length of the answer frame
+ * @return 1 if successful, 0 if the answer is malformed or memory ran out
+ */
+static int getRpcTransactions(RpcConnection *connection, ByteReader *reader, int offset, uint64_t count, uint32_t length)
+{
+        // Each transaction takes several bytes, so a count past the frame's length is malformed
+        if (count > length || offset + count > length)
+                return 0;
+        if (offset + count > (uint64_t)connection->transaction_capacity)
+        {
+                uint64_t capacity = offset + count;
+                if (capacity < (uint64_t)connection->transaction_capacity * 2)
+                        capacity = (uint64_t)connection->transaction_capacity * 2;
+                Transaction *grown = (Transaction *)realloc(connection->transactions, capacity * sizeof(Transaction));
+                if (!grown)
+                        return 0;
+                connection->transactions = grown;
+                connection->transaction_capacity = (int)capacity;
+        }
+        for (uint64_t i = 0; i < count && !reader->failed; i++)
+        {
+                Transaction *trans = &connection->transactions[offset + i];
+                memset(trans, 0, sizeof(Transaction));
+                getString(reader, trans->sender, sizeof(trans->sender));
+                getString(reader, trans->receiver, sizeof(trans->receiver));
+                trans->amount = getAmount(reader);
+                trans->timestamp = (time_t)zigzagDecode(getVarint(reader));
+        }
+        return !reader->failed;
+}
+
+/**
+ * Reads the blocks of an RPC_GET_BLOCKS answer. Their data is copied one
+ * after another into the connection's text, NUL-terminated, and their
+ * transactions one after another into its transaction list.
+ * @param connection Connection the answer arrived on
+ * @param reader Reader positioned at the blocks
+ * @param length Length of the answer frame
+ * @param response Answer receiving the blocks
+ * @return 1 if successful, 0 if the answer is malformed or memory ran out
+ */
+static int getRpcBlocks(RpcConnection *connection, ByteReader *reader, uint32_t length, RpcMessage *response)
+{
+        uint64_t count = getVarint(reader);
+        size_t text_length = 0;
+        int transaction_count = 0;
+
+        if (count > length)
+                return 0;
+        if (count > (uint64_t)connection->block_capacity)
+        {
+                RpcBlock *grown = (RpcBlock *)realloc(connection->blocks, count * sizeof(RpcBlock));
+                if (!grown)
+                        return 0;
+                connection->blocks = grown;
+                connection->block_capacity = (int)count;
+        }
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+                RpcBlock *block = &connection->blocks[i];
+                getBlockHeader(reader, &block->header);
+                size_t data_length = (size_t)block->header.data_length;
+                const unsigned char *data = getSpan(reader, data_length);
+                if (!data || block->header.transaction_count < 0)
+                        return 0;
+
+                if (text_length + data_length >= connection->text_capacity)
+                {
+                        size_t capacity = connection->text_capacity * 2;
+                        if (capacity < text_length + data_length + 1)
+                                capacity = text_length + data_length + 1;
+                        char *grown = (char *)realloc(connection->text, capacity);
+                        if (!grown)
+                                return 0;
+                        connection->text = grown;
+                        connection->text_capacity = capacity;
+                }
+                memcpy(connection->text + text_length, data, data_length);
+                connection->text[text_length + data_length] = '\0';
+                text_length += data_length + 1;
+
+                if (!getRpcTransactions(connection, reader, transaction_count, block->header.transaction_count, length))
+                        return 0;
+                transaction_count += block->header.transaction_count;
+        }
+
+        // The text and transactions may have moved while growing, so the blocks point into them only now
+        text_length = 0;
+        transaction_count = 0;
+        for (uint64_t i = 0; i < count; i++)
+        {
+                RpcBlock *block = &connection->blocks[i];
+                block->data = connection->text + text_length;
+                block->transactions = connection->transactions + transaction_count;
+                text_length += block->header.data_length + 1;
+                transaction_count += block->header.transaction_count;
+        }
+        response->blocks = connection->blocks;
+        response->block_count = (int)count;
+        return 1;
+}
+
+/**
+ * Waits for the answer to the oldest request still in flight
+ * @param connection Connection to read from
+ * @param response Receives the answer; its data and transactions stay valid until the next call on the connection
+ * @return 1 if an answer was read, whatever its status, 0 if the connection failed
+ */
+int readRpcResponse(RpcConnection *connection, RpcMessage *response)
+{
+        uint32_t length = 0;
+        unsigned char head[2];
+
+        if (!pumpRpc(connection, 1))
+                return 0;
+
+        completeFrame(connection->input.data + connection->consumed,
+                      connection->input.length - connection->consumed, &length);
+        ByteReader reader = {connection->input.data + connection->consumed + RPC_FRAME_HEADER, length, 0, 0};
+        connection->consumed += RPC_FRAME_HEADER + length;
+
+        memset(response, 0, sizeof(RpcMessage));
+        getBytes(&reader, head, sizeof(head));
+        response->status = head[0];
+        response->type = head[1];
+        response->id = (uint32_t)getVarint(&reader);
+        if (response->status != RPC_OK)
+                return !reader.failed;
+
+        switch (response->type)
+        {
+        case RPC_CHAIN_INFO:
+        case RPC_SUBMIT_TRANSACTION:
+        case RPC_ADD_BLOCK:
+                getBlockHeader(&reader, &response->header);
+                break;
+
+        case RPC_GET_BLOCK:
+        case RPC_FIND_BLOCK:
+        {
+                getBlockHeader(&reader, &response->header);
+                size_t data_length = (size_t)response->header.data_length;
+                const unsigned char *data = getVarint(&reader) ? getSpan(&reader, data_length) : NULL;
+                if (!data)
+                        break;
+                if (data_length >= connection->text_capacity)
+                {
+                        char *grown = (char *)realloc(connection->text, data_length + 1);
+                        if (!grown)
+                                return 0;
+                        connection->text = grown;
+                        connection->text_capacity = data_length + 1;
+                }
+                memcpy(connection->text, data, data_length);
+                connection->text[data_length] = '\0';
+                response->data = connection->text;
+                response->data_length = (int)data_length;
+                break;
+        }
+
+        case RPC_GET_TRANSACTIONS:
+        {
+                uint64_t count = getVarint(&reader);
+                if (!getRpcTransactions(connection, &reader, 0, count, length))
+                        return 0;
+                response->transactions = connection->transactions;
+                response->transaction_count = (int)count;
+                break;
+        }
+
+        case RPC_GET_BALANCE:
+                response->balance = getAmount(&reader);
+                break;
+
+        case RPC_LOCATE_FORK:
+                response->height = (int)getVarint(&reader);
+                break;
+
+        case RPC_GET_HEADERS:
+        {
+                // Each header takes dozens of bytes, so a count past the frame's length is malformed
+                uint64_t count = getVarint(&reader);
+                if (count > length)
+                        return 0;
+                if (count > (uint64_t)connection->header_capacity)
+                {
+                        BlockHeader *grown = (BlockHeader *)realloc(connection->headers, count * sizeof(BlockHeader));
+                        if (!grown)
+                                return 0;
+                        connection->headers = grown;
+                        connection->header_capacity = (int)count;
+                }
+                for (uint64_t i = 0; i < count; i++)
+                        getBlockHeader(&reader, &connection->headers[i]);
+                response->headers = connection->headers;
+                response->header_count = (int)count;
+                break;
+        }
+
+        case RPC_GET_BLOCKS:
+                if (!getRpcBlocks(connection, &reader, length, response))
+                        return 0;
+                break;
+        }
+        return !reader.failed;
+}
+
+/**
+ * Lists hashes of a chain's active blocks from the tip back, one per block
+ * near the tip and exponentially sparser further back, ending at genesis
+ * @param chain Chain to describe
+ * @param locator Receives up to RPC_MAX_LOCATOR hashes, newest first
+ * @return Number of hashes
+ */
+static int buildLocator(Blockchain *chain, char (*locator)[HASH_SIZE + 1])
+{
+        int count = 0;
+        int step = 1;
+        int height = getChainLength(chain) - 1;
+
+        while (height > 0 && count < RPC_MAX_LOCATOR - 1)
+        {
+                strcpy(locator[count++], getBlockHash(getBlockAtHeight(chain, height)));
+                if (count >= SYNC_DENSE_LOCATOR)
+                        step *= 2;
+                height -= step;
+        }
+        if (height >= 0 || count > 0)
+                strcpy(locator[count++], getBlockHash(getBlockAtHeight(chain, 0)));
+        return count;
+}
+
+/**
+ * Queues a request for a run of headers or blocks
+ * @param connection Connection to the peer
+ * @param type RPC_GET_HEADERS or RPC_GET_BLOCKS
+ * @param height First block asked for
+ * @param count Number of blocks asked for
+ * @return 1 if successful, 0 if failed
+ */
+static int requestRange(RpcConnection *connection, int type, int height, int count)
+{
+        RpcMessage request;
+
+        memset(&request, 0, sizeof(RpcMessage));
+        request.type = type;
+        request.id = (uint32_t)height;
+        request.height = height;
+        request.count = count;
+        return sendRpcRequest(connection, &request);
+}
+
+/**
+ * Makes a downloaded block's branch the active one unless this chain's own
+ * branch is heavier; between equally heavy branches, the peer's wins, so two
+ * nodes whose tips took different transactions settle on one
+ * @param chain Chain being synced
+ * @param hash Hash of the peer's tip
+ * @return 1 if the block is now on the active chain, 0 if not
+ */
+static int preferBranch(Blockchain *chain, const char *hash)
+{
+        lockChain(chain);
+        Block *block = findBlockLocked(chain, hash);
+        int active = block && getAncestor(chain->tip, block->index) == block;
+        if (block && !active && block->chain_work >= chain->tip->chain_work && switchBranch(chain, block))
+        {
+                chain->preferred = block;
+                active = 1;
+        }
+        unlockChain(chain);
+        return active;
+}
+
+/**
+ * Brings a chain up to date with a peer's, headers first. The fork point is
+ * found from a locator, then the peer's headers past it are downloaded and
+ * checked to link up in bulk, so a peer whose branch is shorter than this
+ * chain is turned down before any block is downloaded. Blocks then arrive in
+ * batches, several requests in flight at once, and each is checked against
+ * its header and accepted, which switches the chain over once the peer's
+ * branch is the heavier one, or as heavy.
+ * @param chain Chain to bring up to date; an empty one takes the peer's whole chain
+ * @param connection Connection to the peer; close it if the sync fails
+ * @param stats Receives what the sync did, may be NULL
+ * @return SYNC_LEVEL if the peer's tip is now on the active chain, SYNC_DIVERGED if this chain keeps a
+ *         heavier branch of its own, SYNC_FAILED if failed
+ */
+int syncFromRpc(Blockchain *chain, RpcConnection *connection, SyncStats *stats)
+{
+        char locator[RPC_MAX_LOCATOR][HASH_SIZE + 1];
+        char fork_hash[HASH_SIZE + 1] = "0";
+        SyncStats ignored;
+        RpcMessage request;
+        RpcMessage response;
+
+        if (!stats)
+                stats = &ignored;
+        memset(stats, 0, sizeof(SyncStats));
+        stats->fork_height = -1;
+        if (!chain || !connection)
+                return 0;
+        size_t received = connection->received;
+
+        memset(&request, 0, sizeof(RpcMessage));
+        request.type = RPC_CHAIN_INFO;
+        if (!sendRpcRequest(connection, &request) || !readRpcResponse(connection, &response) ||
+            response.status != RPC_OK)
+        {
+                reportMessage("Error: Could not read the peer's chain");
+                return 0;
+        }
+        int remote_length = response.header.index + 1;
+        int local_length = getChainLength(chain);
+        char peer_tip[HASH_SIZE + 1];
+        memcpy(peer_tip, response.header.hash, HASH_SIZE + 1);
+
+        // The first locator hash the peer has on its active chain is a block both chains share
+        int fork = -1;
+        if (local_length > 0)
+        {
+                request.type = RPC_LOCATE_FORK;
+                request.locator = (const char (*)[HASH_SIZE + 1])locator;
+                request.locator_count = buildLocator(chain, locator);
+                if (!sendRpcRequest(connection, &request) || !readRpcResponse(connection, &response) ||
+                    (response.status != RPC_OK && response.status != RPC_NOT_FOUND))
+                {
+                        reportMessage("Error: Could not locate the fork with the peer");
+                        return 0;
+                }
+                if (response.status == RPC_NOT_FOUND)
+                {
+                        reportMessage("Error: The peer's chain shares no blocks with this one");
+                        return 0;
+                }
+                fork = response.height;
+                strcpy(fork_hash, getBlockHash(getBlockAtHeight(chain, fork)));
+        }
+        stats->fork_height = fork;
+
+        // A peer whose tip is on this chain has nothing to offer, and a shorter branch cannot take over
+        Block *level = remote_length <= local_length ? getBlockAtHeight(chain, remote_length - 1) : NULL;
+        if (level && strcmp(getBlockHash(level), peer_tip) == 0)
+                return SYNC_LEVEL;
+        if (remote_length < local_length)
+                return SYNC_DIVERGED;
+
+        // The peer's tip may have moved onto this chain since it was asked for
+        int total = remote_length - fork - 1;
+        if (total <= 0)
+                return SYNC_LEVEL;
+        BlockHeader *headers = (BlockHeader *)malloc(total * sizeof(BlockHeader));
+        if (!headers)
+                return 0;
+
+        // Headers are few bytes each, so the whole branch is checked before any block is fetched
+        int requested = 0;
+        int in_flight = 0;
+        int ok = 1;
+        int short_answer = 0;
+        while (ok && (in_flight > 0 || (requested < total && !short_answer)))
+        {
+                while (ok && in_flight < SYNC_WINDOW && requested < total && !short_answer)
+                {
+                        int count = total - requested < RPC_MAX_HEADERS ? total - requested : RPC_MAX_HEADERS;
+                        ok = requestRange(connection, RPC_GET_HEADERS, fork + 1 + requested, count);
+                        requested += count;
+                        in_flight++;
+                }
+                if (!ok || !readRpcResponse(connection, &response) || response.status != RPC_OK)
+                {
+                        reportMessage("Error: Could not download headers from the peer");
+                        ok = 0;
+                        break;
+                }
+                in_flight--;
+
+                // A peer whose chain shrank answers short; what is already queued is drained and dropped
+                if (short_answer)
+                        continue;
+                int first = (int)response.id - fork - 1;
+                for (int i = 0; i < response.header_count && ok; i++)
+                {
+                        const BlockHeader *header = &response.headers[i];
+                        const char *previous = first + i > 0 ? headers[first + i - 1].hash : fork_hash;
+                        if (header->index != fork + 1 + first + i || strcmp(header->previous_hash, previous) != 0)
+                        {
+                                reportMessage("Error: Headers from the peer do not link up at height %d",
+                                              header->index);
+                                ok = 0;
+                        }
+                        headers[first + i] = *header;
+                }
+                stats->headers += response.header_count;
+                if (response.header_count < (total - first < RPC_MAX_HEADERS ? total - first : RPC_MAX_HEADERS))
+                {
+                        short_answer = 1;
+                        total = first + response.header_count;
+                }
+        }
+
+        // The locator only pins the fork down roughly; skip the blocks this chain already has
+        int start = 0;
+        while (ok && start < total && fork + 1 + start < local_length &&
+               strcmp(headers[start].hash, getBlockHash(getBlockAtHeight(chain, fork + 1 + start))) == 0)
+                start++;
+        stats->fork_height = fork + start;
+        if (!ok || start == total || fork + 1 + total < local_length)
+        {
+                free(headers);
+                return !ok ? SYNC_FAILED : start == total ? SYNC_LEVEL : SYNC_DIVERGED;
+        }
+
+        requested = start;
+        int applied = start;
+        while (ok && applied < total)
+        {
+                while (ok && in_flight < SYNC_WINDOW && requested < total)
+                {
+                        int count = total - requested < RPC_MAX_BLOCKS ? total - requested : RPC_MAX_BLOCKS;
+                        ok = requestRange(connection, RPC_GET_BLOCKS, fork + 1 + requested, count);
+                        requested += count;
+                        in_flight++;
+                }
+                if (!ok || !readRpcResponse(connection, &response) || response.status != RPC_OK ||
+                    response.block_count == 0)
+                {
+                        reportMessage("Error: Could not download blocks from the peer");
+                        ok = 0;
+                        break;
+                }
+                in_flight--;
+
+                for (int i = 0; i < response.block_count && ok && applied < total; i++, applied++)
+                {
+                        const RpcBlock *body = &response.blocks[i];
+                        const BlockHeader *header = &headers[applied];
+                        const char *previous = applied > 0 ? headers[applied - 1].hash : fork_hash;
+
+                        // The peer's tip may have taken transactions since its header was sent; it still has to link up
+                        if (body->header.index != header->index || strcmp(body->header.previous_hash, previous) != 0 ||
+                            (applied < total - 1 && strcmp(body->header.hash, header->hash) != 0))
+                        {
+                                reportMessage("Error: Block %d from the peer does not match its header", header->index);
+                                ok = 0;
+                                break;
+                        }
+
+                        Block block;
+                        memset(&block, 0, sizeof(Block));
+                        block.index = body->header.index;
+                        block.timestamp = body->header.timestamp;
+                        block.data_length = body->header.data_length;
+                        block.data = (char *)body->data;
+                        block.transaction_count = body->header.transaction_count;
+                        block.transactions = (Transaction *)body->transactions;
+                        memcpy(block.previous_hash, body->header.previous_hash, HASH_SIZE + 1);
+                        memcpy(block.hash, body->header.hash, HASH_SIZE + 1);
+
+                        int status = acceptBlock(chain, &block);
+                        if (status != ACCEPT_OK && status != ACCEPT_DUPLICATE)
+                        {
+                                reportMessage("Error: Block %d from the peer failed validation", header->index);
+                                ok = 0;
+                        }
+                        stats->blocks += status == ACCEPT_OK;
+                        memcpy(peer_tip, body->header.hash, HASH_SIZE + 1);
+                }
+        }
+
+        free(headers);
+        stats->bytes = connection->received - received;
+        if (!ok)
+                return SYNC_FAILED;
+        return preferBranch(chain, peer_tip) ? SYNC_LEVEL : SYNC_DIVERGED;
+}
+
+/**
+ * Simulated time since a simulation started, scaled by its speed
+ * @param sim Running simulation
+ * @return Simulated milliseconds
+ */
+static double simNow(NetworkSim *sim)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - sim->start.tv_sec) * 1000.0 + (now.tv_nsec - sim->start.tv_nsec) / 1e6;
+        return elapsed * sim->config.speed;
+}
+
+/**
+ * Wall-clock deadline at which a simulation reaches a simulated time
+ * @param sim Running simulation
+ * @param at Simulated milliseconds
+ * @param deadline Receives the CLOCK_MONOTONIC time
+ */
+static void simDeadline(NetworkSim *sim, double at, struct timespec *deadline)
+{
+        double real = at / sim->config.speed;
+        long long nanoseconds = sim->start.tv_nsec + (long long)(real * 1e6);
+
+        deadline->tv_sec = sim->start.tv_sec + (time_t)(nanoseconds / 1000000000LL);
+        deadline->tv_nsec = (long)(nanoseconds % 1000000000LL);
+}
+
+/**
+ * Next number from a node's xorshift generator
+ * @param state Generator state, never 0
+ * @return Pseudo-random 32-bit number
+ */
+static uint32_t simRandom(uint32_t *state)
+{
+        uint32_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+        return x;
+}
+
+/**
+ * Uniform random number in [0, 1)
+ * @param state Generator state
+ * @return The number
+ */
+static double simUniform(uint32_t *state)
+{
+        return (simRandom(state) >> 8) / 16777216.0;
+}
+
+/**
+ * Random wait of a Poisson process, so events arrive independently at a mean rate
+ * @param state Generator state
+ * @param mean Mean wait
+ * @return The wait
+ */
+static double simExponential(uint32_t *state, double mean)
+{
+        return -log(1.0 - simUniform(state)) * mean;
+}
+
+/**
+ * Key a block hash is filed under in a SimTable
+ * @param hash Hex hash
+ * @return Its leading 64 bits, never 0
+ */
+static uint64_t simHashKey(const char *hash)
+{
+        uint64_t key = 0;
+
+        for (int i = 0; i < 16 && hash[i]; i++)
+        {
+                char c = hash[i];
+                key = key << 4 | (uint64_t)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        return key ? key : 1;
+}
+
+/**
+ * Slot a key occupies in a SimTable, or the empty slot it would go in
+ * @param table Table to search
+ * @param key Key, never 0
+ * @return Slot index
+ */
+static int simTableSlot(const SimTable *table, uint64_t key)
+{
+        int mask = table->capacity - 1;
+        int slot = (int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+        while (table->keys[slot] && table->keys[slot] != key)
+                slot = (slot + 1) & mask;
+        return slot;
+}
+
+/**
+ * Looks a key up in a SimTable
+ * @param table Table to search
+ * @param key Key, never 0
+ * @return Its value, or -1 if absent
+ */
+static int simTableFind(const SimTable *table, uint64_t key)
+{
+        if (table->capacity == 0)
+                return -1;
+        int slot = simTableSlot(table, key);
+        return table->keys[slot] ? table->values[slot] : -1;
+}
+
+/**
+ * Files a key in a SimTable, growing it to stay at most half full
+ * @param table Table to add to
+ * @param key Key, never 0 and not yet present
+ * @param value Value to keep with it
+ * @return 1 if successful, 0 if out of memory
+ */
+static int simTableInsert(SimTable *table, uint64_t key, int value)
+{
+        if ((table->count + 1) * 2 > table->capacity)
+        {
+                SimTable grown;
+                grown.capacity = table->capacity ? table->capacity * 2 : 256;
+                grown.count = table->count;
+                grown.keys = (uint64_t *)calloc(grown.capacity, sizeof(uint64_t));
+                grown.values = (int *)malloc(grown.capacity * sizeof(int));
+                if (!grown.keys || !grown.values)
+                {
+                        free(grown.keys);
+                        free(grown.values);
+                        return 0;
+                }
+                for (int i = 0; i < table->capacity; i++)
+                {
+                        if (!table->keys[i])
+                                continue;
+                        int slot = simTableSlot(&grown, table->keys[i]);
+                        grown.keys[slot] = table->keys[i];
+                        grown.values[slot] = table->values[i];
+                }
+                free(table->keys);
+                free(table->values);
+                *table = grown;
+        }
+
+        int slot = simTableSlot(table, key);
+        table->keys[slot] = key;
+        table->values[slot] = value;
+        table->count++;
+        return 1;
+}
+
+/**
+ * Frees a SimTable's slots
+ * @param table Table to free
+ */
+static void freeSimTable(SimTable *table)
+{
+        free(table->keys);
+        free(table->values);
+        memset(table, 0, sizeof(SimTable));
+}
+
+/**
+ * Copies a block's header and payload out of a chain so it can travel between nodes
+ * @param block Block to copy; its payload must be resident
+ * @return Copy holding one reference, or NULL if out of memory
+ */
+static SimBlock *copySimBlock(const Block *block)
+{
+        SimBlock *copy = (SimBlock *)calloc(1, sizeof(SimBlock));
+        if (!copy)
+                return NULL;
+
+        copy->refs = 1;
+        copy->block.index = block->index;
+        copy->block.timestamp = block->timestamp;
+        copy->block.data_length = block->data_length;
+        copy->block.transaction_count = block->transaction_count;
+        copy->block.transaction_capacity = block->transaction_count;
+        memcpy(copy->block.previous_hash, block->previous_hash, HASH_SIZE + 1);
+        memcpy(copy->block.hash, block->hash, HASH_SIZE + 1);
+        copy->block.data = (char *)malloc(block->data_length + 1);
+        if (block->transaction_count > 0)
+                copy->block.transactions = (Transaction *)malloc(block->transaction_count * sizeof(Transaction));
+        if (!copy->block.data || (block->transaction_count > 0 && !copy->block.transactions))
+        {
+                free(copy->block.data);
+                free(copy->block.transactions);
+                free(copy);
+                return NULL;
+        }
+        memcpy(copy->block.data, block->data, block->data_length);
+        copy->block.data[block->data_length] = '\0';
+        if (block->transaction_count > 0)
+                memcpy(copy->block.transactions, block->transactions, block->transaction_count * sizeof(Transaction));
+        return copy;
+}
+
+/**
+ * Drops one reference to a travelling block, freeing it with the last
+ * @param block Block to release
+ */
+static void releaseSimBlock(SimBlock *block)
+{
+        if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) > 0)
+                return;
+        free(block->block.data);
+        free(block->block.transactions);
+        free(block);
+}
+
+/**
+ * Size a message would have on a real link, which is what its bandwidth is charged for
+ * @param message Message to size
+ * @return Size in bytes
+ */
+static size_t simMessageBytes(const SimMessage *message)
+{
+        if (message->type == SIM_BLOCK)
+                return SIM_HEADER_BYTES + message->block->block.data_length +
+                       (size_t)message->block->block.transaction_count * SIM_TRANSACTION_BYTES;
+        if (message->type == SIM_TRANSACTION)
+                return SIM_TRANSACTION_BYTES;
+        return SIM_HEADER_BYTES;
+}
+
+/**
+ * Whether one message is due before another in an inbox
+ * @param a First message
+ * @param b Second message
+ * @return 1 if a comes first
+ */
+static int simMessageBefore(const SimMessage *a, const SimMessage *b)
+{
+        return a->deliver_at < b->deliver_at || (a->deliver_at == b->deliver_at && a->sequence < b->sequence);
+}
+
+/**
+ * Queues a message in a node's inbox; the caller holds the node's lock
+ * @param node Receiving node
+ * @param message Message to queue
+ * @return 1 if successful, 0 if out of memory
+ */
+static int pushSimMessage(SimNode *node, const SimMessage *message)
+{
+        if (node->inbox_count == node->inbox_capacity)
+        {
+                int capacity = node->inbox_capacity ? node->inbox_capacity * 2 : 64;
+                SimMessage *grown = (SimMessage *)realloc(node->inbox, capacity * sizeof(SimMessage));
+                if (!grown)
+                        return 0;
+                node->inbox = grown;
+                node->inbox_capacity = capacity;
+        }
+
+        int child = node->inbox_count++;
+        while (child > 0)
+        {
+                int parent = (child - 1) / 2;
+                if (!simMessageBefore(message, &node->inbox[parent]))
+                        break;
+                node->inbox[child] = node->inbox[parent];
+                child = parent;
+        }
+        node->inbox[child] = *message;
+        return 1;
+}
+
+/**
+ * Takes the earliest message out of a node's inbox; the caller holds the node's lock
+ * @param node Node whose inbox is not empty
+ * @param message Receives the message
+ */
+static void popSimMessage(SimNode *node, SimMessage *message)
+{
+        *message = node->inbox[0];
+        SimMessage *last = &node->inbox[--node->inbox_count];
+
+        int parent = 0;
+        for (;;)
+        {
+                int child = parent * 2 + 1;
+                if (child >= node->inbox_count)
+                        break;
+                if (child + 1 < node->inbox_count && simMessageBefore(&node->inbox[child + 1], &node->inbox[child]))
+                        child++;
+                if (!simMessageBefore(&node->inbox[child], last))
+                        break;
+                node->inbox[parent] = node->inbox[child];
+                parent = child;
+        }
+        node->inbox[parent] = *last;
+}
+
+/**
+ * Sends a message over one of a node's links. The link sends one message at
+ * a time at its bandwidth, so a message waits for those queued before it,
+ * then takes the link's latency plus jitter to arrive, unless it is lost.
+ * The message's block reference passes to the link.
+ * @param node Sending node
+ * @param link Link to send on
+ * @param message Message to send
+ */
+static void sendSimMessage(SimNode *node, SimLink *link, SimMessage *message)
+{
+        NetworkSim *sim = node->sim;
+        const NetworkConfig *config = &sim->config;
+        size_t bytes = simMessageBytes(message);
+        double now = simNow(sim);
+
+        double start = link->busy_until > now ? link->busy_until : now;
+        link->busy_until = start + (config->bandwidth_kbps > 0 ? bytes * 8.0 / config->bandwidth_kbps : 0);
+        __atomic_add_fetch(&sim->messages_sent, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&sim->bytes_sent, (long)bytes, __ATOMIC_RELAXED);
+
+        int delivered = 0;
+        if (simUniform(&node->random) >= config->loss)
+        {
+                SimNode *peer = &sim->nodes[link->peer];
+                message->from = node->id;
+                message->deliver_at = link->busy_until + config->latency_ms + simUniform(&node->random) * config->jitter_ms;
+                message->sequence = __atomic_add_fetch(&sim->sequence, 1, __ATOMIC_RELAXED);
+
+                pthread_mutex_lock(&peer->lock);
+                delivered = pushSimMessage(peer, message);
+                if (delivered && peer->inbox[0].sequence == message->sequence)
+                        pthread_cond_signal(&peer->wake);
+                pthread_mutex_unlock(&peer->lock);
+        }
+
+        if (!delivered)
+        {
+                __atomic_add_fetch(&sim->messages_dropped, 1, __ATOMIC_RELAXED);
+                if (message->block)
+                        releaseSimBlock(message->block);
+        }
+}
+
+/**
+ * Sends a block to every peer of a node but the one it came from
+ * @param node Sending node
+ * @param block Block to send
+ * @param except Node not to send it back to, -1 for none
+ */
+static void relaySimBlock(SimNode *node, SimBlock *block, int except)
+{
+        SimMessage message;
+
+        for (int i = 0; i < node->link_count; i++)
+        {
+                if (node->links[i].peer == except)
+                        continue;
+                memset(&message, 0, sizeof(SimMessage));
+                message.type = SIM_BLOCK;
+                message.block = block;
+                __atomic_add_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+                sendSimMessage(node, &node->links[i], &message);
+        }
+}
+
+/**
+ * Sends a hash-only message (SIM_GET_BLOCK or SIM_TIP) to one peer
+ * @param node Sending node
+ * @param peer Node to send to
+ * @param type Message type
+ * @param hash Hash it carries
+ */
+static void sendSimHash(SimNode *node, int peer, int type, const char *hash)
+{
+        SimMessage message;
+
+        for (int i = 0; i < node->link_count; i++)
+        {
+                if (node->links[i].peer != peer)
+                        continue;
+                memset(&message, 0, sizeof(SimMessage));
+                message.type = type;
+                memcpy(message.hash, hash, HASH_SIZE + 1);
+                sendSimMessage(node, &node->links[i], &message);
+                return;
+        }
+}
+
+/**
+ * Starts following a block a node has just mined
+ * @param sim Running simulation
+ * @param hash Hash of the block
+ * @param now Simulated time it was mined
+ */
+static void registerSimBlock(NetworkSim *sim, const char *hash, double now)
+{
+        pthread_mutex_lock(&sim->lock);
+        if (sim->record_count == sim->record_capacity)
+        {
+                int capacity = sim->record_capacity ? sim->record_capacity * 2 : 256;
+                SimRecord *grown = (SimRecord *)realloc(sim->records, capacity * sizeof(SimRecord));
+                if (!grown)
+                {
+                        pthread_mutex_unlock(&sim->lock);
+                        return;
+                }
+                sim->records = grown;
+                sim->record_capacity = capacity;
+        }
+
+        if (simTableInsert(&sim->record_table, simHashKey(hash), sim->record_count))
+        {
+                SimRecord *record = &sim->records[sim->record_count++];
+                memcpy(record->hash, hash, HASH_SIZE + 1);
+                record->mined_at = now;
+                record->last_at = now;
+                record->reached = 1;
+        }
+        pthread_mutex_unlock(&sim->lock);
+}
+
+/**
+ * Notes that another node has accepted a block
+ * @param sim Running simulation
+ * @param hash Hash of the block
+ * @param now Simulated time it was accepted
+ */
+static void recordSimArrival(NetworkSim *sim, const char *hash, double now)
+{
+        pthread_mutex_lock(&sim->lock);
+        int index = simTableFind(&sim->record_table, simHashKey(hash));
+        if (index >= 0)
+        {
+                SimRecord *record = &sim->records[index];
+                record->reached++;
+                record->last_at = now;
+
+                if (sim->delay_count == sim->delay_capacity)
+                {
+                        long capacity = sim->delay_capacity ? sim->delay_capacity * 2 : 1024;
+                        double *grown = (double *)realloc(sim->delays, capacity * sizeof(double));
+                        if (grown)
+                        {
+                                sim->delays = grown;
+                                sim->delay_capacity = capacity;
+                        }
+                }
+                if (sim->delay_count < sim->delay_capacity)
+                        sim->delays[sim->delay_count++] = now - record->mined_at;
+        }
+        pthread_mutex_unlock(&sim->lock);
+}
+
+/**
+ * Takes the transactions a block confirmed out of a node's pool
+ * @param node Node whose pool to trim
+ * @param block Block accepted by the node
+ */
+static void removeSimPoolTransactions(SimNode *node, const Block *block)
+{
+        for (int i = 0; i < block->transaction_count; i++)
+        {
+                const Transaction *trans = &block->transactions[i];
+                for (int j = 0; j < node->pool_count; j++)
+                {
+                        // Blocks restamp transactions, so they are matched without their timestamps
+                        Transaction *pending = &node->pool[j];
+                        if (pending->amount == trans->amount && strcmp(pending->sender, trans->sender) == 0 &&
+                            strcmp(pending->receiver, trans->receiver) == 0)
+                        {
+                                node->pool[j] = node->pool[--node->pool_count];
+                                break;
+                        }
+                }
+        }
+}
+
+/**
+ * Handles a block a node accepted: measures its arrival, relays it, and
+ * connects any orphans that were waiting for it
+ * @param node Node that accepted the block
+ * @param block Block it accepted
+ * @param from Node it came from
+ */
+static void connectSimBlock(SimNode *node, SimBlock *block, int from)
+{
+        NetworkSim *sim = node->sim;
+
+        recordSimArrival(sim, block->block.hash, simNow(sim));
+        removeSimPoolTransactions(node, &block->block);
+        relaySimBlock(node, block, from);
+
+        for (int i = 0; i < node->orphan_count; i++)
+        {
+                SimBlock *orphan = node->orphans[i];
+                if (strcmp(orphan->block.previous_hash, block->block.hash) != 0)
+                        continue;
+
+                memmove(&node->orphans[i], &node->orphans[i + 1], (node->orphan_count - i - 1) * sizeof(SimBlock *));
+                node->orphan_count--;
+                if (acceptBlock(node->chain, &orphan->block) == ACCEPT_OK)
+                        connectSimBlock(node, orphan, -1);
+                releaseSimBlock(orphan);
+
+                // Connecting it may have taken more orphans off the list
+                i = -1;
+        }
+}
+
+/**
+ * Keeps a block whose parent a node lacks and asks the sender for the parent
+ * @param node Node that received the block
+ * @param block Block to keep; the node takes a reference
+ * @param from Node it came from
+ */
+static void keepSimOrphan(SimNode *node, SimBlock *block, int from)
+{
+        for (int i = 0; i < node->orphan_count; i++)
+        {
+                if (strcmp(node->orphans[i]->block.hash, block->block.hash) == 0)
+                        return;
+        }
+
+        // A full list makes room by forgetting its oldest orphan
+        if (node->orphan_count == SIM_MAX_ORPHANS)
+        {
+                releaseSimBlock(node->orphans[0]);
+                memmove(&node->orphans[0], &node->orphans[1], (SIM_MAX_ORPHANS - 1) * sizeof(SimBlock *));
+                node->orphan_count--;
+        }
+        __atomic_add_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+        node->orphans[node->orphan_count++] = block;
+        sendSimHash(node, from, SIM_GET_BLOCK, block->block.previous_hash);
+}
+
+/**
+ * Adds a transaction to a node's pool unless it has seen it, and relays it
+ * @param node Node the transaction reached
+ * @param trans Transaction
+ * @param id Identifies it across nodes
+ * @param from Node it came from, -1 if the node made it
+ */
+static void offerSimTransaction(SimNode *node, const Transaction *trans, uint64_t id, int from)
+{
+        SimMessage message;
+
+        if (simTableFind(&node->seen, id) >= 0 || !simTableInsert(&node->seen, id, 0))
+                return;
+        if (node->pool_count < SIM_MAX_POOL)
+                node->pool[node->pool_count++] = *trans;
+
+        for (int i = 0; i < node->link_count; i++)
+        {
+                if (node->links[i].peer == from)
+                        continue;
+                memset(&message, 0, sizeof(SimMessage));
+                message.type = SIM_TRANSACTION;
+                message.transaction = *trans;
+                message.transaction_id = id;
+                sendSimMessage(node, &node->links[i], &message);
+        }
+}
+
+/**
+ * Acts on a message that reached a node
+ * @param node Receiving node
+ * @param message Message; its block reference is released here
+ */
+static void handleSimMessage(SimNode *node, SimMessage *message)
+{
+        Block *block;
+
+        switch (message->type)
+        {
+        case SIM_BLOCK:
+        {
+                int status = acceptBlock(node->chain, &message->block->block);
+                if (status == ACCEPT_OK)
+                        connectSimBlock(node, message->block, message->from);
+                else if (status == ACCEPT_ORPHAN)
+                        keepSimOrphan(node, message->block, message->from);
+                releaseSimBlock(message->block);
+                break;
+        }
+
+        case SIM_GET_BLOCK:
+                block = findBlock(node->chain, message->hash);
+                if (block && fetchBlockPayload(node->chain, block))
+                {
+                        SimMessage answer;
+                        memset(&answer, 0, sizeof(SimMessage));
+                        answer.type = SIM_BLOCK;
+                        answer.block = copySimBlock(block);
+                        for (int i = 0; answer.block && i < node->link_count; i++)
+                        {
+                                if (node->links[i].peer == message->from)
+                                {
+                                        sendSimMessage(node, &node->links[i], &answer);
+                                        answer.block = NULL;
+                                }
+                        }
+                        if (answer.block)
+                                releaseSimBlock(answer.block);
+                }
+                break;
+
+        case SIM_TIP:
+                // A tip the node has never heard of means it missed blocks; fetch them back from there
+                if (!findBlock(node->chain, message->hash))
+                        sendSimHash(node, message->from, SIM_GET_BLOCK, message->hash);
+                break;
+
+        case SIM_TRANSACTION:
+                offerSimTransaction(node, &message->transaction, message->transaction_id, message->from);
+                break;
+        }
+}
+
+/**
+ * Mines a block on a node's tip with the transactions in its pool and sends it to its peers
+ * @param node Mining node
+ */
+static void mineSimBlock(SimNode *node)
+{
+        NetworkSim *sim = node->sim;
+        char data[MAX_DATA_SIZE];
+
+        snprintf(data, sizeof(data), "Node %d block %d", node->id, node->blocks_mined + 1);
+        if (!addBlock(node->chain, data))
+                return;
+
+        Block *tip = getChainTip(node->chain);
+        int count = node->pool_count < SIM_BLOCK_TRANSACTIONS ? node->pool_count : SIM_BLOCK_TRANSACTIONS;
+        for (int i = 0; i < count; i++)
+                addTransaction(node->chain, tip, node->pool[i].sender, node->pool[i].receiver, node->pool[i].amount);
+        memmove(node->pool, node->pool + count, (node->pool_count - count) * sizeof(Transaction));
+        node->pool_count -= count;
+
+        SimBlock *block = copySimBlock(tip);
+        if (!block)
+                return;
+        node->blocks_mined++;
+        registerSimBlock(sim, block->block.hash, simNow(sim));
+        relaySimBlock(node, block, -1);
+        releaseSimBlock(block);
+}
+
+/**
+ * Makes up a payment between two of the simulation's accounts and floods it to the network
+ * @param node Node the payment is submitted to
+ */
+static void makeSimTransaction(SimNode *node)
+{
+        Transaction trans;
+
+        memset(&trans, 0, sizeof(Transaction));
+        snprintf(trans.sender, MAX_SENDER_SIZE, "account%u", simRandom(&node->random) % SIM_ACCOUNTS);
+        snprintf(trans.receiver, MAX_RECEIVER_SIZE, "account%u", simRandom(&node->random) % SIM_ACCOUNTS);
+        trans.amount = (1 + simRandom(&node->random) % 100000) / 100.0;
+        trans.timestamp = time(NULL);
+
+        node->transactions_made++;
+        offerSimTransaction(node, &trans, (uint64_t)(node->id + 1) << 32 | (uint64_t)node->transactions_made, -1);
+}
+
+/**
+ * Tells every peer of a node which block is its tip
+ * @param node Announcing node
+ */
+static void announceSimTip(SimNode *node)
+{
+        Block *tip = getChainTip(node->chain);
+
+        for (int i = 0; tip && i < node->link_count; i++)
+                sendSimHash(node, node->links[i].peer, SIM_TIP, tip->hash);
+}
+
+/**
+ * Runs one node: delivers its messages as they fall due, and mines, makes
+ * transactions and announces its tip on its own schedule
+ * @param arg The node's SimNode
+ * @return NULL
+ */
+static void *runSimNode(void *arg)
+{
+        SimNode *node = (SimNode *)arg;
+        NetworkSim *sim = node->sim;
+        const NetworkConfig *config = &sim->config;
+        double block_mean = config->block_interval_ms * config->nodes;
+        double transaction_mean = config->transaction_rate > 0 ? 1000.0 * config->nodes / config->transaction_rate : 0;
+        SimMessage message;
+        struct timespec deadline;
+
+        node->next_block = simExponential(&node->random, block_mean);
+        node->next_transaction = transaction_mean > 0 ? simExponential(&node->random, transaction_mean) : 0;
+        node->next_announce = SIM_ANNOUNCE_INTERVAL_MS * simUniform(&node->random);
+
+        pthread_mutex_lock(&node->lock);
+        while (!__atomic_load_n(&sim->stopping, __ATOMIC_ACQUIRE))
+        {
+                double now = simNow(sim);
+                if (node->inbox_count > 0 && node->inbox[0].deliver_at <= now)
+                {
+                        popSimMessage(node, &message);
+                        pthread_mutex_unlock(&node->lock);
+                        handleSimMessage(node, &message);
+                        pthread_mutex_lock(&node->lock);
+                        continue;
+                }
+                pthread_mutex_unlock(&node->lock);
+
+                int mining = __atomic_load_n(&sim->mining, __ATOMIC_ACQUIRE);
+                if (mining && now >= node->next_block)
+                {
+                        mineSimBlock(node);
+                        node->next_block = now + simExponential(&node->random, block_mean);
+                }
+                if (mining && transaction_mean > 0 && now >= node->next_transaction)
+                {
+                        makeSimTransaction(node);
+                        node->next_transaction = now + simExponential(&node->random, transaction_mean);
+                }
+                if (now >= node->next_announce)
+                {
+                        announceSimTip(node);
+                        node->next_announce = now + SIM_ANNOUNCE_INTERVAL_MS;
+                }
+
+                // Sleep until the next message or the node's own next event, whichever is sooner
+                double wake = node->next_announce;
+                if (mining && node->next_block < wake)
+                        wake = node->next_block;
+                if (mining && transaction_mean > 0 && node->next_transaction < wake)
+                        wake = node->next_transaction;
+
+                pthread_mutex_lock(&node->lock);
+                if (node->inbox_count > 0 && node->inbox[0].deliver_at < wake)
+                        wake = node->inbox[0].deliver_at;
+                if (wake > simNow(sim) && !__atomic_load_n(&sim->stopping, __ATOMIC_ACQUIRE))
+                {
+                        simDeadline(sim, wake, &deadline);
+                        pthread_cond_timedwait(&node->wake, &node->lock, &deadline);
+                }
+        }
+        pthread_mutex_unlock(&node->lock);
+        return NULL;
+}
+
+/**
+ * Links two nodes in both directions unless they already are
+ * @param sim Simulation being set up
+ * @param a First node
+ * @param b Second node
+ * @return 1 if linked or already linked, 0 if out of memory
+ */
+static int linkSimNodes(NetworkSim *sim, int a, int b)
+{
+        SimNode *ends[2] = {&sim->nodes[a], &sim->nodes[b]};
+        int peers[2] = {b, a};
+
+        for (int i = 0; i < ends[0]->link_count; i++)
+        {
+                if (ends[0]->links[i].peer == b)
+                        return 1;
+        }
+        for (int side = 0; side < 2; side++)
+        {
+                SimLink *grown = (SimLink *)realloc(ends[side]->links, (ends[side]->link_count + 1) * sizeof(SimLink));
+                if (!grown)
+                        return 0;
+                ends[side]->links = grown;
+                grown[ends[side]->link_count].peer = peers[side];
+                grown[ends[side]->link_count].busy_until = 0;
+                ends[side]->link_count++;
+        }
+        return 1;
+}
+
+/**
+ * Frees everything a simulation holds
+ * @param sim Simulation whose node threads have all exited
+ */
+static void freeNetworkSim(NetworkSim *sim)
+{
+        for (int i = 0; sim->nodes && i < sim->config.nodes; i++)
+        {
+                SimNode *node = &sim->nodes[i];
+                for (int j = 0; j < node->inbox_count; j++)
+                {
+                        if (node->inbox[j].block)
+                                releaseSimBlock(node->inbox[j].block);
+                }
+                for (int j = 0; j < node->orphan_count; j++)
+                        releaseSimBlock(node->orphans[j]);
+                if (node->reader)
+                        closeChainReader(node->reader);
+                if (node->chain)
+                        freeBlockchain(node->chain);
+                pthread_mutex_destroy(&node->lock);
+                pthread_cond_destroy(&node->wake);
+                free(node->inbox);
+                free(node->links);
+                free(node->orphans);
+                free(node->pool);
+                freeSimTable(&node->seen);
+        }
+        pthread_mutex_destroy(&sim->lock);
+        free(sim->nodes);
+        free(sim->records);
+        freeSimTable(&sim->record_table);
+        free(sim->delays);
+        free(sim->spells);
+        free(sim->tips);
+        free(sim);
+}
+
+/**
+ * Sets up a simulation's nodes, each with its own chain holding the same
+ * genesis block, and links them in a ring plus random extra links
+ * @param sim Simulation with its config set
+ * @return 1 if successful, 0 if out of memory
+ */
+static int setUpNetworkSim(NetworkSim *sim)
+{
+        const NetworkConfig *config = &sim->config;
+        pthread_condattr_t attributes;
+        uint32_t random = config->seed ? config->seed : 1;
+
+        sim->nodes = (SimNode *)calloc(config->nodes, sizeof(SimNode));
+        sim->tips = (char *)malloc((size_t)config->nodes * (HASH_SIZE + 1));
+        if (!sim->nodes || !sim->tips)
+                return 0;
+
+        pthread_condattr_init(&attributes);
+        pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+        for (int i = 0; i < config->nodes; i++)
+        {
+                SimNode *node = &sim->nodes[i];
+                node->id = i;
+                node->sim = sim;
+                node->random = (uint32_t)((i + 1) * 2654435761u) ^ random;
+                if (!node->random)
+                        node->random = 1;
+                pthread_mutex_init(&node->lock, NULL);
+                pthread_cond_init(&node->wake, &attributes);
+        }
+        pthread_condattr_destroy(&attributes);
+
+        // Every node starts from node 0's genesis block
+        for (int i = 0; i < config->nodes; i++)
+        {
+                SimNode *node = &sim->nodes[i];
+                node->chain = createBlockchain();
+                node->orphans = (SimBlock **)malloc(SIM_MAX_ORPHANS * sizeof(SimBlock *));
+                node->pool = (Transaction *)malloc(SIM_MAX_POOL * sizeof(Transaction));
+                if (!node->chain || !node->orphans || !node->pool)
+                        return 0;
+                if (i == 0 ? !addBlock(node->chain, "Genesis Block")
+                           : acceptBlock(node->chain, getChainTip(sim->nodes[0].chain)) != ACCEPT_OK)
+                        return 0;
+                node->reader = openChainReader(node->chain);
+                if (!node->reader)
+                        return 0;
+        }
+
+        for (int i = 0; config->nodes > 1 && i < config->nodes; i++)
+        {
+                if (!linkSimNodes(sim, i, (i + 1) % config->nodes))
+                        return 0;
+                for (int j = 0; j < config->peers; j++)
+                {
+                        int peer = (int)(simRandom(&random) % config->nodes);
+                        if (peer != i && !linkSimNodes(sim, i, peer))
+                                return 0;
+                }
+        }
+        return 1;
+}
+
+/**
+ * Counts the distinct tips of a simulation's nodes, read without waiting on the nodes
+ * @param sim Running simulation
+ * @param all 1 to count them all, 0 to stop at the second
+ * @return Number of distinct tips
+ */
+static int countSimTips(NetworkSim *sim, int all)
+{
+        char (*tips)[HASH_SIZE + 1] = (char (*)[HASH_SIZE + 1])sim->tips;
+        BlockHeader header;
+        int count = 0;
+
+        for (int i = 0; i < sim->config.nodes && (all || count < 2); i++)
+        {
+                const ChainView *view = beginChainRead(sim->nodes[i].reader);
+                int length = getViewLength(view);
+                int found = length > 0 && getViewHeader(view, length - 1, &header);
+                endChainRead(sim->nodes[i].reader);
+                if (!found)
+                        continue;
+
+                int seen = 0;
+                for (int j = 0; j < count && !seen; j++)
+                        seen = strcmp(tips[j], header.hash) == 0;
+                if (!seen)
+                        memcpy(tips[count++], header.hash, HASH_SIZE + 1);
+        }
+        return count;
+}
+
+/**
+ * Notes how long the nodes of a simulation disagreed on their tip
+ * @param sim Running simulation
+ * @param length Length of the spell
+ */
+static void addSimSpell(NetworkSim *sim, double length)
+{
+        if (sim->spell_count == sim->spell_capacity)
+        {
+                int capacity = sim->spell_capacity ? sim->spell_capacity * 2 : 256;
+                double *grown = (double *)realloc(sim->spells, capacity * sizeof(double));
+                if (!grown)
+                        return;
+                sim->spells = grown;
+                sim->spell_capacity = capacity;
+        }
+        sim->spells[sim->spell_count++] = length;
+}
+
+/**
+ * Sleeps until a simulation reaches a simulated time
+ * @param sim Running simulation
+ * @param at Simulated milliseconds
+ */
+static void sleepUntilSim(NetworkSim *sim, double at)
+{
+        struct timespec deadline;
+
+        simDeadline(sim, at, &deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+                ;
+}
+
+/**
+ * Orders simulated times for picking percentiles
+ * @param a First time
+ * @param b Second time
+ * @return Negative, zero or positive as a sorts before, with or after b
+ */
+static int compareSimTimes(const void *a, const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+/**
+ * Fills in a report from a finished simulation, judging blocks against node 0's final chain
+ * @param sim Simulation whose node threads have all exited
+ * @param report Report to fill in
+ */
+static void reportNetworkSim(NetworkSim *sim, NetworkReport *report)
+{
+        Blockchain *chain = sim->nodes[0].chain;
+        int nodes = sim->config.nodes;
+
+        report->blocks_mined = sim->record_count;
+        for (int i = 0; i < sim->record_count; i++)
+        {
+                Block *block = findBlock(chain, sim->records[i].hash);
+                if (!block || getBlockAtHeight(chain, getBlockIndex(block)) != block)
+                        report->stale_blocks++;
+        }
+        report->fork_rate = report->blocks_mined > 0 ? (double)report->stale_blocks / report->blocks_mined : 0;
+        report->chain_length = getChainLength(chain);
+        for (int height = 1; height < report->chain_length; height++)
+                report->transactions_confirmed += getBlockTransactionCount(getBlockAtHeight(chain, height));
+        for (int i = 0; i < nodes; i++)
+                report->transactions_made += sim->nodes[i].transactions_made;
+
+        if (sim->delay_count > 0)
+        {
+                double total = 0;
+                qsort(sim->delays, sim->delay_count, sizeof(double), compareSimTimes);
+                for (long i = 0; i < sim->delay_count; i++)
+                        total += sim->delays[i];
+                report->propagation_mean_ms = total / sim->delay_count;
+                report->propagation_p50_ms = sim->delays[sim->delay_count / 2];
+                report->propagation_p90_ms = sim->delays[(long)(sim->delay_count * 0.9)];
+                report->propagation_max_ms = sim->delays[sim->delay_count - 1];
+        }
+
+        // Blocks that lost a race stop spreading, so only those every node got count towards full reach
+        double *reach = sim->record_count > 0 ? (double *)malloc(sim->record_count * sizeof(double)) : NULL;
+        int reached = 0;
+        for (int i = 0; reach && i < sim->record_count; i++)
+        {
+                if (sim->records[i].reached == nodes)
+                        reach[reached++] = sim->records[i].last_at - sim->records[i].mined_at;
+        }
+        if (reached > 0)
+        {
+                qsort(reach, reached, sizeof(double), compareSimTimes);
+                report->full_reach_p50_ms = reach[reached / 2];
+                report->full_reach_p90_ms = reach[(int)(reached * 0.9)];
+        }
+        free(reach);
+
+        if (sim->spell_count > 0)
+        {
+                double total = 0;
+                qsort(sim->spells, sim->spell_count, sizeof(double), compareSimTimes);
+                for (int i = 0; i < sim->spell_count; i++)
+                        total += sim->spells[i];
+                report->convergence_mean_ms = total / sim->spell_count;
+                report->convergence_p90_ms = sim->spells[(int)(sim->spell_count * 0.9)];
+                report->convergence_max_ms = sim->spells[sim->spell_count - 1];
+        }
+
+        report->messages_sent = sim->messages_sent;
+        report->messages_dropped = sim->messages_dropped;
+        report->bytes_sent = sim->bytes_sent;
+}
+
+/**
+ * Fills a network config with its defaults: 16 nodes with 3 extra links each,
+ * 50 ms links with 10 ms of jitter and no loss at 10 Mbit/s, a block every
+ * second and 100 transactions per second for 60 seconds, run 10 times faster
+ * than real time
+ * @param config Config to fill
+ */
+void initNetworkConfig(NetworkConfig *config)
+{
+        memset(config, 0, sizeof(NetworkConfig));
+        config->nodes = 16;
+        config->peers = 3;
+        config->latency_ms = 50;
+        config->jitter_ms = 10;
+        config->bandwidth_kbps = 10000;
+        config->block_interval_ms = 1000;
+        config->transaction_rate = 100;
+        config->duration_s = 60;
+        config->timeout_s = 10;
+        config->speed = 10;
+        config->seed = 1;
+}
+
+/**
+ * Runs a network of nodes in this process, each with its own chain on a
+ * worker thread, exchanging blocks and transactions over simulated links.
+ * Nodes mine for the configured duration, then the simulation waits for
+ * every node to settle on the same tip and reports how blocks spread.
+ * @param config Network to simulate
+ * @param report Receives the measurements
+ * @return 1 if the simulation ran, 0 if the config is invalid or it could not start
+ */
+int runNetworkSimulation(const NetworkConfig *config, NetworkReport *report)
+{
+        if (!config || !report || config->nodes < 2 || config->peers < 0 || config->latency_ms < 0 ||
+            config->jitter_ms < 0 || config->loss < 0 || config->loss >= 1 || config->bandwidth_kbps < 0 ||
+            config->block_interval_ms <= 0 || config->transaction_rate < 0 || config->duration_s <= 0 ||
+            config->timeout_s < 0 || config->speed <= 0)
+        {
+                reportMessage("Error: Invalid network simulation settings");
+                return 0;
+        }
+
+        NetworkSim *sim = (NetworkSim *)calloc(1, sizeof(NetworkSim));
+        if (!sim)
+                return 0;
+        sim->config = *config;
+        sim->mining = 1;
+        pthread_mutex_init(&sim->lock, NULL);
+        if (!setUpNetworkSim(sim))
+        {
+                reportMessage("Error: Could not set up the simulated network");
+                freeNetworkSim(sim);
+                return 0;
+        }
+
+        memset(report, 0, sizeof(NetworkReport));
+        clock_gettime(CLOCK_MONOTONIC, &sim->start);
+        int ok = 1;
+        for (int i = 0; ok && i < config->nodes; i++)
+        {
+                sim->nodes[i].started = pthread_create(&sim->nodes[i].thread, NULL, runSimNode, &sim->nodes[i]) == 0;
+                ok = sim->nodes[i].started;
+        }
+
+        if (ok)
+        {
+                // Every new block sets the tips apart until it has spread; time each spell
+                double stop_at = config->duration_s * 1000.0;
+                double poll = SIM_POLL_INTERVAL_MS * config->speed;
+                double split_at = -1;
+                for (double now = simNow(sim); now < stop_at; now = simNow(sim))
+                {
+                        int agree = countSimTips(sim, 0) == 1;
+                        if (!agree && split_at < 0)
+                                split_at = now;
+                        else if (agree && split_at >= 0)
+                        {
+                                addSimSpell(sim, now - split_at);
+                                split_at = -1;
+                        }
+                        sleepUntilSim(sim, now + poll < stop_at ? now + poll : stop_at);
+                }
+                __atomic_store_n(&sim->mining, 0, __ATOMIC_RELEASE);
+
+                // With mining stopped, tips that match stay matched, while a tie between equally long branches never breaks
+                report->settle_ms = -1;
+                for (double now = simNow(sim); now - stop_at <= config->timeout_s * 1000.0; now = simNow(sim))
+                {
+                        if (countSimTips(sim, 0) == 1)
+                        {
+                                report->settle_ms = now - stop_at;
+                                break;
+                        }
+                        sleepUntilSim(sim, now + poll);
+                }
+                report->final_tips = countSimTips(sim, 1);
+        }
+        else
+        {
+                reportMessage("Error: Could not start the node threads");
+        }
+
+        __atomic_store_n(&sim->stopping, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < config->nodes; i++)
+        {
+                SimNode *node = &sim->nodes[i];
+                pthread_mutex_lock(&node->lock);
+                pthread_cond_signal(&node->wake);
+                pthread_mutex_unlock(&node->lock);
+                if (node->started)
+                        pthread_join(node->thread, NULL);
+        }
+
+        if (ok)
+                reportNetworkSim(sim, report);
+        freeNetworkSim(sim);
+        return ok;
+}
+
+/*
+ * Public entry points. Each call on a chain takes the chain's lock around
+ * the matching ...Locked body above; the bodies only call each other, so
+ * the lock is never taken twice.
+ */
+
+/**
+ * Takes a chain's lock
+ * @param chain Chain to lock, NULL for none
+ */
+static void lockChain(Blockchain *chain)
+{
+        if (chain)
+                pthread_mutex_lock(&chain->lock);
+}
+
+/**
+ * Publishes what the call changed to lock-free readers, then releases a chain's lock
+ * @param chain Chain to unlock, NULL for none
+ */
+static void unlockChain(Blockchain *chain)
+{
+        if (!chain)
+                return;
+
+        if (chain->readers)
+        {
+                publishView(chain);
+                reclaimRetired(chain);
+        }
+        pthread_mutex_unlock(&chain->lock);
+}
+
+/**
+ * Has a chain publish the blocks that join its tree and the transactions added to them into a feed
+ * @param chain Pointer to the blockchain
+ * @param feed Feed to publish into, NULL to stop publishing
+ * @return 1 if successful, 0 if another chain already publishes into the feed
+ */
+int attachChainFeed(Blockchain *chain, ChainFeed *feed)
+{
+        lockChain(chain);
+        int ok = attachChainFeedLocked(chain, feed);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Registers the calling thread as a lock-free reader of a chain
+ * @param chain Pointer to the blockchain
+ * @return The reader, or NULL if out of memory
+ */
+ChainReader *openChainReader(Blockchain *chain)
+{
+        ChainReader *reader = NULL;
+
+        if (!chain || posix_memalign((void **)&reader, CACHE_LINE_SIZE, sizeof(ChainReader)) != 0)
+                return NULL;
+        memset(reader, 0, sizeof(ChainReader));
+        reader->chain = chain;
+
+        lockChain(chain);
+        int ok = addReaderLocked(chain, reader);
+        unlockChain(chain);
+        if (!ok)
+        {
+                free(reader);
+                return NULL;
+        }
+        return reader;
+}
+
+/**
+ * Unregisters and frees a lock-free reader
+ * @param reader Reader to close, not in a read; may be NULL
+ */
+void closeChainReader(ChainReader *reader)
+{
+        if (!reader)
+                return;
+
+        lockChain(reader->chain);
+        removeReaderLocked(reader->chain, reader);
+        unlockChain(reader->chain);
+        free(reader);
+}
+
+/**
+ * Reports the version of the library
+ * @return Version string, CHAIN_VERSION of the library's own build
+ */
+const char *getChainVersion(void)
+{
+        return CHAIN_VERSION;
+}
+
+/**
+ * Adds a new block on top of the active chain
+ * @param chain Pointer to the blockchain
+ * @param data Data for the new block
+ * @return 1 if successful, 0 if failed
+ */
+int addBlock(Blockchain *chain, const char *data)
+{
+        lockChain(chain);
+        int ok = addBlockLocked(chain, data);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Adds a copy of a block from elsewhere to the tree
+ * @param chain Pointer to the blockchain
+ * @param block Block to copy in
+ * @return ACCEPT_* status
+ */
+int acceptBlock(Blockchain *chain, const Block *block)
+{
+        lockChain(chain);
+        int status = acceptBlockLocked(chain, block);
+        unlockChain(chain);
+        return status;
+}
+
+/**
+ * Adds a transaction to a block that nothing builds on yet
+ * @param chain Pointer to the blockchain
+ * @param block Target block
+ * @param sender Transaction sender
+ * @param receiver Transaction receiver
+ * @param amount Transaction amount
+ * @return 1 if successful, 0 if failed
+ */
+int addTransaction(Blockchain *chain, Block *block, const char *sender, const char *receiver, double amount)
+{
+        lockChain(chain);
+        int ok = addTransactionLocked(chain, block, sender, receiver, amount);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Checks every block on the active chain
+ * @param chain Pointer to the blockchain
+ * @return 1 if valid, 0 if invalid
+ */
+int validateBlockchain(Blockchain *chain)
+{
+        lockChain(chain);
+        int valid = validateBlockchainLocked(chain);
+        unlockChain(chain);
+        return valid;
+}
+
+/**
+ * Counts the blocks on the active chain
+ * @param chain Pointer to the blockchain
+ * @return Number of blocks, genesis included
+ */
+int getChainLength(Blockchain *chain)
+{
+        if (!chain)
+                return 0;
+
+        lockChain(chain);
+        int length = chain->length;
+        unlockChain(chain);
+        return length;
+}
+
+/**
+ * Finds the last block of the active chain
+ * @param chain Pointer to the blockchain
+ * @return The tip, or NULL for an empty chain
+ */
+Block *getChainTip(Blockchain *chain)
+{
+        if (!chain)
+                return NULL;
+
+        lockChain(chain);
+        Block *tip = chain->tip;
+        unlockChain(chain);
+        return tip;
+}
+
+/**
+ * Finds the block at a height on the active chain
+ * @param chain Pointer to the blockchain
+ * @param height Height to look up
+ * @return The block, or NULL if the chain is shorter
+ */
+Block *getBlockAtHeight(Blockchain *chain, int height)
+{
+        lockChain(chain);
+        Block *block = getBlockAtHeightLocked(chain, height);
+        unlockChain(chain);
+        return block;
+}
+
+/**
+ * Finds a block anywhere in the tree by its hash
+ * @param chain Pointer to the blockchain
+ * @param hash Hash to look up
+ * @return The block, or NULL if the tree does not hold it
+ */
+Block *findBlock(Blockchain *chain, const char *hash)
+{
+        lockChain(chain);
+        Block *block = findBlockLocked(chain, hash);
+        unlockChain(chain);
+        return block;
+}
+
+/**
+ * Makes sure a block's payload is in memory, reading it back if it was evicted
+ * @param chain Pointer to the blockchain
+ * @param block Block whose payload is needed
+ * @return 1 if the payload is resident, 0 if it is pruned or unreadable
+ */
+int fetchBlockPayload(Blockchain *chain, Block *block)
+{
+        lockChain(chain);
+        int ok = fetchBlockPayloadLocked(chain, block);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Looks up an account's balance on the active chain
+ * @param chain Pointer to the blockchain
+ * @param address Account address
+ * @return The balance, 0 for an unknown account
+ */
+double getBalance(Blockchain *chain, const char *address)
+{
+        lockChain(chain);
+        double balance = getBalanceLocked(chain, address);
+        unlockChain(chain);
+        return balance;
+}
+
+/**
+ * Drops payloads that fall outside the pruning target
+ * @param chain Pointer to the blockchain
+ */
+void pruneBlockchain(Blockchain *chain)
+{
+        lockChain(chain);
+        pruneBlockchainLocked(chain);
+        unlockChain(chain);
+}
+
+/**
+ * Changes the pruning target and prunes right away
+ * @param chain Pointer to the blockchain
+ * @param keep_blocks Number of most recent payloads to keep, 0 for all
+ * @param keep_bytes Payload byte budget, 0 for no limit
+ */
+void setPruneTarget(Blockchain *chain, int keep_blocks, size_t keep_bytes)
+{
+        lockChain(chain);
+        setPruneTargetLocked(chain, keep_blocks, keep_bytes);
+        unlockChain(chain);
+}
+
+/**
+ * Copies the chain's memory pool statistics
+ * @param chain Pointer to the blockchain
+ * @param stats Receives the statistics
+ */
+void getPoolStats(Blockchain *chain, PoolStats *stats)
+{
+        lockChain(chain);
+        getPoolStatsLocked(chain, stats);
+        unlockChain(chain);
+}
+
+/**
+ * Copies the chain's payload cache statistics
+ * @param chain Pointer to the blockchain
+ * @param stats Receives the statistics
+ */
+void getCacheStats(Blockchain *chain, CacheStats *stats)
+{
+        lockChain(chain);
+        getCacheStatsLocked(chain, stats);
+        unlockChain(chain);
+}
+
+/**
+ * Saves the chain's new records to a file
+ * @param chain Pointer to the blockchain
+ * @param filename Chain file
+ * @return 1 if successful, 0 if failed
+ */
+int saveBlockchain(Blockchain *chain, const char *filename)
+{
+        lockChain(chain);
+        int ok = saveBlockchainLocked(chain, filename);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Starts saving the chain on a background thread
+ * @param chain Pointer to the blockchain
+ * @param filename Chain file
+ * @return The running save, or NULL if it could not start
+ */
+SaveJob *saveBlockchainInBackground(Blockchain *chain, const char *filename)
+{
+        lockChain(chain);
+        SaveJob *job = saveBlockchainInBackgroundLocked(chain, filename);
+        unlockChain(chain);
+        return job;
+}
+
+/**
+ * Waits for the chain's background save, if any, and finishes it
+ * @param chain Pointer to the blockchain
+ * @return 1 if there was none or it succeeded, 0 if it failed
+ */
+int waitForSave(Blockchain *chain)
+{
+        lockChain(chain);
+        int ok = waitForSaveLocked(chain);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Flushes and fsyncs the records the chain has written so far
+ * @param chain Pointer to the blockchain
+ * @return 1 if successful, 0 if failed
+ */
+int syncBlockchain(Blockchain *chain)
+{
+        lockChain(chain);
+        int ok = syncBlockchainLocked(chain);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Finishes the chain's saves and closes the file it appends to, so the file
+ * can be loaded into another chain; the chain's next save rewrites it whole
+ * @param chain Pointer to the blockchain
+ */
+void releaseBlockchainFile(Blockchain *chain)
+{
+        lockChain(chain);
+        closeChainLog(chain);
+        unlockChain(chain);
+}
+
+/**
+ * Imports blocks and transactions from a JSONL or CSV file onto the tip
+ * @param chain Pointer to the blockchain
+ * @param filename File to import, CSV if it ends in .csv
+ * @return 1 if every record was imported, 0 if failed
+ */
+int importBlockchain(Blockchain *chain, const char *filename)
+{
+        lockChain(chain);
+        int ok = importBlockchainLocked(chain, filename);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Exports the active chain to a JSONL or CSV file
+ * @param chain Pointer to the blockchain
+ * @param filename File to export to, CSV if it ends in .csv
+ * @return 1 if successful, 0 if failed
+ */
+int exportBlockchain(Blockchain *chain, const char *filename)
+{
+        lockChain(chain);
+        int ok = exportBlockchainLocked(chain, filename);
+        unlockChain(chain);
+        return ok;
+}
+
+/**
+ * Displays every block on the active chain
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+void displayBlockchain(Blockchain *chain, FILE *out)
+{
+        lockChain(chain);
+        displayBlockchainLocked(chain, out);
+        unlockChain(chain);
+}
+
+/**
+ * Displays every account balance
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+void displayBalances(Blockchain *chain, FILE *out)
+{
+        lockChain(chain);
+        displayBalancesLocked(chain, out);
+        unlockChain(chain);
+}
+
+/**
+ * Displays the chain's memory pool statistics
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+void displayPoolStats(Blockchain *chain, FILE *out)
+{
+        lockChain(chain);
+        displayPoolStatsLocked(chain, out);
+        unlockChain(chain);
+}
+
+/**
+ * Displays the chain's payload cache statistics
+ * @param chain Pointer to the blockchain
+ * @param out Stream to write to
+ */
+void displayCacheStats(Blockchain *chain, FILE *out)
+{
+        lockChain(chain);
+        displayCacheStatsLocked(chain, out);
+        unlockChain(chain);
+}
+
+/**
+ * Reads a block's height
+ * @param block Block to read
+ * @return Its index
+ */
+int getBlockIndex(const Block *block)
+{
+        return block->index;
+}
+
+/**
+ * Reads when a block was created
+ * @param block Block to read
+ * @return Its timestamp
+ */
+time_t getBlockTimestamp(const Block *block)
+{
+        return block->timestamp;
+}
+
+/**
+ * Reads a block's hash
+ * @param block Block to read
+ * @return Its hash as hex text
+ */
+const char *getBlockHash(const Block *block)
+{
+        return block->hash;
+}
+
+/**
+ * Reads the hash a block builds on
+ * @param block Block to read
+ * @return Its parent's hash as hex text, "0" for genesis
+ */
+const char *getBlockPreviousHash(const Block *block)
+{
+        return block->previous_hash;
+}
+
+/**
+ * Reads a block's data
+ * @param block Block to read
+ * @return The data, or NULL while the payload is pruned or evicted (see fetchBlockPayload)
+ */
+const char *getBlockData(const Block *block)
+{
+        return (block->flags & (BLOCK_PRUNED | BLOCK_EVICTED)) ? NULL : block->data;
+}
+
+/**
+ * Reads the length of a block's data, known even when the payload is not resident
+ * @param block Block to read
+ * @return Length in bytes
+ */
+int getBlockDataLength(const Block *block)
+{
+        return block->data_length;
+}
+
+/**
+ * Counts a block's transactions, known even when the payload is not resident
+ * @param block Block to read
+ * @return Number of transactions
+ */
+int getBlockTransactionCount(const Block *block)
+{
+        return block->transaction_count;
+}
+
+/**
+ * Reads a block's transactions
+ * @param block Block to read
+ * @return getBlockTransactionCount transactions, or NULL while the payload is pruned or evicted
+ */
+const Transaction *getBlockTransactions(const Block *block)
+{
+        return (block->flags & (BLOCK_PRUNED | BLOCK_EVICTED)) ? NULL : block->transactions;
+}
@@ -0,0 +1,407 @@
+/*
+ * libchain: a block tree with transactions, account balances and an
+ * append-only chain file, built as libchain.a and libchain.so and shared by
+ * the chain programs.
+ *
+ * Thread safety
+ *
+ * Every call that takes a Blockchain holds that chain's lock while it runs,
+ * so one chain can be shared by any number of threads and their calls never
+ * interleave. Separate chains share nothing and can be used in parallel.
+ * A background save holds no lock while it writes; getSaveProgress reads its
+ * SaveJob atomically and can be called from any thread.
+ *
+ * Block pointers handed out stay valid until their chain is freed. Calls
+ * that take only a Block do not lock. A block's index, timestamp and hashes
+ * stay fixed once another block builds on it, but the tip's hash and any
+ * block's payload can change under a concurrent writer, so read those from
+ * the writing thread or while no other thread writes the chain.
+ * freeBlockchain must not race with other calls on the same chain, and a
+ * ChainFile or ChainIndex is used by one thread at a time.
+ *
+ * Query threads that must not wait on a writer open a ChainReader instead.
+ * beginChainRead takes no lock and never waits: it pins the view of the
+ * active chain the last call to change it published, and that view, with
+ * the data and transactions read through it, stays valid and unchanged until
+ * endChainRead, however far the writer moves on. Each thread uses its own
+ * reader, and every reader is closed before the chain is freed.
+ *
+ * A chain attached to a ChainFeed publishes each block that joins its tree
+ * and each transaction added to a block into the feed's ring while it holds
+ * its lock. Subscribers read the ring without any lock, from any thread or,
+ * for a feed created with a name, from any process that opens it. The
+ * publisher waits for a FEED_WAIT subscriber that is a whole ring behind, so
+ * such a subscriber must not call into the chain it follows between reads.
+ * Subscribers are unsubscribed before their feed is closed, and a chain is
+ * detached from its feed or freed before the feed is closed.
+ *
+ * Messages
+ *
+ * The library prints nothing and leaves the buffering of stdout alone. Its
+ * errors and progress notes go to the callback set with
+ * setChainMessageCallback, from whichever thread hit them, so the callback
+ * is set before other threads start and must be safe to call from any of
+ * them. Output the programs ask for, such as displayBlockchain or the result
+ * lines of runBatch, goes to the stream they pass.
+ */
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CHAIN_VERSION_MAJOR 2
+#define CHAIN_VERSION_MINOR 0
+#define CHAIN_VERSION_PATCH 0
+#define CHAIN_VERSION "2.0.0"
+
+#define MAX_DATA_SIZE 256
+#define HASH_SIZE 64
+#define MAX_SENDER_SIZE 50
+#define MAX_RECEIVER_SIZE 50
+#define FILENAME "blockchain.dat"
+
+#define LAYOUT_ALIGNED 0x1
+#define LAYOUT_COMPACT 0x2
+#define LAYOUT_COMPRESSED 0x4
+
+#define ACCEPT_FAILED 0
+#define ACCEPT_OK 1
+#define ACCEPT_DUPLICATE 2
+#define ACCEPT_ORPHAN 3
+
+#define SYNC_FAILED 0
+#define SYNC_LEVEL 1
+#define SYNC_DIVERGED 2
+
+/* RPC request types */
+#define RPC_CHAIN_INFO 1            // Header of the tip
+#define RPC_GET_BLOCK 2             // Header and data of the block at height
+#define RPC_FIND_BLOCK 3            // Header and data of the block with hash
+#define RPC_GET_TRANSACTIONS 4      // Transactions of the block at height
+#define RPC_GET_BALANCE 5           // Balance of transaction.sender
+#define RPC_SUBMIT_TRANSACTION 6    // Adds transaction to the tip; answers with the tip's new header
+#define RPC_ADD_BLOCK 7             // Adds a block holding data; answers with its header
+#define RPC_VALIDATE 8              // RPC_OK if the chain is valid, RPC_REJECTED if not
+#define RPC_SAVE 9                  // Saves to the server's file
+#define RPC_LOCATE_FORK 10          // Height of the first locator hash on the server's active chain
+#define RPC_GET_HEADERS 11          // Headers of count blocks from height, fewer past the tip
+#define RPC_GET_BLOCKS 12           // Headers, data and transactions of count blocks from height
+
+#define RPC_MAX_LOCATOR 64          // Hashes an RPC_LOCATE_FORK request may carry
+#define RPC_MAX_HEADERS 2000        // Headers an RPC_GET_HEADERS request may ask for
+#define RPC_MAX_BLOCKS 64           // Blocks an RPC_GET_BLOCKS request may ask for
+
+/* RPC answer statuses */
+#define RPC_OK 0
+#define RPC_NOT_FOUND 1
+#define RPC_REJECTED 2
+#define RPC_BAD_REQUEST 3
+
+/* Feed event types */
+#define FEED_BLOCK 1                // A block joined the tree
+#define FEED_TRANSACTION 2          // A transaction was added to a block
+
+/* What happens when a subscriber is a whole ring behind the publisher */
+#define FEED_WAIT 0                 // The publisher waits for it
+#define FEED_DROP 1                 // It loses the oldest events it has not read
+
+/* Opaque handles; the library owns their memory */
+typedef struct Blockchain Blockchain;
+typedef struct Block Block;
+typedef struct ChainFile ChainFile;
+typedef struct SaveJob SaveJob;
+typedef struct ChainReader ChainReader;
+typedef struct ChainView ChainView;
+typedef struct RpcConnection RpcConnection;
+typedef struct ChainFeed ChainFeed;
+typedef struct FeedSubscriber FeedSubscriber;
+typedef struct ChainIndex ChainIndex;
+
+typedef struct Transaction
+{
+        char sender[MAX_SENDER_SIZE];
+        char receiver[MAX_RECEIVER_SIZE];
+        double amount;
+        time_t timestamp;
+} Transaction;
+
+/* Tunables fixed when a chain is created or loaded */
+typedef struct ChainConfig
+{
+        int prune_keep_blocks;      // Most recent blocks whose payload stays resident, 0 for all
+        size_t prune_keep_bytes;    // Payload byte budget, 0 for no limit
+        int log_sync_records;       // Group commit: fsync once this many records are pending, 0 every save
+        uint32_t file_layout;       // LAYOUT_* flags of files the chain creates, 0 for LAYOUT_ALIGNED
+        size_t segment_bytes;       // Start a new segment file once the current one reaches this size, 0 for one file
+        size_t cache_bytes;         // Payload budget past which saved payloads are dropped and read back on demand, 0 for none
+        const char *checkpoint_key; // HMAC key signing trusted checkpoints, NULL to neither write nor trust them
+        int disk_indexes;           // Keep B+tree indexes of block hash, address and time in FILE.index as saves go
+        int state_snapshot_blocks;  // Write the balances to FILE.state every this many blocks as saves go, 0 for never
+} ChainConfig;
+
+typedef struct PoolStats
+{
+        size_t page_count;
+        size_t page_bytes;
+        size_t used_bytes;
+        size_t large_count;
+        size_t large_bytes;
+        size_t allocations;
+        size_t frees;
+} PoolStats;
+
+/* How the payload cache has fared since the chain was loaded */
+typedef struct CacheStats
+{
+        size_t hits;                // Payloads asked for while resident
+        size_t misses;              // Payloads read back from the chain's files
+        size_t evictions;           // Payloads dropped to stay within the budget
+} CacheStats;
+
+/* Snapshot of a save's progress */
+typedef struct SaveProgress
+{
+        int records_written;
+        int records_total;
+        int done;
+} SaveProgress;
+
+/* A block's header as a lock-free reader sees it */
+typedef struct BlockHeader
+{
+        int index;
+        time_t timestamp;
+        int data_length;
+        int transaction_count;
+        char previous_hash[HASH_SIZE + 1];
+        char hash[HASH_SIZE + 1];
+} BlockHeader;
+
+/* One block of an RPC_GET_BLOCKS answer */
+typedef struct RpcBlock
+{
+        BlockHeader header;
+        const char *data;           // NUL-terminated
+        const Transaction *transactions;
+} RpcBlock;
+
+/* What syncFromRpc did */
+typedef struct SyncStats
+{
+        int fork_height;            // Last block both chains shared, -1 if this chain was empty
+        int headers;                // Headers downloaded
+        int blocks;                 // Blocks downloaded and accepted
+        size_t bytes;               // Answer bytes read
+} SyncStats;
+
+/* An RPC request, or the answer to one; which fields count depends on type */
+typedef struct RpcMessage
+{
+        int type;                   // RPC_* request type
+        int status;                 // RPC_OK or the reason the request failed, in answers
+        uint32_t id;                // Chosen by the client and echoed in the answer
+        int height;                 // Block asked for by RPC_GET_BLOCK and RPC_GET_TRANSACTIONS, first block
+                                    // asked for by RPC_GET_HEADERS and RPC_GET_BLOCKS, answer to RPC_LOCATE_FORK
+        int count;                  // Blocks asked for by RPC_GET_HEADERS and RPC_GET_BLOCKS
+        const char (*locator)[HASH_SIZE + 1]; // Hashes RPC_LOCATE_FORK looks for, newest first
+        int locator_count;
+        char hash[HASH_SIZE + 1];   // Block asked for by RPC_FIND_BLOCK
+        Transaction transaction;    // Sent by RPC_SUBMIT_TRANSACTION; RPC_GET_BALANCE asks for its sender
+        const char *data;           // Sent by RPC_ADD_BLOCK, or the answered block's data, NULL if pruned
+        int data_length;
+        BlockHeader header;         // Block answered: the tip, the block asked for or the block added
+        double balance;             // Answer to RPC_GET_BALANCE
+        const Transaction *transactions; // Answer to RPC_GET_TRANSACTIONS
+        int transaction_count;
+        const BlockHeader *headers; // Answer to RPC_GET_HEADERS
+        int header_count;
+        const RpcBlock *blocks;     // Answer to RPC_GET_BLOCKS; each block's transactions follow the last's
+        int block_count;
+} RpcMessage;
+
+/* A block or transaction found through a chain's disk indexes */
+typedef struct IndexHit
+{
+        int height;
+        int position;               // The transaction's place in its block, -1 for a block
+        int sent;                   // 1 if the address looked up sent the transaction, 0 if it received it
+        double amount;
+        time_t timestamp;           // The block's timestamp
+        uint64_t offset;            // Chain offset of the block's record
+        int active;                 // 1 if the block was on the active chain as of the last save, 0 if a reorg left it
+        char hash[HASH_SIZE + 1];   // The block's hash, empty for transactions
+} IndexHit;
+
+/* An event read from a chain feed */
+typedef struct FeedEvent
+{
+        uint64_t sequence;          // 1 for the first event published, one more for each after it
+        int type;                   // FEED_BLOCK or FEED_TRANSACTION
+        BlockHeader header;         // Block that joined the tree, or the block the transaction went into as it now is
+        Transaction transaction;    // FEED_TRANSACTION
+        int64_t published_ns;       // CLOCK_MONOTONIC time it was published, comparable across processes
+} FeedEvent;
+
+/* How a feed has fared since it was created */
+typedef struct FeedStats
+{
+        uint64_t published;         // Events published
+        uint64_t publisher_waits;   // Events the publisher waited on a FEED_WAIT subscriber to make room for
+        uint64_t dropped;           // Events lost by the FEED_DROP subscribers subscribed now
+        int subscribers;
+} FeedStats;
+
+/* Network simulated by runNetworkSimulation; times are simulated, not wall-clock */
+typedef struct NetworkConfig
+{
+        int nodes;                  // At least 2, so every block has somewhere to spread to
+        int peers;                  // Random links each node adds to a ring through every node
+        double latency_ms;          // One-way delay of every link
+        double jitter_ms;           // Extra delay drawn from [0, jitter_ms) per message
+        double loss;                // Fraction of messages links drop, from 0 up to but not including 1
+        double bandwidth_kbps;      // Speed of every link in kilobits per second, 0 for unlimited
+        double block_interval_ms;   // Mean time between blocks across the whole network
+        double transaction_rate;    // Transactions per second across the whole network
+        double duration_s;          // How long nodes mine for
+        double timeout_s;           // How long to wait for the nodes to agree once mining stops
+        double speed;               // Simulated seconds per wall-clock second
+        unsigned int seed;
+} NetworkConfig;
+
+/* What runNetworkSimulation measured */
+typedef struct NetworkReport
+{
+        int blocks_mined;
+        int stale_blocks;           // Mined blocks left off the final chain
+        double fork_rate;           // Share of mined blocks that went stale
+        int chain_length;           // Final chain length, genesis included
+        long transactions_made;
+        long transactions_confirmed; // Transactions in the final chain
+        double propagation_mean_ms; // From mining to acceptance, over every other node that accepted a block
+        double propagation_p50_ms;
+        double propagation_p90_ms;
+        double propagation_max_ms;
+        double full_reach_p50_ms;   // From mining until the last node accepted it, over blocks every node accepted
+        double full_reach_p90_ms;
+        double convergence_mean_ms; // Spells of disagreement while mining: from the tips first differing until they matched
+        double convergence_p90_ms;
+        double convergence_max_ms;
+        double settle_ms;           // From mining stopping until every node had the same tip, -1 if they never did
+        int final_tips;             // Distinct tips the nodes ended on; above 1 when a tie was never broken
+        long messages_sent;
+        long messages_dropped;      // Lost on their links
+        long bytes_sent;
+} NetworkReport;
+
+/* Receives each error or progress message of the library, one line without its line break */
+typedef void (*ChainMessageCallback)(void *context, const char *message);
+
+/* Library version, to check against CHAIN_VERSION at run time */
+const char *getChainVersion(void);
+
+/* Messages; the library writes nothing to stdout, and drops them unless a callback is set */
+void setChainMessageCallback(ChainMessageCallback callback, void *context);
+
+/* Chains */
+void initChainConfig(ChainConfig *config);
+Blockchain *createBlockchain(void);
+Blockchain *createBlockchainWithConfig(const ChainConfig *config);
+void freeBlockchain(Blockchain *chain);
+int addBlock(Blockchain *chain, const char *data);
+int acceptBlock(Blockchain *chain, const Block *block); // Returns an ACCEPT_* status
+int addTransaction(Blockchain *chain, Block *block, const char *sender, const char *receiver, double amount);
+int validateBlockchain(Blockchain *chain);
+int getChainLength(Blockchain *chain);
+Block *getChainTip(Blockchain *chain);
+Block *getBlockAtHeight(Blockchain *chain, int height);
+Block *findBlock(Blockchain *chain, const char *hash);
+int fetchBlockPayload(Blockchain *chain, Block *block);
+double getBalance(Blockchain *chain, const char *address);
+void pruneBlockchain(Blockchain *chain);
+void setPruneTarget(Blockchain *chain, int keep_blocks, size_t keep_bytes);
+void getPoolStats(Blockchain *chain, PoolStats *stats);
+void getCacheStats(Blockchain *chain, CacheStats *stats);
+
+/* Blocks */
+int getBlockIndex(const Block *block);
+time_t getBlockTimestamp(const Block *block);
+const char *getBlockHash(const Block *block);
+const char *getBlockPreviousHash(const Block *block);
+const char *getBlockData(const Block *block);
+int getBlockDataLength(const Block *block);
+int getBlockTransactionCount(const Block *block);
+const Transaction *getBlockTransactions(const Block *block);
+void calculateHash(Block *block, char *output);
+unsigned long long blockWork(const Block *block);
+Block *getAncestor(Block *block, int height);
+Block *findCommonAncestor(Block *a, Block *b);
+
+/* Lock-free reads */
+ChainReader *openChainReader(Blockchain *chain);
+void closeChainReader(ChainReader *reader);
+const ChainView *beginChainRead(ChainReader *reader);
+void endChainRead(ChainReader *reader);
+int getViewLength(const ChainView *view);
+int getViewHeader(const ChainView *view, int height, BlockHeader *header);
+const char *getViewData(const ChainView *view, int height);
+const Transaction *getViewTransactions(const ChainView *view, int height, int *count);
+
+/* Persistence */
+int saveBlockchain(Blockchain *chain, const char *filename);
+SaveJob *saveBlockchainInBackground(Blockchain *chain, const char *filename);
+int getSaveProgress(const SaveJob *job, SaveProgress *progress);
+int waitForSave(Blockchain *chain);
+int syncBlockchain(Blockchain *chain);
+void releaseBlockchainFile(Blockchain *chain);
+Blockchain *loadBlockchain(const char *filename);
+Blockchain *loadBlockchainWithConfig(const char *filename, const ChainConfig *config);
+ChainFile *openChainFile(const char *filename);
+Block *readFileBlockAtHeight(ChainFile *file, int height);
+Block *readFileBlockByHash(ChainFile *file, const char *hash);
+void closeChainFile(ChainFile *file);
+int importBlockchain(Blockchain *chain, const char *filename);
+int exportBlockchain(Blockchain *chain, const char *filename);
+ChainIndex *openChainIndex(const char *filename);
+void closeChainIndex(ChainIndex *index);
+int findIndexedBlock(ChainIndex *index, const char *hash, IndexHit *hit);
+int findIndexedTransactions(ChainIndex *index, const char *address, const IndexHit *after, IndexHit *hits, int max);
+int findIndexedBlocksByTime(ChainIndex *index, time_t from, time_t to, const IndexHit *after, IndexHit *hits,
+                            int max);
+
+/* Output for the command-line programs, written to the stream they pass */
+void displayBlock(Block *block, FILE *out);
+void displayTransactions(Block *block, FILE *out);
+void displayBlockchain(Blockchain *chain, FILE *out);
+void displayBalances(Blockchain *chain, FILE *out);
+void displayPoolStats(Blockchain *chain, FILE *out);
+void displayCacheStats(Blockchain *chain, FILE *out);
+int runBatch(Blockchain **chain, FILE *input, FILE *output, const ChainConfig *config);
+
+/* Local RPC over a Unix socket or a socketpair */
+int runServer(Blockchain *chain, const char *socket_path, const char *filename);
+RpcConnection *connectRpc(const char *socket_path);
+RpcConnection *openRpc(int fd);
+int serveRpc(Blockchain *chain, int fd);
+void closeRpc(RpcConnection *connection);
+int sendRpcRequest(RpcConnection *connection, const RpcMessage *request);
+int readRpcResponse(RpcConnection *connection, RpcMessage *response);
+int syncFromRpc(Blockchain *chain, RpcConnection *connection, SyncStats *stats);
+
+/* Event feed, in process or in shared memory */
+ChainFeed *createChainFeed(const char *name, int capacity);
+ChainFeed *openChainFeed(const char *name);
+void closeChainFeed(ChainFeed *feed);
+int attachChainFeed(Blockchain *chain, ChainFeed *feed);
+FeedSubscriber *subscribeFeed(ChainFeed *feed, int policy);
+void unsubscribeFeed(FeedSubscriber *subscriber);
+int readFeedEvent(FeedSubscriber *subscriber, FeedEvent *event, int timeout_ms);
+void getFeedStats(const ChainFeed *feed, FeedStats *stats);
+
+/* In-process network simulation */
+void initNetworkConfig(NetworkConfig *config);
+int runNetworkSimulation(const NetworkConfig *config, NetworkReport *report);
+
+#endif
@@ -1,6 +1,10 @@
+gcc -c -fPIC -pthread -o chain.o chain.c
+ar rcs libchain.a chain.o
+gcc -shared -o libchain.so chain.o -pthread -lssl -lcrypto -lz -lm
 gcc -o sha256 sha256.c -lssl -lcrypto
-gcc -o blockchain_sim blockchain_sim.c -lssl -lcrypto
-gcc -o block block.c -lssl -lcrypto
-gcc -o blockchain blockchain.c -lssl -lcrypto
-gcc -o blockchain_transactions blockchain_transactions.c -lssl -lcrypto
-gcc -o blockchain_persistence blockchain_persistence.c -lssl -lcrypto
\ No newline at end of file
+gcc -o blockchain_sim blockchain_sim.c libchain.a -pthread -lssl -lcrypto -lz -lm
+gcc -o block block.c libchain.a -pthread -lssl -lcrypto -lz -lm
+gcc -o blockchain blockchain.c libchain.a -pthread -lssl -lcrypto -lz -lm
+gcc -o blockchain_transactions blockchain_transactions.c libchain.a -pthread -lssl -lcrypto -lz -lm
+gcc -o blockchain_persistence blockchain_persistence.c libchain.a -pthread -lssl -lcrypto -lz -lm
+gcc -o blockchain_client blockchain_client.c libchain.a -pthread -lssl -lcrypto -lz -lm
\ No newline at end of file
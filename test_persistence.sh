@@ -0,0 +1,293 @@
+#!/bin/sh
+# Regression checks for the chain file and the programs around it, run from the directory commands.sh built in
+bin="$(pwd)/blockchain_persistence"
+client="$(pwd)/blockchain_client"
+sim="$(pwd)/blockchain_sim"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+failed=0
+
+# Runs commands from stdin in batch mode; only their result lines reach stdout, the messages on stderr are dropped
+batch()
+{
+        "$bin" "$@" --batch - 2>/dev/null
+}
+
+check()
+{
+        if [ "$2" = "$3" ]; then
+                echo "ok   $1"
+        else
+                echo "FAIL $1"
+                echo "  expected: $2"
+                echo "  got:      $3"
+                failed=1
+        fi
+}
+
+# Saving after a load appends to the file the loaded chain owns, not behind the one it replaced
+for options in "" "--segment-mb 1"; do
+        rm -f blockchain.dat*
+        got=$(printf 'add-block\nsave\nload\nadd-block\nsave\nload\nvalidate\n' | batch $options | cut -d' ' -f1-3)
+        check "save, load, add, save, load $options" "ok block 1
+ok saved 2
+ok loaded 2
+ok block 2
+ok saved 3
+ok loaded 3
+ok valid" "$got"
+done
+
+# A second process cannot append to a file a running one has open
+rm -f blockchain.dat*
+printf 'save\n' | batch >/dev/null
+"$bin" --serve "$dir/chain.sock" >/dev/null 2>&1 &
+server=$!
+sleep 1
+got=$(printf 'add-block\nsave\n' | batch | cut -d' ' -f1-2)
+kill "$server"
+wait "$server"
+check "save while another process holds the file" "ok block
+error 2" "$got"
+
+# Offset of the footer index the trailer at the end of a closed file points to
+indexOffset()
+{
+        od -An -t u8 -j $(($(wc -c < "$1") - 16)) -N 8 "$1" | tr -d ' '
+}
+
+# A record cut short at the end is dropped, and the file truncated to the records before it
+rm -f blockchain.dat*
+printf 'add-block\nadd-block\nadd-block\nsave\n' | batch >/dev/null
+truncate -s $(($(indexOffset blockchain.dat) - 5)) blockchain.dat
+got=$(printf 'load\nvalidate\nload\n' | batch | cut -d' ' -f1-3)
+check "load a torn tail" "ok loaded 3
+ok valid
+ok loaded 3" "$got"
+
+# A damaged record with whole records after it fails the load and leaves the file alone
+rm -f blockchain.dat*
+printf 'add-block\nadd-block\nadd-block\nsave\n' | batch >/dev/null
+printf 'X' | dd of=blockchain.dat bs=1 seek=$(($(indexOffset blockchain.dat) / 2)) conv=notrunc 2>/dev/null
+before=$(cksum < blockchain.dat)
+got=$(printf 'load\n' | batch | cut -d' ' -f1-2)
+check "load a damaged record in the middle" "error 1" "$got"
+check "damaged file left untouched" "$before" "$(cksum < blockchain.dat)"
+
+# A node whose tip took other transactions than the peer's settles on the peer's branch, and keeps it across a load
+rm -f blockchain.dat*
+mkdir peer
+printf 'add-block\nadd-block\nsave\n' | batch >/dev/null
+cp blockchain.dat peer/
+(cd peer && exec "$bin" --serve "$dir/peer.sock" >/dev/null 2>&1) &
+server=$!
+sleep 1
+"$client" "$dir/peer.sock" tx Ada Bola 5 >/dev/null
+"$bin" --sync-from "$dir/peer.sock" >/dev/null
+status=$?
+peer_tip=$("$client" "$dir/peer.sock" info | cut -d' ' -f7)
+kill "$server"
+wait "$server"
+got=$(printf 'load\n' | batch | cut -d' ' -f4)
+check "sync at equal length" "0 $peer_tip" "$status $got"
+
+# Transactions of a block a reorg left behind are no longer found through the indexes
+rm -rf blockchain.dat* peer
+mkdir peer
+printf 'add-block\nadd-block\nsave\n' | batch >/dev/null
+cp blockchain.dat peer/
+printf 'load\nadd-tx Old Xavier 1\nsave\n' | batch --index >/dev/null
+(cd peer && exec "$bin" --serve "$dir/peer.sock" >/dev/null 2>&1) &
+server=$!
+sleep 1
+"$client" "$dir/peer.sock" tx Ada Bola 5 >/dev/null
+"$bin" --index --sync-from "$dir/peer.sock" >/dev/null
+kill "$server"
+wait "$server"
+got="$("$bin" --find-address Old | tail -n 1), $("$bin" --find-address Ada | tail -n 1)"
+check "find an address after a reorg" "0 transactions found in blockchain.dat.index, 1 transactions found in \
+blockchain.dat.index" "$got"
+
+# A chain run pruned from the start keeps its payloads until they are saved, so it saves, appends and loads
+rm -rf blockchain.dat* peer
+for options in "--prune-blocks 3" "--prune-mb 1"; do
+        got=$( (for i in 1 2 3 4 5 6 7 8; do echo "add-block $i"; echo "add-tx Ada Bola $i"; done
+                printf 'save\nadd-block 9\nsave\nload\nvalidate\n') | batch $options | tail -n 5 | cut -d' ' -f1-3)
+        check "save and load a pruned chain $options" "ok saved 9
+ok block 9
+ok saved 10
+ok loaded 10
+ok valid" "$got"
+        rm -f blockchain.dat*
+done
+
+# A fork far below both tips is found through the skip pointers, and the longer branch wins
+rm -rf blockchain.dat* peer
+mkdir peer
+printf 'add-block\nadd-block\nsave\n' | batch >/dev/null
+cp blockchain.dat peer/
+printf 'load\nadd-block\nadd-block\nadd-block\nadd-block\nadd-block\nsave\n' | batch >/dev/null
+(cd peer && exec "$bin" --serve "$dir/peer.sock" >/dev/null 2>&1) &
+server=$!
+sleep 1
+for i in $(seq 20); do
+        "$client" "$dir/peer.sock" add-block "peer $i" >/dev/null
+done
+fork=$("$bin" --sync-from "$dir/peer.sock" | grep diverge)
+peer_tip=$("$client" "$dir/peer.sock" info | cut -d' ' -f7)
+kill "$server"
+wait "$server"
+got=$(printf 'load\nvalidate\n' | batch | cut -d' ' -f1-4)
+check "reorg onto a longer branch" "The chains diverge after block 2
+ok loaded 23 $peer_tip
+ok valid" "$fork
+$got"
+
+# Thirty blocks of 400 transactions each, enough payload to overflow a 1 MB cache
+transactions()
+{
+        awk 'BEGIN {
+                for (b = 1; b <= 30; b++) {
+                        print "add-block " b
+                        for (t = 1; t <= 400; t++)
+                                print "add-tx Sender" t " Receiver" b " " t
+                }
+        }'
+}
+
+# Every layout reads back the blocks it wrote, and the compact ones take less room
+rm -rf blockchain.dat* peer
+sizes=""
+for options in "" "--compact" "--compress"; do
+        before=$( (transactions; printf 'save\nquery 1\nquery 30\n') | batch $options | tail -n 2)
+        got=$(printf 'load\nquery 1\nquery 30\n' | batch | tail -n 2)
+        check "read back a chain saved $options" "$before" "$got"
+        sizes="$sizes $(wc -c < blockchain.dat)"
+        rm -f blockchain.dat*
+done
+set -- $sizes
+check "compact layouts take less room" "yes" "$([ "$2" -lt "$1" ] && [ "$3" -lt "$2" ] && echo yes)"
+
+# Payloads evicted under a cache budget are read back unchanged
+(transactions; printf 'save\n') | batch >/dev/null
+before=$(printf 'load\nquery 1\nquery 15\nquery 30\nquery 1\n' | batch | tail -n 4)
+got=$(printf 'load\nquery 1\nquery 15\nquery 30\nquery 1\n' | batch --cache-mb 1 | tail -n 4)
+check "query a chain larger than its cache" "$before" "$got"
+got=$(printf '6\n3\n8\n7\n' | "$bin" --cache-mb 1 |
+      awk '/^Budget/ { print ($5 <= $2) } /^Evictions/ { print ($2 > 0) }')
+check "cache stays within its budget" "1
+1" "$got"
+rm -f blockchain.dat*
+
+# A signed checkpoint spares re-hashing the blocks below it, but only under the key that signed it
+export ALUCHAIN_CHECKPOINT_KEY=secret
+printf 'add-block\nadd-block\nsave\nadd-block\nsave\n' | batch >/dev/null
+trusted=$(printf 'load\n' | "$bin" --batch - 2>&1 >/dev/null | grep -c 'trusted checkpoint')
+ALUCHAIN_CHECKPOINT_KEY=other
+untrusted=$(printf 'load\n' | "$bin" --batch - 2>&1 >/dev/null | grep -c 'trusted checkpoint')
+got=$(printf 'load\nvalidate\n' | batch | cut -d' ' -f1-3)
+check "trust a checkpoint only under its key" "1 0
+ok loaded 4
+ok valid" "$trusted $untrusted
+$got"
+
+# A checkpoint taken from another chain is noticed, and every block verified instead
+ALUCHAIN_CHECKPOINT_KEY=secret
+mkdir peer
+(cd peer && printf 'add-block other\nadd-block\nadd-block\nsave\n' | batch >/dev/null)
+cp peer/blockchain.dat.checkpoint .
+got=$(printf 'load\nvalidate\n' | "$bin" --batch - 2>&1 | grep -v '^Blockchain' | cut -d' ' -f1-3)
+check "load with a checkpoint of another chain" "Checkpoint of blockchain.dat
+ok loaded 4
+ok valid" "$got"
+unset ALUCHAIN_CHECKPOINT_KEY
+rm -rf blockchain.dat* peer
+
+# Exporting and importing again keeps every block's data and transactions; the blocks themselves are mined anew
+printf 'add-block one\nadd-tx Ada Bola 5\nadd-tx Bola Chi 2.5\nadd-block two\nadd-tx Chi Ada 1\nsave\n' |
+        batch >/dev/null
+printf '6\n11\nchain.jsonl\n11\nchain.csv\n7\n' | "$bin" >/dev/null
+rm -f blockchain.dat*
+for format in jsonl csv; do
+        got=$(printf '10\nchain.%s\n11\nagain.csv\n7\n' "$format" | "$bin" |
+              grep -o 'Imported [0-9]* blocks and [0-9]*')
+        check "import $format" "Imported 2 blocks and 3" "$got"
+        # Type, height, data and the transaction fields; the timestamps and hashes are new
+        check "export what was imported from $format" "$(cut -d, -f1,2,4,7- chain.csv)" \
+                "$(cut -d, -f1,2,4,7- again.csv)"
+done
+rm -f chain.* again.csv
+
+# Each RPC answers from the served chain, and what was written through it is saved on the way out
+"$bin" --serve "$dir/chain.sock" >/dev/null 2>&1 &
+server=$!
+sleep 1
+tip=$("$client" "$dir/chain.sock" add-block hello | cut -d' ' -f1-3)
+got="$("$client" "$dir/chain.sock" tx Ada Bola 5 | cut -d' ' -f1-3,5)
+$("$client" "$dir/chain.sock" txs 1 | cut -d' ' -f1-3)
+$("$client" "$dir/chain.sock" balance Bola)
+$("$client" "$dir/chain.sock" find "$("$client" "$dir/chain.sock" info | cut -d' ' -f7)" | cut -d' ' -f1-3,8)
+$("$client" "$dir/chain.sock" validate)
+$("$client" "$dir/chain.sock" bench -c 2 -n 50 | tail -n 1)"
+kill "$server"
+wait "$server"
+check "answer each RPC" "ok block 1
+ok block 1 1
+ok transactions 1
+Ada Bola 5.00
+ok balance 5.00
+ok block 1 hello
+ok
+Errors: 0" "$tip
+$got"
+got=$(printf 'load\nquery 1\n' | batch | tail -n 1 | cut -d' ' -f1-3,5,8)
+check "save what was written through RPC" "ok block 1 1 hello" "$got"
+rm -f blockchain.dat*
+
+# Subscribers of the feed see every block and transaction the server takes, in order
+"$bin" --serve "$dir/chain.sock" --feed "chaintest$$" >/dev/null 2>&1 &
+server=$!
+sleep 1
+"$client" "chaintest$$" watch -n 3 > watch.txt &
+watcher=$!
+sleep 1
+"$client" "$dir/chain.sock" add-block one >/dev/null
+"$client" "$dir/chain.sock" tx Ada Bola 5 >/dev/null
+"$client" "$dir/chain.sock" add-block two >/dev/null
+wait "$watcher"
+kill "$server"
+wait "$server"
+got=$(head -n 4 watch.txt | cut -d' ' -f1-2,4-)
+check "watch the feed" "block 1
+tx 1 Bola 5.00
+block 2
+3 events, dropped" "$got"
+rm -f blockchain.dat* watch.txt
+
+# The disk indexes find transactions by address and blocks by time, and the file finds blocks by height or hash
+printf 'add-block one\nadd-tx Ada Bola 5\nadd-block two\nadd-tx Bola Ada 2\nadd-tx Chi Dayo 1\nsave\n' |
+        batch --index >/dev/null
+hash=$(printf 'load\nquery 2\n' | batch | tail -n 1 | cut -d' ' -f7)
+got="$("$bin" --find-address Ada | cut -d' ' -f1-6)
+$("$bin" --find-time 0 9999999999 | tail -n 1)
+$("$bin" --show-height 2 | grep 'Block #')
+$("$bin" --show-hash "$hash" | grep 'Block #')
+$("$bin" --show-height 3)"
+check "look blocks and transactions up without loading the chain" "Block #1, transaction 0: sent 5.00
+Block #2, transaction 0: received 2.00
+2 transactions found in blockchain.dat.index
+3 blocks found in blockchain.dat.index
+Block #2
+Block #2
+Block not found in blockchain.dat" "$got"
+rm -f blockchain.dat*
+
+# Every block mined across a simulated network ends up on the final chain or counted stale; one node is too few
+got=$("$sim" --network --nodes 4 --duration 5 --speed 50 |
+      awk '/^Blocks mined/ { mined = $3 + 0; chain = $7 } /^Stale/ { print (mined > 0 && mined == chain - 1 + $3) }')
+check "simulate a network" "1" "$got"
+"$sim" --network --nodes 1 --duration 5 --speed 50 >/dev/null
+check "refuse a one-node network" "1" "$?"
+
+exit $failed